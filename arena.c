@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+char *arena_alloc(Arena *a, size_t size) {
+    ArenaBlock *b = a->blocks;
+    if (!b || b->size - b->used < size) {
+        // Strings bigger than a block get one of their own, behind the
+        // current block so its free space isn't abandoned
+        size_t block_size = size > ARENA_BLOCK_SIZE / 4 ? size : ARENA_BLOCK_SIZE;
+        ArenaBlock *nb = malloc(sizeof(ArenaBlock) + block_size);
+        if (!nb) return NULL;
+        nb->used = 0;
+        nb->size = block_size;
+        if (b && block_size != ARENA_BLOCK_SIZE) {
+            nb->next = b->next;
+            b->next = nb;
+        } else {
+            nb->next = b;
+            a->blocks = nb;
+        }
+        b = nb;
+    }
+    char *p = b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+char *arena_strndup(Arena *a, const char *s, size_t len) {
+    char *p = arena_alloc(a, len + 1);
+    if (!p) return NULL;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+char *arena_strdup(Arena *a, const char *s) {
+    return arena_strndup(a, s, strlen(s));
+}
+
+void arena_merge(Arena *dst, Arena *src) {
+    if (!src->blocks) return;
+    if (!dst->blocks) {
+        dst->blocks = src->blocks;
+    } else {
+        // Keep dst's newest block in front: it's the one with room left
+        ArenaBlock *tail = src->blocks;
+        while (tail->next) tail = tail->next;
+        tail->next = dst->blocks->next;
+        dst->blocks->next = src->blocks;
+    }
+    src->blocks = NULL;
+}
+
+void arena_free(Arena *a) {
+    ArenaBlock *b = a->blocks;
+    while (b) {
+        ArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->blocks = NULL;
+}
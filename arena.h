@@ -0,0 +1,28 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for strings that live and die together, like the titles
+// of one playlist. Nothing is freed on its own: arena_free releases every
+// string at once.
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock *blocks;  // newest first, NULL when empty
+} Arena;
+
+// Uninitialized space for size bytes, NULL if out of memory
+char *arena_alloc(Arena *a, size_t size);
+
+// Copy of s (or of its first len bytes, NUL-terminated) in the arena
+char *arena_strdup(Arena *a, const char *s);
+char *arena_strndup(Arena *a, const char *s, size_t len);
+
+// Move all of src's strings into dst, leaving src empty
+void arena_merge(Arena *dst, Arena *src);
+
+void arena_free(Arena *a);
+
+#endif
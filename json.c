@@ -0,0 +1,403 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "json.h"
+
+// ============================================================================
+// Reader
+// ============================================================================
+
+void json_reader_init(JsonReader *r, FILE *fp) {
+    r->fp = fp;
+    r->in = r->buf;
+    r->pos = 0;
+    r->len = 0;
+    r->text = NULL;
+    r->text_len = 0;
+    r->text_cap = 0;
+    r->depth = 0;
+    r->after_key = false;
+    r->failed = false;
+}
+
+void json_reader_init_string(JsonReader *r, const char *s, size_t len) {
+    json_reader_init(r, NULL);
+    r->in = s;
+    r->len = len;
+}
+
+void json_reader_free(JsonReader *r) {
+    free(r->text);
+    r->text = NULL;
+    r->text_cap = 0;
+}
+
+// Make sure unread input is buffered. False at the end of the input.
+static bool fill(JsonReader *r) {
+    if (r->pos < r->len) return true;
+    if (!r->fp) return false;
+    r->len = fread(r->buf, 1, sizeof(r->buf), r->fp);
+    r->pos = 0;
+    return r->len > 0;
+}
+
+static int peek(JsonReader *r) {
+    return fill(r) ? (unsigned char)r->in[r->pos] : EOF;
+}
+
+static int get(JsonReader *r) {
+    return fill(r) ? (unsigned char)r->in[r->pos++] : EOF;
+}
+
+static JsonToken fail(JsonReader *r) {
+    r->failed = true;
+    return JSON_ERROR;
+}
+
+static bool text_append(JsonReader *r, const char *s, size_t n) {
+    if (r->text_len + n + 1 > r->text_cap) {
+        size_t cap = r->text_cap ? r->text_cap : 256;
+        while (cap < r->text_len + n + 1) cap *= 2;
+        char *text = realloc(r->text, cap);
+        if (!text) return false;
+        r->text = text;
+        r->text_cap = cap;
+    }
+    memcpy(r->text + r->text_len, s, n);
+    r->text_len += n;
+    r->text[r->text_len] = '\0';
+    return true;
+}
+
+static int hex4(JsonReader *r) {
+    int v = 0;
+    for (int i = 0; i < 4; i++) {
+        int c = get(r);
+        int d;
+        if (c >= '0' && c <= '9') d = c - '0';
+        else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') d = c - 'A' + 10;
+        else return -1;
+        v = v * 16 + d;
+    }
+    return v;
+}
+
+// \uXXXX (and the low half of a surrogate pair) as UTF-8
+static bool read_unicode(JsonReader *r) {
+    long cp = hex4(r);
+    if (cp < 0) return false;
+    if (cp >= 0xD800 && cp <= 0xDBFF && peek(r) == '\\') {
+        r->pos++;
+        if (get(r) != 'u') return false;
+        int low = hex4(r);
+        if (low < 0xDC00 || low > 0xDFFF) return false;
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+    }
+
+    char out[4];
+    size_t n;
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        n = 2;
+    } else if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        n = 3;
+    } else {
+        out[0] = (char)(0xF0 | (cp >> 18));
+        out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[3] = (char)(0x80 | (cp & 0x3F));
+        n = 4;
+    }
+    return text_append(r, out, n);
+}
+
+// The rest of a string whose opening quote was read, unescaped into text
+static bool read_string(JsonReader *r) {
+    if (!text_append(r, "", 0)) return false;
+    for (;;) {
+        if (!fill(r)) return false;
+
+        // Copy the run up to the next quote or backslash in one go
+        const char *start = r->in + r->pos;
+        const char *end = r->in + r->len;
+        const char *p = start;
+        while (p < end && *p != '"' && *p != '\\') p++;
+        if (!text_append(r, start, p - start)) return false;
+        r->pos += p - start;
+        if (p == end) continue;
+
+        r->pos++;
+        if (*p == '"') return true;
+
+        int c = get(r);
+        char out;
+        switch (c) {
+            case EOF: return false;
+            case 'n': out = '\n'; break;
+            case 'r': out = '\r'; break;
+            case 't': out = '\t'; break;
+            case 'b': out = '\b'; break;
+            case 'f': out = '\f'; break;
+            case 'u':
+                if (!read_unicode(r)) return false;
+                continue;
+            default: out = (char)c; break;
+        }
+        if (!text_append(r, &out, 1)) return false;
+    }
+}
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == ',' || c == ':';
+}
+
+static bool is_word_char(char c, bool number) {
+    if (number) return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+    return c >= 'a' && c <= 'z';
+}
+
+// Letters of true/false/null, or the characters of a number, into text
+static bool read_word(JsonReader *r, bool number) {
+    r->text_len = 0;
+    if (!text_append(r, "", 0)) return false;
+    while (fill(r)) {
+        const char *start = r->in + r->pos;
+        const char *end = r->in + r->len;
+        const char *p = start;
+        while (p < end && is_word_char(*p, number)) p++;
+        if (!text_append(r, start, p - start)) return false;
+        r->pos += p - start;
+        if (p < end) break;
+    }
+    return true;
+}
+
+JsonToken json_next(JsonReader *r) {
+    if (r->failed) return JSON_ERROR;
+
+    // Separators carry nothing a well-formed document needs
+    int c = EOF;
+    while (fill(r)) {
+        const char *p = r->in + r->pos;
+        const char *end = r->in + r->len;
+        while (p < end && is_space(*p)) p++;
+        r->pos = p - r->in;
+        if (p < end) {
+            c = (unsigned char)*p;
+            break;
+        }
+    }
+    if (c == EOF) return r->depth == 0 ? JSON_END : fail(r);
+
+    bool want_key = r->depth > 0 && r->stack[r->depth - 1] == '{' && !r->after_key;
+
+    if (c == '}' || c == ']') {
+        char open = c == '}' ? '{' : '[';
+        if (r->depth == 0 || r->stack[r->depth - 1] != open || r->after_key) return fail(r);
+        r->pos++;
+        r->depth--;
+        return c == '}' ? JSON_OBJECT_END : JSON_ARRAY_END;
+    }
+    if (want_key && c != '"') return fail(r);
+    r->after_key = false;
+
+    switch (c) {
+        case '{':
+        case '[':
+            if (r->depth == JSON_MAX_DEPTH) return fail(r);
+            r->stack[r->depth++] = (char)c;
+            r->pos++;
+            return c == '{' ? JSON_OBJECT : JSON_ARRAY;
+        case '"':
+            r->pos++;
+            r->text_len = 0;
+            if (!read_string(r)) return fail(r);
+            if (want_key) {
+                r->after_key = true;
+                return JSON_KEY;
+            }
+            return JSON_STRING;
+        case 't':
+        case 'f':
+        case 'n':
+            if (!read_word(r, false)) return fail(r);
+            if (strcmp(r->text, "true") == 0) return JSON_TRUE;
+            if (strcmp(r->text, "false") == 0) return JSON_FALSE;
+            if (strcmp(r->text, "null") == 0) return JSON_NULL;
+            return fail(r);
+        default:
+            if (c != '-' && (c < '0' || c > '9')) return fail(r);
+            if (!read_word(r, true)) return fail(r);
+            return JSON_NUMBER;
+    }
+}
+
+bool json_text_is(const JsonReader *r, const char *key) {
+    return r->text && strcmp(r->text, key) == 0;
+}
+
+bool json_leave(JsonReader *r) {
+    int depth = r->depth;
+    while (depth > 0 && r->depth >= depth) {
+        JsonToken t = json_next(r);
+        if (t == JSON_ERROR || t == JSON_END) return false;
+    }
+    return true;
+}
+
+// Next token, with the rest of the value consumed if it opens a container
+static JsonToken next_value(JsonReader *r) {
+    JsonToken t = json_next(r);
+    if ((t == JSON_OBJECT || t == JSON_ARRAY) && !json_leave(r)) return JSON_ERROR;
+    return t;
+}
+
+bool json_skip(JsonReader *r) {
+    JsonToken t = next_value(r);
+    return t != JSON_ERROR && t != JSON_END && t != JSON_OBJECT_END && t != JSON_ARRAY_END;
+}
+
+const char *json_read_str(JsonReader *r, size_t *len) {
+    if (next_value(r) != JSON_STRING) return NULL;
+    if (len) *len = r->text_len;
+    return r->text;
+}
+
+char *json_read_strdup(JsonReader *r) {
+    size_t len;
+    const char *s = json_read_str(r, &len);
+    if (!s) return NULL;
+    char *copy = malloc(len + 1);
+    if (copy) memcpy(copy, s, len + 1);
+    return copy;
+}
+
+bool json_read_string(JsonReader *r, char *out, size_t size) {
+    size_t len;
+    const char *s = json_read_str(r, &len);
+    if (!s || size == 0) return false;
+    if (len >= size) len = size - 1;
+    memcpy(out, s, len);
+    out[len] = '\0';
+    return true;
+}
+
+long long json_read_int(JsonReader *r, long long def) {
+    switch (next_value(r)) {
+        case JSON_NUMBER: return strtoll(r->text, NULL, 10);
+        case JSON_TRUE: return 1;
+        case JSON_FALSE: return 0;
+        default: return def;
+    }
+}
+
+bool json_read_bool(JsonReader *r, bool def) {
+    return json_read_int(r, def ? 1 : 0) != 0;
+}
+
+// ============================================================================
+// Writer
+// ============================================================================
+
+void json_writer_init(JsonWriter *w, FILE *fp) {
+    w->fp = fp;
+    w->len = 0;
+    w->failed = false;
+}
+
+static void flush_buf(JsonWriter *w) {
+    if (w->len > 0 && fwrite(w->buf, 1, w->len, w->fp) != w->len) w->failed = true;
+    w->len = 0;
+}
+
+static void put(JsonWriter *w, const char *s, size_t n) {
+    if (w->len + n > sizeof(w->buf)) {
+        flush_buf(w);
+        if (n > sizeof(w->buf)) {
+            if (fwrite(s, 1, n, w->fp) != n) w->failed = true;
+            return;
+        }
+    }
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+}
+
+static void put_escaped(JsonWriter *w, const char *s) {
+    put(w, "\"", 1);
+    while (s && *s) {
+        const char *run = s;
+        while (*s && (unsigned char)*s >= 0x20 && *s != '"' && *s != '\\') s++;
+        put(w, run, s - run);
+        if (!*s) break;
+
+        char esc[8];
+        switch (*s) {
+            case '"': put(w, "\\\"", 2); break;
+            case '\\': put(w, "\\\\", 2); break;
+            case '\n': put(w, "\\n", 2); break;
+            case '\r': put(w, "\\r", 2); break;
+            case '\t': put(w, "\\t", 2); break;
+            default:
+                snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)*s);
+                put(w, esc, 6);
+                break;
+        }
+        s++;
+    }
+    put(w, "\"", 1);
+}
+
+void json_printf(JsonWriter *w, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    while (*fmt) {
+        const char *run = fmt;
+        while (*fmt && *fmt != '%') fmt++;
+        put(w, run, fmt - run);
+        if (!*fmt) break;
+
+        fmt++;
+        char num[24];
+        int n;
+        if (*fmt == 's') {
+            const char *s = va_arg(ap, const char *);
+            put(w, s, strlen(s));
+        } else if (*fmt == 'q') {
+            put_escaped(w, va_arg(ap, const char *));
+        } else if (*fmt == 'd') {
+            n = snprintf(num, sizeof(num), "%d", va_arg(ap, int));
+            put(w, num, n);
+        } else if (strncmp(fmt, "lld", 3) == 0) {
+            n = snprintf(num, sizeof(num), "%lld", va_arg(ap, long long));
+            put(w, num, n);
+            fmt += 2;
+        } else if (strncmp(fmt, "ld", 2) == 0) {
+            n = snprintf(num, sizeof(num), "%ld", va_arg(ap, long));
+            put(w, num, n);
+            fmt++;
+        } else if (*fmt == 'b') {
+            const char *b = va_arg(ap, int) ? "true" : "false";
+            put(w, b, strlen(b));
+        } else if (*fmt == '%') {
+            put(w, "%", 1);
+        } else {
+            break;
+        }
+        fmt++;
+    }
+    va_end(ap);
+}
+
+bool json_writer_flush(JsonWriter *w) {
+    flush_buf(w);
+    if (fflush(w->fp) != 0) w->failed = true;
+    return !w->failed;
+}
@@ -0,0 +1,89 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Streaming JSON reader: pulls one token at a time from a file, through a
+// fixed buffer, or from a string in memory. Documents of any size parse in
+// one pass without being loaded whole. Strings, keys and numbers are
+// unescaped into one buffer the reader reuses, valid until the next token.
+
+typedef enum {
+    JSON_ERROR,          // malformed input or out of memory
+    JSON_END,            // end of input after the last value
+    JSON_OBJECT,
+    JSON_OBJECT_END,
+    JSON_ARRAY,
+    JSON_ARRAY_END,
+    JSON_KEY,            // text is the key; its value is the next token
+    JSON_STRING,
+    JSON_NUMBER,         // text is the number as written
+    JSON_TRUE,
+    JSON_FALSE,
+    JSON_NULL
+} JsonToken;
+
+#define JSON_MAX_DEPTH 64
+
+typedef struct {
+    FILE *fp;            // NULL when reading from memory
+    const char *in;      // unread input is in[pos .. len)
+    size_t pos;
+    size_t len;
+    char *text;          // string, key or number of the last token
+    size_t text_len;
+    size_t text_cap;
+    char stack[JSON_MAX_DEPTH];  // '{' or '[' per open container
+    int depth;
+    bool after_key;      // in an object, the next token is a key's value
+    bool failed;
+    char buf[16384];
+} JsonReader;
+
+// Read fp from its current position; the caller closes it
+void json_reader_init(JsonReader *r, FILE *fp);
+void json_reader_init_string(JsonReader *r, const char *s, size_t len);
+void json_reader_free(JsonReader *r);
+
+JsonToken json_next(JsonReader *r);
+
+// True if the last token was the key (or string) key
+bool json_text_is(const JsonReader *r, const char *key);
+
+// Skip the next value, with everything in it if it is an object or array
+bool json_skip(JsonReader *r);
+
+// Skip the rest of the object or array the reader is in, up to its end
+bool json_leave(JsonReader *r);
+
+// Read the next value as a given type. A value of another type is skipped:
+// json_read_str returns NULL, the others return def.
+const char *json_read_str(JsonReader *r, size_t *len);   // reader's text
+char *json_read_strdup(JsonReader *r);
+bool json_read_string(JsonReader *r, char *out, size_t size);  // truncates
+long long json_read_int(JsonReader *r, long long def);   // true/false read as 1/0
+bool json_read_bool(JsonReader *r, bool def);
+
+// Buffered JSON writer. Nothing is allocated: output goes through a fixed
+// buffer, with strings escaped on the way.
+
+typedef struct {
+    FILE *fp;
+    size_t len;
+    bool failed;
+    char buf[16384];
+} JsonWriter;
+
+void json_writer_init(JsonWriter *w, FILE *fp);
+
+// printf-like, with these directives only:
+//   %s raw string   %q quoted, escaped string (NULL writes "")
+//   %d int   %ld long   %lld long long   %b bool as true/false   %% percent
+void json_printf(JsonWriter *w, const char *fmt, ...);
+
+// Write out what is buffered. Returns false if any write failed.
+bool json_writer_flush(JsonWriter *w);
+
+#endif
@@ -0,0 +1,384 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "persist.h"
+
+typedef enum {
+    OP_WRITE,
+    OP_APPEND,
+    OP_RENAME,
+    OP_UNLINK
+} PersistKind;
+
+typedef struct PersistOp {
+    PersistKind kind;
+    char *path;
+    char *other;         // write: unlink_after, append: header, rename: target
+    char *data;
+    size_t len;
+    int fd;              // write: its temp file, open between the two passes
+    bool failed;
+    struct PersistOp *next;
+} PersistOp;
+
+typedef struct PathNode {
+    char *path;
+    struct PathNode *next;
+} PathNode;
+
+static pthread_mutex_t persist_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t persist_wake = PTHREAD_COND_INITIALIZER;  // work queued, or stop
+static pthread_cond_t persist_done = PTHREAD_COND_INITIALIZER;  // a batch finished
+static pthread_t persist_thread;
+static bool persist_running = false;
+static bool persist_stopping = false;
+static bool persist_busy = false;        // the thread has a batch in hand
+static PersistOp *queue_head = NULL;
+static PersistOp **queue_tail = &queue_head;
+static PathNode *failed_paths = NULL;    // under the mutex
+// Batches run one at a time, in the thread or in the callers when it
+// isn't running (never started, or stopped at exit while other threads
+// still save)
+static pthread_mutex_t run_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PathNode *broken_appends = NULL;  // under run_mutex
+
+// ============================================================================
+// Path lists
+// ============================================================================
+
+static bool path_list_has(PathNode *list, const char *path) {
+    for (; list; list = list->next) {
+        if (strcmp(list->path, path) == 0) return true;
+    }
+    return false;
+}
+
+static void path_list_add(PathNode **list, const char *path) {
+    if (path_list_has(*list, path)) return;
+    PathNode *node = malloc(sizeof(PathNode));
+    if (!node) return;
+    node->path = strdup(path);
+    if (!node->path) {
+        free(node);
+        return;
+    }
+    node->next = *list;
+    *list = node;
+}
+
+static void path_list_remove(PathNode **list, const char *path) {
+    for (PathNode **link = list; *link; link = &(*link)->next) {
+        if (strcmp((*link)->path, path) == 0) {
+            PathNode *node = *link;
+            *link = node->next;
+            free(node->path);
+            free(node);
+            return;
+        }
+    }
+}
+
+static void path_list_free(PathNode **list) {
+    while (*list) {
+        PathNode *node = *list;
+        *list = node->next;
+        free(node->path);
+        free(node);
+    }
+}
+
+// The directory holding path, to be synced once for the whole batch
+static void path_list_add_dir(PathNode **list, const char *path) {
+    char dir[4096];
+    const char *slash = strrchr(path, '/');
+    if (!slash) {
+        snprintf(dir, sizeof(dir), ".");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path > 0 ? slash - path : 1), path);
+    }
+    path_list_add(list, dir);
+}
+
+// ============================================================================
+// Batches
+// ============================================================================
+
+static bool write_all(int fd, const char *data, size_t len) {
+    for (size_t off = 0; off < len;) {
+        ssize_t n = write(fd, data + off, len - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        off += (size_t)n;
+    }
+    return true;
+}
+
+static void temp_path(const char *path, char *out, size_t size) {
+    snprintf(out, size, "%s.tmp", path);
+}
+
+static void op_free(PersistOp *op) {
+    free(op->path);
+    free(op->other);
+    free(op->data);
+    free(op);
+}
+
+// Where the batch starting at ops has to end: before the second write to
+// the same file, since both would go through the same temp file
+static PersistOp *batch_end(PersistOp *ops) {
+    for (PersistOp *op = ops; op; op = op->next) {
+        if (op->kind != OP_WRITE) continue;
+        for (PersistOp *prev = ops; prev != op; prev = prev->next) {
+            if (prev->kind == OP_WRITE && strcmp(prev->path, op->path) == 0) return op;
+        }
+    }
+    return NULL;
+}
+
+static void run_batch(PersistOp *ops, PersistOp *end) {
+    char tmp[16384 + 512];
+
+    // New contents go to temp files first, and reach the disk together
+    for (PersistOp *op = ops; op != end; op = op->next) {
+        if (op->kind != OP_WRITE) continue;
+        temp_path(op->path, tmp, sizeof(tmp));
+        op->fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (op->fd < 0 || !write_all(op->fd, op->data, op->len)) op->failed = true;
+    }
+    for (PersistOp *op = ops; op != end; op = op->next) {
+        if (op->kind == OP_WRITE && op->fd >= 0 && !op->failed && fdatasync(op->fd) != 0) {
+            op->failed = true;
+        }
+    }
+    for (PersistOp *op = ops; op != end; op = op->next) {
+        if (op->kind == OP_WRITE && op->fd >= 0 && close(op->fd) != 0) op->failed = true;
+    }
+
+    // Then everything takes effect in queue order. Appends to one file in a
+    // row share an open.
+    PathNode *dirs = NULL;
+    int append_fd = -1;
+    const char *append_path = NULL;
+    for (PersistOp *op = ops; op != end; op = op->next) {
+        if (append_fd >= 0 && (op->kind != OP_APPEND || strcmp(op->path, append_path) != 0)) {
+            close(append_fd);
+            append_fd = -1;
+        }
+
+        switch (op->kind) {
+        case OP_WRITE:
+            temp_path(op->path, tmp, sizeof(tmp));
+            if (!op->failed && rename(tmp, op->path) == 0) {
+                path_list_add_dir(&dirs, op->path);
+                if (op->other) {
+                    unlink(op->other);
+                    path_list_remove(&broken_appends, op->other);
+                }
+            } else {
+                unlink(tmp);
+                op->failed = true;
+            }
+            break;
+
+        case OP_APPEND:
+            if (path_list_has(broken_appends, op->path)) break;
+            if (append_fd < 0) {
+                append_fd = open(op->path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+                append_path = op->path;
+            }
+            struct stat sb;
+            if (append_fd < 0 || fstat(append_fd, &sb) != 0 ||
+                (sb.st_size == 0 && op->other && !write_all(append_fd, op->other, strlen(op->other))) ||
+                !write_all(append_fd, op->data, op->len)) {
+                op->failed = true;
+                path_list_add(&broken_appends, op->path);
+            }
+            break;
+
+        case OP_RENAME:
+            if (rename(op->path, op->other) == 0) {
+                path_list_add_dir(&dirs, op->other);
+            } else if (errno != ENOENT) {
+                op->failed = true;
+            }
+            break;
+
+        case OP_UNLINK:
+            if (unlink(op->path) == 0) path_list_add_dir(&dirs, op->path);
+            break;
+        }
+
+        if (op->failed) {
+            pthread_mutex_lock(&persist_mutex);
+            path_list_add(&failed_paths, op->kind == OP_RENAME ? op->other : op->path);
+            pthread_mutex_unlock(&persist_mutex);
+        }
+    }
+    if (append_fd >= 0) close(append_fd);
+
+    // One sync per directory makes the renames and unlinks stick
+    for (PathNode *dir = dirs; dir; dir = dir->next) {
+        int fd = open(dir->path, O_RDONLY | O_DIRECTORY);
+        if (fd >= 0) {
+            fsync(fd);
+            close(fd);
+        }
+    }
+    path_list_free(&dirs);
+}
+
+static void run_ops(PersistOp *ops) {
+    pthread_mutex_lock(&run_mutex);
+    while (ops) {
+        PersistOp *end = batch_end(ops);
+        run_batch(ops, end);
+        while (ops != end) {
+            PersistOp *next = ops->next;
+            op_free(ops);
+            ops = next;
+        }
+    }
+    pthread_mutex_unlock(&run_mutex);
+}
+
+static void *persist_thread_func(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&persist_mutex);
+    for (;;) {
+        while (!queue_head && !persist_stopping) {
+            pthread_cond_wait(&persist_wake, &persist_mutex);
+        }
+        if (!queue_head) break;
+
+        // Everything queued so far is one batch
+        PersistOp *ops = queue_head;
+        queue_head = NULL;
+        queue_tail = &queue_head;
+        persist_busy = true;
+        pthread_mutex_unlock(&persist_mutex);
+
+        run_ops(ops);
+
+        pthread_mutex_lock(&persist_mutex);
+        persist_busy = false;
+        pthread_cond_broadcast(&persist_done);
+    }
+    pthread_mutex_unlock(&persist_mutex);
+    return NULL;
+}
+
+// ============================================================================
+// Public API
+// ============================================================================
+
+bool persist_start(void) {
+    pthread_mutex_lock(&persist_mutex);
+    if (!persist_running) {
+        persist_stopping = false;
+        persist_running = pthread_create(&persist_thread, NULL, persist_thread_func, NULL) == 0;
+    }
+    bool running = persist_running;
+    pthread_mutex_unlock(&persist_mutex);
+    return running;
+}
+
+void persist_stop(void) {
+    pthread_mutex_lock(&persist_mutex);
+    bool running = persist_running;
+    persist_stopping = true;
+    pthread_cond_signal(&persist_wake);
+    pthread_mutex_unlock(&persist_mutex);
+    if (!running) return;
+
+    pthread_join(persist_thread, NULL);
+    pthread_mutex_lock(&persist_mutex);
+    persist_running = false;
+    pthread_mutex_unlock(&persist_mutex);
+}
+
+static void persist_queue(PersistOp *op) {
+    op->fd = -1;
+    pthread_mutex_lock(&persist_mutex);
+    if (persist_running) {
+        *queue_tail = op;
+        queue_tail = &op->next;
+        pthread_cond_signal(&persist_wake);
+        pthread_mutex_unlock(&persist_mutex);
+        return;
+    }
+    pthread_mutex_unlock(&persist_mutex);
+    run_ops(op);
+}
+
+static PersistOp *op_new(PersistKind kind, const char *path, const char *other) {
+    PersistOp *op = calloc(1, sizeof(PersistOp));
+    if (!op) return NULL;
+    op->kind = kind;
+    op->path = strdup(path);
+    op->other = other ? strdup(other) : NULL;
+    if (!op->path || (other && !op->other)) {
+        op_free(op);
+        return NULL;
+    }
+    return op;
+}
+
+void persist_write(const char *path, char *data, size_t len, const char *unlink_after) {
+    PersistOp *op = op_new(OP_WRITE, path, unlink_after);
+    if (!op) {
+        free(data);
+        return;
+    }
+    op->data = data;
+    op->len = len;
+    persist_queue(op);
+}
+
+void persist_append(const char *path, const char *header, char *data, size_t len) {
+    PersistOp *op = op_new(OP_APPEND, path, header);
+    if (!op) {
+        free(data);
+        return;
+    }
+    op->data = data;
+    op->len = len;
+    persist_queue(op);
+}
+
+void persist_rename(const char *from, const char *to) {
+    PersistOp *op = op_new(OP_RENAME, from, to);
+    if (op) persist_queue(op);
+}
+
+void persist_unlink(const char *path) {
+    PersistOp *op = op_new(OP_UNLINK, path, NULL);
+    if (op) persist_queue(op);
+}
+
+void persist_flush(void) {
+    pthread_mutex_lock(&persist_mutex);
+    while (persist_running && (queue_head || persist_busy)) {
+        pthread_cond_wait(&persist_done, &persist_mutex);
+    }
+    pthread_mutex_unlock(&persist_mutex);
+}
+
+bool persist_failed(char *path, size_t size) {
+    pthread_mutex_lock(&persist_mutex);
+    PathNode *node = failed_paths;
+    if (node) failed_paths = node->next;
+    pthread_mutex_unlock(&persist_mutex);
+    if (!node) return false;
+
+    snprintf(path, size, "%s", node->path);
+    free(node->path);
+    free(node);
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef PERSIST_H
+#define PERSIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Write-behind file writer. Callers queue file operations and return right
+// away; one background thread carries them out in the order they were
+// queued, so a later operation never lands before an earlier one. Each
+// batch it picks up writes its new files to temp files, syncs them
+// together, renames them into place and syncs their directories once.
+// Before persist_start, and if the thread can't run, operations are
+// carried out in the caller instead.
+
+bool persist_start(void);
+
+// Carry out everything queued, then stop the thread
+void persist_stop(void);
+
+// Replace path with len bytes of data, which the writer takes over and frees.
+// Once path is in place, unlink_after (if not NULL) is removed.
+void persist_write(const char *path, char *data, size_t len, const char *unlink_after);
+
+// Append len bytes of data to path, taking it over like persist_write; a new
+// or empty file gets header (if not NULL) first. After an append fails,
+// later appends to the same file are dropped until a write removes it
+// through unlink_after.
+void persist_append(const char *path, const char *header, char *data, size_t len);
+
+// A missing from is not an error, and neither is a missing path to unlink
+void persist_rename(const char *from, const char *to);
+void persist_unlink(const char *path);
+
+// Wait until everything queued so far is done
+void persist_flush(void);
+
+// Take the path of an operation that failed: the file written or appended
+// to, or the target of a rename. Returns false once there are none left.
+bool persist_failed(char *path, size_t size);
+
+#endif
@@ -6,6 +6,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <locale.h>
 #include <ncurses.h>
 #include <poll.h>
@@ -13,9 +14,11 @@
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -24,18 +27,48 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <dirent.h>
+#include "json.h"
+#include "persist.h"
 #include "youtube_playlist.h"
+#include "ytdlp_helper.h"
 
-#define MAX_RESULTS 50
-#define MAX_PLAYLISTS 50
-#define MAX_PLAYLIST_ITEMS 500
+#define MAX_RESULTS 50  // results per search page (and in the session cache)
 #define IPC_SOCKET "/tmp/shellbeats_mpv.sock"
 #define CONFIG_DIR ".shellbeats"
 #define PLAYLISTS_DIR "playlists"
 #define PLAYLISTS_INDEX "playlists.json"
 #define CONFIG_FILE "config.json"  // NEW: config file name
 #define DOWNLOAD_QUEUE_FILE "download_queue.json"  // NEW: download queue file
-#define MAX_DOWNLOAD_QUEUE 1000  // NEW: max download queue size
+#define SHUFFLE_FILE "shuffle.json"
+#define STATS_FILE "stats.json"
+#define QUEUE_FILE "queue.json"
+#define SEARCH_CACHE_DIR "search_cache"
+#define SEARCH_CACHE_INDEX "index.json"
+#define PLAY_HISTORY_SIZE 64
+#define SONG_CHUNK_SIZE 1024       // song table entries per allocation
+#define DOWNLOAD_PRIORITY_COUNT 3  // upcoming tracks whose downloads jump the queue
+#define LIBRARY_TRIGRAM_BITS 12
+#define LIBRARY_TRIGRAM_BUCKETS (1 << LIBRARY_TRIGRAM_BITS)
+#define LIBRARY_BIGRAM_BUCKETS 65536
+#define LIBRARY_MAX_TERMS 8
+#define TRACKLIST_PARALLEL 4     // lookups in flight during a tracklist import
+#define TRACKLIST_LOW_SCORE 60   // matches with fewer % of the line's words are reported
+#define IMPORT_REPORT_FILE "import_report.txt"
+#define PLAYLIST_FETCH_PARALLEL 3  // YouTube playlist imports/syncs fetched at once
+#define IMPORT_RESUME_DIR "import_resume"
+#define IMPORT_CHUNK_SIZE 200      // songs per import checkpoint
+#define IMPORT_RESUME_MAX_AGE (24 * 60 * 60)  // older checkpoints are fetched again
+#define JOURNAL_SUFFIX ".log"       // playlist journal, next to its snapshot
+#define JOURNAL_COMPACT_MIN 64      // records before a journal is folded into a snapshot
+#define SAVE_DELAY_MS 500           // saves made within this long are written together
+#define LIBRARY_SNAPSHOT_FILE "library.bin"
+#define SNAPSHOT_MAGIC "SBLIBRY"   // 8 bytes with the NUL
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+#define SNAPSHOT_NONE 0xffffffffu  // string offset of a missing string
+#define SNAPSHOT_YOUTUBE 1u
+#define SNAPSHOT_HEADER_KNOWN 2u
+#define DOWNLOAD_DIR_SETTLE_NS 2000000000LL  // a folder changed more recently is listed again
 #define YTDLP_BIN_DIR "bin"
 #define YTDLP_BINARY "yt-dlp"
 #define YTDLP_VERSION_FILE "yt-dlp.version"
@@ -46,21 +79,418 @@
 
 // Song struct is defined in youtube_playlist.h
 
+// Precomputed shuffle order for one list (playlist or search results).
+// order[0..cursor] is the play history, order[cursor+1..] is still to come.
+typedef struct {
+    int *order;      // permutation of song indices
+    int *pos;        // inverse permutation: pos[song] = index in order
+    int count;
+    int cursor;
+} ShuffleOrder;
+
+// Shuffle order restored from disk, attached when its list is first used
+typedef struct {
+    char *key;
+    int *order;
+    int count;
+    int cursor;
+} SavedShuffle;
+
+// Open-addressing hash map from string keys (copied) to int values
+typedef struct {
+    char **keys;
+    int *values;
+    int cap;        // power of two, 0 when empty
+    int count;
+} StrMap;
+
+// Open-addressing hash map from non-negative int keys to int values
+typedef struct {
+    int *keys;      // -1 marks a free slot
+    int *values;
+    int cap;        // power of two, 0 when empty
+    int count;
+} IntMap;
+
+// Per-song listening statistics, keyed by video_id
+typedef struct {
+    char video_id[32];
+    int plays;
+    int skips;
+    int completions;
+} SongStats;
+
+// Alias table (Vose) for O(1) weighted sampling. Weights that drop after
+// the build are handled by rejection; a weight that rises, or too much
+// total drop, marks the table for a lazy O(n) rebuild.
+typedef struct {
+    double *prob;
+    int *alias;
+    double *built_w;     // weights the table was built from
+    double *cur_w;       // current weights
+    double built_total;
+    double cur_total;
+    int count;
+    bool needs_rebuild;
+} AliasTable;
+
+// Weighted shuffle state for the list being played
+typedef struct {
+    AliasTable table;
+    StrMap index;        // video_id -> position in the list
+    char key[1024];      // list the table was built for
+    int history[PLAY_HISTORY_SIZE];
+    int history_len;
+    int next_pick;       // pre-sampled next song, -1 if none
+} WeightedShuffle;
+
+// One song of the library. lists counts the loaded playlists holding it.
+typedef struct {
+    Song song;           // title is in the table's arena
+    int lists;
+} SongEntry;
+
+// Every song of the loaded playlists, once per video_id. Playlists hold
+// refs (indices into the table), so a song in several playlists is stored
+// once and its metadata is updated in one place. Entries are allocated in
+// chunks that never move: Song pointers into the table stay valid.
+typedef struct {
+    SongEntry **chunks;
+    int count;
+    int *slots;          // hash index: video_id -> ref, -1 marks a free slot
+    int slot_cap;        // power of two, 0 when empty
+    Arena strings;       // titles
+} SongTable;
+
 typedef struct {
     char *name;
     char *filename;
-    Song items[MAX_PLAYLIST_ITEMS];
-    int count;
+    int *items;          // song table refs
+    int count;           // 0 also means not loaded yet (see load_playlist_songs)
+    int cap;
+    IntMap members;      // ref -> times the playlist holds the song
     bool is_youtube_playlist;
+    char *source_url;    // YouTube playlist it was imported from, NULL if unknown
+    bool header_known;   // type and source_url are set, from the index or the file
+    ShuffleOrder shuffle;
+    int generation;      // latest snapshot of the file, written or being written
+    int journal_records; // edits journaled since that snapshot
+    bool dirty;          // a new snapshot is due (see saves_commit)
 } Playlist;
 
+// Search results kept alive for playback after a new search replaced them
+typedef struct {
+    Song *items;
+    int count;
+    Arena strings;       // titles of items
+    char query[256];
+    ShuffleOrder shuffle;
+} SongList;
+
+// Background search: a detached thread reads yt-dlp's output into the
+// staging buffer, the UI thread moves rows into search_results as they come
+typedef struct {
+    pthread_mutex_t mutex;
+    char query[256];
+    pid_t child;         // yt-dlp, -1 once it has exited or when the helper serves the search
+    int fd;              // read end of its stdout (or the helper socket), -1 once closed
+    Song results[MAX_RESULTS];
+    Arena strings;       // titles of results, written by the thread
+    int count;
+    int taken;           // rows already moved to search_results (UI thread only)
+    int offset;          // rows loaded before this page, 0 for a new search
+    bool refresh;        // refreshing cached results: swap in only when done
+    bool finished;
+    bool cancelled;
+} SearchJob;
+
+// One line of a tracklist being imported
+typedef struct {
+    char *query;         // search query built from the line
+    int line;            // line number in the file, for the report
+    Song match;          // top search result, title NULL if nothing was found
+    int score;           // percent of the query's words found in the match title
+    bool cached;         // answered from the search cache
+} TracklistItem;
+
+// Tracklist import: one single-result search per line, a few in flight at
+// a time. The playlist is created once every line is resolved.
+typedef struct {
+    char name[256];
+    char source[1024];
+    bool stream_only;
+    TracklistItem *items;
+    int count;
+    Arena strings;       // titles of the matches
+    int next;            // next item to look up
+    int done;
+    SearchJob *jobs[TRACKLIST_PARALLEL];
+    int job_item[TRACKLIST_PARALLEL];
+} TracklistImport;
+
+// YouTube playlist fetched on a detached thread, to import it as a new
+// playlist or to sync an existing one. The thread fills songs and the UI
+// thread applies the result. Imports checkpoint every IMPORT_CHUNK_SIZE
+// songs to resume_file, so an interrupted one picks up where it stopped.
+typedef struct PlaylistFetch {
+    pthread_mutex_t mutex;
+    char url[512];
+    char name[256];      // import: playlist name, empty to use the YouTube title
+    char sync_file[256]; // sync: file of the playlist to update, empty for an import
+    char title[256];     // YouTube title, set by the thread
+    char ytdlp_cmd[1024];
+    char resume_file[16384 + 32];  // import checkpoint, empty for a sync
+    bool stream_only;
+    Song *songs;
+    int count;           // songs in songs, including ones resumed from the checkpoint
+    int cap;
+    Arena strings;       // titles of songs
+    int resumed;         // songs loaded from the checkpoint
+    int saved;           // songs in the checkpoint file
+    int fetched;         // songs fetched so far
+    int result;          // fetch_youtube_playlist's return value once finished
+    bool started;        // thread launched; at most PLAYLIST_FETCH_PARALLEL run at once
+    bool finished;
+    bool cancelled;
+    struct PlaylistFetch *next;
+} PlaylistFetch;
+
+// A document rendered into memory, for the writer thread to save:
+// json_printf to w between render_begin and render_end
+typedef struct {
+    FILE *mem;
+    char *data;
+    size_t len;
+    JsonWriter w;
+} MemRender;
+
+// Library snapshot file (see "Library Snapshot"): a header, then these
+// sections at 8-byte aligned offsets. Strings are offsets into the pool.
+enum {
+    SNAP_SOURCES,        // SnapshotSource: the files the snapshot was built from
+    SNAP_PLAYLISTS,      // SnapshotPlaylist, in index order
+    SNAP_SONGS,          // SnapshotSong, once per video_id
+    SNAP_ITEMS,          // uint32_t index into songs, each playlist's in a run
+    SNAP_DIRS,           // SnapshotDir: download folders
+    SNAP_FILES,          // SnapshotFile, each folder's in a run
+    SNAP_STRINGS,        // NUL-terminated strings; its count is in bytes
+    SNAPSHOT_SECTIONS
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;     // SNAPSHOT_BYTE_ORDER as the writer stored it
+    uint64_t size;           // of the whole file
+    uint64_t counts[SNAPSHOT_SECTIONS];
+    uint64_t offsets[SNAPSHOT_SECTIONS];
+} SnapshotHeader;
+
+typedef struct {
+    uint32_t path;
+    uint32_t pad;
+    int64_t size;            // -1 if the file didn't exist
+    int64_t mtime_ns;
+    uint64_t ino;
+} SnapshotSource;
+
+typedef struct {
+    uint32_t name;
+    uint32_t filename;
+    uint32_t source_url;     // SNAPSHOT_NONE if unknown
+    uint32_t flags;          // SNAPSHOT_YOUTUBE, SNAPSHOT_HEADER_KNOWN
+    int32_t generation;
+    int32_t journal_records;
+    uint32_t first_item;
+    uint32_t item_count;
+} SnapshotPlaylist;
+
+typedef struct {
+    uint32_t title;
+    int32_t duration;
+    char video_id[VIDEO_ID_SIZE];
+} SnapshotSong;
+
+typedef struct {
+    uint32_t path;
+    uint32_t first_file;
+    uint32_t file_count;
+    uint32_t pad;
+    int64_t mtime_ns;        // of the folder when it was listed
+} SnapshotDir;
+
+typedef struct {
+    uint32_t name;
+    char video_id[VIDEO_ID_SIZE];
+} SnapshotFile;
+
+// The snapshot the library was loaded from, mapped for the session
+typedef struct {
+    void *map;           // NULL if there was none to use
+    size_t size;
+    StrMap dirs;         // download folder path -> index in its dirs
+} LibrarySnapshot;
+
+// A snapshot being put together, each section growing in its own buffer
+typedef struct {
+    char *data[SNAPSHOT_SECTIONS];
+    size_t len[SNAPSHOT_SECTIONS];   // bytes
+    size_t cap[SNAPSHOT_SECTIONS];
+    bool failed;
+} SnapshotWriter;
+
+// Snapshot rebuilt from the JSON files on a background thread, which loads
+// them into an AppState of its own
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_t thread;
+    struct AppState *scratch;
+    char path[PATH_MAX];
+    bool cancelled;
+    bool finished;
+} SnapshotBuild;
+
+// Downloaded files of one folder, by video_id. The listing is kept while
+// the folder's mtime stays the same.
+typedef struct {
+    char *path;
+    long long mtime_ns;  // of the folder when listed, -1 if not listed
+    bool trusted;        // listed after the folder had settled (see download_dir_list)
+    StrMap files;        // video_id -> index in names
+    char **names;
+    int count;
+    int cap;
+    Arena strings;       // names
+} DownloadDir;
+
+// Changes a sync applied to a playlist
+typedef struct {
+    int added;
+    int removed;
+    int moved;           // kept songs that changed position relative to the others
+} SyncDiff;
+
+// Song queued to play next. Entries own a copy of the song so the queue
+// survives new searches and playlist edits.
+typedef struct {
+    Song song;
+    char *playlist;      // playlist it was queued from (local file lookup), NULL if none
+} QueueEntry;
+
+// Play queue: ring buffer of entries, played ahead of the current list
+typedef struct {
+    QueueEntry *items;
+    int cap;
+    int head;
+    int count;
+} PlayQueue;
+
+// Track appended to mpv's internal playlist so the switch to it is gapless
+typedef struct {
+    bool valid;
+    char video_id[32];
+    int tier;            // stream tier its options were built with, -1 for local files
+} PreloadedTrack;
+
+// One cached search; results live in search_cache/<hash>.json
+typedef struct {
+    char *query;         // normalized query
+    time_t fetched;
+    int prev;            // LRU links (head = most recently used), -1 at the ends
+    int next;
+} SearchCacheEntry;
+
+// On-disk LRU cache of query -> results
+typedef struct {
+    SearchCacheEntry *entries;
+    int count;
+    int cap;
+    StrMap index;        // query -> entry
+    int head;
+    int tail;
+    bool dirty;          // index needs saving
+} SearchCache;
+
+// One song of the local library (playlist songs and downloaded files),
+// deduplicated by video_id
+typedef struct {
+    char *title;
+    char *video_id;
+    char *folder;        // download subfolder of a file that is in no playlist
+    int playlist_idx;    // first playlist holding the song, -1 if only on disk
+    int song_idx;
+    int duration;
+    bool downloaded;
+} LibraryEntry;
+
+// Search index over the library. Folded (lowercased) titles are packed into
+// one buffer so scans stay sequential; the entries containing a trigram that
+// hashes to bucket b are postings[start[b] .. start[b + 1]), in entry order.
+// Bigrams get exact lists the same way, keyed by their two bytes.
+typedef struct {
+    LibraryEntry *entries;
+    int count;
+    int cap;
+    StrMap ids;          // video_id -> entry
+    char *text;          // folded titles, each followed by '\n'
+    int *offsets;        // entry i is text[offsets[i] .. offsets[i + 1] - 1)
+    uint64_t *chars;     // character set of each folded title
+    int *start;
+    int *postings;
+    int *bigram_start;
+    int *bigram_postings;
+    int *matches;        // entries matching query, in library order
+    int match_count;
+    int *scratch;        // candidate buffer, count entries
+    char query[256];
+    char filtered[256];  // folded query matches were computed for
+    bool fuzzy;          // matches came from the subsequence fallback
+    int selected;
+    int scroll;
+} LibraryIndex;
+
 // NEW: Configuration structure
 typedef struct {
     char download_path[1024];
     int seek_step;           // Seek step in seconds (default 10)
     bool remember_session;   // Remember last session on exit
+    bool resume_playback;    // Preload last track paused at startup
+    bool weighted_shuffle;   // Shuffle favours songs that aren't usually skipped
+    int stream_quality;      // StreamQuality: auto or a pinned tier
+    int search_cache_ttl;    // Hours a cached search is served without refreshing, 0 = cache off
+    int search_cache_size;   // Max queries kept in the search cache
+    int youtube_sync_hours;  // Hours between automatic syncs of YouTube playlists, 0 = manual only
+    bool youtube_sync_download; // Queue downloads of the songs a sync adds
+    time_t youtube_sync_last;   // When the last sync of all YouTube playlists started
 } Config;
 
+// Stream quality: AUTO lets the controller pick a tier from buffer health
+typedef enum {
+    QUALITY_AUTO = -1,
+    QUALITY_LOW = 0,
+    QUALITY_MEDIUM = 1,
+    QUALITY_HIGH = 2
+} StreamQuality;
+
+// Buffer health of the current stream, fed by mpv property-change events
+typedef struct {
+    int tier;                // tier used for the next stream (index into stream_tiers)
+    int current_tier;        // tier of the track now playing, -1 for local files
+    double cache_duration;   // latest demuxer-cache-duration (seconds)
+    double min_cache;        // lowest cache seen after warm-up
+    double speed_avg;        // smoothed cache-speed (bytes/s)
+    int stalls;              // paused-for-cache transitions during this track
+    bool paused_for_cache;
+    time_t track_started;
+} StreamHealth;
+
+// How the track mpv was playing ended, as far as a poll saw
+typedef enum {
+    TRACK_PLAYING,
+    TRACK_EOF,
+    TRACK_ERROR
+} TrackEnd;
+
 // NEW: Download task status
 typedef enum {
     DOWNLOAD_PENDING,
@@ -80,11 +510,14 @@ typedef struct {
 
 // NEW: Download queue
 typedef struct {
-    DownloadTask tasks[MAX_DOWNLOAD_QUEUE];
+    DownloadTask *tasks;
     int count;
+    int cap;
     int completed;
     int failed;
     int current_idx;  // currently downloading
+    char priority_ids[DOWNLOAD_PRIORITY_COUNT][32];  // upcoming tracks, downloaded first
+    StrMap ids;       // video_id -> its latest task
     bool active;      // thread is running
     pthread_mutex_t mutex;
     pthread_t thread;
@@ -99,22 +532,41 @@ typedef enum {
     VIEW_PLAYLIST_SONGS,
     VIEW_ADD_TO_PLAYLIST,
     VIEW_SETTINGS,
-    VIEW_ABOUT
+    VIEW_ABOUT,
+    VIEW_QUEUE,
+    VIEW_LIBRARY
 } ViewMode;
 
-typedef struct {
+typedef struct AppState {
     // Search results
-    Song search_results[MAX_RESULTS];
+    Song *search_results;
     int search_count;
+    int search_cap;
+    Arena search_strings;        // titles of search_results
+    int search_fetched;          // rows returned by yt-dlp, duplicates included
+    bool search_more;            // last page was full, another may follow
     int search_selected;
     int search_scroll;
     char query[256];
+    SearchJob *search_job;       // search running in the background, NULL if none
+    SearchCache search_cache;
     
     // Playlists
-    Playlist playlists[MAX_PLAYLISTS];
+    Playlist *playlists;
     int playlist_count;
+    int playlist_cap;
+    StrMap playlist_names;       // lowercased name -> index in playlists
+    StrMap playlist_files;       // filename -> index in playlists
+    SongTable songs;             // songs of the loaded playlists
+    bool songs_complete;         // every playlist is loaded: song lists counts are exact
     int playlist_selected;
     int playlist_scroll;
+    TracklistImport *tracklist;  // tracklist import in progress, NULL if none
+    PlaylistFetch *fetches;      // YouTube playlist imports and syncs in progress
+    int sync_total;              // playlists in the running sync batch
+    int sync_done;
+    SyncDiff sync_diff;          // changes the batch applied so far
+    int sync_failed;
     
     // Current playlist view
     int current_playlist_idx;
@@ -126,12 +578,26 @@ typedef struct {
     bool playing_from_playlist;
     int playing_playlist_idx;
     bool paused;
+    SongList played_search;      // playing search list after a new search replaced it
+    bool search_detached;        // search playback runs on played_search
+
+    // Play queue
+    PlayQueue queue;
+    QueueEntry queue_current;    // entry now playing when playing_from_queue
+    bool playing_from_queue;     // queue entry playing; playing_index keeps the list position
+    int queue_selected;
+    int queue_scroll;
+    ViewMode queue_return_view;
+    LibraryIndex library;
+    ViewMode library_return_view;
+    PreloadedTrack preloaded;
+    bool advancing_on_eof;       // play_next called for a natural track end
     
     // UI state
     ViewMode view;
     int add_to_playlist_selected;
     int add_to_playlist_scroll;
-    Song *song_to_add;
+    Song song_to_add;            // copy owned by the add-to-playlist dialog, empty video_id if none
     
     // NEW: Settings UI state
     int settings_selected;
@@ -143,11 +609,22 @@ typedef struct {
     time_t playback_started;
     
     // Config paths
-    char config_dir[16384];      // Significantly increased buffer size
-    char playlists_dir[16384];   // Significantly increased buffer size
-    char playlists_index[16384]; // Significantly increased buffer size
-    char config_file[16384];     // Significantly increased buffer size
-    char download_queue_file[16384]; // Significantly increased buffer size
+    char config_dir[PATH_MAX];
+    char playlists_dir[PATH_MAX];
+    char playlists_index[PATH_MAX];
+    char config_file[PATH_MAX];
+    bool config_dirty;           // config and index saves are pending
+    bool index_dirty;
+    long long saves_due;         // monotonic ms when pending saves go out, 0 if none
+    char download_queue_file[PATH_MAX];
+    char shuffle_file[PATH_MAX];
+    char stats_file[PATH_MAX];
+    char queue_file[PATH_MAX];
+    char search_cache_dir[PATH_MAX];
+    char import_resume_dir[PATH_MAX];
+    char snapshot_file[PATH_MAX];
+    LibrarySnapshot snapshot;
+    SnapshotBuild *snapshot_build;  // rebuild of a stale snapshot, NULL if none
 
     // yt-dlp auto-update paths
     char ytdlp_bin_dir[1024];
@@ -159,6 +636,10 @@ typedef struct {
 
     // NEW: Download queue
     DownloadQueue download_queue;
+    DownloadDir *download_dirs;  // listings of the download folders looked at
+    int download_dir_count;
+    int download_dir_cap;
+    StrMap download_dir_index;   // path -> index in download_dirs
 
     // yt-dlp auto-update state
     bool ytdlp_updating;
@@ -174,6 +655,21 @@ typedef struct {
 
     // Shuffle mode
     bool shuffle_mode;
+    ShuffleOrder search_shuffle;
+    SavedShuffle *saved_shuffles;
+    int saved_shuffle_count;
+    WeightedShuffle weighted;
+
+    // Play statistics
+    SongStats *stats;
+    int stats_count;
+    int stats_cap;
+    StrMap stats_index;      // video_id -> index in stats
+    int stat_pending[8];     // stats of loaded tracks still waiting for end-file
+    int stat_pending_count;
+
+    // Adaptive stream quality
+    StreamHealth stream;
 
     // Seek step in seconds (configurable)
     int seek_step;
@@ -183,8 +679,10 @@ typedef struct {
     char last_query[256];
     Song cached_search[MAX_RESULTS];
     int cached_search_count;
+    Arena cached_search_strings;
     int last_playlist_idx;
     int last_song_idx;
+    int last_position;       // Playback position in seconds, -1 if nothing was playing
     bool was_playing_playlist;
 } AppState;
 
@@ -228,6 +726,12 @@ static void save_config(AppState *st);  // NEW
 static void load_config(AppState *st);  // NEW
 static void save_download_queue(AppState *st);  // NEW
 static void load_download_queue(AppState *st);  // NEW
+static void stats_track_ended(AppState *st, const char *reason);
+static void load_playlist_songs(AppState *st, int idx);
+static void weighted_reset(WeightedShuffle *ws);
+static void saves_schedule(AppState *st);
+static void saves_commit(AppState *st);
+static const char *download_dir_find(AppState *st, const char *path, const char *video_id);
 
 // ============================================================================
 // Utility Functions
@@ -243,6 +747,201 @@ static char *trim_whitespace(char *s) {
     return s;
 }
 
+// FNV-1a
+static uint32_t str_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void strmap_free(StrMap *m) {
+    for (int i = 0; i < m->cap; i++) free(m->keys[i]);
+    free(m->keys);
+    free(m->values);
+    m->keys = NULL;
+    m->values = NULL;
+    m->cap = 0;
+    m->count = 0;
+}
+
+// Returns the value for key, or -1 if absent
+static int strmap_get(const StrMap *m, const char *key) {
+    if (m->cap == 0 || !key) return -1;
+    uint32_t mask = (uint32_t)m->cap - 1;
+    for (uint32_t i = str_hash(key) & mask; m->keys[i]; i = (i + 1) & mask) {
+        if (strcmp(m->keys[i], key) == 0) return m->values[i];
+    }
+    return -1;
+}
+
+static bool strmap_grow(StrMap *m) {
+    int new_cap = m->cap ? m->cap * 2 : 64;
+    char **keys = calloc(new_cap, sizeof(char *));
+    int *values = malloc(sizeof(int) * new_cap);
+    if (!keys || !values) {
+        free(keys);
+        free(values);
+        return false;
+    }
+
+    uint32_t mask = (uint32_t)new_cap - 1;
+    for (int i = 0; i < m->cap; i++) {
+        if (!m->keys[i]) continue;
+        uint32_t j = str_hash(m->keys[i]) & mask;
+        while (keys[j]) j = (j + 1) & mask;
+        keys[j] = m->keys[i];
+        values[j] = m->values[i];
+    }
+
+    free(m->keys);
+    free(m->values);
+    m->keys = keys;
+    m->values = values;
+    m->cap = new_cap;
+    return true;
+}
+
+// Insert or update; the key is copied
+static bool strmap_put(StrMap *m, const char *key, int value) {
+    if (!key) return false;
+    if ((m->count + 1) * 4 > m->cap * 3 && !strmap_grow(m)) return false;
+
+    uint32_t mask = (uint32_t)m->cap - 1;
+    uint32_t i = str_hash(key) & mask;
+    for (; m->keys[i]; i = (i + 1) & mask) {
+        if (strcmp(m->keys[i], key) == 0) {
+            m->values[i] = value;
+            return true;
+        }
+    }
+
+    m->keys[i] = strdup(key);
+    if (!m->keys[i]) return false;
+    m->values[i] = value;
+    m->count++;
+    return true;
+}
+
+// Remove key if present (backward-shift deletion keeps probe chains intact)
+static void strmap_remove(StrMap *m, const char *key) {
+    if (m->cap == 0 || !key) return;
+    uint32_t mask = (uint32_t)m->cap - 1;
+    uint32_t i = str_hash(key) & mask;
+    while (m->keys[i] && strcmp(m->keys[i], key) != 0) i = (i + 1) & mask;
+    if (!m->keys[i]) return;
+
+    free(m->keys[i]);
+    m->keys[i] = NULL;
+    m->count--;
+
+    for (uint32_t j = (i + 1) & mask; m->keys[j]; j = (j + 1) & mask) {
+        uint32_t home = str_hash(m->keys[j]) & mask;
+        // Entry j may move into the hole at i unless its home lies in (i, j]
+        bool stays = (i <= j) ? (home > i && home <= j) : (home > i || home <= j);
+        if (stays) continue;
+        m->keys[i] = m->keys[j];
+        m->values[i] = m->values[j];
+        m->keys[j] = NULL;
+        i = j;
+    }
+}
+
+static uint32_t int_hash(int key) {
+    return (uint32_t)key * 2654435761u;
+}
+
+static void intmap_free(IntMap *m) {
+    free(m->keys);
+    free(m->values);
+    m->keys = NULL;
+    m->values = NULL;
+    m->cap = 0;
+    m->count = 0;
+}
+
+// Returns the value for key, or -1 if absent
+static int intmap_get(const IntMap *m, int key) {
+    if (m->cap == 0 || key < 0) return -1;
+    uint32_t mask = (uint32_t)m->cap - 1;
+    for (uint32_t i = int_hash(key) & mask; m->keys[i] >= 0; i = (i + 1) & mask) {
+        if (m->keys[i] == key) return m->values[i];
+    }
+    return -1;
+}
+
+static bool intmap_grow(IntMap *m) {
+    int new_cap = m->cap ? m->cap * 2 : 64;
+    int *keys = malloc(sizeof(int) * new_cap);
+    int *values = malloc(sizeof(int) * new_cap);
+    if (!keys || !values) {
+        free(keys);
+        free(values);
+        return false;
+    }
+    memset(keys, 0xff, sizeof(int) * new_cap);
+
+    uint32_t mask = (uint32_t)new_cap - 1;
+    for (int i = 0; i < m->cap; i++) {
+        if (m->keys[i] < 0) continue;
+        uint32_t j = int_hash(m->keys[i]) & mask;
+        while (keys[j] >= 0) j = (j + 1) & mask;
+        keys[j] = m->keys[i];
+        values[j] = m->values[i];
+    }
+
+    free(m->keys);
+    free(m->values);
+    m->keys = keys;
+    m->values = values;
+    m->cap = new_cap;
+    return true;
+}
+
+// Insert or update
+static bool intmap_put(IntMap *m, int key, int value) {
+    if (key < 0) return false;
+    if ((m->count + 1) * 4 > m->cap * 3 && !intmap_grow(m)) return false;
+
+    uint32_t mask = (uint32_t)m->cap - 1;
+    uint32_t i = int_hash(key) & mask;
+    for (; m->keys[i] >= 0; i = (i + 1) & mask) {
+        if (m->keys[i] == key) {
+            m->values[i] = value;
+            return true;
+        }
+    }
+
+    m->keys[i] = key;
+    m->values[i] = value;
+    m->count++;
+    return true;
+}
+
+// Remove key if present, like strmap_remove
+static void intmap_remove(IntMap *m, int key) {
+    if (m->cap == 0 || key < 0) return;
+    uint32_t mask = (uint32_t)m->cap - 1;
+    uint32_t i = int_hash(key) & mask;
+    while (m->keys[i] >= 0 && m->keys[i] != key) i = (i + 1) & mask;
+    if (m->keys[i] < 0) return;
+
+    m->keys[i] = -1;
+    m->count--;
+
+    for (uint32_t j = (i + 1) & mask; m->keys[j] >= 0; j = (j + 1) & mask) {
+        uint32_t home = int_hash(m->keys[j]) & mask;
+        bool stays = (i <= j) ? (home > i && home <= j) : (home > i || home <= j);
+        if (stays) continue;
+        m->keys[i] = m->keys[j];
+        m->values[i] = m->values[j];
+        m->keys[j] = -1;
+        i = j;
+    }
+}
+
 static bool file_exists(const char *path) {
     struct stat sb;
     return stat(path, &sb) == 0;
@@ -253,6 +952,22 @@ static bool dir_exists(const char *path) {
     return stat(path, &sb) == 0 && S_ISDIR(sb.st_mode);
 }
 
+static long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static long long realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long long stat_mtime_ns(const struct stat *sb) {
+    return (long long)sb->st_mtim.tv_sec * 1000000000LL + sb->st_mtim.tv_nsec;
+}
+
 // NEW: Create directory recursively (like mkdir -p)
 static bool mkdir_p(const char *path) {
     char tmp[4096]; // Increased buffer size
@@ -368,24 +1083,11 @@ static bool get_local_file_path_for_song(AppState *st, const char *playlist_name
         snprintf(dest_dir, sizeof(dest_dir), "%s", st->config.download_path);
     }
 
-    // Search for file with this video_id
-    DIR *dir = opendir(dest_dir);
-    if (!dir) return false;
-
-    char pattern[64];
-    snprintf(pattern, sizeof(pattern), "[%s].mp3", video_id);
-
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strstr(entry->d_name, pattern) != NULL) {
-            snprintf(out_path, out_size, "%s/%s", dest_dir, entry->d_name);
-            closedir(dir);
-            return true;
-        }
-    }
-
-    closedir(dir);
-    return false;
+    // The folder's listing has the file with this video_id, if any
+    const char *name = download_dir_find(st, dest_dir, video_id);
+    if (!name) return false;
+    snprintf(out_path, out_size, "%s/%s", dest_dir, name);
+    return true;
 }
 
 // Recursively delete a directory and all its contents
@@ -431,63 +1133,32 @@ static bool delete_directory_recursive(const char *path) {
     return success;
 }
 
-static char *json_escape_string(const char *s) {
-    if (!s) return strdup("");
-    
-    size_t len = strlen(s);
-    size_t alloc = len * 2 + 1;
-    char *out = malloc(alloc);
-    if (!out) return NULL;
-    
-    size_t j = 0;
-    for (size_t i = 0; i < len && j < alloc - 2; i++) {
-        char c = s[i];
-        if (c == '"' || c == '\\') {
-            out[j++] = '\\';
-        } else if (c == '\n') {
-            out[j++] = '\\';
-            out[j++] = 'n';
-            continue;
-        } else if (c == '\r') {
-            out[j++] = '\\';
-            out[j++] = 'r';
-            continue;
-        } else if (c == '\t') {
-            out[j++] = '\\';
-            out[j++] = 't';
-            continue;
-        }
-        out[j++] = c;
-    }
-    out[j] = '\0';
-    return out;
-}
-
 // Simple JSON string extraction (finds "key":"value" and returns value)
-static char *json_get_string(const char *json, const char *key) {
+// Escaped value of key's string in json: sets *start and *len, false if absent
+static bool json_find_string(const char *json, const char *key, const char **start, size_t *len) {
     char pattern[256];
     snprintf(pattern, sizeof(pattern), "\"%s\"", key);
     
     const char *p = strstr(json, pattern);
-    if (!p) return NULL;
+    if (!p) return false;
     
     p += strlen(pattern);
     while (*p && (*p == ' ' || *p == ':' || *p == '\t')) p++;
     
-    if (*p != '"') return NULL;
+    if (*p != '"') return false;
     p++;
     
-    const char *start = p;
+    *start = p;
     while (*p && *p != '"') {
         if (*p == '\\' && *(p+1)) p++;
         p++;
     }
-    
-    size_t len = p - start;
-    char *result = malloc(len + 1);
-    if (!result) return NULL;
-    
-    // Unescape
+    *len = p - *start;
+    return true;
+}
+
+// Unescape len bytes of a JSON string into result (len + 1 bytes)
+static void json_unescape(const char *start, size_t len, char *result) {
     size_t j = 0;
     for (size_t i = 0; i < len; i++) {
         if (start[i] == '\\' && i + 1 < len) {
@@ -501,9 +1172,104 @@ static char *json_get_string(const char *json, const char *key) {
         }
     }
     result[j] = '\0';
+}
+
+static char *json_get_string(const char *json, const char *key) {
+    const char *start;
+    size_t len;
+    if (!json_find_string(json, key, &start, &len)) return NULL;
+    
+    char *result = malloc(len + 1);
+    if (!result) return NULL;
+    json_unescape(start, len, result);
     return result;
 }
 
+static bool json_grow_songs(Song **songs, int *cap) {
+    int new_cap = *cap ? *cap * 2 : MAX_RESULTS;
+    Song *grown = realloc(*songs, sizeof(Song) * new_cap);
+    if (!grown) return false;
+    *songs = grown;
+    *cap = new_cap;
+    return true;
+}
+
+// Read the rest of a song object (its '{' was the last token) into song,
+// its title in arena. False if it lacks a video id or a title.
+static bool json_read_song(JsonReader *r, Song *song, Arena *arena) {
+    memset(song, 0, sizeof(*song));
+    bool has_id = false;
+    while (json_next(r) == JSON_KEY) {
+        if (json_text_is(r, "title")) {
+            size_t len;
+            const char *title = json_read_str(r, &len);
+            if (title) song->title = arena_strndup(arena, title, len);
+        } else if (json_text_is(r, "video_id")) {
+            char id[64];
+            has_id = json_read_string(r, id, sizeof(id)) && song_set_video_id(song, id);
+        } else if (json_text_is(r, "duration")) {
+            song->duration = (int)json_read_int(r, 0);
+        } else {
+            json_skip(r);
+        }
+    }
+    return has_id && song->title != NULL;
+}
+
+// Read an array of song objects, the next value, into a new array with
+// their titles in arena. Returns the number of songs (*out NULL if none).
+static int json_read_songs(JsonReader *r, Song **out, Arena *arena) {
+    int count = 0;
+    int cap = 0;
+    Song *songs = NULL;
+    JsonToken t = json_next(r);
+    if (t == JSON_OBJECT) json_leave(r);
+
+    while (t == JSON_ARRAY) {
+        JsonToken item = json_next(r);
+        if (item == JSON_ARRAY_END || item == JSON_ERROR) break;
+        if (item == JSON_ARRAY) {
+            json_leave(r);
+        } else if (item == JSON_OBJECT) {
+            if (count == cap && !json_grow_songs(&songs, &cap)) {
+                json_leave(r);
+            } else if (json_read_song(r, &songs[count], arena)) {
+                count++;
+            }
+        }
+    }
+
+    if (count == 0) free(songs);
+    *out = count > 0 ? songs : NULL;
+    return count;
+}
+
+// One song object of an array, as every file with songs has them
+static void json_write_song(JsonWriter *w, const Song *song, bool last) {
+    json_printf(w, "    {\"title\": %q, \"video_id\": %q, \"duration\": %d}%s\n",
+                song->title, song->video_id, song->duration, last ? "" : ",");
+}
+
+static bool render_begin(MemRender *m) {
+    m->data = NULL;
+    m->len = 0;
+    m->mem = open_memstream(&m->data, &m->len);
+    if (!m->mem) return false;
+    json_writer_init(&m->w, m->mem);
+    return true;
+}
+
+// Returns false, with nothing left to free, if the document is incomplete
+static bool render_end(MemRender *m) {
+    bool ok = json_writer_flush(&m->w);
+    if (fclose(m->mem) != 0) ok = false;
+    if (!ok) {
+        free(m->data);
+        m->data = NULL;
+    }
+    return ok;
+}
+
 // ============================================================================
 // Config Directory Management
 // ============================================================================
@@ -519,6 +1285,12 @@ static bool init_config_dirs(AppState *st) {
     snprintf(st->playlists_index, sizeof(st->playlists_index), "%s/%s", st->config_dir, PLAYLISTS_INDEX);
     snprintf(st->config_file, sizeof(st->config_file), "%s/%s", st->config_dir, CONFIG_FILE);  // NEW
     snprintf(st->download_queue_file, sizeof(st->download_queue_file), "%s/%s", st->config_dir, DOWNLOAD_QUEUE_FILE);  // NEW
+    snprintf(st->shuffle_file, sizeof(st->shuffle_file), "%s/%s", st->config_dir, SHUFFLE_FILE);
+    snprintf(st->stats_file, sizeof(st->stats_file), "%s/%s", st->config_dir, STATS_FILE);
+    snprintf(st->queue_file, sizeof(st->queue_file), "%s/%s", st->config_dir, QUEUE_FILE);
+    snprintf(st->search_cache_dir, sizeof(st->search_cache_dir), "%s/%s", st->config_dir, SEARCH_CACHE_DIR);
+    snprintf(st->import_resume_dir, sizeof(st->import_resume_dir), "%s/%s", st->config_dir, IMPORT_RESUME_DIR);
+    snprintf(st->snapshot_file, sizeof(st->snapshot_file), "%s/%s", st->config_dir, LIBRARY_SNAPSHOT_FILE);
 
     // yt-dlp auto-update paths
     snprintf(st->ytdlp_bin_dir, sizeof(st->ytdlp_bin_dir), "%s/%s", st->config_dir, YTDLP_BIN_DIR);
@@ -545,6 +1317,16 @@ static bool init_config_dirs(AppState *st) {
         }
     }
 
+    // Search cache directory (non-fatal: searches just aren't cached)
+    if (!dir_exists(st->search_cache_dir)) {
+        mkdir(st->search_cache_dir, 0755);
+    }
+
+    // Import checkpoints (non-fatal: interrupted imports start over)
+    if (!dir_exists(st->import_resume_dir)) {
+        mkdir(st->import_resume_dir, 0755);
+    }
+
     // Create bin directory for local yt-dlp (non-fatal: auto-update is optional)
     if (!dir_exists(st->ytdlp_bin_dir)) {
         mkdir(st->ytdlp_bin_dir, 0755);  // best-effort, app works without it
@@ -783,80 +1565,104 @@ static void init_default_config(AppState *st) {
 
     // Default: don't remember session
     st->config.remember_session = false;
+
+    // Default: don't preload the last track
+    st->config.resume_playback = false;
+
+    // Default: uniform shuffle
+    st->config.weighted_shuffle = false;
+
+    // Default: adapt stream quality to the connection
+    st->config.stream_quality = QUALITY_AUTO;
+
+    // Default: cached searches stay fresh for a day, 200 queries kept
+    st->config.search_cache_ttl = 24;
+    st->config.search_cache_size = 200;
+
+    // Default: YouTube playlists sync on demand only
+    st->config.youtube_sync_hours = 0;
+    st->config.youtube_sync_download = false;
+    st->config.youtube_sync_last = 0;
 }
 
-static void save_config(AppState *st) {
-    FILE *f = fopen(st->config_file, "w");
-    if (!f) return;
+// Bitrate tiers for streamed audio, each with its own cache/readahead profile.
+// Formats fall back to whatever audio exists when no stream matches the cap.
+static const struct {
+    const char *name;
+    const char *ytdl_format;
+    int kbps;
+    int readahead_secs;
+    const char *max_bytes;
+} stream_tiers[] = {
+    { "64k",  "bestaudio[abr<=64]/worstaudio/worst",   64,  60, "8MiB"  },
+    { "128k", "bestaudio[abr<=128]/bestaudio/best",   128,  30, "16MiB" },
+    { "best", "bestaudio/best",                       256,  20, "32MiB" },
+};
+#define STREAM_TIER_COUNT ((int)(sizeof(stream_tiers) / sizeof(stream_tiers[0])))
+
+static const char *stream_quality_name(int quality) {
+    switch (quality) {
+        case QUALITY_LOW: return "low";
+        case QUALITY_MEDIUM: return "medium";
+        case QUALITY_HIGH: return "high";
+        default: return "auto";
+    }
+}
 
-    char *escaped_path = json_escape_string(st->config.download_path);
-    char *escaped_query = json_escape_string(st->last_query);
+static int stream_quality_from_name(const char *name) {
+    if (!name) return QUALITY_AUTO;
+    if (strcmp(name, "low") == 0) return QUALITY_LOW;
+    if (strcmp(name, "medium") == 0) return QUALITY_MEDIUM;
+    if (strcmp(name, "high") == 0) return QUALITY_HIGH;
+    return QUALITY_AUTO;
+}
 
-    fprintf(f, "{\n");
-    fprintf(f, "  \"download_path\": \"%s\",\n", escaped_path ? escaped_path : "");
-    fprintf(f, "  \"seek_step\": %d,\n", st->config.seek_step);
-    fprintf(f, "  \"remember_session\": %s,\n", st->config.remember_session ? "true" : "false");
-    fprintf(f, "  \"shuffle_mode\": %s,\n", st->shuffle_mode ? "true" : "false");
+static bool config_render(AppState *st, MemRender *m) {
+    if (!render_begin(m)) return false;
+    JsonWriter *w = &m->w;
+    json_printf(w, "{\n");
+    json_printf(w, "  \"download_path\": %q,\n", st->config.download_path);
+    json_printf(w, "  \"seek_step\": %d,\n", st->config.seek_step);
+    json_printf(w, "  \"remember_session\": %b,\n", st->config.remember_session);
+    json_printf(w, "  \"resume_playback\": %b,\n", st->config.resume_playback);
+    json_printf(w, "  \"stream_quality\": %q,\n", stream_quality_name(st->config.stream_quality));
+    json_printf(w, "  \"shuffle_mode\": %b,\n", st->shuffle_mode);
+    json_printf(w, "  \"weighted_shuffle\": %b,\n", st->config.weighted_shuffle);
+    json_printf(w, "  \"search_cache_ttl\": %d,\n", st->config.search_cache_ttl);
+    json_printf(w, "  \"search_cache_size\": %d,\n", st->config.search_cache_size);
+    json_printf(w, "  \"youtube_sync_hours\": %d,\n", st->config.youtube_sync_hours);
+    json_printf(w, "  \"youtube_sync_download\": %b,\n", st->config.youtube_sync_download);
+    json_printf(w, "  \"youtube_sync_last\": %lld,\n", (long long)st->config.youtube_sync_last);
 
     // Session state (only saved if remember_session is enabled)
     if (st->config.remember_session) {
-        fprintf(f, "  \"last_query\": \"%s\",\n", escaped_query ? escaped_query : "");
-        fprintf(f, "  \"last_playlist_idx\": %d,\n", st->last_playlist_idx);
-        fprintf(f, "  \"last_song_idx\": %d,\n", st->last_song_idx);
-        fprintf(f, "  \"was_playing_playlist\": %s,\n", st->was_playing_playlist ? "true" : "false");
+        json_printf(w, "  \"last_query\": %q,\n", st->last_query);
+        json_printf(w, "  \"last_playlist_idx\": %d,\n", st->last_playlist_idx);
+        json_printf(w, "  \"last_song_idx\": %d,\n", st->last_song_idx);
+        json_printf(w, "  \"last_position\": %d,\n", st->last_position);
+        json_printf(w, "  \"was_playing_playlist\": %b,\n", st->was_playing_playlist);
 
         // Save cached search results
-        fprintf(f, "  \"cached_search_count\": %d,\n", st->cached_search_count);
-        fprintf(f, "  \"cached_search\": [\n");
+        json_printf(w, "  \"cached_search_count\": %d,\n", st->cached_search_count);
+        json_printf(w, "  \"cached_search\": [\n");
         for (int i = 0; i < st->cached_search_count; i++) {
-            char *esc_title = json_escape_string(st->cached_search[i].title);
-            char *esc_vid = json_escape_string(st->cached_search[i].video_id);
-            char *esc_url = json_escape_string(st->cached_search[i].url);
-            fprintf(f, "    {\"title\": \"%s\", \"video_id\": \"%s\", \"url\": \"%s\", \"duration\": %d}%s\n",
-                    esc_title ? esc_title : "",
-                    esc_vid ? esc_vid : "",
-                    esc_url ? esc_url : "",
-                    st->cached_search[i].duration,
-                    (i < st->cached_search_count - 1) ? "," : "");
-            free(esc_title);
-            free(esc_vid);
-            free(esc_url);
-        }
-        fprintf(f, "  ]\n");
+            json_write_song(w, &st->cached_search[i], i == st->cached_search_count - 1);
+        }
+        json_printf(w, "  ]\n");
     } else {
-        fprintf(f, "  \"last_query\": \"\",\n");
-        fprintf(f, "  \"cached_search_count\": 0,\n");
-        fprintf(f, "  \"cached_search\": []\n");
+        json_printf(w, "  \"last_query\": \"\",\n");
+        json_printf(w, "  \"cached_search_count\": 0,\n");
+        json_printf(w, "  \"cached_search\": []\n");
     }
 
-    fprintf(f, "}\n");
-
-    free(escaped_path);
-    free(escaped_query);
-    fclose(f);
-}
-
-static int json_get_int(const char *json, const char *key, int default_val) {
-    char pattern[256];
-    snprintf(pattern, sizeof(pattern), "\"%s\"", key);
-
-    const char *p = strstr(json, pattern);
-    if (!p) return default_val;
-
-    p += strlen(pattern);
-    while (*p && (*p == ' ' || *p == ':' || *p == '\t')) p++;
-
-    if (!*p) return default_val;
-
-    // Check for true/false
-    if (strncmp(p, "true", 4) == 0) return 1;
-    if (strncmp(p, "false", 5) == 0) return 0;
-
-    return atoi(p);
+    json_printf(w, "}\n");
+    return render_end(m);
 }
 
-static bool json_get_bool(const char *json, const char *key, bool default_val) {
-    return json_get_int(json, key, default_val ? 1 : 0) != 0;
+// Written behind, like the playlists (see saves_commit)
+static void save_config(AppState *st) {
+    st->config_dirty = true;
+    saves_schedule(st);
 }
 
 static void load_config(AppState *st) {
@@ -869,6 +1675,7 @@ static void load_config(AppState *st) {
     st->cached_search_count = 0;
     st->last_playlist_idx = -1;
     st->last_song_idx = -1;
+    st->last_position = -1;
     st->was_playing_playlist = false;
 
     FILE *f = fopen(st->config_file, "r");
@@ -878,107 +1685,97 @@ static void load_config(AppState *st) {
         return;
     }
 
-    // Read entire file
-    fseek(f, 0, SEEK_END);
-    long fsize = ftell(f);
-    fseek(f, 0, SEEK_SET);
-
-    if (fsize <= 0 || fsize > 256 * 1024) {
-        fclose(f);
-        return;
-    }
+    arena_free(&st->cached_search_strings);
+    Song *cached = NULL;
+    int cached_count = 0;
 
-    char *content = malloc(fsize + 1);
-    if (!content) {
-        fclose(f);
-        return;
+    JsonReader r;
+    json_reader_init(&r, f);
+    if (json_next(&r) == JSON_OBJECT) {
+        while (json_next(&r) == JSON_KEY) {
+            if (json_text_is(&r, "download_path")) {
+                char path[sizeof(st->config.download_path)];
+                if (json_read_string(&r, path, sizeof(path)) && path[0]) {
+                    memcpy(st->config.download_path, path, sizeof(path));
+                }
+            } else if (json_text_is(&r, "seek_step")) {
+                st->config.seek_step = (int)json_read_int(&r, 10);
+            } else if (json_text_is(&r, "remember_session")) {
+                st->config.remember_session = json_read_bool(&r, false);
+            } else if (json_text_is(&r, "resume_playback")) {
+                st->config.resume_playback = json_read_bool(&r, false);
+            } else if (json_text_is(&r, "stream_quality")) {
+                st->config.stream_quality = stream_quality_from_name(json_read_str(&r, NULL));
+            } else if (json_text_is(&r, "shuffle_mode")) {
+                st->shuffle_mode = json_read_bool(&r, false);
+            } else if (json_text_is(&r, "weighted_shuffle")) {
+                st->config.weighted_shuffle = json_read_bool(&r, false);
+            } else if (json_text_is(&r, "search_cache_ttl")) {
+                st->config.search_cache_ttl = (int)json_read_int(&r, 24);
+            } else if (json_text_is(&r, "search_cache_size")) {
+                st->config.search_cache_size = (int)json_read_int(&r, 200);
+            } else if (json_text_is(&r, "youtube_sync_hours")) {
+                st->config.youtube_sync_hours = (int)json_read_int(&r, 0);
+            } else if (json_text_is(&r, "youtube_sync_download")) {
+                st->config.youtube_sync_download = json_read_bool(&r, false);
+            } else if (json_text_is(&r, "youtube_sync_last")) {
+                st->config.youtube_sync_last = (time_t)json_read_int(&r, 0);
+            } else if (json_text_is(&r, "last_query")) {
+                // Session state
+                json_read_string(&r, st->last_query, sizeof(st->last_query));
+            } else if (json_text_is(&r, "last_playlist_idx")) {
+                st->last_playlist_idx = (int)json_read_int(&r, -1);
+            } else if (json_text_is(&r, "last_song_idx")) {
+                st->last_song_idx = (int)json_read_int(&r, -1);
+            } else if (json_text_is(&r, "last_position")) {
+                st->last_position = (int)json_read_int(&r, -1);
+            } else if (json_text_is(&r, "was_playing_playlist")) {
+                st->was_playing_playlist = json_read_bool(&r, false);
+            } else if (json_text_is(&r, "cached_search") && !cached) {
+                cached_count = json_read_songs(&r, &cached, &st->cached_search_strings);
+            } else {
+                json_skip(&r);
+            }
+        }
     }
-
-    size_t read_size = fread(content, 1, fsize, f);
-    content[read_size] = '\0';
+    json_reader_free(&r);
     fclose(f);
 
-    // Parse download_path
-    char *download_path = json_get_string(content, "download_path");
-    if (download_path && download_path[0]) {
-        strncpy(st->config.download_path, download_path, sizeof(st->config.download_path) - 1);
-        st->config.download_path[sizeof(st->config.download_path) - 1] = '\0';
-    }
-    free(download_path);
-
-    // Parse new config options
-    st->config.seek_step = json_get_int(content, "seek_step", 10);
     if (st->config.seek_step < 1) st->config.seek_step = 10;
     if (st->config.seek_step > 300) st->config.seek_step = 300;
-
-    st->config.remember_session = json_get_bool(content, "remember_session", false);
-    st->shuffle_mode = json_get_bool(content, "shuffle_mode", false);
-
-    // Parse session state
-    char *last_query = json_get_string(content, "last_query");
-    if (last_query) {
-        strncpy(st->last_query, last_query, sizeof(st->last_query) - 1);
-        st->last_query[sizeof(st->last_query) - 1] = '\0';
-        free(last_query);
-    }
-
-    st->last_playlist_idx = json_get_int(content, "last_playlist_idx", -1);
-    st->last_song_idx = json_get_int(content, "last_song_idx", -1);
-    st->was_playing_playlist = json_get_bool(content, "was_playing_playlist", false);
-    st->cached_search_count = json_get_int(content, "cached_search_count", 0);
-    if (st->cached_search_count > MAX_RESULTS) st->cached_search_count = MAX_RESULTS;
-
-    // Parse cached search results
-    if (st->cached_search_count > 0) {
-        const char *arr = strstr(content, "\"cached_search\"");
-        if (arr) {
-            arr = strchr(arr, '[');
-            if (arr) {
-                arr++;
-                for (int i = 0; i < st->cached_search_count; i++) {
-                    const char *obj_start = strchr(arr, '{');
-                    if (!obj_start) break;
-                    const char *obj_end = strchr(obj_start, '}');
-                    if (!obj_end) break;
-
-                    size_t obj_len = obj_end - obj_start + 1;
-                    char *obj = malloc(obj_len + 1);
-                    if (!obj) break;
-                    memcpy(obj, obj_start, obj_len);
-                    obj[obj_len] = '\0';
-
-                    char *title = json_get_string(obj, "title");
-                    char *vid = json_get_string(obj, "video_id");
-                    char *url = json_get_string(obj, "url");
-                    int dur = json_get_int(obj, "duration", 0);
-
-                    st->cached_search[i].title = title;
-                    st->cached_search[i].video_id = vid;
-                    st->cached_search[i].url = url;
-                    st->cached_search[i].duration = dur;
-
-                    free(obj);
-                    arr = obj_end + 1;
-                }
-            }
-        }
-    }
-
-    free(content);
+    if (st->config.search_cache_ttl < 0) st->config.search_cache_ttl = 0;
+    if (st->config.search_cache_ttl > 720) st->config.search_cache_ttl = 720;
+    if (st->config.search_cache_size < 1) st->config.search_cache_size = 1;
+    if (st->config.search_cache_size > 10000) st->config.search_cache_size = 10000;
+    if (st->config.youtube_sync_hours < 0) st->config.youtube_sync_hours = 0;
+    if (st->config.youtube_sync_hours > 720) st->config.youtube_sync_hours = 720;
+
+    // Cached search results
+    st->cached_search_count = cached_count < MAX_RESULTS ? cached_count : MAX_RESULTS;
+    if (cached) memcpy(st->cached_search, cached, sizeof(Song) * st->cached_search_count);
+    free(cached);
 }
 
 // ============================================================================
 // NEW: Download Queue Persistence
 // ============================================================================
 
+// Make room for one more task. Must be called with the mutex locked.
+static bool download_queue_reserve(DownloadQueue *q) {
+    if (q->count < q->cap) return true;
+    int new_cap = q->cap ? q->cap * 2 : 64;
+    DownloadTask *tasks = realloc(q->tasks, sizeof(DownloadTask) * new_cap);
+    if (!tasks) return false;
+    q->tasks = tasks;
+    q->cap = new_cap;
+    return true;
+}
+
 // NOTE: Must be called with download_queue.mutex already locked
 static void save_download_queue(AppState *st) {
-    FILE *f = fopen(st->download_queue_file, "w");
-    if (!f) {
-        return;
-    }
-
-    fprintf(f, "{\n  \"tasks\": [\n");
+    MemRender m;
+    if (!render_begin(&m)) return;
+    json_printf(&m.w, "{\n  \"tasks\": [\n");
 
     bool first = true;
     for (int i = 0; i < st->download_queue.count; i++) {
@@ -989,118 +1786,85 @@ static void save_download_queue(AppState *st) {
             continue;
         }
 
-        char *escaped_title = json_escape_string(task->title);
-        char *escaped_filename = json_escape_string(task->sanitized_filename);
-        char *escaped_playlist = json_escape_string(task->playlist_name);
-
         const char *status_str = task->status == DOWNLOAD_FAILED ? "failed" : "pending";
 
-        if (!first) fprintf(f, ",\n");
+        if (!first) json_printf(&m.w, ",\n");
         first = false;
 
-        fprintf(f, "    {\"video_id\": \"%s\", \"title\": \"%s\", \"filename\": \"%s\", \"playlist\": \"%s\", \"status\": \"%s\"}",
-                task->video_id,
-                escaped_title ? escaped_title : "",
-                escaped_filename ? escaped_filename : "",
-                escaped_playlist ? escaped_playlist : "",
-                status_str);
-
-        free(escaped_title);
-        free(escaped_filename);
-        free(escaped_playlist);
+        json_printf(&m.w, "    {\"video_id\": %q, \"title\": %q, \"filename\": %q, \"playlist\": %q, \"status\": %q}",
+                    task->video_id, task->title, task->sanitized_filename, task->playlist_name,
+                    status_str);
     }
 
-    fprintf(f, "\n  ]\n}\n");
-    fclose(f);
+    json_printf(&m.w, "\n  ]\n}\n");
+    if (render_end(&m)) persist_write(st->download_queue_file, m.data, m.len, NULL);
 }
 
 static void load_download_queue(AppState *st) {
     FILE *f = fopen(st->download_queue_file, "r");
     if (!f) return;
     
-    fseek(f, 0, SEEK_END);
-    long fsize = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    
-    if (fsize <= 0 || fsize > 1024 * 1024) {
-        fclose(f);
-        return;
-    }
-    
-    char *content = malloc(fsize + 1);
-    if (!content) {
-        fclose(f);
-        return;
-    }
-    
-    size_t read_size = fread(content, 1, fsize, f);
-    content[read_size] = '\0';
-    fclose(f);
-    
-    const char *p = strstr(content, "\"tasks\"");
-    if (!p) {
-        free(content);
-        return;
-    }
-    
-    p = strchr(p, '[');
-    if (!p) {
-        free(content);
-        return;
-    }
+    JsonReader r;
+    json_reader_init(&r, f);
     
     pthread_mutex_lock(&st->download_queue.mutex);
     
-    while (st->download_queue.count < MAX_DOWNLOAD_QUEUE) {
-        const char *obj_start = strchr(p, '{');
-        if (!obj_start) break;
-        
-        const char *obj_end = strchr(obj_start, '}');
-        if (!obj_end) break;
-        
-        size_t obj_len = obj_end - obj_start + 1;
-        char *obj = malloc(obj_len + 1);
-        if (!obj) break;
-        
-        memcpy(obj, obj_start, obj_len);
-        obj[obj_len] = '\0';
-        
-        char *video_id = json_get_string(obj, "video_id");
-        char *title = json_get_string(obj, "title");
-        char *filename = json_get_string(obj, "filename");
-        char *playlist = json_get_string(obj, "playlist");
-        char *status_str = json_get_string(obj, "status");
-        
-        if (video_id && video_id[0]) {
-            DownloadTask *task = &st->download_queue.tasks[st->download_queue.count];
-            
-            strncpy(task->video_id, video_id, sizeof(task->video_id) - 1);
-            strncpy(task->title, title ? title : "", sizeof(task->title) - 1);
-            strncpy(task->sanitized_filename, filename ? filename : "", sizeof(task->sanitized_filename) - 1);
-            strncpy(task->playlist_name, playlist ? playlist : "", sizeof(task->playlist_name) - 1);
-            
-            if (status_str && strcmp(status_str, "failed") == 0) {
-                task->status = DOWNLOAD_FAILED;
-                st->download_queue.failed++;
-            } else {
-                task->status = DOWNLOAD_PENDING;
+    if (json_next(&r) == JSON_OBJECT) {
+        while (json_next(&r) == JSON_KEY) {
+            if (!json_text_is(&r, "tasks") || json_next(&r) != JSON_ARRAY) {
+                json_skip(&r);
+                continue;
             }
             
-            st->download_queue.count++;
+            JsonToken t;
+            while ((t = json_next(&r)) == JSON_OBJECT) {
+                if (!download_queue_reserve(&st->download_queue)) {
+                    json_leave(&r);
+                    continue;
+                }
+                DownloadTask *task = &st->download_queue.tasks[st->download_queue.count];
+                memset(task, 0, sizeof(*task));
+                bool failed = false;
+                
+                while (json_next(&r) == JSON_KEY) {
+                    if (json_text_is(&r, "video_id")) {
+                        json_read_string(&r, task->video_id, sizeof(task->video_id));
+                    } else if (json_text_is(&r, "title")) {
+                        json_read_string(&r, task->title, sizeof(task->title));
+                    } else if (json_text_is(&r, "filename")) {
+                        json_read_string(&r, task->sanitized_filename, sizeof(task->sanitized_filename));
+                    } else if (json_text_is(&r, "playlist")) {
+                        json_read_string(&r, task->playlist_name, sizeof(task->playlist_name));
+                    } else if (json_text_is(&r, "status")) {
+                        const char *status_str = json_read_str(&r, NULL);
+                        failed = status_str && strcmp(status_str, "failed") == 0;
+                    } else {
+                        json_skip(&r);
+                    }
+                }
+                if (!task->video_id[0]) continue;
+                
+                if (failed) {
+                    task->status = DOWNLOAD_FAILED;
+                    st->download_queue.failed++;
+                } else {
+                    task->status = DOWNLOAD_PENDING;
+                }
+                
+                // A pending task stays the one found for its video
+                int known = strmap_get(&st->download_queue.ids, task->video_id);
+                if (known < 0 || st->download_queue.tasks[known].status != DOWNLOAD_PENDING) {
+                    strmap_put(&st->download_queue.ids, task->video_id, st->download_queue.count);
+                }
+                st->download_queue.count++;
+            }
+            if (t != JSON_ARRAY_END) json_leave(&r);
         }
-        
-        free(video_id);
-        free(title);
-        free(filename);
-        free(playlist);
-        free(status_str);
-        free(obj);
-        
-        p = obj_end + 1;
     }
     
     pthread_mutex_unlock(&st->download_queue.mutex);
-    free(content);
+    json_reader_free(&r);
+    fclose(f);
 }
 
 // ============================================================================
@@ -1113,17 +1877,29 @@ static void *download_thread_func(void *arg) {
     while (!st->download_queue.should_stop) {
         pthread_mutex_lock(&st->download_queue.mutex);
         
-        // Find next pending task
+        // Find next pending task, preferring the tracks that play next
         int task_idx = -1;
-        for (int i = 0; i < st->download_queue.count; i++) {
+        for (int p = 0; p < DOWNLOAD_PRIORITY_COUNT && task_idx < 0; p++) {
+            const char *vid = st->download_queue.priority_ids[p];
+            if (!vid[0]) continue;
+            for (int i = 0; i < st->download_queue.count; i++) {
+                if (st->download_queue.tasks[i].status == DOWNLOAD_PENDING &&
+                    strcmp(st->download_queue.tasks[i].video_id, vid) == 0) {
+                    task_idx = i;
+                    break;
+                }
+            }
+        }
+        for (int i = 0; task_idx < 0 && i < st->download_queue.count; i++) {
             if (st->download_queue.tasks[i].status == DOWNLOAD_PENDING) {
                 task_idx = i;
-                st->download_queue.tasks[i].status = DOWNLOAD_ACTIVE;
-                st->download_queue.current_idx = i;
-                st->download_queue.active = true;
-                break;
             }
         }
+        if (task_idx >= 0) {
+            st->download_queue.tasks[task_idx].status = DOWNLOAD_ACTIVE;
+            st->download_queue.current_idx = task_idx;
+            st->download_queue.active = true;
+        }
         
         if (task_idx < 0) {
             // No pending tasks
@@ -1173,8 +1949,15 @@ static void *download_thread_func(void *arg) {
                  "-o '%s' 'https://www.youtube.com/watch?v=%s' >/dev/null 2>&1",
                  get_ytdlp_cmd(st), dest_path, task.video_id);
         
-        // Execute download
-        int result = system(cmd);
+        // Execute download, in the helper when it's up
+        char url[128];
+        snprintf(url, sizeof(url), "https://www.youtube.com/watch?v=%s", task.video_id);
+        char *argv[] = {
+            "-x", "--audio-format", "mp3", "--no-playlist", "--quiet", "--no-warnings",
+            "-o", dest_path, url, NULL
+        };
+        int result = ytdlp_helper_run(argv);
+        if (result < 0) result = system(cmd);
         
         pthread_mutex_lock(&st->download_queue.mutex);
         
@@ -1236,16 +2019,13 @@ static int add_to_download_queue(AppState *st, const char *video_id, const char
     pthread_mutex_lock(&st->download_queue.mutex);
     
     // Check if already in queue
-    for (int i = 0; i < st->download_queue.count; i++) {
-        if (strcmp(st->download_queue.tasks[i].video_id, video_id) == 0 &&
-            st->download_queue.tasks[i].status == DOWNLOAD_PENDING) {
-            pthread_mutex_unlock(&st->download_queue.mutex);
-            return 0;  // Already queued
-        }
+    int queued = strmap_get(&st->download_queue.ids, video_id);
+    if (queued >= 0 && st->download_queue.tasks[queued].status == DOWNLOAD_PENDING) {
+        pthread_mutex_unlock(&st->download_queue.mutex);
+        return 0;  // Already queued
     }
     
-    // Check queue capacity
-    if (st->download_queue.count >= MAX_DOWNLOAD_QUEUE) {
+    if (!download_queue_reserve(&st->download_queue)) {
         pthread_mutex_unlock(&st->download_queue.mutex);
         return -1;
     }
@@ -1270,6 +2050,7 @@ static int add_to_download_queue(AppState *st, const char *video_id, const char
     }
     
     task->status = DOWNLOAD_PENDING;
+    strmap_put(&st->download_queue.ids, task->video_id, st->download_queue.count);
     st->download_queue.count++;
     
     save_download_queue(st);
@@ -1295,35 +2076,290 @@ static int get_pending_download_count(AppState *st) {
     return count;
 }
 
+// ============================================================================
+// Song Table
+// ============================================================================
+
+static SongEntry *song_entry(const SongTable *t, int ref) {
+    return &t->chunks[ref / SONG_CHUNK_SIZE][ref % SONG_CHUNK_SIZE];
+}
+
+static Song *song_at(const SongTable *t, int ref) {
+    return &song_entry(t, ref)->song;
+}
+
+// Ref of the song with video_id, -1 if the table doesn't have it
+static int song_find(const SongTable *t, const char *video_id) {
+    if (t->slot_cap == 0 || !video_id) return -1;
+    uint32_t mask = (uint32_t)t->slot_cap - 1;
+    for (uint32_t i = str_hash(video_id) & mask; t->slots[i] >= 0; i = (i + 1) & mask) {
+        if (strcmp(song_at(t, t->slots[i])->video_id, video_id) == 0) return t->slots[i];
+    }
+    return -1;
+}
+
+// Double the index, or make it big enough for n songs
+static bool song_index_grow(SongTable *t, int n) {
+    int new_cap = t->slot_cap ? t->slot_cap * 2 : 1024;
+    while (n * 4 > new_cap * 3) new_cap *= 2;
+    int *slots = malloc(sizeof(int) * new_cap);
+    if (!slots) return false;
+    memset(slots, 0xff, sizeof(int) * new_cap);
+
+    uint32_t mask = (uint32_t)new_cap - 1;
+    for (int ref = 0; ref < t->count; ref++) {
+        uint32_t j = str_hash(song_at(t, ref)->video_id) & mask;
+        while (slots[j] >= 0) j = (j + 1) & mask;
+        slots[j] = ref;
+    }
+
+    free(t->slots);
+    t->slots = slots;
+    t->slot_cap = new_cap;
+    return true;
+}
+
+// Ref of song in the table, adding it if it's new. A song already there
+// only takes the metadata it is missing. Returns -1 on failure.
+static int song_intern(SongTable *t, const Song *song) {
+    if (!song->video_id[0]) return -1;
+    int ref = song_find(t, song->video_id);
+    if (ref >= 0) {
+        Song *known = song_at(t, ref);
+        if (known->duration <= 0) known->duration = song->duration;
+        return ref;
+    }
+
+    if ((t->count + 1) * 4 > t->slot_cap * 3 && !song_index_grow(t, t->count + 1)) return -1;
+    if (t->count % SONG_CHUNK_SIZE == 0) {
+        int chunk = t->count / SONG_CHUNK_SIZE;
+        SongEntry **chunks = realloc(t->chunks, sizeof(SongEntry *) * (chunk + 1));
+        if (!chunks) return -1;
+        t->chunks = chunks;
+        t->chunks[chunk] = malloc(sizeof(SongEntry) * SONG_CHUNK_SIZE);
+        if (!t->chunks[chunk]) return -1;
+    }
+
+    SongEntry *e = song_entry(t, t->count);
+    e->song = *song;
+    e->song.title = arena_strdup(&t->strings, song->title ? song->title : "Unknown");
+    if (!e->song.title) return -1;
+    e->lists = 0;
+
+    uint32_t mask = (uint32_t)t->slot_cap - 1;
+    uint32_t i = str_hash(song->video_id) & mask;
+    while (t->slots[i] >= 0) i = (i + 1) & mask;
+    t->slots[i] = t->count;
+    return t->count++;
+}
+
+// Take a song's current metadata from YouTube, for every playlist holding
+// it. Returns true if anything changed.
+static bool song_update(SongTable *t, int ref, const Song *fresh) {
+    Song *song = song_at(t, ref);
+    bool changed = false;
+    if (fresh->duration > 0 && fresh->duration != song->duration) {
+        song->duration = fresh->duration;
+        changed = true;
+    }
+    // Videos made private or deleted are listed under a placeholder title
+    bool placeholder = fresh->title && (strcmp(fresh->title, "[Private video]") == 0 ||
+                                        strcmp(fresh->title, "[Deleted video]") == 0);
+    if (fresh->title && fresh->title[0] && !placeholder && strcmp(song->title, fresh->title) != 0) {
+        // The old title stays in the arena; the table only grows
+        char *title = arena_strdup(&t->strings, fresh->title);
+        if (title) {
+            song->title = title;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Make room in the index for n songs in all, so interning them doesn't
+// rehash on the way
+static bool song_table_reserve(SongTable *t, int n) {
+    return n * 4 <= t->slot_cap * 3 || song_index_grow(t, n);
+}
+
+static void song_table_free(SongTable *t) {
+    for (int c = 0; c * SONG_CHUNK_SIZE < t->count; c++) free(t->chunks[c]);
+    free(t->chunks);
+    free(t->slots);
+    arena_free(&t->strings);
+    memset(t, 0, sizeof(*t));
+}
+
 // ============================================================================
 // Playlist Persistence
 // ============================================================================
 
-static void free_playlist_items(Playlist *pl) {
-    for (int i = 0; i < pl->count; i++) {
-        free(pl->items[i].title);
-        free(pl->items[i].video_id);
-        free(pl->items[i].url);
-        pl->items[i].title = NULL;
-        pl->items[i].video_id = NULL;
-        pl->items[i].url = NULL;
+// Make room for n songs, growing the array geometrically
+static bool playlist_reserve(Playlist *pl, int n) {
+    if (n <= pl->cap) return true;
+    int new_cap = pl->cap ? pl->cap : 16;
+    while (new_cap < n) new_cap *= 2;
+    int *items = realloc(pl->items, sizeof(int) * new_cap);
+    if (!items) return false;
+    pl->items = items;
+    pl->cap = new_cap;
+    return true;
+}
+
+static Song *playlist_song(AppState *st, const Playlist *pl, int i) {
+    return song_at(&st->songs, pl->items[i]);
+}
+
+// True if the playlist holds the song with video_id
+static bool playlist_has_song(AppState *st, const Playlist *pl, const char *video_id) {
+    return intmap_get(&pl->members, song_find(&st->songs, video_id)) > 0;
+}
+
+// Count one more copy of song ref in the playlist's members
+static void playlist_hold(AppState *st, Playlist *pl, int ref) {
+    int n = intmap_get(&pl->members, ref);
+    if (n <= 0) {
+        if (!intmap_put(&pl->members, ref, 1)) return;
+        song_entry(&st->songs, ref)->lists++;
+    } else {
+        intmap_put(&pl->members, ref, n + 1);
+    }
+}
+
+static void playlist_release(AppState *st, Playlist *pl, int ref) {
+    int n = intmap_get(&pl->members, ref);
+    if (n > 1) {
+        intmap_put(&pl->members, ref, n - 1);
+    } else if (n == 1) {
+        intmap_remove(&pl->members, ref);
+        song_entry(&st->songs, ref)->lists--;
+    }
+}
+
+// Drop every membership of the playlist; its items are kept
+static void playlist_release_all(AppState *st, Playlist *pl) {
+    for (int i = 0; i < pl->members.cap; i++) {
+        if (pl->members.keys[i] >= 0) song_entry(&st->songs, pl->members.keys[i])->lists--;
+    }
+    intmap_free(&pl->members);
+}
+
+// Append song, interning it in the song table
+static bool playlist_append_song(AppState *st, Playlist *pl, const Song *song) {
+    if (!playlist_reserve(pl, pl->count + 1)) return false;
+    int ref = song_intern(&st->songs, song);
+    if (ref < 0) return false;
+    pl->items[pl->count++] = ref;
+    playlist_hold(st, pl, ref);
+    return true;
+}
+
+// Drop the song at i; it stays in the song table
+static void playlist_remove_at(AppState *st, Playlist *pl, int i) {
+    playlist_release(st, pl, pl->items[i]);
+    memmove(&pl->items[i], &pl->items[i + 1], sizeof(int) * (pl->count - i - 1));
+    pl->count--;
+}
+
+// Position of the song at i once the song at from has moved to to
+static int moved_index(int i, int from, int to) {
+    if (i == from) return to;
+    if (from < to && i > from && i <= to) return i - 1;
+    if (to < from && i >= to && i < from) return i + 1;
+    return i;
+}
+
+static void playlist_move_item(Playlist *pl, int from, int to) {
+    int ref = pl->items[from];
+    if (from < to) {
+        memmove(&pl->items[from], &pl->items[from + 1], sizeof(int) * (to - from));
+    } else {
+        memmove(&pl->items[to + 1], &pl->items[to], sizeof(int) * (from - to));
     }
+    pl->items[to] = ref;
+}
+
+// Unload the songs. They stay in the song table, shared with other playlists.
+static void free_playlist_items(AppState *st, Playlist *pl) {
+    playlist_release_all(st, pl);
+    free(pl->items);
+    pl->items = NULL;
     pl->count = 0;
+    pl->cap = 0;
 }
 
-static void free_playlist(Playlist *pl) {
+static void shuffle_free(ShuffleOrder *so);
+
+static void free_playlist(AppState *st, Playlist *pl) {
     free(pl->name);
     free(pl->filename);
+    free(pl->source_url);
     pl->name = NULL;
     pl->filename = NULL;
-    free_playlist_items(pl);
+    pl->source_url = NULL;
+    free_playlist_items(st, pl);
+    shuffle_free(&pl->shuffle);
 }
 
 static void free_all_playlists(AppState *st) {
     for (int i = 0; i < st->playlist_count; i++) {
-        free_playlist(&st->playlists[i]);
+        free_playlist(st, &st->playlists[i]);
     }
+    free(st->playlists);
+    st->playlists = NULL;
     st->playlist_count = 0;
+    st->playlist_cap = 0;
+    strmap_free(&st->playlist_names);
+    strmap_free(&st->playlist_files);
+    st->songs_complete = false;
+}
+
+// Key of a playlist name in playlist_names: names are unique ignoring case
+static char *playlist_name_key(const char *name) {
+    char *key = strdup(name);
+    if (!key) return NULL;
+    for (char *c = key; *c; c++) *c = tolower((unsigned char)*c);
+    return key;
+}
+
+// Index of the playlist called name (ignoring case), -1 if there is none
+static int find_playlist(AppState *st, const char *name) {
+    char *key = playlist_name_key(name);
+    int idx = strmap_get(&st->playlist_names, key);
+    free(key);
+    return idx;
+}
+
+// Point the name and filename indexes at playlist idx
+static bool playlist_index_put(AppState *st, int idx) {
+    Playlist *pl = &st->playlists[idx];
+    char *key = playlist_name_key(pl->name);
+    bool ok = key && strmap_put(&st->playlist_names, key, idx) &&
+              strmap_put(&st->playlist_files, pl->filename, idx);
+    free(key);
+    return ok;
+}
+
+static void playlist_index_remove(AppState *st, int idx) {
+    Playlist *pl = &st->playlists[idx];
+    char *key = playlist_name_key(pl->name);
+    strmap_remove(&st->playlist_names, key);
+    strmap_remove(&st->playlist_files, pl->filename);
+    free(key);
+}
+
+// Append an empty slot to the playlists array, -1 if out of memory
+static int playlist_append(AppState *st) {
+    if (st->playlist_count == st->playlist_cap) {
+        int new_cap = st->playlist_cap ? st->playlist_cap * 2 : 16;
+        Playlist *grown = realloc(st->playlists, sizeof(Playlist) * new_cap);
+        if (!grown) return -1;
+        st->playlists = grown;
+        st->playlist_cap = new_cap;
+    }
+    int idx = st->playlist_count;
+    memset(&st->playlists[idx], 0, sizeof(Playlist));
+    return idx;
 }
 
 static char *sanitize_filename(const char *name) {
@@ -1346,262 +2382,454 @@ static char *sanitize_filename(const char *name) {
     return out;
 }
 
-static void save_playlists_index(AppState *st) {
-    FILE *f = fopen(st->playlists_index, "w");
-    if (!f) return;
-    
-    fprintf(f, "{\n  \"playlists\": [\n");
+// File name for a playlist called name that no other playlist uses. self is
+// the playlist being renamed, which may keep its own file name (-1 if none).
+static char *unique_playlist_filename(AppState *st, const char *name, int self) {
+    char *base = sanitize_filename(name);
+    if (!base) return NULL;
+    int owner = strmap_get(&st->playlist_files, base);
+    if (owner < 0 || owner == self) return base;
+
+    // Add number prefix
+    size_t size = strlen(base) + 16;
+    char *filename = malloc(size);
+    for (int n = st->playlist_count; filename; n++) {
+        snprintf(filename, size, "%d_%s", n, base);
+        owner = strmap_get(&st->playlist_files, filename);
+        if (owner < 0 || owner == self) break;
+    }
+    free(base);
+    return filename;
+}
+
+// ============================================================================
+// Playlist Journal
+// ============================================================================
+
+// A playlist file is a snapshot. Edits made since are appended to a journal
+// next to it (<file>.log), one JSON object per line, and replayed when the
+// playlist loads. The first line names the snapshot the records follow:
+//
+//   {"base": 3}
+//   {"add": {"title": "...", "video_id": "...", "duration": 212}}
+//   {"remove": {"at": 4, "video_id": "..."}}
+//   {"move": {"from": 7, "to": 2}}
+//   {"rename": "New name"}
+//
+// Once the journal reaches a quarter of the playlist it is compacted: the
+// playlist is saved, and the writer thread drops the journal once the new
+// snapshot is in place. Records and snapshots reach the disk in the order
+// they were made, so wherever the app stops the files replay to the same
+// list: a journal based on an older snapshot than the file is already in
+// it and is discarded.
+
+static void playlist_journal_path(AppState *st, const char *filename, char *out, size_t out_size) {
+    snprintf(out, out_size, "%s/%s%s", st->playlists_dir, filename, JOURNAL_SUFFIX);
+}
+
+// The playlist file as generation of its snapshots, into a new buffer
+static bool playlist_render(AppState *st, Playlist *pl, int generation, char **data, size_t *len) {
+    MemRender m;
+    if (!render_begin(&m)) return false;
+
+    json_printf(&m.w, "{\n  \"name\": %q,\n  \"type\": %q,\n  \"generation\": %d,\n",
+                pl->name, pl->is_youtube_playlist ? "youtube" : "local", generation);
+    if (pl->source_url) json_printf(&m.w, "  \"source_url\": %q,\n", pl->source_url);
+    json_printf(&m.w, "  \"songs\": [\n");
+    for (int i = 0; i < pl->count; i++) {
+        json_write_song(&m.w, playlist_song(st, pl, i), i == pl->count - 1);
+    }
+    json_printf(&m.w, "  ]\n}\n");
+
+    if (!render_end(&m)) return false;
+    *data = m.data;
+    *len = m.len;
+    return true;
+}
+
+// Start a record for the playlist's journal. False if there's nothing to
+// record: the playlist has a snapshot due, which will hold the edit.
+static bool playlist_journal_begin(AppState *st, int idx, MemRender *m) {
+    if (st->playlists[idx].dirty) return false;
+    if (!render_begin(m)) {
+        save_playlist(st, idx);
+        return false;
+    }
+    return true;
+}
+
+// Queue the record. A new journal starts with the snapshot it's based on.
+// If the record can't be made the playlist is saved whole, so the edit
+// reaches the disk either way.
+static void playlist_journal_end(AppState *st, int idx, MemRender *m) {
+    if (!render_end(m)) {
+        save_playlist(st, idx);
+        return;
+    }
+
+    Playlist *pl = &st->playlists[idx];
+    char path[16384 + 256];
+    char header[32];
+    playlist_journal_path(st, pl->filename, path, sizeof(path));
+    snprintf(header, sizeof(header), "{\"base\": %d}\n", pl->generation);
+    persist_append(path, header, m->data, m->len);
+
+    // Compacting at a quarter of the list keeps the bytes written per
+    // edit constant, however long the playlist grows
+    pl->journal_records++;
+    if (pl->journal_records >= JOURNAL_COMPACT_MIN && pl->journal_records * 4 >= pl->count) {
+        save_playlist(st, idx);
+    }
+}
+
+static void playlist_journal_add(AppState *st, int idx, const Song *song) {
+    MemRender m;
+    if (!playlist_journal_begin(st, idx, &m)) return;
+    json_printf(&m.w, "{\"add\": {\"title\": %q, \"video_id\": %q, \"duration\": %d}}\n",
+                song->title, song->video_id, song->duration);
+    playlist_journal_end(st, idx, &m);
+}
+
+static void playlist_journal_remove(AppState *st, int idx, int at, const char *video_id) {
+    MemRender m;
+    if (!playlist_journal_begin(st, idx, &m)) return;
+    json_printf(&m.w, "{\"remove\": {\"at\": %d, \"video_id\": %q}}\n", at, video_id);
+    playlist_journal_end(st, idx, &m);
+}
+
+static void playlist_journal_move(AppState *st, int idx, int from, int to) {
+    MemRender m;
+    if (!playlist_journal_begin(st, idx, &m)) return;
+    json_printf(&m.w, "{\"move\": {\"from\": %d, \"to\": %d}}\n", from, to);
+    playlist_journal_end(st, idx, &m);
+}
+
+static void playlist_journal_rename(AppState *st, int idx) {
+    MemRender m;
+    if (!playlist_journal_begin(st, idx, &m)) return;
+    json_printf(&m.w, "{\"rename\": %q}\n", st->playlists[idx].name);
+    playlist_journal_end(st, idx, &m);
+}
+
+// Apply a journal's records to the playlist being loaded. Returns the
+// number applied, -1 if there's no journal to replay: a journal based on
+// an older snapshot than the file is already in it, and sets *stale.
+// Replay stops at a torn last record or one that doesn't fit the list,
+// and clears *complete. Nothing is written: repairs are up to the caller.
+static int playlist_journal_replay(AppState *st, Playlist *pl, const char *path, Arena *scratch,
+                                   bool *stale, bool *complete) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+
+    JsonReader r;
+    json_reader_init(&r, f);
+    int base = -1;
+    if (json_next(&r) == JSON_OBJECT) {
+        while (json_next(&r) == JSON_KEY) {
+            if (json_text_is(&r, "base")) {
+                base = (int)json_read_int(&r, -1);
+            } else {
+                json_skip(&r);
+            }
+        }
+    }
+    if (r.failed || base < pl->generation) {
+        json_reader_free(&r);
+        fclose(f);
+        *stale = true;
+        return -1;
+    }
+
+    int applied = 0;
+    JsonToken t;
+    while ((t = json_next(&r)) == JSON_OBJECT && json_next(&r) == JSON_KEY) {
+        enum { OP_NONE, OP_ADD, OP_REMOVE, OP_MOVE } op = OP_NONE;
+        Song song;
+        int at = -1;
+        int to = -1;
+        char video_id[64] = "";
+
+        if (json_text_is(&r, "add")) {
+            if (json_next(&r) == JSON_OBJECT && json_read_song(&r, &song, scratch)) op = OP_ADD;
+        } else if (json_text_is(&r, "remove") || json_text_is(&r, "move")) {
+            bool remove = json_text_is(&r, "remove");
+            if (json_next(&r) == JSON_OBJECT) {
+                while (json_next(&r) == JSON_KEY) {
+                    if (json_text_is(&r, "at") || json_text_is(&r, "from")) {
+                        at = (int)json_read_int(&r, -1);
+                    } else if (json_text_is(&r, "to")) {
+                        to = (int)json_read_int(&r, -1);
+                    } else if (json_text_is(&r, "video_id")) {
+                        json_read_string(&r, video_id, sizeof(video_id));
+                    } else {
+                        json_skip(&r);
+                    }
+                }
+                op = remove ? OP_REMOVE : OP_MOVE;
+            }
+        } else {
+            // A rename: the index has the name the playlist is listed
+            // under, and the next snapshot takes it from there
+            json_skip(&r);
+        }
+        if (r.failed || json_next(&r) != JSON_OBJECT_END) break;
+
+        bool fits = true;
+        if (op == OP_ADD) {
+            fits = playlist_append_song(st, pl, &song);
+        } else if (op == OP_REMOVE) {
+            fits = at >= 0 && at < pl->count && strcmp(playlist_song(st, pl, at)->video_id, video_id) == 0;
+            if (fits) playlist_remove_at(st, pl, at);
+        } else if (op == OP_MOVE) {
+            fits = at >= 0 && at < pl->count && to >= 0 && to < pl->count;
+            if (fits) playlist_move_item(pl, at, to);
+        }
+        if (!fits) break;
+        applied++;
+    }
+
+    if (t != JSON_END) {
+        sb_log("[PLAYBACK] playlist journal: %s stops after %d records", path, applied);
+        *complete = false;
+    }
+    json_reader_free(&r);
+    fclose(f);
+    return applied;
+}
+
+static bool playlists_index_render(AppState *st, MemRender *m) {
+    if (!render_begin(m)) return false;
+    json_printf(&m->w, "{\n  \"playlists\": [\n");
     
     for (int i = 0; i < st->playlist_count; i++) {
-        char *escaped_name = json_escape_string(st->playlists[i].name);
-        char *escaped_file = json_escape_string(st->playlists[i].filename);
-        
-        fprintf(f, "    {\"name\": \"%s\", \"filename\": \"%s\"}%s\n",
-                escaped_name ? escaped_name : "",
-                escaped_file ? escaped_file : "",
-                (i < st->playlist_count - 1) ? "," : "");
-        
-        free(escaped_name);
-        free(escaped_file);
+        Playlist *pl = &st->playlists[i];
+        json_printf(&m->w, "    {\"name\": %q, \"filename\": %q", pl->name, pl->filename);
+        // The header lets a sync pick YouTube playlists without opening every file
+        if (pl->header_known) {
+            json_printf(&m->w, ", \"type\": %q", pl->is_youtube_playlist ? "youtube" : "local");
+            if (pl->source_url) json_printf(&m->w, ", \"source_url\": %q", pl->source_url);
+        }
+        json_printf(&m->w, "}%s\n", (i < st->playlist_count - 1) ? "," : "");
     }
     
-    fprintf(f, "  ]\n}\n");
-    fclose(f);
+    json_printf(&m->w, "  ]\n}\n");
+    return render_end(m);
+}
+
+static void save_playlists_index(AppState *st) {
+    st->index_dirty = true;
+    saves_schedule(st);
 }
 
+// The snapshot is rendered and written when the pending saves go out:
+// any number of saves until then cost one
 static void save_playlist(AppState *st, int idx) {
     if (idx < 0 || idx >= st->playlist_count) return;
+    st->playlists[idx].dirty = true;
+    saves_schedule(st);
+}
+
+// Render the playlist's next snapshot and queue it. The journal goes once
+// the snapshot is in place: no journal follows a snapshot with every edit.
+static void playlist_commit(AppState *st, int idx) {
+    Playlist *pl = &st->playlists[idx];
+    char *data;
+    size_t len;
+    if (!playlist_render(st, pl, pl->generation + 1, &data, &len)) return;
     
+    char path[16384 + 256];
+    char journal[sizeof(path)];
+    snprintf(path, sizeof(path), "%s/%s", st->playlists_dir, pl->filename);
+    playlist_journal_path(st, pl->filename, journal, sizeof(journal));
+    persist_write(path, data, len, journal);
+    pl->generation++;
+    pl->journal_records = 0;
+    pl->dirty = false;
+}
+
+// Read the playlist's file and journal into it, touching no file. A stale
+// journal sets *stale, one that replay gave up on clears *complete.
+static void playlist_read(AppState *st, int idx, bool *stale, bool *complete) {
     Playlist *pl = &st->playlists[idx];
+    *stale = false;
+    *complete = true;
+    free_playlist_items(st, pl);
     
-    char path[4096]; // Increased buffer size
+    char path[16384 + 256];
     snprintf(path, sizeof(path), "%s/%s", st->playlists_dir, pl->filename);
     
-    FILE *f = fopen(path, "w");
+    FILE *f = fopen(path, "r");
     if (!f) return;
     
-    fprintf(f, "{\n  \"name\": \"%s\",\n  \"type\": \"%s\",\n  \"songs\": [\n",
-            pl->name, pl->is_youtube_playlist ? "youtube" : "local");
-    
-    for (int i = 0; i < pl->count; i++) {
-        char *escaped_title = json_escape_string(pl->items[i].title);
-        char *escaped_id = json_escape_string(pl->items[i].video_id);
-
-        fprintf(f, "    {\"title\": \"%s\", \"video_id\": \"%s\", \"duration\": %d}%s\n",
-                escaped_title ? escaped_title : "",
-                escaped_id ? escaped_id : "",
-                pl->items[i].duration,
-                (i < pl->count - 1) ? "," : "");
-
-        free(escaped_title);
-        free(escaped_id);
+    // One pass over the file: each song goes into the table as it's read,
+    // its title through a scratch arena until the table has it
+    Arena scratch = {0};
+    JsonReader r;
+    json_reader_init(&r, f);
+    if (json_next(&r) == JSON_OBJECT) {
+        pl->header_known = true;
+        pl->is_youtube_playlist = false;
+        pl->generation = 0;
+        free(pl->source_url);
+        pl->source_url = NULL;
+        while (json_next(&r) == JSON_KEY) {
+            if (json_text_is(&r, "generation")) {
+                pl->generation = (int)json_read_int(&r, 0);
+            } else if (json_text_is(&r, "type")) {
+                const char *type = json_read_str(&r, NULL);
+                pl->is_youtube_playlist = type && strcmp(type, "youtube") == 0;
+            } else if (json_text_is(&r, "source_url") && !pl->source_url) {
+                pl->source_url = json_read_strdup(&r);
+            } else if (json_text_is(&r, "songs") && json_next(&r) == JSON_ARRAY) {
+                JsonToken t;
+                while ((t = json_next(&r)) == JSON_OBJECT) {
+                    Song song;
+                    if (json_read_song(&r, &song, &scratch)) playlist_append_song(st, pl, &song);
+                }
+                if (t != JSON_ARRAY_END) json_leave(&r);
+            } else {
+                json_skip(&r);
+            }
+        }
     }
-    
-    fprintf(f, "  ]\n}\n");
+    json_reader_free(&r);
     fclose(f);
+    
+    // Then the edits made since
+    char journal[sizeof(path)];
+    playlist_journal_path(st, pl->filename, journal, sizeof(journal));
+    int n = playlist_journal_replay(st, pl, journal, &scratch, stale, complete);
+    pl->journal_records = n > 0 ? n : 0;
+    arena_free(&scratch);
 }
 
 static void load_playlist_songs(AppState *st, int idx) {
     if (idx < 0 || idx >= st->playlist_count) return;
     
     Playlist *pl = &st->playlists[idx];
-    free_playlist_items(pl);
-    
-    char path[16384]; // Significantly increased buffer size
-    snprintf(path, sizeof(path), "%s/%s", st->playlists_dir, pl->filename);
+    // The files are read back: what's pending for them lands first
+    if (pl->dirty) playlist_commit(st, idx);
+    persist_flush();
+    
+    bool stale, complete;
+    playlist_read(st, idx, &stale, &complete);
+    if (stale) {
+        char journal[16384 + 256];
+        playlist_journal_path(st, pl->filename, journal, sizeof(journal));
+        persist_unlink(journal);
+    }
+    // Cut off a journal that replay gave up on: with a snapshot due no
+    // records land after it, and the snapshot drops it
+    if (!complete) save_playlist(st, idx);
+}
+
+// Read the index into an empty list of playlists, touching no file
+static void playlists_index_read(AppState *st) {
+    free_all_playlists(st);
     
-    FILE *f = fopen(path, "r");
+    FILE *f = fopen(st->playlists_index, "r");
     if (!f) return;
     
-    // Read entire file
-    fseek(f, 0, SEEK_END);
-    long fsize = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    
-    if (fsize <= 0 || fsize > 1024 * 1024) {
-        fclose(f);
-        return;
-    }
+    JsonReader r;
+    json_reader_init(&r, f);
     
-    char *content = malloc(fsize + 1);
-    if (!content) {
-        fclose(f);
-        return;
+    // Only the index is read: songs load when a playlist is opened
+    if (json_next(&r) == JSON_OBJECT) {
+        while (json_next(&r) == JSON_KEY) {
+            if (!json_text_is(&r, "playlists") || json_next(&r) != JSON_ARRAY) {
+                json_skip(&r);
+                continue;
+            }
+            
+            JsonToken t;
+            while ((t = json_next(&r)) == JSON_OBJECT) {
+                char *name = NULL;
+                char *filename = NULL;
+                char *type = NULL;
+                char *source_url = NULL;
+                while (json_next(&r) == JSON_KEY) {
+                    char **field = json_text_is(&r, "name") ? &name
+                                 : json_text_is(&r, "filename") ? &filename
+                                 : json_text_is(&r, "type") ? &type
+                                 : json_text_is(&r, "source_url") ? &source_url
+                                 : NULL;
+                    if (field && !*field) {
+                        *field = json_read_strdup(&r);
+                    } else {
+                        json_skip(&r);
+                    }
+                }
+                
+                int idx = -1;
+                if (name && filename && name[0] && filename[0] &&
+                    find_playlist(st, name) < 0 && strmap_get(&st->playlist_files, filename) < 0) {
+                    idx = playlist_append(st);
+                }
+                if (idx >= 0) {
+                    Playlist *pl = &st->playlists[idx];
+                    pl->name = name;
+                    pl->filename = filename;
+                    // Indexes written before the header was stored lack the type
+                    if (type) {
+                        pl->header_known = true;
+                        pl->is_youtube_playlist = strcmp(type, "youtube") == 0;
+                        pl->source_url = source_url;
+                        source_url = NULL;
+                    }
+                    if (playlist_index_put(st, idx)) {
+                        st->playlist_count++;
+                    } else {
+                        playlist_index_remove(st, idx);
+                        free_playlist(st, pl);
+                    }
+                } else {
+                    free(name);
+                    free(filename);
+                }
+                free(type);
+                free(source_url);
+            }
+            if (t != JSON_ARRAY_END) json_leave(&r);
+        }
     }
     
-    size_t read_size = fread(content, 1, fsize, f);
-    content[read_size] = '\0';
+    json_reader_free(&r);
     fclose(f);
-    
-    // Parse type
-    char *type = json_get_string(content, "type");
-    pl->is_youtube_playlist = (type && strcmp(type, "youtube") == 0);
-    free(type);
-    
-    // Parse songs array - simple approach
-    const char *p = strstr(content, "\"songs\"");
-    if (!p) {
-        free(content);
-        return;
-    }
-    
-    p = strchr(p, '[');
-    if (!p) {
-        free(content);
-        return;
-    }
-    
-    // Find each song object
-    while (pl->count < MAX_PLAYLIST_ITEMS) {
-        const char *obj_start = strchr(p, '{');
-        if (!obj_start) break;
-        
-        const char *obj_end = strchr(obj_start, '}');
-        if (!obj_end) break;
-        
-        // Extract this object
-        size_t obj_len = obj_end - obj_start + 1;
-        char *obj = malloc(obj_len + 1);
-        if (!obj) break;
-        
-        memcpy(obj, obj_start, obj_len);
-        obj[obj_len] = '\0';
-        
-        char *title = json_get_string(obj, "title");
-        char *video_id = json_get_string(obj, "video_id");
-        int duration = json_get_int(obj, "duration", 0);
-
-        if (title && video_id && video_id[0]) {
-            pl->items[pl->count].title = title;
-            pl->items[pl->count].video_id = video_id;
-
-            char url[256];
-            snprintf(url, sizeof(url), "https://www.youtube.com/watch?v=%s", video_id);
-            pl->items[pl->count].url = strdup(url);
-            pl->items[pl->count].duration = duration;
-            
-            pl->count++;
-        } else {
-            free(title);
-            free(video_id);
-        }
-        
-        free(obj);
-        p = obj_end + 1;
-    }
-    
-    free(content);
 }
 
 static void load_playlists(AppState *st) {
-    free_all_playlists(st);
-    
-    FILE *f = fopen(st->playlists_index, "r");
-    if (!f) return;
-    
-    // Read entire file
-    fseek(f, 0, SEEK_END);
-    long fsize = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    
-    if (fsize <= 0 || fsize > 1024 * 1024) {
-        fclose(f);
-        return;
-    }
-    
-    char *content = malloc(fsize + 1);
-    if (!content) {
-        fclose(f);
-        return;
-    }
-    
-    size_t read_size = fread(content, 1, fsize, f);
-    content[read_size] = '\0';
-    fclose(f);
-    
-    // Parse playlists array
-    const char *p = strstr(content, "\"playlists\"");
-    if (!p) {
-        free(content);
-        return;
-    }
-    
-    p = strchr(p, '[');
-    if (!p) {
-        free(content);
-        return;
-    }
-    
-    while (st->playlist_count < MAX_PLAYLISTS) {
-        const char *obj_start = strchr(p, '{');
-        if (!obj_start) break;
-        
-        const char *obj_end = strchr(obj_start, '}');
-        if (!obj_end) break;
-        
-        size_t obj_len = obj_end - obj_start + 1;
-        char *obj = malloc(obj_len + 1);
-        if (!obj) break;
-        
-        memcpy(obj, obj_start, obj_len);
-        obj[obj_len] = '\0';
-        
-        char *name = json_get_string(obj, "name");
-        char *filename = json_get_string(obj, "filename");
-        
-        if (name && filename && name[0] && filename[0]) {
-            st->playlists[st->playlist_count].name = name;
-            st->playlists[st->playlist_count].filename = filename;
-            st->playlists[st->playlist_count].count = 0;
-            st->playlist_count++;
-        } else {
-            free(name);
-            free(filename);
-        }
-        
-        free(obj);
-        p = obj_end + 1;
-    }
-    
-    free(content);
+    // The playlists are read back from disk: pending saves land first
+    saves_commit(st);
+    persist_flush();
+    playlists_index_read(st);
 }
 
 static int create_playlist(AppState *st, const char *name, bool is_youtube) {
-    if (st->playlist_count >= MAX_PLAYLISTS) return -1;
     if (!name || !name[0]) return -1;
     
     // Check for duplicate name
-    for (int i = 0; i < st->playlist_count; i++) {
-        if (strcasecmp(st->playlists[i].name, name) == 0) {
-            return -2; // Already exists
-        }
+    if (find_playlist(st, name) >= 0) {
+        return -2; // Already exists
     }
     
-    char *filename = sanitize_filename(name);
+    char *filename = unique_playlist_filename(st, name, -1);
     if (!filename) return -1;
     
-    // Check for duplicate filename
-    for (int i = 0; i < st->playlist_count; i++) {
-        if (strcmp(st->playlists[i].filename, filename) == 0) {
-            // Add number suffix
-            char *new_filename = malloc(strlen(filename) + 10);
-            if (!new_filename) {
-                free(filename);
-                return -1;
-            }
-            snprintf(new_filename, strlen(filename) + 10, "%d_%s", 
-                     st->playlist_count, filename);
-            free(filename);
-            filename = new_filename;
-            break;
-        }
+    int idx = playlist_append(st);
+    if (idx < 0) {
+        free(filename);
+        return -1;
+    }
+    Playlist *pl = &st->playlists[idx];
+    pl->name = strdup(name);
+    pl->filename = filename;
+    pl->is_youtube_playlist = is_youtube;
+    pl->header_known = true;
+    if (!pl->name || !playlist_index_put(st, idx)) {
+        if (pl->name) playlist_index_remove(st, idx);
+        free_playlist(st, pl);
+        return -1;
     }
-    
-    int idx = st->playlist_count;
-    st->playlists[idx].name = strdup(name);
-    st->playlists[idx].filename = filename;
-    st->playlists[idx].count = 0;
-    st->playlists[idx].is_youtube_playlist = is_youtube;
     st->playlist_count++;
     
     save_playlists_index(st);
@@ -1618,10 +2846,13 @@ static bool delete_playlist(AppState *st, int idx) {
     strncpy(playlist_name, st->playlists[idx].name, sizeof(playlist_name) - 1);
     playlist_name[sizeof(playlist_name) - 1] = '\0';
 
-    // Delete the playlist JSON file
-    char path[16384]; // Significantly increased buffer size
+    // Delete the playlist JSON file and its journal, after anything
+    // still being written to them
+    char path[16384 + 256];
     snprintf(path, sizeof(path), "%s/%s", st->playlists_dir, st->playlists[idx].filename);
-    unlink(path);
+    persist_unlink(path);
+    playlist_journal_path(st, st->playlists[idx].filename, path, sizeof(path));
+    persist_unlink(path);
 
     // Delete the download directory and all downloaded songs
     char download_dir[16384]; // Significantly increased buffer size
@@ -1631,24 +2862,40 @@ static bool delete_playlist(AppState *st, int idx) {
     }
 
     // Free memory
-    free_playlist(&st->playlists[idx]);
+    playlist_index_remove(st, idx);
+    free_playlist(st, &st->playlists[idx]);
 
-    // Shift remaining playlists
-    for (int i = idx; i < st->playlist_count - 1; i++) {
-        st->playlists[i] = st->playlists[i + 1];
-    }
+    // Shift remaining playlists, keeping their order on screen, and
+    // repoint the indexes at their new slots
+    memmove(&st->playlists[idx], &st->playlists[idx + 1],
+            sizeof(Playlist) * (st->playlist_count - idx - 1));
     st->playlist_count--;
-
-    // Clear the last slot
-    memset(&st->playlists[st->playlist_count], 0, sizeof(Playlist));
+    for (int i = idx; i < st->playlist_count; i++) {
+        playlist_index_put(st, i);
+    }
 
     save_playlists_index(st);
     return true;
 }
 
+// Load the songs of every playlist not loaded yet, so the song table's
+// lists counts cover the whole library
+static void load_all_playlist_songs(AppState *st) {
+    for (int i = 0; i < st->playlist_count; i++) {
+        if (st->playlists[i].count == 0) load_playlist_songs(st, i);
+    }
+    st->songs_complete = true;
+}
+
+// Number of playlists holding the song with video_id
+static int song_playlist_count(AppState *st, const char *video_id) {
+    int ref = song_find(&st->songs, video_id);
+    return ref >= 0 ? song_entry(&st->songs, ref)->lists : 0;
+}
+
 static bool add_song_to_playlist(AppState *st, int playlist_idx, Song *song) {
     if (playlist_idx < 0 || playlist_idx >= st->playlist_count) return false;
-    if (!song || !song->video_id) return false;
+    if (!song || !song->video_id[0]) return false;
     
     Playlist *pl = &st->playlists[playlist_idx];
     
@@ -1657,27 +2904,12 @@ static bool add_song_to_playlist(AppState *st, int playlist_idx, Song *song) {
         load_playlist_songs(st, playlist_idx);
     }
     
-    if (pl->count >= MAX_PLAYLIST_ITEMS) return false;
-    
-    // Check for duplicate
-    for (int i = 0; i < pl->count; i++) {
-        if (pl->items[i].video_id && strcmp(pl->items[i].video_id, song->video_id) == 0) {
-            return false; // Already in playlist
-        }
+    if (playlist_has_song(st, pl, song->video_id)) {
+        return false; // Already in playlist
     }
-    
-    int idx = pl->count;
-    pl->items[idx].title = song->title ? strdup(song->title) : strdup("Unknown");
-    pl->items[idx].video_id = strdup(song->video_id);
+    if (!playlist_append_song(st, pl, song)) return false;
 
-    char url[256];
-    snprintf(url, sizeof(url), "https://www.youtube.com/watch?v=%s", song->video_id);
-    pl->items[idx].url = strdup(url);
-    pl->items[idx].duration = song->duration;
-
-    pl->count++;
-
-    save_playlist(st, playlist_idx);
+    playlist_journal_add(st, playlist_idx, song);
 
     // Automatically queue song for download
     add_to_download_queue(st, song->video_id, song->title, pl->name);
@@ -1691,187 +2923,1018 @@ static bool remove_song_from_playlist(AppState *st, int playlist_idx, int song_i
     Playlist *pl = &st->playlists[playlist_idx];
     if (song_idx < 0 || song_idx >= pl->count) return false;
     
-    // Free song data
-    free(pl->items[song_idx].title);
-    free(pl->items[song_idx].video_id);
-    free(pl->items[song_idx].url);
+    // The song stays in the song table, and so does its video_id
+    const char *video_id = playlist_song(st, pl, song_idx)->video_id;
+    playlist_remove_at(st, pl, song_idx);
+    playlist_journal_remove(st, playlist_idx, song_idx, video_id);
+    return true;
+}
+
+// Move the song at from to position to. Playback and the shuffle order
+// stay on the same songs.
+static bool move_song_in_playlist(AppState *st, int playlist_idx, int from, int to) {
+    if (playlist_idx < 0 || playlist_idx >= st->playlist_count) return false;
     
-    // Shift remaining songs
-    for (int i = song_idx; i < pl->count - 1; i++) {
-        pl->items[i] = pl->items[i + 1];
+    Playlist *pl = &st->playlists[playlist_idx];
+    if (from < 0 || from >= pl->count || to < 0 || to >= pl->count || from == to) return false;
+    
+    playlist_move_item(pl, from, to);
+    if (st->playing_from_playlist && st->playing_playlist_idx == playlist_idx && st->playing_index >= 0) {
+        st->playing_index = moved_index(st->playing_index, from, to);
+        weighted_reset(&st->weighted);
+    }
+    ShuffleOrder *so = &pl->shuffle;
+    if (so->order && so->count == pl->count) {
+        for (int i = 0; i < so->count; i++) {
+            so->order[i] = moved_index(so->order[i], from, to);
+            so->pos[so->order[i]] = i;
+        }
     }
-    pl->count--;
     
-    // Clear last slot
-    memset(&pl->items[pl->count], 0, sizeof(Song));
-    
-    save_playlist(st, playlist_idx);
+    playlist_journal_move(st, playlist_idx, from, to);
     return true;
 }
 
 // ============================================================================
-// MPV IPC Communication
+// Write-behind Saves
 // ============================================================================
 
-static void mpv_disconnect(void) {
-    if (mpv_ipc_fd >= 0) {
-        sb_log("[PLAYBACK] mpv_disconnect: closing IPC fd=%d", mpv_ipc_fd);
-        close(mpv_ipc_fd);
-        mpv_ipc_fd = -1;
-    }
+// save_config, save_playlists_index and save_playlist only mark what
+// changed. SAVE_DELAY_MS after the first of them, whatever is marked is
+// rendered into memory in one go and handed to the writer thread
+// (persist.c), which does the disk work: a burst of edits costs one write
+// per file. Everything pending goes out before the files are read back
+// and at exit.
+
+static void saves_schedule(AppState *st) {
+    if (!st->saves_due) st->saves_due = monotonic_ms() + SAVE_DELAY_MS;
 }
 
-static bool mpv_connect(void) {
-    if (mpv_ipc_fd >= 0) {
-        sb_log("[PLAYBACK] mpv_connect: already connected (fd=%d)", mpv_ipc_fd);
-        return true;
+static void saves_commit(AppState *st) {
+    st->saves_due = 0;
+    MemRender m;
+    if (st->config_dirty && config_render(st, &m)) {
+        persist_write(st->config_file, m.data, m.len, NULL);
+        st->config_dirty = false;
     }
-    if (!file_exists(IPC_SOCKET)) {
-        sb_log("[PLAYBACK] mpv_connect: IPC socket %s does not exist", IPC_SOCKET);
-        return false;
+    if (st->index_dirty && playlists_index_render(st, &m)) {
+        persist_write(st->playlists_index, m.data, m.len, NULL);
+        st->index_dirty = false;
     }
-
-    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (fd < 0) {
-        sb_log("[PLAYBACK] mpv_connect: socket() failed: %s (errno=%d)", strerror(errno), errno);
-        return false;
+    bool pending = st->config_dirty || st->index_dirty;
+    for (int i = 0; i < st->playlist_count; i++) {
+        if (st->playlists[i].dirty) playlist_commit(st, i);
+        if (st->playlists[i].dirty) pending = true;
     }
+    // Whatever couldn't be rendered is tried again later
+    if (pending) saves_schedule(st);
+}
 
-    // Set non-blocking
-    int flags = fcntl(fd, F_GETFL, 0);
-    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+// Save again what the writer failed to write, from scratch: for a
+// playlist that's a snapshot, which also replaces a journal missing records
+static void saves_retry(AppState *st, const char *path) {
+    sb_log("[PLAYBACK] saves: writing %s failed, saving it again", path);
+    if (strcmp(path, st->config_file) == 0) {
+        save_config(st);
+        return;
+    }
+    if (strcmp(path, st->playlists_index) == 0) {
+        save_playlists_index(st);
+        return;
+    }
 
-    struct sockaddr_un addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, IPC_SOCKET, sizeof(addr.sun_path) - 1);
+    size_t dir_len = strlen(st->playlists_dir);
+    if (strncmp(path, st->playlists_dir, dir_len) != 0 || path[dir_len] != '/') return;
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s", path + dir_len + 1);
+    size_t len = strlen(filename);
+    size_t suffix_len = strlen(JOURNAL_SUFFIX);
+    if (len > suffix_len && strcmp(filename + len - suffix_len, JOURNAL_SUFFIX) == 0) {
+        filename[len - suffix_len] = '\0';
+    }
+    int idx = strmap_get(&st->playlist_files, filename);
+    if (idx >= 0) save_playlist(st, idx);
+}
 
-    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
-        sb_log("[PLAYBACK] mpv_connect: connect() to %s failed: %s (errno=%d)", IPC_SOCKET, strerror(errno), errno);
-        close(fd);
-        return false;
+static void saves_poll(AppState *st) {
+    char path[PATH_MAX];
+    while (persist_failed(path, sizeof(path))) {
+        saves_retry(st, path);
     }
+    if (st->saves_due && monotonic_ms() >= st->saves_due) saves_commit(st);
+}
 
-    mpv_ipc_fd = fd;
-    sb_log("[PLAYBACK] mpv_connect: connected to mpv IPC socket (fd=%d)", fd);
+// ============================================================================
+// Download States
+// ============================================================================
 
-    // Enable end-file event observation
-    const char *observe_cmd = "{\"command\":[\"observe_property\",1,\"eof-reached\"]}\n";
-    ssize_t w = write(mpv_ipc_fd, observe_cmd, strlen(observe_cmd));
-    if (w < 0) {
-        sb_log("[PLAYBACK] mpv_connect: failed to send observe command: %s", strerror(errno));
-    }
-    (void)w;
+// Whether a song is downloaded is checked for every row drawn. Each
+// download folder is listed once and kept, by video_id, until its mtime
+// changes; a listing from the library snapshot saves even the first scan.
+
+static void download_dir_clear(DownloadDir *d) {
+    strmap_free(&d->files);
+    free(d->names);
+    d->names = NULL;
+    d->count = 0;
+    d->cap = 0;
+    arena_free(&d->strings);
+    d->mtime_ns = -1;
+    d->trusted = false;
+}
 
+// The video_id a downloaded file is named after (Title_[video_id].mp3).
+// Returns false if the name doesn't have one.
+static bool download_file_video_id(const char *name, char *out, size_t out_size) {
+    const char *end = strstr(name, "].mp3");
+    if (!end) return false;
+    const char *start = end;
+    while (start > name && start[-1] != '[') start--;
+    if (start == name || start == end || (size_t)(end - start) >= out_size) return false;
+    memcpy(out, start, end - start);
+    out[end - start] = '\0';
     return true;
 }
 
-static void mpv_send_command(const char *cmd) {
-    sb_log("[PLAYBACK] mpv_send_command: sending: %s", cmd);
-    if (!mpv_connect()) {
-        sb_log("[PLAYBACK] mpv_send_command: persistent connection failed, trying one-shot");
-        // Try one-shot connection
-        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
-        if (fd < 0) {
-            sb_log("[PLAYBACK] mpv_send_command: one-shot socket() failed: %s", strerror(errno));
-            return;
-        }
+// Add a file to the listing. The first file of a video_id is the one found.
+static bool download_dir_add(DownloadDir *d, const char *name, const char *video_id) {
+    if (strmap_get(&d->files, video_id) >= 0) return true;
+    if (d->count == d->cap) {
+        int new_cap = d->cap ? d->cap * 2 : 64;
+        char **names = realloc(d->names, sizeof(char *) * new_cap);
+        if (!names) return false;
+        d->names = names;
+        d->cap = new_cap;
+    }
+    d->names[d->count] = arena_strdup(&d->strings, name);
+    if (!d->names[d->count] || !strmap_put(&d->files, video_id, d->count)) return false;
+    d->count++;
+    return true;
+}
 
-        struct sockaddr_un addr;
-        memset(&addr, 0, sizeof(addr));
-        addr.sun_family = AF_UNIX;
-        strncpy(addr.sun_path, IPC_SOCKET, sizeof(addr.sun_path) - 1);
+static bool snapshot_dir_fill(AppState *st, DownloadDir *d);
 
-        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
-            ssize_t w = write(fd, cmd, strlen(cmd));
-            w = write(fd, "\n", 1);
-            sb_log("[PLAYBACK] mpv_send_command: one-shot command sent (bytes=%zd)", w);
-            (void)w;
-        } else {
-            sb_log("[PLAYBACK] mpv_send_command: one-shot connect() failed: %s", strerror(errno));
-        }
-        close(fd);
+// List the folder as it is at mtime. A folder changed in the last couple
+// of seconds could change again within the same mtime tick: its listing
+// isn't trusted, and it's listed again on every use until it settles.
+static void download_dir_list(AppState *st, DownloadDir *d, long long mtime) {
+    download_dir_clear(d);
+    d->mtime_ns = mtime;
+    if (snapshot_dir_fill(st, d)) {
+        d->trusted = true;
         return;
     }
 
-    ssize_t w = write(mpv_ipc_fd, cmd, strlen(cmd));
-    if (w < 0) {
-        sb_log("[PLAYBACK] mpv_send_command: write failed: %s (errno=%d)", strerror(errno), errno);
-    } else {
-        sb_log("[PLAYBACK] mpv_send_command: sent %zd bytes on fd=%d", w, mpv_ipc_fd);
+    DIR *dir = opendir(d->path);
+    if (!dir) return;
+    struct dirent *entry;
+    char video_id[VIDEO_ID_SIZE];
+    while ((entry = readdir(dir)) != NULL) {
+        if (download_file_video_id(entry->d_name, video_id, sizeof(video_id))) {
+            download_dir_add(d, entry->d_name, video_id);
+        }
     }
-    w = write(mpv_ipc_fd, "\n", 1);
-    (void)w;
+    closedir(dir);
+    d->trusted = mtime < realtime_ns() - DOWNLOAD_DIR_SETTLE_NS;
 }
 
-static void mpv_toggle_pause(void) {
-    sb_log("[PLAYBACK] mpv_toggle_pause called");
-    mpv_send_command("{\"command\":[\"cycle\",\"pause\"]}");
+// The listing of the download folder at path, up to date. NULL if the
+// folder doesn't exist.
+static DownloadDir *download_dir_get(AppState *st, const char *path) {
+    struct stat sb;
+    bool exists = stat(path, &sb) == 0 && S_ISDIR(sb.st_mode);
+    int idx = strmap_get(&st->download_dir_index, path);
+    if (idx < 0) {
+        if (!exists) return NULL;
+        if (st->download_dir_count == st->download_dir_cap) {
+            int new_cap = st->download_dir_cap ? st->download_dir_cap * 2 : 16;
+            DownloadDir *grown = realloc(st->download_dirs, sizeof(DownloadDir) * new_cap);
+            if (!grown) return NULL;
+            st->download_dirs = grown;
+            st->download_dir_cap = new_cap;
+        }
+        DownloadDir *d = &st->download_dirs[st->download_dir_count];
+        memset(d, 0, sizeof(*d));
+        d->mtime_ns = -1;
+        d->path = strdup(path);
+        if (!d->path || !strmap_put(&st->download_dir_index, path, st->download_dir_count)) {
+            free(d->path);
+            return NULL;
+        }
+        idx = st->download_dir_count++;
+    }
+
+    DownloadDir *d = &st->download_dirs[idx];
+    if (!exists) {
+        download_dir_clear(d);
+        return NULL;
+    }
+    long long mtime = stat_mtime_ns(&sb);
+    if (mtime != d->mtime_ns || !d->trusted) download_dir_list(st, d, mtime);
+    return d;
 }
 
-static void mpv_stop_playback(void) {
-    sb_log("[PLAYBACK] mpv_stop_playback called");
-    mpv_send_command("{\"command\":[\"stop\"]}");
+// Name of the downloaded file of video_id in the folder at path, NULL if none
+static const char *download_dir_find(AppState *st, const char *path, const char *video_id) {
+    DownloadDir *d = download_dir_get(st, path);
+    if (!d) return NULL;
+    int i = strmap_get(&d->files, video_id);
+    return i >= 0 ? d->names[i] : NULL;
 }
 
-static void mpv_seek(int seconds) {
-    sb_log("[PLAYBACK] mpv_seek: seeking %+d seconds", seconds);
-    char cmd[128];
-    snprintf(cmd, sizeof(cmd), "{\"command\":[\"seek\",\"%d\",\"relative\"]}", seconds);
-    mpv_send_command(cmd);
+static void download_dirs_free(AppState *st) {
+    for (int i = 0; i < st->download_dir_count; i++) {
+        download_dir_clear(&st->download_dirs[i]);
+        free(st->download_dirs[i].path);
+    }
+    free(st->download_dirs);
+    st->download_dirs = NULL;
+    st->download_dir_count = 0;
+    st->download_dir_cap = 0;
+    strmap_free(&st->download_dir_index);
 }
 
-static void mpv_seek_absolute(int seconds) {
-    sb_log("[PLAYBACK] mpv_seek_absolute: seeking to %d seconds", seconds);
-    char cmd[128];
-    snprintf(cmd, sizeof(cmd), "{\"command\":[\"seek\",\"%d\",\"absolute\"]}", seconds);
-    mpv_send_command(cmd);
+// ============================================================================
+// Library Snapshot
+// ============================================================================
+
+// The whole library in one binary file (library.bin), mapped at startup
+// instead of parsing JSON: every playlist with its songs, and the listings
+// of the download folders. It's only a cache. The JSON files stay the
+// source of truth, and the snapshot is used only while each file it was
+// built from (playlists.json, every playlist file and its journal) has the
+// size, mtime and inode it had then: writes go through a new file renamed
+// into place, so a changed file never passes for the old one. A stale
+// snapshot is rebuilt from the JSON files on a background thread, and at
+// exit a fully loaded library is written straight from memory.
+//
+// Numbers are stored in the byte order of the machine that wrote the file;
+// a file from another one, or from another version, is simply rebuilt.
+
+static const size_t snapshot_entry_size[SNAPSHOT_SECTIONS] = {
+    sizeof(SnapshotSource), sizeof(SnapshotPlaylist), sizeof(SnapshotSong),
+    sizeof(uint32_t), sizeof(SnapshotDir), sizeof(SnapshotFile), 1
+};
+
+static const SnapshotHeader *snapshot_header(const LibrarySnapshot *snap) {
+    return snap->map;
 }
 
-static void mpv_load_url(const char *url) {
-    sb_log("[PLAYBACK] mpv_load_url: loading URL: %s", url);
+static const void *snapshot_section(const LibrarySnapshot *snap, int section) {
+    return (const char *)snap->map + snapshot_header(snap)->offsets[section];
+}
 
-    char *escaped = NULL;
-    size_t n = 0;
-    FILE *mem = open_memstream(&escaped, &n);
-    if (!mem) {
-        sb_log("[PLAYBACK] mpv_load_url: open_memstream failed: %s", strerror(errno));
-        return;
-    }
+// The string at offset off, NULL for SNAPSHOT_NONE or an offset out of range
+static const char *snapshot_str(const LibrarySnapshot *snap, uint32_t off) {
+    if (off >= snapshot_header(snap)->counts[SNAP_STRINGS]) return NULL;
+    return (const char *)snapshot_section(snap, SNAP_STRINGS) + off;
+}
 
-    fputc('"', mem);
-    for (const char *p = url; *p; p++) {
-        if (*p == '"' || *p == '\\') fputc('\\', mem);
-        fputc(*p, mem);
+// Check everything the loader relies on, so a truncated or foreign file
+// is rejected instead of read out of bounds
+static bool snapshot_check(const LibrarySnapshot *snap) {
+    if (snap->size < sizeof(SnapshotHeader)) return false;
+    const SnapshotHeader *h = snapshot_header(snap);
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 || h->version != SNAPSHOT_VERSION ||
+        h->byte_order != SNAPSHOT_BYTE_ORDER || h->size != snap->size) {
+        return false;
+    }
+    for (int i = 0; i < SNAPSHOT_SECTIONS; i++) {
+        if (h->offsets[i] % 8 != 0 || h->offsets[i] > snap->size ||
+            h->counts[i] > (snap->size - h->offsets[i]) / snapshot_entry_size[i]) {
+            return false;
+        }
+    }
+    if (h->counts[SNAP_STRINGS] == 0 ||
+        ((const char *)snapshot_section(snap, SNAP_STRINGS))[h->counts[SNAP_STRINGS] - 1] != '\0') {
+        return false;
     }
-    fputc('"', mem);
-    fclose(mem);
-
-    char cmd[4096];
-    snprintf(cmd, sizeof(cmd),
-             "{\"command\":[\"loadfile\",%s,\"replace\"]}", escaped);
-    free(escaped);
 
-    sb_log("[PLAYBACK] mpv_load_url: sending loadfile command to mpv");
-    mpv_send_command(cmd);
+    const SnapshotPlaylist *playlists = snapshot_section(snap, SNAP_PLAYLISTS);
+    for (uint64_t i = 0; i < h->counts[SNAP_PLAYLISTS]; i++) {
+        if (playlists[i].first_item > h->counts[SNAP_ITEMS] ||
+            playlists[i].item_count > h->counts[SNAP_ITEMS] - playlists[i].first_item) {
+            return false;
+        }
+    }
+    const uint32_t *items = snapshot_section(snap, SNAP_ITEMS);
+    for (uint64_t i = 0; i < h->counts[SNAP_ITEMS]; i++) {
+        if (items[i] >= h->counts[SNAP_SONGS]) return false;
+    }
+    const SnapshotSong *songs = snapshot_section(snap, SNAP_SONGS);
+    for (uint64_t i = 0; i < h->counts[SNAP_SONGS]; i++) {
+        if (!memchr(songs[i].video_id, '\0', VIDEO_ID_SIZE)) return false;
+    }
+    const SnapshotDir *dirs = snapshot_section(snap, SNAP_DIRS);
+    for (uint64_t i = 0; i < h->counts[SNAP_DIRS]; i++) {
+        if (dirs[i].first_file > h->counts[SNAP_FILES] ||
+            dirs[i].file_count > h->counts[SNAP_FILES] - dirs[i].first_file) {
+            return false;
+        }
+    }
+    const SnapshotFile *files = snapshot_section(snap, SNAP_FILES);
+    for (uint64_t i = 0; i < h->counts[SNAP_FILES]; i++) {
+        if (!memchr(files[i].video_id, '\0', VIDEO_ID_SIZE)) return false;
+    }
+    return true;
 }
 
-static void mpv_start_if_needed(AppState *st) {
-    sb_log("[PLAYBACK] mpv_start_if_needed: checking if mpv is running...");
-    if (file_exists(IPC_SOCKET) && mpv_connect()) {
-        sb_log("[PLAYBACK] mpv_start_if_needed: mpv already running and connected");
+// Stamp of the file at path as it is now
+static void snapshot_stamp(const char *path, SnapshotSource *out) {
+    struct stat sb;
+    if (stat(path, &sb) != 0) {
+        out->size = -1;
+        out->mtime_ns = 0;
+        out->ino = 0;
         return;
     }
+    out->size = sb.st_size;
+    out->mtime_ns = stat_mtime_ns(&sb);
+    out->ino = sb.st_ino;
+}
 
-    sb_log("[PLAYBACK] mpv_start_if_needed: mpv not running, starting new instance...");
-    unlink(IPC_SOCKET);
-    mpv_disconnect();
+// True if every source file and listed download folder is as it was
+static bool snapshot_current(const LibrarySnapshot *snap) {
+    const SnapshotHeader *h = snapshot_header(snap);
+    const SnapshotSource *sources = snapshot_section(snap, SNAP_SOURCES);
+    for (uint64_t i = 0; i < h->counts[SNAP_SOURCES]; i++) {
+        const char *path = snapshot_str(snap, sources[i].path);
+        if (!path) return false;
+        SnapshotSource now;
+        snapshot_stamp(path, &now);
+        if (now.size != sources[i].size || now.mtime_ns != sources[i].mtime_ns || now.ino != sources[i].ino) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    // Build ytdl_hook path option so mpv can find yt-dlp
-    const char *ytdlp_path = get_ytdlp_cmd(st);
-    char ytdl_opt[1200];
-    snprintf(ytdl_opt, sizeof(ytdl_opt), "--script-opts=ytdl_hook-ytdl_path=%s", ytdlp_path);
-    sb_log("[PLAYBACK] mpv_start_if_needed: yt-dlp path for mpv: %s", ytdlp_path);
+// Fill d from the snapshot's listing of its folder, if the snapshot has
+// one taken at d's mtime
+static bool snapshot_dir_fill(AppState *st, DownloadDir *d) {
+    LibrarySnapshot *snap = &st->snapshot;
+    if (!snap->map) return false;
+    int i = strmap_get(&snap->dirs, d->path);
+    if (i < 0) return false;
+    const SnapshotDir *dir = (const SnapshotDir *)snapshot_section(snap, SNAP_DIRS) + i;
+    if (dir->mtime_ns != d->mtime_ns) return false;
+
+    const SnapshotFile *files = (const SnapshotFile *)snapshot_section(snap, SNAP_FILES) + dir->first_file;
+    for (uint32_t f = 0; f < dir->file_count; f++) {
+        const char *name = snapshot_str(snap, files[f].name);
+        if (!name || !download_dir_add(d, name, files[f].video_id)) {
+            download_dir_clear(d);
+            d->mtime_ns = dir->mtime_ns;
+            return false;
+        }
+    }
+    return true;
+}
+
+// The playlists and their songs, into an empty library
+static bool snapshot_fill_playlists(AppState *st, const LibrarySnapshot *snap) {
+    const SnapshotHeader *h = snapshot_header(snap);
+    int *refs = malloc(sizeof(int) * (h->counts[SNAP_SONGS] ? h->counts[SNAP_SONGS] : 1));
+    if (!refs) return false;
+
+    // Songs go into the table once, then playlists take refs
+    bool ok = song_table_reserve(&st->songs, st->songs.count + (int)h->counts[SNAP_SONGS]);
+    const SnapshotSong *songs = snapshot_section(snap, SNAP_SONGS);
+    for (uint64_t i = 0; ok && i < h->counts[SNAP_SONGS]; i++) {
+        Song song = {0};
+        song.title = (char *)snapshot_str(snap, songs[i].title);
+        memcpy(song.video_id, songs[i].video_id, VIDEO_ID_SIZE);
+        song.duration = songs[i].duration;
+        refs[i] = song.title ? song_intern(&st->songs, &song) : -1;
+        ok = refs[i] >= 0;
+    }
+
+    const SnapshotPlaylist *playlists = snapshot_section(snap, SNAP_PLAYLISTS);
+    const uint32_t *items = snapshot_section(snap, SNAP_ITEMS);
+    for (uint64_t i = 0; ok && i < h->counts[SNAP_PLAYLISTS]; i++) {
+        const SnapshotPlaylist *sp = &playlists[i];
+        const char *name = snapshot_str(snap, sp->name);
+        const char *filename = snapshot_str(snap, sp->filename);
+        const char *source_url = snapshot_str(snap, sp->source_url);
+        int idx = playlist_append(st);
+        if (idx < 0 || !name || !filename || find_playlist(st, name) >= 0 ||
+            strmap_get(&st->playlist_files, filename) >= 0) {
+            ok = false;
+            break;
+        }
+
+        Playlist *pl = &st->playlists[idx];
+        pl->name = strdup(name);
+        pl->filename = strdup(filename);
+        pl->source_url = source_url ? strdup(source_url) : NULL;
+        pl->is_youtube_playlist = (sp->flags & SNAPSHOT_YOUTUBE) != 0;
+        pl->header_known = (sp->flags & SNAPSHOT_HEADER_KNOWN) != 0;
+        pl->generation = sp->generation;
+        pl->journal_records = sp->journal_records;
+        if (!pl->name || !pl->filename || !playlist_index_put(st, idx)) {
+            if (pl->name && pl->filename) playlist_index_remove(st, idx);
+            free_playlist(st, pl);
+            ok = false;
+            break;
+        }
+        st->playlist_count++;
+
+        if (!playlist_reserve(pl, (int)sp->item_count)) {
+            ok = false;
+            break;
+        }
+        for (uint32_t k = 0; k < sp->item_count; k++) {
+            int ref = refs[items[sp->first_item + k]];
+            pl->items[pl->count++] = ref;
+            playlist_hold(st, pl, ref);
+        }
+    }
+    free(refs);
+    if (ok) st->songs_complete = true;
+    return ok;
+}
+
+static void library_snapshot_free(AppState *st) {
+    if (st->snapshot.map) munmap(st->snapshot.map, st->snapshot.size);
+    strmap_free(&st->snapshot.dirs);
+    memset(&st->snapshot, 0, sizeof(st->snapshot));
+}
+
+// Load the library from the snapshot if it's current. Returns false,
+// with no playlists loaded, if it isn't there or can't be used.
+static bool library_snapshot_load(AppState *st) {
+    int fd = open(st->snapshot_file, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size < (off_t)sizeof(SnapshotHeader)) {
+        close(fd);
+        return false;
+    }
+    LibrarySnapshot snap = {0};
+    snap.size = sb.st_size;
+    snap.map = mmap(NULL, snap.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (snap.map == MAP_FAILED) return false;
+
+    if (!snapshot_check(&snap) || !snapshot_current(&snap)) {
+        sb_log("[PLAYBACK] library snapshot: stale or unreadable, loading the JSON files");
+        munmap(snap.map, snap.size);
+        return false;
+    }
+    if (!snapshot_fill_playlists(st, &snap)) {
+        sb_log("[PLAYBACK] library snapshot: couldn't load it, loading the JSON files");
+        free_all_playlists(st);
+        munmap(snap.map, snap.size);
+        return false;
+    }
+
+    const SnapshotHeader *h = snapshot_header(&snap);
+    const SnapshotDir *dirs = snapshot_section(&snap, SNAP_DIRS);
+    for (uint64_t i = 0; i < h->counts[SNAP_DIRS]; i++) {
+        const char *path = snapshot_str(&snap, dirs[i].path);
+        if (path) strmap_put(&snap.dirs, path, (int)i);
+    }
+    st->snapshot = snap;
+    sb_log("[PLAYBACK] library snapshot: %d playlists, %d songs", st->playlist_count, st->songs.count);
+    return true;
+}
+
+// Room for size more bytes of section, zeroed. NULL if out of memory.
+static void *snapshot_push(SnapshotWriter *w, int section, size_t size) {
+    if (w->failed) return NULL;
+    if (w->len[section] + size > w->cap[section]) {
+        size_t new_cap = w->cap[section] ? w->cap[section] : 4096;
+        while (new_cap < w->len[section] + size) new_cap *= 2;
+        char *grown = realloc(w->data[section], new_cap);
+        if (!grown) {
+            w->failed = true;
+            return NULL;
+        }
+        w->data[section] = grown;
+        w->cap[section] = new_cap;
+    }
+    void *p = w->data[section] + w->len[section];
+    memset(p, 0, size);
+    w->len[section] += size;
+    return p;
+}
+
+static uint32_t snapshot_push_str(SnapshotWriter *w, const char *s) {
+    if (!s) return SNAPSHOT_NONE;
+    uint32_t off = (uint32_t)w->len[SNAP_STRINGS];
+    char *p = snapshot_push(w, SNAP_STRINGS, strlen(s) + 1);
+    if (p) memcpy(p, s, strlen(s) + 1);
+    return off;
+}
+
+// Record the file at path as a source, stamped as it is now: before it's read
+static void snapshot_add_source(SnapshotWriter *w, const char *path) {
+    uint32_t path_off = snapshot_push_str(w, path);
+    SnapshotSource *src = snapshot_push(w, SNAP_SOURCES, sizeof(SnapshotSource));
+    if (!src) return;
+    src->path = path_off;
+    snapshot_stamp(path, src);
+}
+
+// The playlist files, after the index that lists them
+static void snapshot_add_playlist_sources(SnapshotWriter *w, AppState *st, int idx) {
+    char path[16384 + 256];
+    snprintf(path, sizeof(path), "%s/%s", st->playlists_dir, st->playlists[idx].filename);
+    snapshot_add_source(w, path);
+    playlist_journal_path(st, st->playlists[idx].filename, path, sizeof(path));
+    snapshot_add_source(w, path);
+}
+
+static void snapshot_add_dir(SnapshotWriter *w, AppState *st, const char *path) {
+    DownloadDir *d = download_dir_get(st, path);
+    if (!d || !d->trusted) return;  // listed when it's first used instead
+    uint32_t path_off = snapshot_push_str(w, path);
+    uint32_t first_file = (uint32_t)(w->len[SNAP_FILES] / sizeof(SnapshotFile));
+    for (int i = 0; i < d->files.cap; i++) {
+        if (!d->files.keys[i]) continue;
+        uint32_t name_off = snapshot_push_str(w, d->names[d->files.values[i]]);
+        SnapshotFile *f = snapshot_push(w, SNAP_FILES, sizeof(SnapshotFile));
+        if (!f) return;
+        f->name = name_off;
+        snprintf(f->video_id, sizeof(f->video_id), "%s", d->files.keys[i]);
+    }
+    SnapshotDir *dir = snapshot_push(w, SNAP_DIRS, sizeof(SnapshotDir));
+    if (!dir) return;
+    dir->path = path_off;
+    dir->first_file = first_file;
+    dir->file_count = (uint32_t)(w->len[SNAP_FILES] / sizeof(SnapshotFile)) - first_file;
+    dir->mtime_ns = d->mtime_ns;
+}
+
+static void snapshot_writer_free(SnapshotWriter *w) {
+    for (int i = 0; i < SNAPSHOT_SECTIONS; i++) free(w->data[i]);
+    memset(w, 0, sizeof(*w));
+}
+
+// Add st's playlists and download folders to the sources already in w,
+// and lay the snapshot out in a new buffer. Every playlist must be loaded.
+static bool snapshot_render(SnapshotWriter *w, AppState *st, char **data, size_t *len) {
+    int *index = malloc(sizeof(int) * (st->songs.count ? st->songs.count : 1));
+    if (!index) return false;
+    memset(index, 0xff, sizeof(int) * (st->songs.count ? st->songs.count : 1));
+
+    uint32_t song_count = 0;
+    for (int p = 0; p < st->playlist_count; p++) {
+        Playlist *pl = &st->playlists[p];
+        SnapshotPlaylist sp = {0};
+        sp.name = snapshot_push_str(w, pl->name);
+        sp.filename = snapshot_push_str(w, pl->filename);
+        sp.source_url = snapshot_push_str(w, pl->source_url);
+        sp.flags = (pl->is_youtube_playlist ? SNAPSHOT_YOUTUBE : 0) |
+                   (pl->header_known ? SNAPSHOT_HEADER_KNOWN : 0);
+        sp.generation = pl->generation;
+        sp.journal_records = pl->journal_records;
+        sp.first_item = (uint32_t)(w->len[SNAP_ITEMS] / sizeof(uint32_t));
+        sp.item_count = (uint32_t)pl->count;
+
+        for (int i = 0; i < pl->count; i++) {
+            int ref = pl->items[i];
+            if (index[ref] < 0) {
+                Song *song = song_at(&st->songs, ref);
+                uint32_t title = snapshot_push_str(w, song->title);
+                SnapshotSong *ss = snapshot_push(w, SNAP_SONGS, sizeof(SnapshotSong));
+                if (!ss) break;
+                ss->title = title;
+                ss->duration = song->duration;
+                memcpy(ss->video_id, song->video_id, VIDEO_ID_SIZE);
+                index[ref] = (int)song_count++;
+            }
+            uint32_t *item = snapshot_push(w, SNAP_ITEMS, sizeof(uint32_t));
+            if (!item) break;
+            *item = (uint32_t)index[ref];
+        }
+        SnapshotPlaylist *out = snapshot_push(w, SNAP_PLAYLISTS, sizeof(SnapshotPlaylist));
+        if (out) *out = sp;
+    }
+    free(index);
+
+    snapshot_add_dir(w, st, st->config.download_path);
+    for (int p = 0; p < st->playlist_count; p++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", st->config.download_path, st->playlists[p].name);
+        snapshot_add_dir(w, st, path);
+    }
+    if (w->failed || w->len[SNAP_STRINGS] >= SNAPSHOT_NONE) return false;
+
+    // Header, then each section 8-byte aligned
+    SnapshotHeader h = {0};
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = SNAPSHOT_VERSION;
+    h.byte_order = SNAPSHOT_BYTE_ORDER;
+    size_t size = sizeof(SnapshotHeader);
+    for (int i = 0; i < SNAPSHOT_SECTIONS; i++) {
+        size = (size + 7) & ~(size_t)7;
+        h.offsets[i] = size;
+        h.counts[i] = w->len[i] / snapshot_entry_size[i];
+        size += w->len[i];
+    }
+    size = (size + 7) & ~(size_t)7;
+    h.size = size;
+
+    *data = calloc(1, size);
+    if (!*data) return false;
+    memcpy(*data, &h, sizeof(h));
+    for (int i = 0; i < SNAPSHOT_SECTIONS; i++) {
+        if (w->len[i]) memcpy(*data + h.offsets[i], w->data[i], w->len[i]);
+    }
+    *len = size;
+    return true;
+}
+
+static void snapshot_build_free(SnapshotBuild *job) {
+    AppState *s = job->scratch;
+    if (s) {
+        free_all_playlists(s);
+        song_table_free(&s->songs);
+        download_dirs_free(s);
+        free(s);
+    }
+    pthread_mutex_destroy(&job->mutex);
+    free(job);
+}
+
+static bool snapshot_build_cancelled(SnapshotBuild *job) {
+    pthread_mutex_lock(&job->mutex);
+    bool cancelled = job->cancelled;
+    pthread_mutex_unlock(&job->mutex);
+    return cancelled;
+}
+
+// Read every JSON file into the scratch state, each stamped before it's
+// read: a file changed meanwhile leaves the snapshot stale, never wrong.
+// Nothing is written but the snapshot; the files belong to the UI thread.
+static void *snapshot_build_thread_func(void *arg) {
+    SnapshotBuild *job = arg;
+    AppState *s = job->scratch;
+    SnapshotWriter w = {0};
+
+    snapshot_add_source(&w, s->playlists_index);
+    playlists_index_read(s);
+    bool usable = true;
+    for (int i = 0; usable && i < s->playlist_count; i++) {
+        snapshot_add_playlist_sources(&w, s, i);
+        bool stale, complete;
+        playlist_read(s, i, &stale, &complete);
+        // A journal that needs repair is left to the UI, which repairs it
+        // when it loads the playlist
+        if (stale || !complete || snapshot_build_cancelled(job)) usable = false;
+    }
+
+    char *data;
+    size_t len;
+    if (usable && snapshot_render(&w, s, &data, &len)) {
+        persist_write(job->path, data, len, NULL);
+        sb_log("[PLAYBACK] library snapshot: rebuilt, %d playlists, %d songs", s->playlist_count, s->songs.count);
+    }
+    snapshot_writer_free(&w);
+
+    pthread_mutex_lock(&job->mutex);
+    job->finished = true;
+    pthread_mutex_unlock(&job->mutex);
+    return NULL;
+}
+
+// Rebuild the snapshot in the background, for the next start
+static void library_snapshot_rebuild(AppState *st) {
+    SnapshotBuild *job = calloc(1, sizeof(SnapshotBuild));
+    if (!job) return;
+    job->scratch = calloc(1, sizeof(AppState));
+    if (!job->scratch) {
+        free(job);
+        return;
+    }
+    pthread_mutex_init(&job->mutex, NULL);
+    snprintf(job->path, sizeof(job->path), "%s", st->snapshot_file);
+    AppState *s = job->scratch;
+    snprintf(s->playlists_dir, sizeof(s->playlists_dir), "%s", st->playlists_dir);
+    snprintf(s->playlists_index, sizeof(s->playlists_index), "%s", st->playlists_index);
+    snprintf(s->config.download_path, sizeof(s->config.download_path), "%s", st->config.download_path);
+
+    if (pthread_create(&job->thread, NULL, snapshot_build_thread_func, job) != 0) {
+        snapshot_build_free(job);
+        return;
+    }
+    st->snapshot_build = job;
+}
+
+static void library_snapshot_poll(AppState *st) {
+    SnapshotBuild *job = st->snapshot_build;
+    if (!job) return;
+    pthread_mutex_lock(&job->mutex);
+    bool finished = job->finished;
+    pthread_mutex_unlock(&job->mutex);
+    if (!finished) return;
+    pthread_join(job->thread, NULL);
+    snapshot_build_free(job);
+    st->snapshot_build = NULL;
+}
+
+static void library_snapshot_cancel(AppState *st) {
+    SnapshotBuild *job = st->snapshot_build;
+    if (!job) return;
+    pthread_mutex_lock(&job->mutex);
+    job->cancelled = true;
+    pthread_mutex_unlock(&job->mutex);
+    pthread_join(job->thread, NULL);
+    snapshot_build_free(job);
+    st->snapshot_build = NULL;
+}
+
+// True if the snapshot loaded at startup still matches the files and
+// the download folders
+static bool library_snapshot_current(AppState *st) {
+    LibrarySnapshot *snap = &st->snapshot;
+    if (!snap->map || !snapshot_current(snap)) return false;
+    const SnapshotHeader *h = snapshot_header(snap);
+    const SnapshotDir *dirs = snapshot_section(snap, SNAP_DIRS);
+    for (uint64_t i = 0; i < h->counts[SNAP_DIRS]; i++) {
+        struct stat sb;
+        const char *path = snapshot_str(snap, dirs[i].path);
+        if (!path || stat(path, &sb) != 0 || stat_mtime_ns(&sb) != dirs[i].mtime_ns) return false;
+    }
+    return true;
+}
+
+// At exit, once the saves are on disk and the writer has stopped: unless
+// the snapshot loaded is still current, write a new one from memory,
+// loading first whatever playlists the session didn't open
+static void library_snapshot_save(AppState *st) {
+    if (library_snapshot_current(st)) return;
+    if (!st->songs_complete) {
+        load_all_playlist_songs(st);
+        saves_commit(st);  // a journal repaired on the way
+    }
+    // A save that didn't make it leaves memory ahead of the files
+    char failed[PATH_MAX];
+    if (persist_failed(failed, sizeof(failed))) return;
+    for (int i = 0; i < st->playlist_count; i++) {
+        if (st->playlists[i].dirty) return;
+    }
+
+    SnapshotWriter w = {0};
+    snapshot_add_source(&w, st->playlists_index);
+    for (int i = 0; i < st->playlist_count; i++) {
+        snapshot_add_playlist_sources(&w, st, i);
+    }
+    char *data;
+    size_t len;
+    if (snapshot_render(&w, st, &data, &len)) persist_write(st->snapshot_file, data, len, NULL);
+    snapshot_writer_free(&w);
+}
+
+// ============================================================================
+// MPV IPC Communication
+// ============================================================================
+
+// Receive buffer for IPC messages (one JSON object per line, may span reads)
+static char mpv_ipc_buf[8192];
+static size_t mpv_ipc_len = 0;
+
+static void mpv_disconnect(void) {
+    mpv_ipc_len = 0;
+    if (mpv_ipc_fd >= 0) {
+        sb_log("[PLAYBACK] mpv_disconnect: closing IPC fd=%d", mpv_ipc_fd);
+        close(mpv_ipc_fd);
+        mpv_ipc_fd = -1;
+    }
+}
+
+static bool mpv_connect(void) {
+    if (mpv_ipc_fd >= 0) {
+        sb_log("[PLAYBACK] mpv_connect: already connected (fd=%d)", mpv_ipc_fd);
+        return true;
+    }
+    if (!file_exists(IPC_SOCKET)) {
+        sb_log("[PLAYBACK] mpv_connect: IPC socket %s does not exist", IPC_SOCKET);
+        return false;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        sb_log("[PLAYBACK] mpv_connect: socket() failed: %s (errno=%d)", strerror(errno), errno);
+        return false;
+    }
+
+    // Set non-blocking
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, IPC_SOCKET, sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        sb_log("[PLAYBACK] mpv_connect: connect() to %s failed: %s (errno=%d)", IPC_SOCKET, strerror(errno), errno);
+        close(fd);
+        return false;
+    }
+
+    mpv_ipc_fd = fd;
+    sb_log("[PLAYBACK] mpv_connect: connected to mpv IPC socket (fd=%d)", fd);
+
+    // Enable end-file event observation, plus the cache properties that
+    // drive adaptive stream quality
+    const char *observe_cmd =
+        "{\"command\":[\"observe_property\",1,\"eof-reached\"]}\n"
+        "{\"command\":[\"observe_property\",2,\"paused-for-cache\"]}\n"
+        "{\"command\":[\"observe_property\",3,\"demuxer-cache-duration\"]}\n"
+        "{\"command\":[\"observe_property\",4,\"cache-speed\"]}\n";
+    ssize_t w = write(mpv_ipc_fd, observe_cmd, strlen(observe_cmd));
+    if (w < 0) {
+        sb_log("[PLAYBACK] mpv_connect: failed to send observe command: %s", strerror(errno));
+    }
+    (void)w;
+
+    return true;
+}
+
+static void mpv_send_command(const char *cmd) {
+    sb_log("[PLAYBACK] mpv_send_command: sending: %s", cmd);
+    if (!mpv_connect()) {
+        sb_log("[PLAYBACK] mpv_send_command: persistent connection failed, trying one-shot");
+        // Try one-shot connection
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            sb_log("[PLAYBACK] mpv_send_command: one-shot socket() failed: %s", strerror(errno));
+            return;
+        }
+
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, IPC_SOCKET, sizeof(addr.sun_path) - 1);
+
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            ssize_t w = write(fd, cmd, strlen(cmd));
+            w = write(fd, "\n", 1);
+            sb_log("[PLAYBACK] mpv_send_command: one-shot command sent (bytes=%zd)", w);
+            (void)w;
+        } else {
+            sb_log("[PLAYBACK] mpv_send_command: one-shot connect() failed: %s", strerror(errno));
+        }
+        close(fd);
+        return;
+    }
+
+    ssize_t w = write(mpv_ipc_fd, cmd, strlen(cmd));
+    if (w < 0) {
+        sb_log("[PLAYBACK] mpv_send_command: write failed: %s (errno=%d)", strerror(errno), errno);
+    } else {
+        sb_log("[PLAYBACK] mpv_send_command: sent %zd bytes on fd=%d", w, mpv_ipc_fd);
+    }
+    w = write(mpv_ipc_fd, "\n", 1);
+    (void)w;
+}
+
+static void mpv_toggle_pause(void) {
+    sb_log("[PLAYBACK] mpv_toggle_pause called");
+    mpv_send_command("{\"command\":[\"cycle\",\"pause\"]}");
+}
+
+static void mpv_stop_playback(void) {
+    sb_log("[PLAYBACK] mpv_stop_playback called");
+    mpv_send_command("{\"command\":[\"stop\"]}");
+}
+
+static void mpv_seek(int seconds) {
+    sb_log("[PLAYBACK] mpv_seek: seeking %+d seconds", seconds);
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "{\"command\":[\"seek\",\"%d\",\"relative\"]}", seconds);
+    mpv_send_command(cmd);
+}
+
+static void mpv_seek_absolute(int seconds) {
+    sb_log("[PLAYBACK] mpv_seek_absolute: seeking to %d seconds", seconds);
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "{\"command\":[\"seek\",\"%d\",\"absolute\"]}", seconds);
+    mpv_send_command(cmd);
+}
+
+// Load a URL, optionally with per-file options (e.g. "start=42,pause=yes").
+// Options only apply to this file; mpv restores them when the file ends.
+// flags is "replace" (play now, clears mpv's playlist) or "append".
+static void mpv_load_url(const char *url, const char *options, const char *flags) {
+    sb_log("[PLAYBACK] mpv_load_url: loading URL: %s (flags=%s options=%s)", url, flags,
+           options ? options : "none");
+
+    char *escaped = NULL;
+    size_t n = 0;
+    FILE *mem = open_memstream(&escaped, &n);
+    if (!mem) {
+        sb_log("[PLAYBACK] mpv_load_url: open_memstream failed: %s", strerror(errno));
+        return;
+    }
+
+    fputc('"', mem);
+    for (const char *p = url; *p; p++) {
+        if (*p == '"' || *p == '\\') fputc('\\', mem);
+        fputc(*p, mem);
+    }
+    fputc('"', mem);
+    fclose(mem);
+
+    char cmd[4096];
+    if (options && options[0]) {
+        // Named arguments keep the options slot stable across mpv versions
+        // (0.38 inserted an "index" argument before "options")
+        snprintf(cmd, sizeof(cmd),
+                 "{\"command\":{\"name\":\"loadfile\",\"url\":%s,"
+                 "\"flags\":\"%s\",\"options\":\"%s\"}}", escaped, flags, options);
+    } else {
+        snprintf(cmd, sizeof(cmd),
+                 "{\"command\":[\"loadfile\",%s,\"%s\"]}", escaped, flags);
+    }
+    free(escaped);
+
+    sb_log("[PLAYBACK] mpv_load_url: sending loadfile command to mpv");
+    mpv_send_command(cmd);
+}
+
+// Synchronously query a numeric property. Events that arrive while waiting
+// for the reply are dropped, so this is only meant for shutdown/one-off use.
+static bool mpv_get_property_double(const char *name, double *out) {
+    if (!mpv_connect()) return false;
+
+    static int request_id = 1000;
+    int id = ++request_id;
+
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd),
+             "{\"command\":[\"get_property\",\"%s\"],\"request_id\":%d}\n", name, id);
+    if (write(mpv_ipc_fd, cmd, strlen(cmd)) < 0) {
+        sb_log("[PLAYBACK] mpv_get_property: write failed: %s", strerror(errno));
+        return false;
+    }
+
+    char id_pattern[32];
+    snprintf(id_pattern, sizeof(id_pattern), "\"request_id\":%d", id);
+
+    char buf[8192];
+    size_t len = 0;
+    for (int waited = 0; waited < 500; waited += 20) {
+        struct pollfd pfd = { .fd = mpv_ipc_fd, .events = POLLIN };
+        if (poll(&pfd, 1, 20) <= 0) continue;
+
+        ssize_t n = read(mpv_ipc_fd, buf + len, sizeof(buf) - 1 - len);
+        if (n <= 0) {
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return false;
+            continue;
+        }
+        len += (size_t)n;
+        buf[len] = '\0';
+
+        // Scan complete lines for our reply
+        char *line = buf;
+        char *nl;
+        while ((nl = strchr(line, '\n')) != NULL) {
+            *nl = '\0';
+            if (strstr(line, id_pattern)) {
+                const char *data = strstr(line, "\"data\":");
+                bool ok = strstr(line, "\"error\":\"success\"") != NULL;
+                if (ok && data) {
+                    *out = atof(data + 7);
+                    sb_log("[PLAYBACK] mpv_get_property: %s = %.2f", name, *out);
+                    return true;
+                }
+                return false;
+            }
+            line = nl + 1;
+        }
+
+        // Keep the partial trailing line for the next read
+        len = strlen(line);
+        memmove(buf, line, len + 1);
+        if (len >= sizeof(buf) - 1) len = 0;
+    }
+
+    sb_log("[PLAYBACK] mpv_get_property: timed out waiting for %s", name);
+    return false;
+}
+
+static void mpv_start_if_needed(AppState *st) {
+    sb_log("[PLAYBACK] mpv_start_if_needed: checking if mpv is running...");
+    if (file_exists(IPC_SOCKET) && mpv_connect()) {
+        sb_log("[PLAYBACK] mpv_start_if_needed: mpv already running and connected");
+        return;
+    }
+
+    sb_log("[PLAYBACK] mpv_start_if_needed: mpv not running, starting new instance...");
+    unlink(IPC_SOCKET);
+    mpv_disconnect();
+
+    // Build ytdl_hook path option so mpv can find yt-dlp. The helper's client
+    // script resolves through the running helper and falls back to yt-dlp.
+    const char *ytdlp_path = ytdlp_helper_client();
+    if (!ytdlp_path) ytdlp_path = get_ytdlp_cmd(st);
+    char ytdl_opt[1200];
+    snprintf(ytdl_opt, sizeof(ytdl_opt), "--script-opts=ytdl_hook-ytdl_path=%s", ytdlp_path);
+    sb_log("[PLAYBACK] mpv_start_if_needed: yt-dlp path for mpv: %s", ytdlp_path);
 
     pid_t pid = fork();
     if (pid == 0) {
@@ -1881,247 +3944,3179 @@ static void mpv_start_if_needed(AppState *st) {
             dup2(fd, STDERR_FILENO);
             close(fd);
         }
-        execlp("mpv", "mpv",
-               "--no-video",
-               "--idle=yes",
-               "--force-window=no",
-               "--really-quiet",
-               "--input-ipc-server=" IPC_SOCKET,
-               ytdl_opt,
-               (char *)NULL);
-        _exit(127);
+        execlp("mpv", "mpv",
+               "--no-video",
+               "--idle=yes",
+               "--force-window=no",
+               "--really-quiet",
+               "--input-ipc-server=" IPC_SOCKET,
+               ytdl_opt,
+               (char *)NULL);
+        _exit(127);
+    }
+
+    if (pid < 0) {
+        sb_log("[PLAYBACK] mpv_start_if_needed: fork() failed: %s (errno=%d)", strerror(errno), errno);
+        return;
+    }
+
+    sb_log("[PLAYBACK] mpv_start_if_needed: mpv forked with pid=%d, waiting for IPC socket...", pid);
+    mpv_pid = pid;
+    bool connected = false;
+    for (int i = 0; i < 100; i++) {
+        if (file_exists(IPC_SOCKET)) {
+            sb_log("[PLAYBACK] mpv_start_if_needed: IPC socket appeared after %d ms", (i + 1) * 50);
+            usleep(50 * 1000);
+            if (mpv_connect()) {
+                sb_log("[PLAYBACK] mpv_start_if_needed: successfully connected to mpv (pid=%d)", pid);
+                connected = true;
+            } else {
+                sb_log("[PLAYBACK] mpv_start_if_needed: IPC socket exists but connect failed");
+            }
+            break;
+        }
+        usleep(50 * 1000);
+    }
+    if (!connected) {
+        sb_log("[PLAYBACK] mpv_start_if_needed: WARNING - failed to connect after 5s timeout (pid=%d)", pid);
+    }
+}
+
+static void mpv_quit(void) {
+    sb_log("[PLAYBACK] mpv_quit: shutting down mpv (pid=%d)", mpv_pid);
+    mpv_send_command("{\"command\":[\"quit\"]}");
+    usleep(100 * 1000);
+
+    mpv_disconnect();
+
+    if (mpv_pid > 0) {
+        kill(mpv_pid, SIGTERM);
+        waitpid(mpv_pid, NULL, WNOHANG);
+        sb_log("[PLAYBACK] mpv_quit: sent SIGTERM to pid=%d", mpv_pid);
+        mpv_pid = -1;
+    }
+    unlink(IPC_SOCKET);
+    sb_log("[PLAYBACK] mpv_quit: cleanup complete");
+}
+
+// ============================================================================
+// Adaptive Stream Quality
+// ============================================================================
+
+// Evaluate the stream that just finished and pick the tier for the next one.
+// Stalls or a draining cache step down; a healthy cache with plenty of
+// measured throughput steps up.
+static void stream_quality_choose(AppState *st) {
+    StreamHealth *h = &st->stream;
+
+    if (st->config.stream_quality != QUALITY_AUTO) {
+        h->tier = st->config.stream_quality;
+        return;
+    }
+
+    // Nothing to judge yet (first stream or too short to say anything)
+    if (h->current_tier < 0 || time(NULL) - h->track_started < 10) return;
+
+    int old_tier = h->tier;
+    double kbps = h->speed_avg * 8.0 / 1000.0;
+
+    if (h->stalls > 0 || h->min_cache < 3.0) {
+        if (h->tier > 0) h->tier--;
+    } else if (h->tier + 1 < STREAM_TIER_COUNT && h->min_cache >= 10.0 &&
+               kbps > 4.0 * stream_tiers[h->tier + 1].kbps) {
+        h->tier++;
+    }
+
+    if (h->tier != old_tier) {
+        sb_log("[PLAYBACK] stream quality: %s -> %s (stalls=%d min_cache=%.1fs speed=%.0fkbps)",
+               stream_tiers[old_tier].name, stream_tiers[h->tier].name,
+               h->stalls, h->min_cache, kbps);
+    }
+}
+
+// Build per-file options for a track: local files skip the network cache,
+// streams get the readahead profile and format of the current tier.
+// Returns the tier used, -1 for local files.
+static int stream_profile_options(AppState *st, const char *url, char *out, size_t out_size) {
+    StreamHealth *h = &st->stream;
+
+    if (url[0] == '/') {
+        snprintf(out, out_size, "cache=no");
+        return -1;
+    }
+    snprintf(out, out_size,
+             "cache=yes,demuxer-readahead-secs=%d,demuxer-max-bytes=%s,ytdl-format=%s",
+             stream_tiers[h->tier].readahead_secs, stream_tiers[h->tier].max_bytes,
+             stream_tiers[h->tier].ytdl_format);
+    return h->tier;
+}
+
+// Reset health tracking for a track that just started playing
+static void stream_track_started(AppState *st, int tier) {
+    StreamHealth *h = &st->stream;
+    h->current_tier = tier;
+    h->cache_duration = 0;
+    h->min_cache = 1e9;
+    h->stalls = 0;
+    h->paused_for_cache = false;
+    h->track_started = time(NULL);
+}
+
+static double ipc_get_number(const char *line, const char *key) {
+    const char *p = strstr(line, key);
+    if (!p) return -1;
+    p += strlen(key);
+    if (strncmp(p, "true", 4) == 0) return 1;
+    if (strncmp(p, "false", 5) == 0) return 0;
+    return atof(p);
+}
+
+static void handle_property_change(AppState *st, const char *line) {
+    StreamHealth *h = &st->stream;
+    if (h->current_tier < 0) return;  // local playback, nothing to adapt
+
+    // Skip the warm-up where the cache is still filling
+    bool warmed_up = time(NULL) - h->track_started >= 5;
+
+    if (strstr(line, "\"name\":\"paused-for-cache\"")) {
+        bool paused = ipc_get_number(line, "\"data\":") > 0;
+        if (paused && !h->paused_for_cache && warmed_up) {
+            h->stalls++;
+            sb_log("[PLAYBACK] stream stalled (paused-for-cache), stalls=%d", h->stalls);
+        }
+        h->paused_for_cache = paused;
+    } else if (strstr(line, "\"name\":\"demuxer-cache-duration\"")) {
+        double d = ipc_get_number(line, "\"data\":");
+        if (d >= 0) {
+            h->cache_duration = d;
+            if (warmed_up && d < h->min_cache) h->min_cache = d;
+        }
+    } else if (strstr(line, "\"name\":\"cache-speed\"")) {
+        double speed = ipc_get_number(line, "\"data\":");
+        // cache-speed drops to 0 once readahead is full; only average while downloading
+        if (speed > 0) {
+            h->speed_avg = h->speed_avg > 0 ? 0.8 * h->speed_avg + 0.2 * speed : speed;
+        }
+    }
+}
+
+// Drain pending IPC messages: track property changes and detect track end.
+// Tracks replaced or stopped ("stop") don't count as ended.
+static TrackEnd mpv_poll_events(AppState *st) {
+    if (mpv_ipc_fd < 0) return TRACK_PLAYING;
+
+    TrackEnd track_ended = TRACK_PLAYING;
+
+    for (;;) {
+        if (mpv_ipc_len >= sizeof(mpv_ipc_buf) - 1) {
+            // A single message larger than the buffer: drop it
+            mpv_ipc_len = 0;
+        }
+
+        ssize_t n = read(mpv_ipc_fd, mpv_ipc_buf + mpv_ipc_len,
+                         sizeof(mpv_ipc_buf) - 1 - mpv_ipc_len);
+        if (n <= 0) {
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                // Connection lost
+                sb_log("[PLAYBACK] mpv_poll_events: connection lost: %s (errno=%d)", strerror(errno), errno);
+                mpv_disconnect();
+            }
+            break;
+        }
+        mpv_ipc_len += (size_t)n;
+        mpv_ipc_buf[mpv_ipc_len] = '\0';
+
+        char *line = mpv_ipc_buf;
+        char *nl;
+        while ((nl = strchr(line, '\n')) != NULL) {
+            *nl = '\0';
+
+            if (strstr(line, "\"event\":\"property-change\"")) {
+                handle_property_change(st, line);
+            } else if (strstr(line, "\"event\":\"end-file\"")) {
+                sb_log("[PLAYBACK] mpv_poll_events: %.200s", line);
+                char *reason = json_get_string(line, "reason");
+                if (reason) stats_track_ended(st, reason);
+                free(reason);
+                // Only trigger on reason "eof" (not "error" or "stop")
+                if (strstr(line, "\"reason\":\"eof\"")) {
+                    sb_log("[PLAYBACK] mpv_poll_events: track ended (EOF)");
+                    track_ended = TRACK_EOF;
+                } else if (strstr(line, "\"reason\":\"error\"")) {
+                    // Useful for debugging stream failures
+                    sb_log("[PLAYBACK] mpv_poll_events: WARNING - track ended with ERROR");
+                    if (track_ended == TRACK_PLAYING) track_ended = TRACK_ERROR;
+                }
+            }
+
+            line = nl + 1;
+        }
+
+        // Keep the partial trailing message for the next read
+        mpv_ipc_len = strlen(line);
+        memmove(mpv_ipc_buf, line, mpv_ipc_len + 1);
+    }
+
+    return track_ended;
+}
+
+// ============================================================================
+// Search Cache
+// ============================================================================
+
+// Normalize a query for cache lookups: trimmed, lowercase, single spaces
+static void search_cache_key(const char *query, char *out, size_t out_size) {
+    size_t j = 0;
+    bool space = false;
+    for (const char *p = query; *p && j + 1 < out_size; p++) {
+        if (isspace((unsigned char)*p)) {
+            space = j > 0;
+            continue;
+        }
+        if (space && j + 2 < out_size) out[j++] = ' ';
+        space = false;
+        out[j++] = tolower((unsigned char)*p);
+    }
+    out[j] = '\0';
+}
+
+static void search_cache_path(AppState *st, const char *key, char *out, size_t out_size) {
+    snprintf(out, out_size, "%s/%08x.json", st->search_cache_dir, str_hash(key));
+}
+
+static void lru_unlink(SearchCache *c, int i) {
+    SearchCacheEntry *e = &c->entries[i];
+    if (e->prev >= 0) c->entries[e->prev].next = e->next; else c->head = e->next;
+    if (e->next >= 0) c->entries[e->next].prev = e->prev; else c->tail = e->prev;
+    e->prev = e->next = -1;
+}
+
+static void lru_push_front(SearchCache *c, int i) {
+    SearchCacheEntry *e = &c->entries[i];
+    e->prev = -1;
+    e->next = c->head;
+    if (c->head >= 0) c->entries[c->head].prev = i;
+    c->head = i;
+    if (c->tail < 0) c->tail = i;
+}
+
+// Drop entry i (and its results file), moving the last entry into its slot
+static void search_cache_remove(AppState *st, int i) {
+    SearchCache *c = &st->search_cache;
+    char path[16384 + 32];
+    search_cache_path(st, c->entries[i].query, path, sizeof(path));
+    persist_unlink(path);  // after a write of it still queued
+
+    lru_unlink(c, i);
+    strmap_remove(&c->index, c->entries[i].query);
+    free(c->entries[i].query);
+
+    int last = c->count - 1;
+    if (i != last) {
+        SearchCacheEntry *e = &c->entries[i];
+        *e = c->entries[last];
+        if (e->prev >= 0) c->entries[e->prev].next = i; else c->head = i;
+        if (e->next >= 0) c->entries[e->next].prev = i; else c->tail = i;
+        strmap_put(&c->index, e->query, i);
+    }
+    c->count--;
+    c->dirty = true;
+}
+
+static int search_cache_add(SearchCache *c, const char *key) {
+    if (c->count == c->cap) {
+        int new_cap = c->cap ? c->cap * 2 : 64;
+        SearchCacheEntry *entries = realloc(c->entries, sizeof(SearchCacheEntry) * new_cap);
+        if (!entries) return -1;
+        c->entries = entries;
+        c->cap = new_cap;
+    }
+    int i = c->count;
+    c->entries[i].query = strdup(key);
+    if (!c->entries[i].query) return -1;
+    if (!strmap_put(&c->index, key, i)) {
+        free(c->entries[i].query);
+        return -1;
+    }
+    c->entries[i].fetched = 0;
+    c->count++;
+    lru_push_front(c, i);
+    c->dirty = true;
+    return i;
+}
+
+// Find a cached query and mark it most recently used. Returns -1 if absent.
+static int search_cache_lookup(AppState *st, const char *key) {
+    SearchCache *c = &st->search_cache;
+    int i = strmap_get(&c->index, key);
+    if (i >= 0 && c->head != i) {
+        lru_unlink(c, i);
+        lru_push_front(c, i);
+        c->dirty = true;
+    }
+    return i;
+}
+
+// Read the results of entry i into a new array, their titles in arena.
+// Returns the number of songs, -1 if the file is missing or belongs to
+// another query (hash collision).
+static int search_cache_read(AppState *st, int i, Song **out, Arena *arena) {
+    char path[16384 + 32];
+    search_cache_path(st, st->search_cache.entries[i].query, path, sizeof(path));
+
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+
+    // The query is written ahead of the results: a file whose name hash
+    // collides with another query's stops there
+    JsonReader r;
+    json_reader_init(&r, f);
+    bool match = false;
+    int count = 0;
+    *out = NULL;
+    if (json_next(&r) == JSON_OBJECT) {
+        while (json_next(&r) == JSON_KEY) {
+            if (json_text_is(&r, "query")) {
+                const char *query = json_read_str(&r, NULL);
+                match = query && strcmp(query, st->search_cache.entries[i].query) == 0;
+                if (!match) break;
+            } else if (json_text_is(&r, "results") && match && !*out) {
+                count = json_read_songs(&r, out, arena);
+            } else {
+                json_skip(&r);
+            }
+        }
+    }
+    json_reader_free(&r);
+    fclose(f);
+    return match ? count : -1;
+}
+
+static void save_search_cache_index(AppState *st) {
+    SearchCache *c = &st->search_cache;
+    char path[16384 + 32];
+    snprintf(path, sizeof(path), "%s/%s", st->search_cache_dir, SEARCH_CACHE_INDEX);
+
+    // Most recently used first
+    MemRender m;
+    if (!render_begin(&m)) return;
+    json_printf(&m.w, "{\n  \"entries\": [\n");
+    for (int i = c->head; i >= 0; i = c->entries[i].next) {
+        json_printf(&m.w, "    {\"query\": %q, \"fetched\": %lld}%s\n",
+                    c->entries[i].query, (long long)c->entries[i].fetched,
+                    c->entries[i].next >= 0 ? "," : "");
+    }
+    json_printf(&m.w, "  ]\n}\n");
+    if (render_end(&m)) persist_write(path, m.data, m.len, NULL);
+    c->dirty = false;
+}
+
+static void load_search_cache_index(AppState *st) {
+    SearchCache *c = &st->search_cache;
+    c->head = c->tail = -1;
+
+    char path[16384 + 32];
+    snprintf(path, sizeof(path), "%s/%s", st->search_cache_dir, SEARCH_CACHE_INDEX);
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+
+    JsonReader r;
+    json_reader_init(&r, f);
+    if (json_next(&r) == JSON_OBJECT) {
+        while (json_next(&r) == JSON_KEY) {
+            if (!json_text_is(&r, "entries") || json_next(&r) != JSON_ARRAY) {
+                json_skip(&r);
+                continue;
+            }
+
+            JsonToken t;
+            while ((t = json_next(&r)) == JSON_OBJECT) {
+                char query[256] = "";  // fits any search_cache_key
+                time_t fetched = 0;
+                while (json_next(&r) == JSON_KEY) {
+                    if (json_text_is(&r, "query")) {
+                        json_read_string(&r, query, sizeof(query));
+                    } else if (json_text_is(&r, "fetched")) {
+                        fetched = (time_t)json_read_int(&r, 0);
+                    } else {
+                        json_skip(&r);
+                    }
+                }
+
+                if (!query[0] || strmap_get(&c->index, query) >= 0) continue;
+                int i = search_cache_add(c, query);
+                if (i >= 0) {
+                    // Listed most recent first: keep file order
+                    lru_unlink(c, i);
+                    c->entries[i].prev = c->tail;
+                    if (c->tail >= 0) c->entries[c->tail].next = i; else c->head = i;
+                    c->tail = i;
+                    c->entries[i].fetched = fetched;
+                }
+            }
+            if (t != JSON_ARRAY_END) json_leave(&r);
+        }
+    }
+    json_reader_free(&r);
+    fclose(f);
+
+    while (c->count > st->config.search_cache_size) search_cache_remove(st, c->tail);
+    c->dirty = false;
+    sb_log("[PLAYBACK] load_search_cache_index: %d cached searches", c->count);
+}
+
+// Write results for a query and make it the most recent entry, evicting
+// the least recently used ones past the size limit
+static void search_cache_store(AppState *st, const char *key, const Song *songs, int count) {
+    SearchCache *c = &st->search_cache;
+    if (st->config.search_cache_ttl <= 0 || !key[0] || count <= 0) return;
+
+    int i = search_cache_lookup(st, key);
+    if (i < 0) i = search_cache_add(c, key);
+    if (i < 0) return;
+
+    char path[16384 + 32];
+    search_cache_path(st, key, path, sizeof(path));
+    MemRender m;
+    if (!render_begin(&m)) return;
+    json_printf(&m.w, "{\n  \"query\": %q,\n  \"fetched\": %lld,\n  \"results\": [\n",
+                key, (long long)time(NULL));
+    for (int j = 0; j < count; j++) {
+        json_write_song(&m.w, &songs[j], j == count - 1);
+    }
+    json_printf(&m.w, "  ]\n}\n");
+    if (render_end(&m)) persist_write(path, m.data, m.len, NULL);
+
+    c->entries[i].fetched = time(NULL);
+    c->dirty = true;
+    while (c->count > st->config.search_cache_size) search_cache_remove(st, c->tail);
+    save_search_cache_index(st);
+}
+
+static void search_cache_free(SearchCache *c) {
+    for (int i = 0; i < c->count; i++) free(c->entries[i].query);
+    free(c->entries);
+    strmap_free(&c->index);
+    memset(c, 0, sizeof(*c));
+    c->head = c->tail = -1;
+}
+
+// ============================================================================
+// Search Functions
+// ============================================================================
+
+static void free_song_list(SongList *list) {
+    arena_free(&list->strings);
+    free(list->items);
+    shuffle_free(&list->shuffle);
+    memset(list, 0, sizeof(*list));
+}
+
+// Drop the detached search list once playback moves to another list
+static void release_played_search(AppState *st) {
+    if (!st->search_detached) return;
+    free_song_list(&st->played_search);
+    st->search_detached = false;
+}
+
+// The search list that search playback runs on
+static Song *playing_search_songs(AppState *st, int *count) {
+    if (st->search_detached) {
+        *count = st->played_search.count;
+        return st->played_search.items;
+    }
+    *count = st->search_count;
+    return st->search_results;
+}
+
+static void song_to_add_clear(AppState *st) {
+    free(st->song_to_add.title);
+    memset(&st->song_to_add, 0, sizeof(st->song_to_add));
+}
+
+// The add-to-playlist dialog keeps its own copy: search results can be
+// replaced while it's open
+static bool song_to_add_set(AppState *st, const Song *song) {
+    song_to_add_clear(st);
+    char *title = strdup(song->title ? song->title : "");
+    if (!title) return false;
+    st->song_to_add = *song;
+    st->song_to_add.title = title;
+    return true;
+}
+
+static void free_search_results(AppState *st) {
+    // Results being played move to played_search so auto-advance keeps working
+    if (st->playing_index >= 0 && !st->playing_from_playlist && !st->search_detached &&
+        st->search_count > 0) {
+        SongList *list = &st->played_search;
+        list->items = st->search_results;
+        list->count = st->search_count;
+        list->strings = st->search_strings;
+        st->search_strings.blocks = NULL;
+        snprintf(list->query, sizeof(list->query), "%s", st->query);
+        list->shuffle = st->search_shuffle;
+        memset(&st->search_shuffle, 0, sizeof(st->search_shuffle));
+        st->search_detached = true;
+        sb_log("[PLAYBACK] free_search_results: keeping %d playing results for \"%s\"",
+               list->count, list->query);
+    } else {
+        arena_free(&st->search_strings);
+        free(st->search_results);
+    }
+
+    st->search_results = NULL;
+    st->search_cap = 0;
+    st->search_fetched = 0;
+    st->search_more = false;
+    st->search_count = 0;
+    st->search_selected = 0;
+    st->search_scroll = 0;
+    shuffle_free(&st->search_shuffle);
+}
+
+static bool search_results_reserve(AppState *st, int n) {
+    if (n <= st->search_cap) return true;
+    int new_cap = st->search_cap ? st->search_cap : MAX_RESULTS;
+    while (new_cap < n) new_cap *= 2;
+    Song *songs = realloc(st->search_results, sizeof(Song) * new_cap);
+    if (!songs) return false;
+    st->search_results = songs;
+    st->search_cap = new_cap;
+    return true;
+}
+
+// Parse one "title|||id|||duration" line printed by yt-dlp, the title
+// going into arena. Returns false for noise lines or when out of memory.
+static bool parse_search_line(char *line, Song *out, Arena *arena) {
+    size_t len = strlen(line);
+    while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) {
+        line[--len] = '\0';
+    }
+
+    if (!line[0]) return false;
+    if (strncmp(line, "ERROR", 5) == 0) return false;
+    if (strncmp(line, "WARNING", 7) == 0) return false;
+
+    char *sep1 = strstr(line, "|||");
+    if (!sep1) return false;
+    *sep1 = '\0';
+
+    char *sep2 = strstr(sep1 + 3, "|||");
+    if (!sep2) return false;
+    *sep2 = '\0';
+
+    const char *title = line;
+    const char *video_id = sep1 + 3;
+    const char *duration_str = sep2 + 3;
+
+    if (strlen(video_id) < 5 || !song_set_video_id(out, video_id)) return false;
+
+    out->title = arena_strdup(arena, title);
+    out->duration = atoi(duration_str);
+    return out->title != NULL;
+}
+
+static void search_job_free(SearchJob *job) {
+    arena_free(&job->strings);
+    pthread_mutex_destroy(&job->mutex);
+    free(job);
+}
+
+// Reads yt-dlp's output into the job's staging buffer. The thread is
+// detached: whichever of the thread and search_cancel sees the other side
+// already gone frees the job.
+static void *search_thread_func(void *arg) {
+    SearchJob *job = arg;
+
+    FILE *fp = fdopen(job->fd, "r");
+    if (fp) {
+        char *line = NULL;
+        size_t cap = 0;
+        while (getline(&line, &cap, fp) != -1) {
+            // Only this thread allocates in the arena; the UI thread just
+            // reads the titles of rows below count
+            Song song;
+            if (!parse_search_line(line, &song, &job->strings)) continue;
+
+            pthread_mutex_lock(&job->mutex);
+            bool keep = !job->cancelled && job->count < MAX_RESULTS;
+            if (keep) job->results[job->count++] = song;
+            bool stop = job->cancelled;
+            pthread_mutex_unlock(&job->mutex);
+            if (stop) break;
+        }
+        free(line);
+    }
+
+    // search_cancel may shut the socket down until fd is cleared
+    pthread_mutex_lock(&job->mutex);
+    int fd = job->fd;
+    job->fd = -1;
+    pthread_mutex_unlock(&job->mutex);
+    if (fp) {
+        fclose(fp);
+    } else {
+        close(fd);
+    }
+
+    // Wait without reaping so the pid can't be reused while it may still be killed
+    pid_t child = job->child;
+    if (child > 0) {
+        siginfo_t info;
+        waitid(P_PID, child, &info, WEXITED | WNOWAIT);
+    }
+    pthread_mutex_lock(&job->mutex);
+    job->child = -1;
+    job->finished = true;
+    bool cancelled = job->cancelled;
+    pthread_mutex_unlock(&job->mutex);
+    if (child > 0) waitpid(child, NULL, 0);
+
+    if (cancelled) search_job_free(job);
+    return NULL;
+}
+
+// Stop a search job, killing yt-dlp or hanging up on the helper. The job
+// must not be used afterwards.
+static void search_job_cancel(SearchJob *job) {
+    pthread_mutex_lock(&job->mutex);
+    job->cancelled = true;
+    if (job->child > 0) {
+        kill(-job->child, SIGTERM);
+    } else if (job->fd >= 0) {
+        shutdown(job->fd, SHUT_RDWR);
+    }
+    bool finished = job->finished;
+    pthread_mutex_unlock(&job->mutex);
+
+    sb_log("[PLAYBACK] search_cancel: query=\"%s\"", job->query);
+    if (finished) search_job_free(job);
+}
+
+// Stop the running search, if any
+static void search_cancel(AppState *st) {
+    SearchJob *job = st->search_job;
+    if (!job) return;
+    st->search_job = NULL;
+    search_job_cancel(job);
+}
+
+// Launch yt-dlp for query on a detached reader thread, fetching up to limit
+// (at most MAX_RESULTS) results. offset > 0 fetches the page after the
+// first offset results.
+static SearchJob *search_spawn(AppState *st, const char *query, bool refresh, int offset,
+                               int limit) {
+    SearchJob *job = calloc(1, sizeof(SearchJob));
+    if (!job) return NULL;
+    pthread_mutex_init(&job->mutex, NULL);
+    snprintf(job->query, sizeof(job->query), "%s", query);
+    job->refresh = refresh;
+    job->offset = offset;
+
+    char target[512];
+    char items[32];
+    snprintf(target, sizeof(target), "ytsearch%d:%s", offset + limit, query);
+    snprintf(items, sizeof(items), "%d-%d", offset + 1, offset + limit);
+    // --lazy-playlist prints each result as soon as its page is parsed;
+    // --playlist-items skips the rows that are already loaded
+    char *argv[] = {
+        (char *)get_ytdlp_cmd(st), "--flat-playlist", "--lazy-playlist", "--quiet",
+        "--no-warnings", "--playlist-items", items,
+        "--print", "%(title)s|||%(id)s|||%(duration)s", target, NULL
+    };
+
+    // The warm helper skips yt-dlp's startup; fall back to a fresh process
+    job->child = -1;
+    job->fd = ytdlp_helper_list(target, offset + 1, offset + limit);
+    sb_log("[PLAYBACK] search_spawn: query=\"%s\" items=%s refresh=%d using %s",
+           query, items, refresh, job->fd >= 0 ? "helper" : argv[0]);
+    if (job->fd < 0) job->fd = ytdlp_spawn(argv, &job->child);
+    if (job->fd < 0) {
+        sb_log("[PLAYBACK] search_spawn: spawn failed: %s", strerror(errno));
+        search_job_free(job);
+        return NULL;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, search_thread_func, job) != 0) {
+        if (job->child > 0) {
+            kill(-job->child, SIGTERM);
+            waitpid(job->child, NULL, 0);
+        }
+        close(job->fd);
+        search_job_free(job);
+        return NULL;
+    }
+    pthread_detach(thread);
+    return job;
+}
+
+// Replace the search results with songs, taking ownership of the array
+// and of the arena holding their titles
+static void search_show(AppState *st, const char *query, Song *songs, int count, Arena *strings) {
+    free_search_results(st);
+    arena_merge(&st->search_strings, strings);
+    st->search_results = songs;
+    st->search_count = count;
+    st->search_cap = count;
+    st->search_fetched = count;
+    st->search_more = count > 0 && count % MAX_RESULTS == 0;
+    snprintf(st->query, sizeof(st->query), "%s", query);
+    // The playlist counts shown with the rows need every playlist's songs
+    if (count > 0 && !st->songs_complete) load_all_playlist_songs(st);
+}
+
+// While a new query is fetched, show the cached results of its longest
+// cached prefix that match the extra words, e.g. "daft punk" for "daft punk live"
+static void search_show_prefix_matches(AppState *st, const char *key, const char *query) {
+    char prefix[256];
+    snprintf(prefix, sizeof(prefix), "%s", key);
+
+    char *cut;
+    while ((cut = strrchr(prefix, ' ')) != NULL) {
+        *cut = '\0';
+        int ci = search_cache_lookup(st, prefix);
+        if (ci < 0) continue;
+
+        Song *cached = NULL;
+        Arena strings = {0};
+        int n = search_cache_read(st, ci, &cached, &strings);
+        if (n <= 0) {
+            arena_free(&strings);
+            continue;
+        }
+
+        // Keep the songs whose title contains every extra word
+        char words[256];
+        snprintf(words, sizeof(words), "%s", key + strlen(prefix) + 1);
+        int kept = 0;
+        for (int i = 0; i < n; i++) {
+            bool match = true;
+            char scratch[256];
+            snprintf(scratch, sizeof(scratch), "%s", words);
+            char *save = NULL;
+            for (char *w = strtok_r(scratch, " ", &save); w && match; w = strtok_r(NULL, " ", &save)) {
+                match = strcasestr(cached[i].title, w) != NULL;
+            }
+            if (match) cached[kept++] = cached[i];
+        }
+
+        if (kept > 0) {
+            sb_log("[PLAYBACK] search: showing %d rows cached for \"%s\" while fetching", kept, prefix);
+            search_show(st, query, cached, kept, &strings);
+            st->search_more = false;
+        } else {
+            arena_free(&strings);
+            free(cached);
+        }
+        return;
+    }
+}
+
+// Start a search, replacing any search still running. A fresh cache hit is
+// shown right away with no fetch; a stale one is shown while it refreshes
+// in the background. Otherwise rows are moved in by search_poll as they
+// arrive. Returns -1 on error, 0 for an empty query, 1 when a fetch was
+// started and 2 when cached results are shown.
+static int search_start(AppState *st, const char *raw_query) {
+    char query_buf[256];
+    strncpy(query_buf, raw_query, sizeof(query_buf) - 1);
+    query_buf[sizeof(query_buf) - 1] = '\0';
+    char *query = trim_whitespace(query_buf);
+
+    if (!query[0]) return 0;
+
+    search_cancel(st);
+
+    bool cached = false;
+    if (st->config.search_cache_ttl > 0) {
+        char key[256];
+        search_cache_key(query, key, sizeof(key));
+
+        int ci = search_cache_lookup(st, key);
+        Song *songs = NULL;
+        Arena strings = {0};
+        int n = ci >= 0 ? search_cache_read(st, ci, &songs, &strings) : -1;
+        if (n > 0) {
+            search_show(st, query, songs, n, &strings);
+            cached = true;
+            time_t age = time(NULL) - st->search_cache.entries[ci].fetched;
+            sb_log("[PLAYBACK] search_start: cache hit for \"%s\" (%d results, %lds old)",
+                   key, n, (long)age);
+            if (age < (time_t)st->config.search_cache_ttl * 3600) return 2;
+        } else {
+            if (ci >= 0) search_cache_remove(st, ci);
+            search_show_prefix_matches(st, key, query);
+        }
+    }
+
+    st->search_job = search_spawn(st, query, cached, 0, MAX_RESULTS);
+    if (cached) return 2;
+    return st->search_job ? 1 : -1;
+}
+
+// Move newly arrived rows of the running search into search_results. The
+// old results are replaced when the first row (or the end of the search)
+// arrives; the list being played is kept aside by free_search_results, so
+// playback isn't disturbed. Returns true when the results changed.
+static bool search_poll(AppState *st, char *status, size_t status_size) {
+    SearchJob *job = st->search_job;
+    if (!job) return false;
+
+    pthread_mutex_lock(&job->mutex);
+    bool finished = job->finished;
+    int count = job->count;
+    pthread_mutex_unlock(&job->mutex);
+    if (count == job->taken && !finished) return false;
+
+    // A refresh of cached results swaps in the whole list at once
+    int selected = st->search_selected;
+    if (job->refresh) {
+        if (!finished) return false;
+        if (count == 0) {
+            st->search_job = NULL;
+            snprintf(status, status_size, "Couldn't refresh results for: %s", job->query);
+            search_job_free(job);
+            return true;
+        }
+    }
+
+    if (job->taken == 0 && job->offset == 0) {
+        free_search_results(st);
+        snprintf(st->query, sizeof(st->query), "%s", job->query);
+    }
+    // Rows below count are no longer touched by the reader thread
+    if (!search_results_reserve(st, st->search_count + (count - job->taken))) {
+        return false;
+    }
+    int before = st->search_count;
+    for (int i = job->taken; i < count; i++) {
+        Song *song = &job->results[i];
+        bool dup = false;
+        // Later pages can repeat a row that has moved up in the ranking
+        for (int j = 0; j < job->offset && j < st->search_count && !dup; j++) {
+            dup = strcmp(st->search_results[j].video_id, song->video_id) == 0;
+        }
+        if (dup) continue;
+        // The job's arena goes away with it
+        Song *row = &st->search_results[st->search_count];
+        *row = *song;
+        row->title = arena_strdup(&st->search_strings, song->title);
+        if (row->title) st->search_count++;
+    }
+    job->taken = count;
+
+    if (!finished) {
+        if (job->offset > 0) {
+            snprintf(status, status_size, "Loading more results for: %s ... %d so far",
+                     st->query, st->search_count);
+        } else {
+            snprintf(status, status_size, "Searching: %s ... %d results so far", st->query, count);
+        }
+        return true;
+    }
+
+    st->search_job = NULL;
+    st->search_fetched = job->offset + count;
+    st->search_more = count == MAX_RESULTS;
+    sb_log("[PLAYBACK] search_poll: found %d results (offset %d) for query=\"%s\"",
+           count, job->offset, st->query);
+    if (job->offset > 0) {
+        if (st->search_count > before || count > 0) {
+            snprintf(status, status_size, "Loaded %d results for: %s%s", st->search_count,
+                     st->query, st->search_more ? "" : " (no more)");
+        } else {
+            snprintf(status, status_size, "No more results for: %s", st->query);
+        }
+    } else if (st->search_count == 0) {
+        snprintf(status, status_size, "No results for: %s", st->query);
+    } else if (job->refresh) {
+        st->search_selected = selected < count ? selected : count - 1;
+        snprintf(status, status_size, "Refreshed %d results for: %s", st->search_count, st->query);
+    } else {
+        snprintf(status, status_size, "Found %d results for: %s", st->search_count, st->query);
+    }
+
+    char key[256];
+    search_cache_key(st->query, key, sizeof(key));
+    search_cache_store(st, key, st->search_results, st->search_count);
+    if (st->search_count > 0 && !st->songs_complete) load_all_playlist_songs(st);
+
+    search_job_free(job);
+    return true;
+}
+
+// Fetch the next page in the background once the selection nears the
+// end of the loaded results. Returns true if a fetch was started.
+static bool search_load_more(AppState *st) {
+    if (!st->search_more || st->search_job || st->search_count == 0) return false;
+    if (st->search_selected < st->search_count - 10) return false;
+
+    st->search_job = search_spawn(st, st->query, false, st->search_fetched, MAX_RESULTS);
+    if (!st->search_job) {
+        st->search_more = false;
+        return false;
+    }
+    return true;
+}
+
+// ============================================================================
+// Tracklist Import
+// ============================================================================
+
+// Split a CSV row in place, honouring quoted fields. Returns the field count.
+static int csv_split(char *line, char **fields, int max) {
+    int n = 0;
+    char *p = line;
+    while (n < max) {
+        char *start = p;
+        char *out = p;
+        if (*p == '"') {
+            p++;
+            while (*p) {
+                if (*p == '"') {
+                    if (p[1] != '"') {
+                        p++;
+                        break;
+                    }
+                    p++;
+                }
+                *out++ = *p++;
+            }
+            while (*p && *p != ',') p++;
+        } else {
+            while (*p && *p != ',') *out++ = *p++;
+        }
+        char end = *p;
+        *out = '\0';
+        fields[n++] = trim_whitespace(start);
+        if (end != ',') break;
+        p++;
+    }
+    return n;
+}
+
+// Lowercase letters and digits padded with spaces; other ASCII becomes a
+// space. UTF-8 bytes are kept so non-Latin titles still compare.
+static void tracklist_fold(const char *in, char *out, size_t out_size) {
+    size_t n = 0;
+    out[n++] = ' ';
+    for (; *in && n + 2 < out_size; in++) {
+        unsigned char c = (unsigned char)*in;
+        if (c >= 0x80) {
+            out[n++] = (char)c;
+        } else {
+            out[n++] = isalnum(c) ? (char)tolower(c) : ' ';
+        }
+    }
+    out[n++] = ' ';
+    out[n] = '\0';
+}
+
+// Percent of the query's words (two characters or longer) found as whole
+// words in the title of its match
+static int tracklist_score(const char *query, const char *title) {
+    char q[512];
+    char t[1024];
+    tracklist_fold(query, q, sizeof(q));
+    tracklist_fold(title ? title : "", t, sizeof(t));
+
+    int words = 0;
+    int found = 0;
+    char *save = NULL;
+    for (char *w = strtok_r(q, " ", &save); w; w = strtok_r(NULL, " ", &save)) {
+        if (strlen(w) < 2) continue;
+        char needle[520];
+        snprintf(needle, sizeof(needle), " %s ", w);
+        words++;
+        if (strstr(t, needle)) found++;
+    }
+    return words > 0 ? found * 100 / words : 100;
+}
+
+static void tracklist_free(TracklistImport *imp) {
+    for (int i = 0; i < imp->count; i++) {
+        free(imp->items[i].query);
+    }
+    free(imp->items);
+    arena_free(&imp->strings);
+    free(imp);
+}
+
+// Read a tracklist: "Artist - Title" lines (blank lines, "#" comments and
+// leading track numbers are skipped), or for .csv files rows with title and
+// artist columns named in a header, "artist,title" otherwise.
+// Returns NULL if the file can't be read.
+static TracklistImport *tracklist_load(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return NULL;
+
+    TracklistImport *imp = calloc(1, sizeof(TracklistImport));
+    if (!imp) {
+        fclose(f);
+        return NULL;
+    }
+    snprintf(imp->source, sizeof(imp->source), "%s", path);
+
+    const char *ext = strrchr(path, '.');
+    bool csv = ext && strcasecmp(ext, ".csv") == 0;
+    int title_col = -1;
+    int artist_col = -1;
+    bool header_checked = false;
+    int cap = 0;
+    int line_no = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+
+    while (getline(&line, &line_cap, f) != -1) {
+        line_no++;
+        char *p = line;
+        if (line_no == 1 && strncmp(p, "\xef\xbb\xbf", 3) == 0) p += 3;  // UTF-8 BOM
+        p = trim_whitespace(p);
+        if (!p[0] || p[0] == '#') continue;
+
+        char query[512];
+        if (csv) {
+            char *fields[32];
+            int n = csv_split(p, fields, 32);
+            if (!header_checked) {
+                header_checked = true;
+                for (int i = 0; i < n; i++) {
+                    if (artist_col < 0 && strncasecmp(fields[i], "artist", 6) == 0) {
+                        artist_col = i;
+                    } else if (title_col < 0 && (strcasecmp(fields[i], "title") == 0 ||
+                                                 strcasecmp(fields[i], "track") == 0 ||
+                                                 strcasecmp(fields[i], "track name") == 0 ||
+                                                 strcasecmp(fields[i], "song") == 0 ||
+                                                 strcasecmp(fields[i], "name") == 0)) {
+                        title_col = i;
+                    }
+                }
+                if (title_col >= 0) continue;
+                artist_col = -1;
+            }
+
+            const char *artist;
+            const char *title;
+            if (title_col >= 0) {
+                artist = artist_col >= 0 && artist_col < n ? fields[artist_col] : "";
+                title = title_col < n ? fields[title_col] : "";
+            } else {
+                artist = n > 1 ? fields[0] : "";
+                title = n > 1 ? fields[1] : fields[0];
+            }
+            if (artist[0] && title[0]) {
+                snprintf(query, sizeof(query), "%s - %s", artist, title);
+            } else {
+                snprintf(query, sizeof(query), "%s", title[0] ? title : artist);
+            }
+        } else {
+            // Drop track numbers such as "01." or "3)"
+            char *q = p;
+            while (isdigit((unsigned char)*q)) q++;
+            if (q > p && (*q == '.' || *q == ')') && isspace((unsigned char)q[1])) {
+                p = trim_whitespace(q + 1);
+            }
+            snprintf(query, sizeof(query), "%s", p);
+        }
+        if (!query[0]) continue;
+
+        if (imp->count == cap) {
+            int new_cap = cap ? cap * 2 : 64;
+            TracklistItem *grown = realloc(imp->items, sizeof(TracklistItem) * new_cap);
+            if (!grown) break;
+            imp->items = grown;
+            cap = new_cap;
+        }
+        TracklistItem *item = &imp->items[imp->count];
+        memset(item, 0, sizeof(*item));
+        item->query = strdup(query);
+        item->line = line_no;
+        if (item->query) imp->count++;
+    }
+
+    free(line);
+    fclose(f);
+    return imp;
+}
+
+// Answer item from a search cache entry for its query that is still fresh,
+// the match's title going into strings
+static bool tracklist_from_cache(AppState *st, TracklistItem *item, Arena *strings) {
+    if (st->config.search_cache_ttl <= 0) return false;
+
+    char key[256];
+    search_cache_key(item->query, key, sizeof(key));
+    int ci = search_cache_lookup(st, key);
+    if (ci < 0) return false;
+    if (time(NULL) - st->search_cache.entries[ci].fetched >= (time_t)st->config.search_cache_ttl * 3600) {
+        return false;
+    }
+
+    Song *songs = NULL;
+    Arena results = {0};
+    int n = search_cache_read(st, ci, &songs, &results);
+    if (n > 0) {
+        item->match = songs[0];
+        item->match.title = arena_strdup(strings, songs[0].title);
+        item->cached = item->match.title != NULL;
+    }
+    arena_free(&results);
+    free(songs);
+    return item->cached;
+}
+
+// Create the playlist from the resolved lines in a single save and write
+// the lines that need a second look to the import report
+static void tracklist_finish(AppState *st, char *status, size_t status_size) {
+    TracklistImport *imp = st->tracklist;
+    st->tracklist = NULL;
+
+    int idx = create_playlist(st, imp->name, false);
+    if (idx < 0) {
+        snprintf(status, status_size, "Import failed: couldn't create playlist '%s'", imp->name);
+        tracklist_free(imp);
+        return;
+    }
+    Playlist *pl = &st->playlists[idx];
+
+    // First line each video was matched by, to report repeats
+    StrMap first = {0};
+    int low = 0;
+    int missing = 0;
+    int repeated = 0;
+    int cached = 0;
+    for (int i = 0; i < imp->count; i++) {
+        TracklistItem *item = &imp->items[i];
+        if (item->cached) cached++;
+        if (!item->match.title) {
+            missing++;
+            continue;
+        }
+        item->score = tracklist_score(item->query, item->match.title);
+        if (strmap_get(&first, item->match.video_id) >= 0) {
+            repeated++;
+        } else {
+            strmap_put(&first, item->match.video_id, i);
+            if (item->score < TRACKLIST_LOW_SCORE) low++;
+        }
+    }
+
+    char report[16384 + 32];
+    snprintf(report, sizeof(report), "%s/%s", st->config_dir, IMPORT_REPORT_FILE);
+    FILE *f = fopen(report, "w");
+    if (f) {
+        fprintf(f, "Import of %s into '%s'\n", imp->source, imp->name);
+        fprintf(f, "%d lines: %d low confidence, %d not found, %d repeated\n",
+                imp->count, low, missing, repeated);
+        if (low > 0) {
+            fprintf(f, "\nLow confidence (added, check these):\n");
+            for (int i = 0; i < imp->count; i++) {
+                TracklistItem *item = &imp->items[i];
+                if (!item->match.title || item->score >= TRACKLIST_LOW_SCORE) continue;
+                if (strmap_get(&first, item->match.video_id) != i) continue;
+                fprintf(f, "  line %d: %s\n    -> %s [%s] (%d%%)\n", item->line, item->query,
+                        item->match.title, item->match.video_id, item->score);
+            }
+        }
+        if (missing > 0) {
+            fprintf(f, "\nNot found:\n");
+            for (int i = 0; i < imp->count; i++) {
+                if (imp->items[i].match.title) continue;
+                fprintf(f, "  line %d: %s\n", imp->items[i].line, imp->items[i].query);
+            }
+        }
+        if (repeated > 0) {
+            fprintf(f, "\nSame video as an earlier line (added once):\n");
+            for (int i = 0; i < imp->count; i++) {
+                TracklistItem *item = &imp->items[i];
+                if (!item->match.title) continue;
+                int j = strmap_get(&first, item->match.video_id);
+                if (j == i) continue;
+                fprintf(f, "  line %d: %s\n    -> %s (line %d)\n", item->line, item->query,
+                        item->match.title, imp->items[j].line);
+            }
+        }
+        fclose(f);
+    }
+
+    for (int i = 0; i < imp->count; i++) {
+        TracklistItem *item = &imp->items[i];
+        if (!item->match.title || strmap_get(&first, item->match.video_id) != i) continue;
+        if (!playlist_append_song(st, pl, &item->match)) break;
+    }
+    strmap_free(&first);
+    save_playlist(st, idx);
+
+    if (!imp->stream_only) {
+        for (int i = 0; i < pl->count; i++) {
+            Song *song = playlist_song(st, pl, i);
+            add_to_download_queue(st, song->video_id, song->title, pl->name);
+        }
+    }
+
+    sb_log("[PLAYBACK] tracklist import: %s -> '%s': %d added, %d low confidence, "
+           "%d not found, %d repeated, %d from cache",
+           imp->source, imp->name, pl->count, low, missing, repeated, cached);
+    if (low + missing > 0) {
+        snprintf(status, status_size, "Imported %d songs into '%s', %d to review: ~/%s/%s",
+                 pl->count, pl->name, low + missing, CONFIG_DIR, IMPORT_REPORT_FILE);
+    } else {
+        snprintf(status, status_size, "Imported %d songs into '%s'", pl->count, pl->name);
+    }
+    tracklist_free(imp);
+}
+
+// Collect finished lookups and keep TRACKLIST_PARALLEL of them running.
+// Lines with a fresh search cache entry don't need a lookup. Returns true
+// when the import made progress.
+static bool tracklist_poll(AppState *st, char *status, size_t status_size) {
+    TracklistImport *imp = st->tracklist;
+    if (!imp) return false;
+
+    bool changed = false;
+    for (int s = 0; s < TRACKLIST_PARALLEL; s++) {
+        SearchJob *job = imp->jobs[s];
+        if (job) {
+            pthread_mutex_lock(&job->mutex);
+            bool finished = job->finished;
+            pthread_mutex_unlock(&job->mutex);
+            if (!finished) continue;
+
+            TracklistItem *item = &imp->items[imp->job_item[s]];
+            if (job->count > 0) {
+                item->match = job->results[0];
+                item->match.title = arena_strdup(&imp->strings, job->results[0].title);
+            }
+            search_job_free(job);
+            imp->jobs[s] = NULL;
+            imp->done++;
+            changed = true;
+        }
+
+        while (!imp->jobs[s] && imp->next < imp->count) {
+            int i = imp->next++;
+            changed = true;
+            if (tracklist_from_cache(st, &imp->items[i], &imp->strings)) {
+                imp->done++;
+                continue;
+            }
+            imp->jobs[s] = search_spawn(st, imp->items[i].query, false, 0, 1);
+            imp->job_item[s] = i;
+            if (!imp->jobs[s]) imp->done++;  // reported as not found
+        }
+    }
+
+    if (imp->done < imp->count) return changed;
+    tracklist_finish(st, status, status_size);
+    return true;
+}
+
+// Start importing the tracklist at path into a new playlist. Returns the
+// number of lines to resolve, -1 if the file can't be read.
+static int tracklist_start(AppState *st, const char *path, const char *name, bool stream_only) {
+    TracklistImport *imp = tracklist_load(path);
+    if (!imp) return -1;
+    if (imp->count == 0) {
+        tracklist_free(imp);
+        return 0;
+    }
+
+    snprintf(imp->name, sizeof(imp->name), "%s", name);
+    imp->stream_only = stream_only;
+    st->tracklist = imp;
+    sb_log("[PLAYBACK] tracklist import: %d lines from %s into '%s'", imp->count, path, name);
+    return imp->count;
+}
+
+// Abandon a running import, stopping its lookups
+static void tracklist_cancel(AppState *st) {
+    TracklistImport *imp = st->tracklist;
+    if (!imp) return;
+    st->tracklist = NULL;
+
+    for (int s = 0; s < TRACKLIST_PARALLEL; s++) {
+        if (imp->jobs[s]) search_job_cancel(imp->jobs[s]);
+    }
+    tracklist_free(imp);
+}
+
+// ============================================================================
+// YouTube Playlist Import and Sync
+// ============================================================================
+
+static void playlist_fetch_free(PlaylistFetch *job) {
+    arena_free(&job->strings);
+    free(job->songs);
+    pthread_mutex_destroy(&job->mutex);
+    free(job);
+}
+
+// The list= id of a YouTube playlist URL. Returns false if it has none.
+static bool youtube_list_id(const char *url, char *out, size_t out_size) {
+    const char *list = strstr(url, "list=");
+    if (!list) return false;
+    list += 5;
+    int len = (int)strcspn(list, "&#");
+    if (len == 0) return false;
+    snprintf(out, out_size, "%.*s", len, list);
+    return true;
+}
+
+// Checkpoint file for imports of url, keyed by its list id
+static bool import_resume_path(AppState *st, const char *url, char *out, size_t out_size) {
+    char list_id[256];
+    if (!youtube_list_id(url, list_id, sizeof(list_id))) return false;
+    snprintf(out, out_size, "%s/%08x.json", st->import_resume_dir, str_hash(list_id));
+    return true;
+}
+
+// Open a checkpoint, NULL if it's missing, stale or unreadable
+static FILE *import_resume_open(const char *path) {
+    struct stat sb;
+    if (stat(path, &sb) != 0) return NULL;
+    if (time(NULL) - sb.st_mtime > IMPORT_RESUME_MAX_AGE) {
+        unlink(path);
+        return NULL;
+    }
+    return fopen(path, "r");
+}
+
+// Write the first n songs and the import's settings to its checkpoint.
+// Runs on the fetch thread; the rename keeps the previous checkpoint
+// intact if the app exits halfway.
+static void import_resume_save(PlaylistFetch *job, int n) {
+    char tmp[sizeof(job->resume_file) + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", job->resume_file);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return;
+
+    // The header goes ahead of the songs so it's read without them
+    JsonWriter w;
+    json_writer_init(&w, f);
+    json_printf(&w, "{\n  \"url\": %q,\n  \"name\": %q,\n  \"stream_only\": %b,\n  \"songs\": [\n",
+                job->url, job->name, job->stream_only);
+    for (int i = 0; i < n; i++) {
+        json_write_song(&w, &job->songs[i], i == n - 1);
+    }
+    json_printf(&w, "  ]\n}\n");
+
+    bool ok = json_writer_flush(&w);
+    if (fclose(f) != 0) ok = false;
+    if (ok && rename(tmp, job->resume_file) == 0) {
+        job->saved = n;
+    } else {
+        unlink(tmp);
+    }
+}
+
+static bool playlist_fetch_progress(int count, const char *message, void *user_data) {
+    (void)message;
+    PlaylistFetch *job = user_data;
+    pthread_mutex_lock(&job->mutex);
+    job->fetched = count;
+    bool keep_going = !job->cancelled;
+    pthread_mutex_unlock(&job->mutex);
+
+    // Checkpoint whole chunks; only this thread touches the songs until it finishes
+    if (job->resume_file[0] && count - job->saved >= IMPORT_CHUNK_SIZE) {
+        import_resume_save(job, count - (count - job->saved) % IMPORT_CHUNK_SIZE);
+    }
+    return keep_going;
+}
+
+// Fetches the playlist, continuing after the songs resumed from a
+// checkpoint. The thread is detached: it frees the job itself if it was
+// cancelled meanwhile.
+static void *playlist_fetch_thread_func(void *arg) {
+    PlaylistFetch *job = arg;
+    char title[256] = {0};
+
+    int result = fetch_youtube_playlist(job->url, job->count + 1, &job->songs, &job->count, &job->cap, &job->strings,
+                                        title, sizeof(title),
+                                        playlist_fetch_progress, job, job->ytdlp_cmd);
+
+    pthread_mutex_lock(&job->mutex);
+    job->result = result;
+    snprintf(job->title, sizeof(job->title), "%s", title);
+    job->finished = true;
+    bool cancelled = job->cancelled;
+    pthread_mutex_unlock(&job->mutex);
+
+    if (cancelled) playlist_fetch_free(job);
+    return NULL;
+}
+
+// Queue a fetch of url; playlist_fetch_poll launches it when a slot is free
+static PlaylistFetch *playlist_fetch_queue(AppState *st, const char *url) {
+    PlaylistFetch *job = calloc(1, sizeof(PlaylistFetch));
+    if (!job) return NULL;
+    pthread_mutex_init(&job->mutex, NULL);
+    snprintf(job->url, sizeof(job->url), "%s", url);
+    snprintf(job->ytdlp_cmd, sizeof(job->ytdlp_cmd), "%s", get_ytdlp_cmd(st));
+
+    // Append so jobs start, and imports become playlists, in queue order
+    PlaylistFetch **tail = &st->fetches;
+    while (*tail) tail = &(*tail)->next;
+    *tail = job;
+    return job;
+}
+
+// Start importing the playlist at url in the background, picking up an
+// interrupted import of it from its checkpoint. An empty name uses the
+// playlist's YouTube title. Returns 1 if queued, 0 if it is already being
+// imported, -1 on failure.
+static int playlist_import_start(AppState *st, const char *url, const char *name, bool stream_only) {
+    char resume_file[sizeof(((PlaylistFetch *)0)->resume_file)] = "";
+    import_resume_path(st, url, resume_file, sizeof(resume_file));
+    for (PlaylistFetch *job = st->fetches; job; job = job->next) {
+        if (job->sync_file[0]) continue;
+        bool same = resume_file[0] ? strcmp(job->resume_file, resume_file) == 0
+                                   : strcmp(job->url, url) == 0;
+        if (same) return 0;
+    }
+
+    PlaylistFetch *job = playlist_fetch_queue(st, url);
+    if (!job) return -1;
+    snprintf(job->name, sizeof(job->name), "%s", name);
+    snprintf(job->resume_file, sizeof(job->resume_file), "%s", resume_file);
+    job->stream_only = stream_only;
+
+    FILE *checkpoint = resume_file[0] ? import_resume_open(resume_file) : NULL;
+    if (checkpoint) {
+        JsonReader r;
+        json_reader_init(&r, checkpoint);
+        if (json_next(&r) == JSON_OBJECT) {
+            while (json_next(&r) == JSON_KEY) {
+                if (json_text_is(&r, "songs") && !job->songs) {
+                    job->count = json_read_songs(&r, &job->songs, &job->strings);
+                } else {
+                    json_skip(&r);
+                }
+            }
+        }
+        json_reader_free(&r);
+        fclose(checkpoint);
+        job->cap = job->count;
+        job->resumed = job->count;
+        job->saved = job->count;
+        job->fetched = job->count;
+    }
+    sb_log("[PLAYBACK] playlist import: queued %s (%d songs from a checkpoint)", url, job->resumed);
+    return 1;
+}
+
+// Queue the imports an earlier session didn't finish. Returns the number queued.
+static int import_resume_pending(AppState *st) {
+    DIR *dir = opendir(st->import_resume_dir);
+    if (!dir) return 0;
+
+    int queued = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len < 5 || strcmp(entry->d_name + len - 5, ".json") != 0) continue;
+
+        char path[16384 + 256];
+        snprintf(path, sizeof(path), "%s/%s", st->import_resume_dir, entry->d_name);
+        FILE *f = import_resume_open(path);
+        if (!f) continue;
+
+        // Only the header is read: the songs follow it
+        char *url = NULL;
+        char *name = NULL;
+        bool stream_only = true;
+        JsonReader r;
+        json_reader_init(&r, f);
+        if (json_next(&r) == JSON_OBJECT) {
+            while (json_next(&r) == JSON_KEY && !json_text_is(&r, "songs")) {
+                if (json_text_is(&r, "url") && !url) {
+                    url = json_read_strdup(&r);
+                } else if (json_text_is(&r, "name") && !name) {
+                    name = json_read_strdup(&r);
+                } else if (json_text_is(&r, "stream_only")) {
+                    stream_only = json_read_bool(&r, true);
+                } else {
+                    json_skip(&r);
+                }
+            }
+        }
+        json_reader_free(&r);
+        fclose(f);
+
+        if (url && validate_youtube_playlist_url(url) &&
+            playlist_import_start(st, url, name ? name : "", stream_only) > 0) {
+            queued++;
+        }
+        free(url);
+        free(name);
+    }
+    closedir(dir);
+    return queued;
+}
+
+// Queue a sync of playlist idx from its stored URL. Returns 1 if queued,
+// 0 if it is already being synced, -1 on failure.
+static int playlist_sync_start(AppState *st, int idx) {
+    Playlist *pl = &st->playlists[idx];
+    if (!pl->source_url) return -1;
+    for (PlaylistFetch *job = st->fetches; job; job = job->next) {
+        if (strcmp(job->sync_file, pl->filename) == 0) return 0;
+    }
+
+    PlaylistFetch *job = playlist_fetch_queue(st, pl->source_url);
+    if (!job) return -1;
+    snprintf(job->sync_file, sizeof(job->sync_file), "%s", pl->filename);
+    st->sync_total++;
+    sb_log("[PLAYBACK] playlist sync: queued '%s' from %s", pl->name, pl->source_url);
+    return 1;
+}
+
+// Queue a sync of every YouTube playlist with a stored URL and restart the
+// sync schedule. Returns the number queued; *no_url counts the YouTube
+// playlists imported before URLs were stored.
+static int playlist_sync_all(AppState *st, int *no_url) {
+    int queued = 0;
+    bool learned = false;
+    *no_url = 0;
+    for (int i = 0; i < st->playlist_count; i++) {
+        // The index has the type and URL, except for playlists listed by
+        // an older version: load those once and store their header
+        if (!st->playlists[i].header_known) {
+            load_playlist_songs(st, i);
+            learned = true;
+        }
+        Playlist *pl = &st->playlists[i];
+        if (!pl->is_youtube_playlist) continue;
+        if (!pl->source_url) {
+            (*no_url)++;
+        } else if (playlist_sync_start(st, i) > 0) {
+            queued++;
+        }
+    }
+    if (learned) save_playlists_index(st);
+    st->config.youtube_sync_last = time(NULL);
+    save_config(st);
+    return queued;
+}
+
+// Turn a finished import into a playlist. Returns its index, -1 on failure.
+static int playlist_import_finish(AppState *st, PlaylistFetch *job) {
+    const char *base = job->name[0] ? job->name : job->title;
+    char name[256];
+    snprintf(name, sizeof(name), "%s", base);
+
+    // Another import may have taken the name meanwhile
+    int idx = create_playlist(st, name, true);
+    for (int n = 2; idx == -2 && n < 100; n++) {
+        snprintf(name, sizeof(name), "%s (%d)", base, n);
+        idx = create_playlist(st, name, true);
+    }
+    if (idx < 0) return -1;
+
+    Playlist *pl = &st->playlists[idx];
+    pl->source_url = strdup(job->url);
+    if (playlist_reserve(pl, job->count)) {
+        for (int i = 0; i < job->count; i++) playlist_append_song(st, pl, &job->songs[i]);
+    }
+    save_playlists_index(st);
+    save_playlist(st, idx);
+
+    if (!job->stream_only) {
+        for (int i = 0; i < pl->count; i++) {
+            Song *song = playlist_song(st, pl, i);
+            add_to_download_queue(st, song->video_id, song->title, pl->name);
+        }
+    }
+    return idx;
+}
+
+// Length of the longest strictly increasing subsequence of the non-negative
+// entries of seq (patience sorting, O(n log n))
+static int longest_increasing_run(const int *seq, int n) {
+    int *tails = malloc(sizeof(int) * (n > 0 ? n : 1));
+    if (!tails) return 0;
+    int len = 0;
+    for (int i = 0; i < n; i++) {
+        if (seq[i] < 0) continue;
+        int lo = 0, hi = len;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (tails[mid] < seq[i]) lo = mid + 1;
+            else hi = mid;
+        }
+        tails[lo] = seq[i];
+        if (lo == len) len++;
+    }
+    free(tails);
+    return len;
+}
+
+static void shuffle_key_for(AppState *st, bool from_playlist, int playlist_idx,
+                            char *out, size_t out_size);
+static void update_download_priority(AppState *st);
+static void preload_next_track(AppState *st);
+
+// The list changed under the song now playing: follow it to its new index.
+// A song the sync removed keeps playing as a detached entry, like a queued
+// one, and the list resumes after it with the next song that's still there.
+static void playlist_sync_remap_playing(AppState *st, Playlist *pl, const int *old_pos,
+                                        int old_count, int new_count) {
+    int cur = st->playing_index;
+    if (old_pos[cur] >= 0) {
+        st->playing_index = old_pos[cur];
+        return;
+    }
+
+    int resume = new_count;
+    for (int j = cur + 1; j < old_count && resume == new_count; j++) {
+        if (old_pos[j] >= 0) resume = old_pos[j];
+    }
+    st->playing_index = resume - 1;
+
+    if (!st->playing_from_queue) {
+        // Queue entries own their title; the table's stays in its arena
+        st->queue_current.song = *playlist_song(st, pl, cur);
+        st->queue_current.song.title = strdup(st->queue_current.song.title);
+        st->queue_current.playlist = strdup(pl->name);
+        st->playing_from_queue = true;
+    }
+}
+
+// Diff a finished sync against the playlist by video_id and apply it in one
+// pass: the playlist takes YouTube's order, songs it already had keep their
+// entry (and with it the downloaded file) with YouTube's current title and
+// duration, new ones are added and ones gone from YouTube are dropped.
+// Returns false if nothing could be applied.
+static bool playlist_sync_apply(AppState *st, int idx, PlaylistFetch *job, SyncDiff *diff) {
+    Playlist *pl = &st->playlists[idx];
+    if (pl->count == 0) load_playlist_songs(st, idx);
+    memset(diff, 0, sizeof(*diff));
+
+    int old_count = pl->count;
+    int new_count = job->count;
+    int *items = malloc(sizeof(int) * (new_count + 1));
+    int *from = malloc(sizeof(int) * (new_count + 1));         // old index per new song, -1 if added
+    int *old_pos = malloc(sizeof(int) * (old_count + 1));      // new index per old song, -1 if dropped
+    int *next_same = malloc(sizeof(int) * (old_count + 1));    // next old song with the same id
+    IntMap first = {0};                                        // song ref -> first unclaimed old index
+    if (!items || !from || !old_pos || !next_same) {
+        free(items);
+        free(from);
+        free(old_pos);
+        free(next_same);
+        return false;
+    }
+
+    for (int i = old_count - 1; i >= 0; i--) {
+        old_pos[i] = -1;
+        next_same[i] = intmap_get(&first, pl->items[i]);
+        intmap_put(&first, pl->items[i], i);
+    }
+
+    // The table holds each song once: kept ones take YouTube's metadata
+    // for every playlist they're in
+    int kept = 0;
+    bool refreshed = false;
+    for (int i = 0; i < new_count; i++) {
+        Song *fetched = &job->songs[i];
+        int ref = song_find(&st->songs, fetched->video_id);
+        int j = intmap_get(&first, ref);
+        if (j >= 0) {
+            // Duplicates are matched in order, each old copy at most once
+            if (next_same[j] >= 0) {
+                intmap_put(&first, ref, next_same[j]);
+            } else {
+                intmap_remove(&first, ref);
+            }
+            if (song_update(&st->songs, ref, fetched)) refreshed = true;
+            old_pos[j] = kept;
+        } else {
+            ref = song_intern(&st->songs, fetched);
+            if (ref < 0) continue;
+            diff->added++;
+        }
+        items[kept] = ref;
+        from[kept++] = j;
+    }
+    intmap_free(&first);
+    new_count = kept;
+
+    for (int i = 0; i < old_count; i++) {
+        if (old_pos[i] < 0) diff->removed++;
+    }
+    diff->moved = (new_count - diff->added) - longest_increasing_run(from, new_count);
+
+    if (diff->added == 0 && diff->removed == 0 && diff->moved == 0) {
+        // Same songs in the same order: the entries are still in place
+        if (refreshed) save_playlist(st, idx);
+        free(items);
+        free(from);
+        free(old_pos);
+        free(next_same);
+        return true;
+    }
+
+    bool playing_here = st->playing_from_playlist && st->playing_playlist_idx == idx &&
+                        st->playing_index >= 0 && st->playing_index < old_count;
+    if (playing_here) playlist_sync_remap_playing(st, pl, old_pos, old_count, new_count);
+
+    // Removed songs stay in the song table, shared with other playlists
+    playlist_release_all(st, pl);
+    free(pl->items);
+    pl->items = items;
+    pl->count = new_count;
+    pl->cap = new_count;
+    for (int i = 0; i < new_count; i++) playlist_hold(st, pl, items[i]);
+
+    // Shuffle orders hold indices into the old list
+    shuffle_free(&pl->shuffle);
+    char key[1024];
+    shuffle_key_for(st, true, idx, key, sizeof(key));
+    for (int i = 0; i < st->saved_shuffle_count; i++) {
+        SavedShuffle *saved = &st->saved_shuffles[i];
+        if (saved->order && strcmp(saved->key, key) == 0) {
+            free(saved->order);
+            saved->order = NULL;
+        }
+    }
+
+    if (st->current_playlist_idx == idx && st->playlist_song_selected >= pl->count) {
+        st->playlist_song_selected = pl->count - 1;
+    }
+
+    save_playlist(st, idx);
+    if (st->config.youtube_sync_download) {
+        for (int i = 0; i < new_count; i++) {
+            if (from[i] < 0) {
+                Song *song = playlist_song(st, pl, i);
+                add_to_download_queue(st, song->video_id, song->title, pl->name);
+            }
+        }
+    }
+    if (playing_here) {
+        weighted_reset(&st->weighted);
+        update_download_priority(st);
+        preload_next_track(st);
+    }
+
+    free(from);
+    free(old_pos);
+    free(next_same);
+    return true;
+}
+
+// Format a sync's changes as "+12 -3 moved 5", leaving out zero parts
+static void format_sync_diff(const SyncDiff *diff, char *out, size_t out_size) {
+    size_t len = 0;
+    out[0] = '\0';
+    if (diff->added > 0) {
+        len += snprintf(out + len, out_size - len, "+%d", diff->added);
+    }
+    if (diff->removed > 0 && len < out_size) {
+        len += snprintf(out + len, out_size - len, "%s-%d", len ? " " : "", diff->removed);
+    }
+    if (diff->moved > 0 && len < out_size) {
+        snprintf(out + len, out_size - len, "%smoved %d", len ? " " : "", diff->moved);
+    }
+}
+
+// Apply a finished sync and report it, per playlist for a single sync or
+// once the whole batch is done
+static void playlist_sync_finish(AppState *st, PlaylistFetch *job, char *status, size_t status_size) {
+    int idx = strmap_get(&st->playlist_files, job->sync_file);
+
+    SyncDiff diff = {0};
+    // A listing cut short would look like removals, so only complete ones apply
+    bool failed = idx < 0 || job->result < 0 || job->count == 0 ||
+                  !playlist_sync_apply(st, idx, job, &diff);
+    sb_log("[PLAYBACK] playlist sync: %s fetched %d songs%s, +%d -%d moved %d", job->sync_file,
+           job->count, job->result < 0 ? " (incomplete)" : "", diff.added, diff.removed, diff.moved);
+
+    st->sync_done++;
+    st->sync_diff.added += diff.added;
+    st->sync_diff.removed += diff.removed;
+    st->sync_diff.moved += diff.moved;
+    if (failed) st->sync_failed++;
+
+    char changes[64];
+    if (st->sync_total == 1) {
+        format_sync_diff(&diff, changes, sizeof(changes));
+        if (idx < 0) {
+            snprintf(status, status_size, "Sync skipped: playlist was renamed or deleted");
+        } else if (failed) {
+            snprintf(status, status_size, "Failed to sync '%s'", st->playlists[idx].name);
+        } else if (changes[0]) {
+            snprintf(status, status_size, "'%s': %s", st->playlists[idx].name, changes);
+        } else {
+            snprintf(status, status_size, "'%s' is up to date", st->playlists[idx].name);
+        }
+    } else if (st->sync_done == st->sync_total) {
+        format_sync_diff(&st->sync_diff, changes, sizeof(changes));
+        if (!changes[0]) snprintf(changes, sizeof(changes), "no changes");
+        if (st->sync_failed > 0) {
+            snprintf(status, status_size, "Synced %d YouTube playlists: %s (%d failed)",
+                     st->sync_total, changes, st->sync_failed);
+        } else {
+            snprintf(status, status_size, "Synced %d YouTube playlists: %s",
+                     st->sync_total, changes);
+        }
+    }
+    if (st->sync_done == st->sync_total) {
+        st->sync_total = 0;
+        st->sync_done = 0;
+        memset(&st->sync_diff, 0, sizeof(st->sync_diff));
+        st->sync_failed = 0;
+    }
+}
+
+// Apply finished fetches and launch queued ones while fewer than
+// PLAYLIST_FETCH_PARALLEL are running. Returns true if any finished.
+static bool playlist_fetch_poll(AppState *st, char *status, size_t status_size) {
+    bool changed = false;
+    int running = 0;
+    PlaylistFetch **link = &st->fetches;
+    while (*link) {
+        PlaylistFetch *job = *link;
+        pthread_mutex_lock(&job->mutex);
+        bool finished = job->finished;
+        pthread_mutex_unlock(&job->mutex);
+        if (!finished) {
+            if (job->started) running++;
+            link = &job->next;
+            continue;
+        }
+        *link = job->next;
+        changed = true;
+
+        if (job->sync_file[0]) {
+            playlist_sync_finish(st, job, status, status_size);
+        } else {
+            sb_log("[PLAYBACK] playlist import: %s fetched %d songs (%d resumed)%s", job->url,
+                   job->count, job->resumed, job->result < 0 ? ", interrupted" : "");
+            const char *label = job->name[0] ? job->name : job->url;
+            if (job->result < 0 && job->saved > 0) {
+                // The checkpoint stays for the next attempt
+                snprintf(status, status_size, "Import of %s stopped after %d songs; import it again to resume",
+                         label, job->count);
+            } else if (job->result < 0 || job->count == 0) {
+                snprintf(status, status_size, "Failed to fetch playlist %s", label);
+            } else {
+                int count = job->count;
+                int idx = playlist_import_finish(st, job);
+                if (idx < 0) {
+                    snprintf(status, status_size, "Failed to create playlist for %s", job->url);
+                } else {
+                    snprintf(status, status_size, "Imported %d songs into '%s'",
+                             count, st->playlists[idx].name);
+                }
+            }
+            if (job->result >= 0 && job->resume_file[0]) unlink(job->resume_file);
+        }
+        playlist_fetch_free(job);
+    }
+
+    for (PlaylistFetch *job = st->fetches; job && running < PLAYLIST_FETCH_PARALLEL; job = job->next) {
+        if (job->started) continue;
+        job->started = true;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, playlist_fetch_thread_func, job) != 0) {
+            job->result = -1;
+            job->finished = true;  // reported on the next poll
+            continue;
+        }
+        pthread_detach(thread);
+        running++;
+    }
+    return changed;
+}
+
+// Abandon every queued and running fetch; each thread stops at its next
+// progress report
+static void playlist_fetch_cancel_all(AppState *st) {
+    while (st->fetches) {
+        PlaylistFetch *job = st->fetches;
+        st->fetches = job->next;
+        pthread_mutex_lock(&job->mutex);
+        job->cancelled = true;
+        bool free_now = job->finished || !job->started;
+        pthread_mutex_unlock(&job->mutex);
+        if (free_now) playlist_fetch_free(job);
+    }
+    st->sync_total = 0;
+    st->sync_done = 0;
+    memset(&st->sync_diff, 0, sizeof(st->sync_diff));
+    st->sync_failed = 0;
+}
+
+// ============================================================================
+// Shuffle Order
+// ============================================================================
+
+static void shuffle_free(ShuffleOrder *so) {
+    free(so->order);
+    free(so->pos);
+    so->order = NULL;
+    so->pos = NULL;
+    so->count = 0;
+    so->cursor = 0;
+}
+
+static void shuffle_swap(ShuffleOrder *so, int a, int b) {
+    int sa = so->order[a];
+    int sb = so->order[b];
+    so->order[a] = sb;
+    so->order[b] = sa;
+    so->pos[sb] = a;
+    so->pos[sa] = b;
+}
+
+// Fisher-Yates over [0, count) with `first` (if valid) moved to the front
+static bool shuffle_generate(ShuffleOrder *so, int count, int first) {
+    if (so->count != count || !so->order) {
+        shuffle_free(so);
+        so->order = malloc(sizeof(int) * (count > 0 ? count : 1));
+        so->pos = malloc(sizeof(int) * (count > 0 ? count : 1));
+        if (!so->order || !so->pos) {
+            shuffle_free(so);
+            return false;
+        }
+        so->count = count;
+    }
+
+    for (int i = 0; i < count; i++) so->order[i] = i;
+    for (int i = count - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int tmp = so->order[i];
+        so->order[i] = so->order[j];
+        so->order[j] = tmp;
+    }
+    for (int i = 0; i < count; i++) so->pos[so->order[i]] = i;
+
+    if (first >= 0 && first < count) {
+        shuffle_swap(so, 0, so->pos[first]);
+    }
+    so->cursor = 0;
+    return true;
+}
+
+// Advance to the next song in the order; reshuffles once the list is exhausted
+static int shuffle_next(ShuffleOrder *so) {
+    if (!so->order || so->count == 0) return -1;
+
+    if (so->cursor + 1 >= so->count) {
+        int last = so->order[so->cursor];
+        shuffle_generate(so, so->count, -1);
+        // Don't play the same song twice in a row across passes
+        if (so->count > 1 && so->order[0] == last) {
+            shuffle_swap(so, 0, 1 + rand() % (so->count - 1));
+        }
+        return so->order[0];
+    }
+
+    so->cursor++;
+    return so->order[so->cursor];
+}
+
+static int shuffle_prev(ShuffleOrder *so) {
+    if (!so->order || so->cursor <= 0) return -1;
+    so->cursor--;
+    return so->order[so->cursor];
+}
+
+// Song k positions after the cursor, or -1 if the pass ends before that
+static int shuffle_peek(const ShuffleOrder *so, int k) {
+    if (!so->order || so->cursor + k >= so->count) return -1;
+    return so->order[so->cursor + k];
+}
+
+// The user picked a song directly: an upcoming song becomes the next entry
+// of the pass, a song from the history starts a fresh pass from it
+static void shuffle_select(ShuffleOrder *so, int count, int song) {
+    if (!so->order || so->count != count) {
+        shuffle_generate(so, count, song);
+        return;
+    }
+    if (song < 0 || song >= count || so->order[so->cursor] == song) return;
+
+    int p = so->pos[song];
+    if (p > so->cursor) {
+        shuffle_swap(so, p, so->cursor + 1);
+        so->cursor++;
+    } else {
+        shuffle_generate(so, count, song);
+    }
+}
+
+static void shuffle_key_for(AppState *st, bool from_playlist, int playlist_idx,
+                            char *out, size_t out_size) {
+    if (from_playlist) {
+        snprintf(out, out_size, "playlist:%s", st->playlists[playlist_idx].filename);
+    } else {
+        snprintf(out, out_size, "search:%s",
+                 st->search_detached ? st->played_search.query : st->query);
+    }
+}
+
+// Shuffle order for a list, restoring the saved one on first use
+static ShuffleOrder *shuffle_for_list(AppState *st, bool from_playlist, int playlist_idx,
+                                      int *count_out) {
+    ShuffleOrder *so;
+    int count;
+    if (from_playlist) {
+        if (playlist_idx < 0 || playlist_idx >= st->playlist_count) return NULL;
+        so = &st->playlists[playlist_idx].shuffle;
+        count = st->playlists[playlist_idx].count;
+    } else {
+        so = st->search_detached ? &st->played_search.shuffle : &st->search_shuffle;
+        playing_search_songs(st, &count);
+    }
+    if (count_out) *count_out = count;
+
+    if (!so->order && st->saved_shuffle_count > 0) {
+        char key[1024];
+        shuffle_key_for(st, from_playlist, playlist_idx, key, sizeof(key));
+        for (int i = 0; i < st->saved_shuffle_count; i++) {
+            SavedShuffle *saved = &st->saved_shuffles[i];
+            if (!saved->order || saved->count != count || strcmp(saved->key, key) != 0) continue;
+
+            so->order = saved->order;
+            so->count = saved->count;
+            so->cursor = saved->cursor;
+            so->pos = malloc(sizeof(int) * count);
+            saved->order = NULL;
+            if (!so->pos) {
+                shuffle_free(so);
+                break;
+            }
+            for (int j = 0; j < count; j++) so->pos[so->order[j]] = j;
+            sb_log("[PLAYBACK] restored shuffle order for %s (position %d/%d)",
+                   key, so->cursor + 1, count);
+            break;
+        }
+    }
+    return so;
+}
+
+static ShuffleOrder *playing_shuffle(AppState *st, int *count_out) {
+    if (st->playing_from_playlist) {
+        return shuffle_for_list(st, true, st->playing_playlist_idx, count_out);
+    }
+    return shuffle_for_list(st, false, -1, count_out);
+}
+
+static void save_shuffle_orders(AppState *st) {
+    MemRender m;
+    if (!render_begin(&m)) return;
+    json_printf(&m.w, "{\n  \"lists\": [\n");
+    bool first = true;
+    for (int i = -1; i < st->playlist_count; i++) {
+        ShuffleOrder *so;
+        if (i < 0) {
+            so = st->search_detached ? &st->played_search.shuffle : &st->search_shuffle;
+        } else {
+            so = &st->playlists[i].shuffle;
+        }
+        if (!so->order || so->count == 0) continue;
+
+        char key[1024];
+        shuffle_key_for(st, i >= 0, i, key, sizeof(key));
+
+        if (!first) json_printf(&m.w, ",\n");
+        first = false;
+        json_printf(&m.w, "    {\"key\": %q, \"count\": %d, \"cursor\": %d, \"order\": [",
+                    key, so->count, so->cursor);
+        for (int j = 0; j < so->count; j++) {
+            json_printf(&m.w, j ? ",%d" : "%d", so->order[j]);
+        }
+        json_printf(&m.w, "]}");
+    }
+    json_printf(&m.w, "\n  ]\n}\n");
+    if (render_end(&m)) persist_write(st->shuffle_file, m.data, m.len, NULL);
+}
+
+static void free_saved_shuffles(AppState *st) {
+    for (int i = 0; i < st->saved_shuffle_count; i++) {
+        free(st->saved_shuffles[i].key);
+        free(st->saved_shuffles[i].order);
+    }
+    free(st->saved_shuffles);
+    st->saved_shuffles = NULL;
+    st->saved_shuffle_count = 0;
+}
+
+static void load_shuffle_orders(AppState *st) {
+    free_saved_shuffles(st);
+
+    FILE *f = fopen(st->shuffle_file, "r");
+    if (!f) return;
+
+    JsonReader r;
+    json_reader_init(&r, f);
+    if (json_next(&r) == JSON_OBJECT) {
+        while (json_next(&r) == JSON_KEY) {
+            if (!json_text_is(&r, "lists") || json_next(&r) != JSON_ARRAY) {
+                json_skip(&r);
+                continue;
+            }
+
+            JsonToken t;
+            while ((t = json_next(&r)) == JSON_OBJECT) {
+                char *key = NULL;
+                int count = 0;
+                int cursor = 0;
+                int *order = NULL;
+                int order_len = 0;
+                int order_cap = 0;
+                bool valid = true;
+                while (json_next(&r) == JSON_KEY) {
+                    if (json_text_is(&r, "key") && !key) {
+                        key = json_read_strdup(&r);
+                    } else if (json_text_is(&r, "count")) {
+                        count = (int)json_read_int(&r, 0);
+                    } else if (json_text_is(&r, "cursor")) {
+                        cursor = (int)json_read_int(&r, 0);
+                    } else if (json_text_is(&r, "order") && !order && json_next(&r) == JSON_ARRAY) {
+                        JsonToken v;
+                        while ((v = json_next(&r)) == JSON_NUMBER) {
+                            if (order_len == order_cap) {
+                                int cap = order_cap ? order_cap * 2 : 64;
+                                int *grown = realloc(order, sizeof(int) * cap);
+                                if (!grown) break;
+                                order = grown;
+                                order_cap = cap;
+                            }
+                            order[order_len++] = atoi(r.text);
+                        }
+                        if (v != JSON_ARRAY_END) {
+                            valid = false;
+                            if (v != JSON_ERROR) json_leave(&r);
+                        }
+                    } else {
+                        json_skip(&r);
+                    }
+                }
+
+                valid = valid && order && key && count > 0 && order_len == count &&
+                        cursor >= 0 && cursor < count;
+                if (valid) {
+                    // Check it's a real permutation
+                    char *seen = calloc(count, 1);
+                    for (int j = 0; valid && j < count; j++) {
+                        int v = order[j];
+                        if (!seen || v < 0 || v >= count || seen[v]) {
+                            valid = false;
+                            break;
+                        }
+                        seen[v] = 1;
+                    }
+                    free(seen);
+                }
+
+                if (valid) {
+                    SavedShuffle *grown = realloc(st->saved_shuffles,
+                                                  sizeof(SavedShuffle) * (st->saved_shuffle_count + 1));
+                    if (grown) {
+                        st->saved_shuffles = grown;
+                        SavedShuffle *saved = &st->saved_shuffles[st->saved_shuffle_count++];
+                        saved->key = key;
+                        saved->order = order;
+                        saved->count = count;
+                        saved->cursor = cursor;
+                        key = NULL;
+                        order = NULL;
+                    }
+                }
+                free(key);
+                free(order);
+            }
+            if (t != JSON_ARRAY_END) json_leave(&r);
+        }
     }
+    json_reader_free(&r);
+    fclose(f);
+}
 
-    if (pid < 0) {
-        sb_log("[PLAYBACK] mpv_start_if_needed: fork() failed: %s (errno=%d)", strerror(errno), errno);
-        return;
+// ============================================================================
+// Play Statistics
+// ============================================================================
+
+// Index of the stats entry for video_id, optionally creating it (-1 if none)
+static int stats_lookup(AppState *st, const char *video_id, bool create) {
+    if (!video_id || !video_id[0]) return -1;
+
+    int idx = strmap_get(&st->stats_index, video_id);
+    if (idx >= 0 || !create) return idx;
+
+    if (st->stats_count >= st->stats_cap) {
+        int new_cap = st->stats_cap ? st->stats_cap * 2 : 256;
+        SongStats *grown = realloc(st->stats, sizeof(SongStats) * new_cap);
+        if (!grown) return -1;
+        st->stats = grown;
+        st->stats_cap = new_cap;
     }
 
-    sb_log("[PLAYBACK] mpv_start_if_needed: mpv forked with pid=%d, waiting for IPC socket...", pid);
-    mpv_pid = pid;
-    bool connected = false;
-    for (int i = 0; i < 100; i++) {
-        if (file_exists(IPC_SOCKET)) {
-            sb_log("[PLAYBACK] mpv_start_if_needed: IPC socket appeared after %d ms", (i + 1) * 50);
-            usleep(50 * 1000);
-            if (mpv_connect()) {
-                sb_log("[PLAYBACK] mpv_start_if_needed: successfully connected to mpv (pid=%d)", pid);
-                connected = true;
-            } else {
-                sb_log("[PLAYBACK] mpv_start_if_needed: IPC socket exists but connect failed");
+    idx = st->stats_count;
+    SongStats *stats = &st->stats[idx];
+    memset(stats, 0, sizeof(*stats));
+    snprintf(stats->video_id, sizeof(stats->video_id), "%s", video_id);
+    if (!strmap_put(&st->stats_index, stats->video_id, idx)) return -1;
+    st->stats_count++;
+    return idx;
+}
+
+// Shuffle weight: 1.0 for songs that are never skipped, shrinking as skips
+// outnumber completed plays
+static double song_weight(const SongStats *stats) {
+    if (!stats) return 1.0;
+    double w = (stats->completions + 1.0) / (stats->completions + 3.0 * stats->skips + 1.0);
+    return w < 0.05 ? 0.05 : w;
+}
+
+static void weighted_stats_changed(AppState *st, int stat_idx);
+
+// A track was handed to mpv: count the play and wait for its end-file
+static void stats_track_loaded(AppState *st, const char *video_id) {
+    int idx = stats_lookup(st, video_id, true);
+    if (idx < 0) return;
+
+    st->stats[idx].plays++;
+
+    if (st->stat_pending_count >= (int)(sizeof(st->stat_pending) / sizeof(st->stat_pending[0]))) {
+        memmove(st->stat_pending, st->stat_pending + 1,
+                sizeof(int) * (st->stat_pending_count - 1));
+        st->stat_pending_count--;
+    }
+    st->stat_pending[st->stat_pending_count++] = idx;
+}
+
+// mpv reported end-file for the oldest loaded track: "eof" is a completed
+// play, "stop" means it was replaced or stopped before the end
+static void stats_track_ended(AppState *st, const char *reason) {
+    if (st->stat_pending_count == 0) return;
+
+    int idx = st->stat_pending[0];
+    memmove(st->stat_pending, st->stat_pending + 1, sizeof(int) * (st->stat_pending_count - 1));
+    st->stat_pending_count--;
+
+    if (strcmp(reason, "eof") == 0) {
+        st->stats[idx].completions++;
+    } else if (strcmp(reason, "stop") == 0) {
+        st->stats[idx].skips++;
+    } else {
+        return;  // quit/error/redirect say nothing about the song
+    }
+    weighted_stats_changed(st, idx);
+}
+
+static void save_stats(AppState *st) {
+    MemRender m;
+    if (!render_begin(&m)) return;
+    json_printf(&m.w, "{\n  \"songs\": [\n");
+    for (int i = 0; i < st->stats_count; i++) {
+        SongStats *stats = &st->stats[i];
+        json_printf(&m.w, "    {\"video_id\": %q, \"plays\": %d, \"skips\": %d, \"completions\": %d}%s\n",
+                    stats->video_id, stats->plays, stats->skips, stats->completions,
+                    (i < st->stats_count - 1) ? "," : "");
+    }
+    json_printf(&m.w, "  ]\n}\n");
+    if (render_end(&m)) persist_write(st->stats_file, m.data, m.len, NULL);
+}
+
+static void load_stats(AppState *st) {
+    FILE *f = fopen(st->stats_file, "r");
+    if (!f) return;
+
+    JsonReader r;
+    json_reader_init(&r, f);
+    if (json_next(&r) == JSON_OBJECT) {
+        while (json_next(&r) == JSON_KEY) {
+            if (!json_text_is(&r, "songs") || json_next(&r) != JSON_ARRAY) {
+                json_skip(&r);
+                continue;
             }
-            break;
+
+            JsonToken t;
+            while ((t = json_next(&r)) == JSON_OBJECT) {
+                char video_id[64] = "";
+                int plays = 0, skips = 0, completions = 0;
+                while (json_next(&r) == JSON_KEY) {
+                    if (json_text_is(&r, "video_id")) {
+                        json_read_string(&r, video_id, sizeof(video_id));
+                    } else if (json_text_is(&r, "plays")) {
+                        plays = (int)json_read_int(&r, 0);
+                    } else if (json_text_is(&r, "skips")) {
+                        skips = (int)json_read_int(&r, 0);
+                    } else if (json_text_is(&r, "completions")) {
+                        completions = (int)json_read_int(&r, 0);
+                    } else {
+                        json_skip(&r);
+                    }
+                }
+
+                int idx = stats_lookup(st, video_id, true);
+                if (idx >= 0) {
+                    st->stats[idx].plays = plays;
+                    st->stats[idx].skips = skips;
+                    st->stats[idx].completions = completions;
+                }
+            }
+            if (t != JSON_ARRAY_END) json_leave(&r);
         }
-        usleep(50 * 1000);
     }
-    if (!connected) {
-        sb_log("[PLAYBACK] mpv_start_if_needed: WARNING - failed to connect after 5s timeout (pid=%d)", pid);
+    json_reader_free(&r);
+    fclose(f);
+}
+
+// ============================================================================
+// Weighted Shuffle (alias method)
+// ============================================================================
+
+static void alias_free(AliasTable *t) {
+    free(t->prob);
+    free(t->alias);
+    free(t->built_w);
+    free(t->cur_w);
+    memset(t, 0, sizeof(*t));
+}
+
+// Vose's alias method over the current weights
+static bool alias_rebuild(AliasTable *t) {
+    int n = t->count;
+    int *small = malloc(sizeof(int) * n);
+    int *large = malloc(sizeof(int) * n);
+    double *scaled = malloc(sizeof(double) * n);
+    if (!small || !large || !scaled) {
+        free(small);
+        free(large);
+        free(scaled);
+        return false;
+    }
+
+    double total = 0;
+    for (int i = 0; i < n; i++) total += t->cur_w[i];
+
+    int ns = 0, nl = 0;
+    for (int i = 0; i < n; i++) {
+        t->built_w[i] = t->cur_w[i];
+        scaled[i] = total > 0 ? t->cur_w[i] * n / total : 1.0;
+        if (scaled[i] < 1.0) small[ns++] = i;
+        else large[nl++] = i;
+    }
+
+    while (ns > 0 && nl > 0) {
+        int s = small[--ns];
+        int l = large[--nl];
+        t->prob[s] = scaled[s];
+        t->alias[s] = l;
+        scaled[l] = scaled[l] + scaled[s] - 1.0;
+        if (scaled[l] < 1.0) small[ns++] = l;
+        else large[nl++] = l;
+    }
+    while (nl > 0) {
+        int l = large[--nl];
+        t->prob[l] = 1.0;
+        t->alias[l] = l;
     }
+    while (ns > 0) {  // only reachable through rounding
+        int s = small[--ns];
+        t->prob[s] = 1.0;
+        t->alias[s] = s;
+    }
+
+    t->built_total = total;
+    t->cur_total = total;
+    t->needs_rebuild = false;
+
+    free(small);
+    free(large);
+    free(scaled);
+    return true;
 }
 
-static void mpv_quit(void) {
-    sb_log("[PLAYBACK] mpv_quit: shutting down mpv (pid=%d)", mpv_pid);
-    mpv_send_command("{\"command\":[\"quit\"]}");
-    usleep(100 * 1000);
+static bool alias_build(AliasTable *t, const double *weights, int n) {
+    alias_free(t);
+    if (n <= 0) return false;
 
-    mpv_disconnect();
+    t->prob = malloc(sizeof(double) * n);
+    t->alias = malloc(sizeof(int) * n);
+    t->built_w = malloc(sizeof(double) * n);
+    t->cur_w = malloc(sizeof(double) * n);
+    if (!t->prob || !t->alias || !t->built_w || !t->cur_w) {
+        alias_free(t);
+        return false;
+    }
+    memcpy(t->cur_w, weights, sizeof(double) * n);
+    t->count = n;
+    return alias_rebuild(t);
+}
 
-    if (mpv_pid > 0) {
-        kill(mpv_pid, SIGTERM);
-        waitpid(mpv_pid, NULL, WNOHANG);
-        sb_log("[PLAYBACK] mpv_quit: sent SIGTERM to pid=%d", mpv_pid);
-        mpv_pid = -1;
+// O(1) weight update. Lower weights are absorbed by rejection sampling;
+// a higher weight can't be, so the table is rebuilt before the next sample.
+static void alias_set_weight(AliasTable *t, int i, double w) {
+    if (i < 0 || i >= t->count) return;
+    t->cur_total += w - t->cur_w[i];
+    t->cur_w[i] = w;
+    if (w > t->built_w[i]) t->needs_rebuild = true;
+}
+
+static int alias_sample(AliasTable *t) {
+    if (t->count <= 0) return -1;
+
+    // Rejection gets expensive once most of the built mass is gone
+    if (t->needs_rebuild || t->cur_total < 0.5 * t->built_total) {
+        alias_rebuild(t);
     }
-    unlink(IPC_SOCKET);
-    sb_log("[PLAYBACK] mpv_quit: cleanup complete");
+
+    for (int attempt = 0; attempt < 64; attempt++) {
+        int i = rand() % t->count;
+        double u = rand() / ((double)RAND_MAX + 1.0);
+        int j = u < t->prob[i] ? i : t->alias[i];
+
+        double accept = t->built_w[j] > 0 ? t->cur_w[j] / t->built_w[j] : 0;
+        if (rand() / ((double)RAND_MAX + 1.0) < accept) return j;
+    }
+
+    alias_rebuild(t);
+    return rand() % t->count;
 }
 
-// Check if mpv finished playing (returns true if track ended)
-// Only returns true for genuine end-of-file, not loading states
-static bool mpv_check_track_end(void) {
-    if (mpv_ipc_fd < 0) return false;
+static void weighted_reset(WeightedShuffle *ws) {
+    alias_free(&ws->table);
+    strmap_free(&ws->index);
+    ws->key[0] = '\0';
+    ws->history_len = 0;
+    ws->next_pick = -1;
+}
+
+// Build the alias table for the playing list if it isn't built for it yet
+static bool weighted_prepare(AppState *st) {
+    WeightedShuffle *ws = &st->weighted;
+    Playlist *pl = NULL;
+    Song *songs = NULL;
+    int count;
+    if (st->playing_from_playlist) {
+        if (st->playing_playlist_idx < 0 || st->playing_playlist_idx >= st->playlist_count) return false;
+        pl = &st->playlists[st->playing_playlist_idx];
+        count = pl->count;
+    } else {
+        songs = playing_search_songs(st, &count);
+    }
+
+    char key[1024];
+    shuffle_key_for(st, st->playing_from_playlist, st->playing_playlist_idx, key, sizeof(key));
+    if (ws->table.count == count && count > 0 && strcmp(ws->key, key) == 0) return true;
 
-    char buf[4096];
-    ssize_t n = read(mpv_ipc_fd, buf, sizeof(buf) - 1);
+    weighted_reset(ws);
+    if (count <= 0) return false;
 
-    if (n <= 0) {
-        if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            // Connection lost
-            sb_log("[PLAYBACK] mpv_check_track_end: connection lost: %s (errno=%d)", strerror(errno), errno);
-            mpv_disconnect();
-        }
-        return false;
+    double *weights = malloc(sizeof(double) * count);
+    if (!weights) return false;
+    for (int i = 0; i < count; i++) {
+        const char *video_id = pl ? playlist_song(st, pl, i)->video_id : songs[i].video_id;
+        int idx = stats_lookup(st, video_id, false);
+        weights[i] = song_weight(idx >= 0 ? &st->stats[idx] : NULL);
+        strmap_put(&ws->index, video_id, i);
     }
+    bool ok = alias_build(&ws->table, weights, count);
+    free(weights);
+    if (ok) snprintf(ws->key, sizeof(ws->key), "%s", key);
+    return ok;
+}
 
-    buf[n] = '\0';
-    sb_log("[PLAYBACK] mpv_check_track_end: IPC data received (%zd bytes): %.200s", n, buf);
+static void weighted_stats_changed(AppState *st, int stat_idx) {
+    WeightedShuffle *ws = &st->weighted;
+    int i = strmap_get(&ws->index, st->stats[stat_idx].video_id);
+    if (i >= 0) alias_set_weight(&ws->table, i, song_weight(&st->stats[stat_idx]));
+}
 
-    // Only trigger on end-file event with reason "eof" (not "error" or "stop")
-    // Format: {"event":"end-file","reason":"eof",...}
-    if (strstr(buf, "\"event\":\"end-file\"") && strstr(buf, "\"reason\":\"eof\"")) {
-        sb_log("[PLAYBACK] mpv_check_track_end: track ended (EOF)");
-        return true;
+static int weighted_sample_other(AppState *st, int current) {
+    WeightedShuffle *ws = &st->weighted;
+    int pick = alias_sample(&ws->table);
+    for (int tries = 0; pick == current && ws->table.count > 1 && tries < 8; tries++) {
+        pick = alias_sample(&ws->table);
     }
+    if (pick == current && ws->table.count > 1) {
+        pick = (current + 1 + rand() % (ws->table.count - 1)) % ws->table.count;
+    }
+    return pick;
+}
 
-    // Log if there's an end-file with error reason (useful for debugging stream failures)
-    if (strstr(buf, "\"event\":\"end-file\"") && strstr(buf, "\"reason\":\"error\"")) {
-        sb_log("[PLAYBACK] mpv_check_track_end: WARNING - track ended with ERROR");
+// Record a started song in the history and pre-sample the one after it
+static void weighted_after_play(AppState *st, int idx) {
+    WeightedShuffle *ws = &st->weighted;
+    if (!weighted_prepare(st)) return;
+
+    if (ws->history_len == PLAY_HISTORY_SIZE) {
+        memmove(ws->history, ws->history + 1, sizeof(int) * (PLAY_HISTORY_SIZE - 1));
+        ws->history_len--;
     }
+    ws->history[ws->history_len++] = idx;
+    ws->next_pick = weighted_sample_other(st, idx);
+}
 
-    return false;
+static int weighted_next(AppState *st) {
+    WeightedShuffle *ws = &st->weighted;
+    if (!weighted_prepare(st)) return -1;
+    int next = ws->next_pick;
+    if (next < 0 || next >= ws->table.count || next == st->playing_index) {
+        next = weighted_sample_other(st, st->playing_index);
+    }
+    return next;
+}
+
+static int weighted_prev(AppState *st) {
+    WeightedShuffle *ws = &st->weighted;
+    if (!weighted_prepare(st) || ws->history_len < 2) return -1;
+    // Drop the current song and the previous one; replaying it pushes it back
+    int prev = ws->history[ws->history_len - 2];
+    ws->history_len -= 2;
+    return prev;
 }
 
 // ============================================================================
-// Search Functions
+// Play Queue
 // ============================================================================
 
-static void free_search_results(AppState *st) {
-    for (int i = 0; i < st->search_count; i++) {
-        free(st->search_results[i].title);
-        free(st->search_results[i].video_id);
-        free(st->search_results[i].url);
-        st->search_results[i].title = NULL;
-        st->search_results[i].video_id = NULL;
-        st->search_results[i].url = NULL;
+static QueueEntry *queue_at(PlayQueue *q, int i) {
+    return &q->items[(q->head + i) % q->cap];
+}
+
+static void queue_entry_free(QueueEntry *e) {
+    free(e->song.title);
+    free(e->playlist);
+    memset(e, 0, sizeof(*e));
+}
+
+static bool queue_grow(PlayQueue *q) {
+    int new_cap = q->cap ? q->cap * 2 : 16;
+    QueueEntry *items = malloc(sizeof(QueueEntry) * new_cap);
+    if (!items) return false;
+    for (int i = 0; i < q->count; i++) items[i] = *queue_at(q, i);
+    free(q->items);
+    q->items = items;
+    q->cap = new_cap;
+    q->head = 0;
+    return true;
+}
+
+// Queue a copy of song at the back, or at the front for "play next"
+static bool queue_push(PlayQueue *q, const Song *song, const char *playlist, bool front) {
+    if (!song || !song->video_id[0]) return false;
+    if (q->count == q->cap && !queue_grow(q)) return false;
+
+    QueueEntry e = {0};
+    e.song = *song;
+    e.song.title = strdup(song->title ? song->title : "");
+    e.playlist = (playlist && playlist[0]) ? strdup(playlist) : NULL;
+    if (!e.song.title) {
+        queue_entry_free(&e);
+        return false;
     }
-    st->search_count = 0;
-    st->search_selected = 0;
-    st->search_scroll = 0;
+
+    if (front) {
+        q->head = (q->head + q->cap - 1) % q->cap;
+        q->items[q->head] = e;
+    } else {
+        q->items[(q->head + q->count) % q->cap] = e;
+    }
+    q->count++;
+    return true;
 }
 
-static int run_search(AppState *st, const char *raw_query) {
-    free_search_results(st);
+// Take the front entry; the caller owns its strings
+static bool queue_pop_front(PlayQueue *q, QueueEntry *out) {
+    if (q->count == 0) return false;
+    *out = q->items[q->head];
+    q->head = (q->head + 1) % q->cap;
+    q->count--;
+    return true;
+}
 
-    char query_buf[256];
-    strncpy(query_buf, raw_query, sizeof(query_buf) - 1);
-    query_buf[sizeof(query_buf) - 1] = '\0';
-    char *query = trim_whitespace(query_buf);
+static void queue_remove(PlayQueue *q, int i) {
+    if (i < 0 || i >= q->count) return;
+    queue_entry_free(queue_at(q, i));
+    for (int j = i; j < q->count - 1; j++) *queue_at(q, j) = *queue_at(q, j + 1);
+    q->count--;
+}
 
-    if (!query[0]) return 0;
+static void queue_swap(PlayQueue *q, int a, int b) {
+    if (a < 0 || b < 0 || a >= q->count || b >= q->count) return;
+    QueueEntry tmp = *queue_at(q, a);
+    *queue_at(q, a) = *queue_at(q, b);
+    *queue_at(q, b) = tmp;
+}
 
-    sb_log("[PLAYBACK] run_search: query=\"%s\"", query);
+static void queue_clear(PlayQueue *q) {
+    for (int i = 0; i < q->count; i++) queue_entry_free(queue_at(q, i));
+    q->head = 0;
+    q->count = 0;
+}
 
-    // Escape for shell
-    char escaped_query[512];
-    size_t j = 0;
-    for (size_t i = 0; query[i] && j < sizeof(escaped_query) - 5; i++) {
-        char c = query[i];
-        if (c == '"' || c == '\\' || c == '$' || c == '`') {
-            escaped_query[j++] = '\\';
+static void save_play_queue(AppState *st) {
+    MemRender m;
+    if (!render_begin(&m)) return;
+    json_printf(&m.w, "{\n  \"queue\": [\n");
+    for (int i = 0; i < st->queue.count; i++) {
+        QueueEntry *e = queue_at(&st->queue, i);
+        json_printf(&m.w, "    {\"title\": %q, \"video_id\": %q, \"duration\": %d, \"playlist\": %q}%s\n",
+                    e->song.title, e->song.video_id, e->song.duration, e->playlist,
+                    (i < st->queue.count - 1) ? "," : "");
+    }
+    json_printf(&m.w, "  ]\n}\n");
+    if (render_end(&m)) persist_write(st->queue_file, m.data, m.len, NULL);
+}
+
+static void load_play_queue(AppState *st) {
+    FILE *f = fopen(st->queue_file, "r");
+    if (!f) return;
+
+    JsonReader r;
+    json_reader_init(&r, f);
+    if (json_next(&r) == JSON_OBJECT) {
+        while (json_next(&r) == JSON_KEY) {
+            if (!json_text_is(&r, "queue") || json_next(&r) != JSON_ARRAY) {
+                json_skip(&r);
+                continue;
+            }
+
+            JsonToken t;
+            while ((t = json_next(&r)) == JSON_OBJECT) {
+                Song song = {0};
+                char *playlist = NULL;
+                bool has_id = false;
+                while (json_next(&r) == JSON_KEY) {
+                    if (json_text_is(&r, "title") && !song.title) {
+                        song.title = json_read_strdup(&r);
+                    } else if (json_text_is(&r, "video_id")) {
+                        char id[64];
+                        has_id = json_read_string(&r, id, sizeof(id)) && song_set_video_id(&song, id);
+                    } else if (json_text_is(&r, "duration")) {
+                        song.duration = (int)json_read_int(&r, 0);
+                    } else if (json_text_is(&r, "playlist") && !playlist) {
+                        playlist = json_read_strdup(&r);
+                    } else {
+                        json_skip(&r);
+                    }
+                }
+                if (has_id) queue_push(&st->queue, &song, playlist, false);
+
+                free(song.title);
+                free(playlist);
+            }
+            if (t != JSON_ARRAY_END) json_leave(&r);
         }
-        escaped_query[j++] = c;
     }
-    escaped_query[j] = '\0';
+    json_reader_free(&r);
+    fclose(f);
+    sb_log("[PLAYBACK] load_play_queue: %d queued songs", st->queue.count);
+}
 
-    char cmd[2048];
-    snprintf(cmd, sizeof(cmd),
-             "%s --flat-playlist --quiet --no-warnings "
-             "--print '%%(title)s|||%%(id)s|||%%(duration)s' "
-             "\"ytsearch%d:%s\" 2>/dev/null",
-             get_ytdlp_cmd(st), MAX_RESULTS, escaped_query);
+// ============================================================================
+// Library Index
+// ============================================================================
+
+static uint32_t bigram_bucket(const char *p) {
+    return (uint32_t)(unsigned char)p[0] << 8 | (uint32_t)(unsigned char)p[1];
+}
 
-    sb_log("[PLAYBACK] run_search: executing: %s", cmd);
+static uint32_t trigram_bucket(const char *p) {
+    uint32_t t = (uint32_t)(unsigned char)p[0] << 16 |
+                 (uint32_t)(unsigned char)p[1] << 8 |
+                 (uint32_t)(unsigned char)p[2];
+    return (t * 2654435761u) >> (32 - LIBRARY_TRIGRAM_BITS);
+}
 
-    FILE *fp = popen(cmd, "r");
-    if (!fp) {
-        sb_log("[PLAYBACK] run_search: popen() failed: %s", strerror(errno));
+// Letters and digits get a bit each, so the mask test is exact for them
+static uint64_t library_char_bit(unsigned char c) {
+    if (c >= 'a' && c <= 'z') return 1ULL << (c - 'a');
+    if (c >= '0' && c <= '9') return 1ULL << (26 + c - '0');
+    return 1ULL << (36 + c % 28);
+}
+
+// Lowercase ASCII and turn underscores (downloaded file names) into spaces
+static char library_fold_char(char c) {
+    return c == '_' ? ' ' : (char)tolower((unsigned char)c);
+}
+
+static void library_free(LibraryIndex *lib) {
+    for (int i = 0; i < lib->count; i++) {
+        free(lib->entries[i].title);
+        free(lib->entries[i].video_id);
+        free(lib->entries[i].folder);
+    }
+    free(lib->entries);
+    free(lib->text);
+    free(lib->offsets);
+    free(lib->chars);
+    free(lib->start);
+    free(lib->postings);
+    free(lib->bigram_start);
+    free(lib->bigram_postings);
+    free(lib->matches);
+    free(lib->scratch);
+    strmap_free(&lib->ids);
+    lib->entries = NULL;
+    lib->text = NULL;
+    lib->offsets = NULL;
+    lib->chars = NULL;
+    lib->start = NULL;
+    lib->postings = NULL;
+    lib->bigram_start = NULL;
+    lib->bigram_postings = NULL;
+    lib->matches = NULL;
+    lib->scratch = NULL;
+    lib->count = 0;
+    lib->cap = 0;
+    lib->match_count = 0;
+    lib->filtered[0] = '\0';
+    lib->fuzzy = false;
+}
+
+// Add a song unless its video_id is already indexed. Returns its entry, -1 on error.
+static int library_add(LibraryIndex *lib, const char *title, const char *video_id,
+                       int duration) {
+    int i = strmap_get(&lib->ids, video_id);
+    if (i >= 0) return i;
+
+    if (lib->count == lib->cap) {
+        int new_cap = lib->cap ? lib->cap * 2 : 256;
+        LibraryEntry *entries = realloc(lib->entries, sizeof(LibraryEntry) * new_cap);
+        if (!entries) return -1;
+        lib->entries = entries;
+        lib->cap = new_cap;
+    }
+
+    LibraryEntry *e = &lib->entries[lib->count];
+    memset(e, 0, sizeof(*e));
+    e->title = strdup(title);
+    e->video_id = strdup(video_id);
+    e->playlist_idx = -1;
+    e->duration = duration;
+    if (!e->title || !e->video_id || !strmap_put(&lib->ids, e->video_id, lib->count)) {
+        free(e->title);
+        free(e->video_id);
         return -1;
     }
-    
-    char *line = NULL;
-    size_t cap = 0;
-    int count = 0;
-    
-    while (count < MAX_RESULTS && getline(&line, &cap, fp) != -1) {
-        size_t len = strlen(line);
-        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) {
-            line[--len] = '\0';
+    return lib->count++;
+}
+
+// Index the "Title_[video_id].mp3" files of one download directory
+static void library_scan_downloads(LibraryIndex *lib, const char *dir_path,
+                                   const char *folder, bool recurse) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (name[0] == '.') continue;
+
+        size_t len = strlen(name);
+        const char *open = strrchr(name, '[');
+        if (len > 5 && strcmp(name + len - 5, "].mp3") == 0 && open) {
+            char video_id[32];
+            size_t id_len = (size_t)(name + len - 5 - (open + 1));
+            if (id_len == 0 || id_len >= sizeof(video_id)) continue;
+            memcpy(video_id, open + 1, id_len);
+            video_id[id_len] = '\0';
+
+            char title[512];
+            size_t title_len = (size_t)(open - name);
+            if (title_len > 0 && name[title_len - 1] == '_') title_len--;
+            if (title_len >= sizeof(title)) title_len = sizeof(title) - 1;
+            memcpy(title, name, title_len);
+            title[title_len] = '\0';
+            for (char *c = title; *c; c++) {
+                if (*c == '_') *c = ' ';
+            }
+
+            bool known = strmap_get(&lib->ids, video_id) >= 0;
+            int i = library_add(lib, title_len ? title : video_id, video_id, 0);
+            if (i < 0) continue;
+            lib->entries[i].downloaded = true;
+            if (!known && folder) lib->entries[i].folder = strdup(folder);
+        } else if (recurse) {
+            char sub[4096];
+            snprintf(sub, sizeof(sub), "%s/%s", dir_path, name);
+            if (dir_exists(sub)) library_scan_downloads(lib, sub, name, false);
         }
-        
-        if (!line[0]) continue;
-        if (strncmp(line, "ERROR", 5) == 0) continue;
-        if (strncmp(line, "WARNING", 7) == 0) continue;
-        
-        char *sep1 = strstr(line, "|||");
-        if (!sep1) continue;
-        *sep1 = '\0';
-
-        char *sep2 = strstr(sep1 + 3, "|||");
-        if (!sep2) continue;
-        *sep2 = '\0';
-
-        const char *title = line;
-        const char *video_id = sep1 + 3;
-        const char *duration_str = sep2 + 3;
-        if (!video_id[0]) continue;
-
-        size_t id_len = strlen(video_id);
-        if (id_len < 5 || id_len > 20) continue;
-
-        st->search_results[count].title = strdup(title);
-        st->search_results[count].video_id = strdup(video_id);
-
-        char fullurl[256];
-        snprintf(fullurl, sizeof(fullurl),
-                 "https://www.youtube.com/watch?v=%s", video_id);
-        st->search_results[count].url = strdup(fullurl);
-        st->search_results[count].duration = atoi(duration_str);
-        
-        if (st->search_results[count].title && 
-            st->search_results[count].video_id &&
-            st->search_results[count].url) {
-            count++;
+    }
+    closedir(dir);
+}
+
+// Posting lists of the n-grams of every title, built in two passes:
+// count per bucket, then fill
+static bool library_build_postings(LibraryIndex *lib, int gram, uint32_t (*bucket)(const char *),
+                                   int buckets, int **start_out, int **postings_out) {
+    int *last = malloc(sizeof(int) * buckets);
+    int *start = calloc(buckets + 1, sizeof(int));
+    if (!last || !start) {
+        free(last);
+        free(start);
+        return false;
+    }
+
+    for (int b = 0; b < buckets; b++) last[b] = -1;
+    for (int i = 0; i < lib->count; i++) {
+        for (int j = lib->offsets[i]; j + gram < lib->offsets[i + 1]; j++) {
+            uint32_t b = bucket(lib->text + j);
+            if (last[b] == i) continue;
+            last[b] = i;
+            start[b + 1]++;
+        }
+    }
+    for (int b = 0; b < buckets; b++) {
+        start[b + 1] += start[b];
+    }
+
+    int *postings = malloc(sizeof(int) * (start[buckets] ? start[buckets] : 1));
+    if (!postings) {
+        free(last);
+        free(start);
+        return false;
+    }
+
+    // last[] doubles as the fill cursor of each bucket
+    for (int b = 0; b < buckets; b++) last[b] = start[b];
+    for (int i = 0; i < lib->count; i++) {
+        for (int j = lib->offsets[i]; j + gram < lib->offsets[i + 1]; j++) {
+            uint32_t b = bucket(lib->text + j);
+            if (last[b] > start[b] && postings[last[b] - 1] == i) continue;
+            postings[last[b]++] = i;
+        }
+    }
+
+    free(last);
+    *start_out = start;
+    *postings_out = postings;
+    return true;
+}
+
+// Pack the folded titles and build the posting lists
+static bool library_finalize(LibraryIndex *lib) {
+    int n = lib->count ? lib->count : 1;
+    size_t text_size = 1;
+    for (int i = 0; i < lib->count; i++) text_size += strlen(lib->entries[i].title) + 1;
+
+    lib->text = malloc(text_size);
+    lib->offsets = malloc(sizeof(int) * (n + 1));
+    lib->chars = calloc(n, sizeof(uint64_t));
+    lib->matches = malloc(sizeof(int) * n);
+    lib->scratch = malloc(sizeof(int) * n);
+    if (!lib->text || !lib->offsets || !lib->chars || !lib->matches || !lib->scratch) {
+        return false;
+    }
+
+    int pos = 0;
+    for (int i = 0; i < lib->count; i++) {
+        lib->offsets[i] = pos;
+        for (const char *c = lib->entries[i].title; *c; c++) {
+            char f = library_fold_char(*c);
+            if (f == '\n') f = ' ';
+            lib->text[pos++] = f;
+            if (f != ' ') lib->chars[i] |= library_char_bit((unsigned char)f);
+        }
+        lib->text[pos++] = '\n';
+    }
+    lib->offsets[lib->count] = pos;
+    lib->text[pos] = '\0';
+
+    bool ok = library_build_postings(lib, 3, trigram_bucket, LIBRARY_TRIGRAM_BUCKETS,
+                                     &lib->start, &lib->postings) &&
+              library_build_postings(lib, 2, bigram_bucket, LIBRARY_BIGRAM_BUCKETS,
+                                     &lib->bigram_start, &lib->bigram_postings);
+    return ok;
+}
+
+static bool library_entry_has(const LibraryIndex *lib, int i, const char *term, size_t len) {
+    const char *title = lib->text + lib->offsets[i];
+    size_t title_len = (size_t)(lib->offsets[i + 1] - lib->offsets[i] - 1);
+    return memmem(title, title_len, term, len) != NULL;
+}
+
+// Characters of needle appear in order in the title (typo-tolerant fallback)
+static bool library_match_subsequence(const LibraryIndex *lib, int i, const char *needle) {
+    const char *p = lib->text + lib->offsets[i];
+    const char *end = lib->text + lib->offsets[i + 1];
+    for (; *needle; needle++) {
+        if (*needle == ' ') continue;
+        p = memchr(p, *needle, (size_t)(end - p));
+        if (!p) return false;
+        p++;
+    }
+    return true;
+}
+
+// Keep the entries of cand[0..n) that are also in list[0..len), both sorted
+static int library_intersect(int *cand, int n, const int *list, int len) {
+    int kept = 0;
+    int j = 0;
+    for (int i = 0; i < n && j < len; i++) {
+        while (j < len && list[j] < cand[i]) j++;
+        if (j < len && list[j] == cand[i]) cand[kept++] = cand[i];
+    }
+    return kept;
+}
+
+// Recompute matches for lib->query: every word must appear in the title, in
+// any order. While the user keeps typing the new query only narrows the old
+// one, so the previous matches are the starting candidates.
+static void library_filter(LibraryIndex *lib) {
+    if (!lib->matches) return;
+
+    char folded[256];
+    size_t folded_len = 0;
+    uint64_t mask = 0;
+    for (const char *c = lib->query; *c && folded_len + 1 < sizeof(folded); c++) {
+        char f = library_fold_char(*c);
+        folded[folded_len++] = f;
+        if (f != ' ') mask |= library_char_bit((unsigned char)f);
+    }
+    folded[folded_len] = '\0';
+
+    char terms[LIBRARY_MAX_TERMS][256];
+    size_t lens[LIBRARY_MAX_TERMS];
+    int term_count = 0;
+    char *save = NULL;
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s", folded);
+    for (char *tok = strtok_r(tmp, " ", &save); tok && term_count < LIBRARY_MAX_TERMS;
+         tok = strtok_r(NULL, " ", &save)) {
+        snprintf(terms[term_count], sizeof(terms[0]), "%s", tok);
+        lens[term_count++] = strlen(tok);
+    }
+
+    bool refine = lib->filtered[0] && !lib->fuzzy && term_count > 0 &&
+                  strncmp(folded, lib->filtered, strlen(lib->filtered)) == 0;
+    snprintf(lib->filtered, sizeof(lib->filtered), "%s", folded);
+    lib->fuzzy = false;
+
+    if (term_count == 0) {
+        lib->match_count = 0;
+        for (int i = 0; i < lib->count; i++) lib->matches[lib->match_count++] = i;
+        return;
+    }
+
+    // Candidates: the previous matches or the shortest posting list,
+    // intersected with the lists of every other trigram in the query (bigram
+    // for two-letter words)
+    int *cand = lib->scratch;
+    int n = -1;
+    if (refine) {
+        memcpy(cand, lib->matches, sizeof(int) * lib->match_count);
+        n = lib->match_count;
+    }
+    const int *lists[64];
+    int list_lens[64];
+    int list_count = 0;
+    for (int t = 0; t < term_count; t++) {
+        if (lens[t] == 2 && list_count < 64) {
+            uint32_t b = bigram_bucket(terms[t]);
+            lists[list_count] = lib->bigram_postings + lib->bigram_start[b];
+            list_lens[list_count++] = lib->bigram_start[b + 1] - lib->bigram_start[b];
+        }
+        for (size_t j = 0; j + 3 <= lens[t] && list_count < 64; j++) {
+            uint32_t b = trigram_bucket(terms[t] + j);
+            lists[list_count] = lib->postings + lib->start[b];
+            list_lens[list_count++] = lib->start[b + 1] - lib->start[b];
+        }
+    }
+    for (int k = 0; k < list_count && n != 0; k++) {
+        int shortest = k;
+        for (int m = k + 1; m < list_count; m++) {
+            if (list_lens[m] < list_lens[shortest]) shortest = m;
+        }
+        const int *list = lists[shortest];
+        int len = list_lens[shortest];
+        lists[shortest] = lists[k];
+        list_lens[shortest] = list_lens[k];
+        if (n < 0) {
+            memcpy(cand, list, sizeof(int) * len);
+            n = len;
         } else {
-            free(st->search_results[count].title);
-            free(st->search_results[count].video_id);
-            free(st->search_results[count].url);
+            n = library_intersect(cand, n, list, len);
+        }
+    }
+
+    // Single letters and digits are settled by the character mask, two-letter
+    // words by their exact bigram list
+    lib->match_count = 0;
+    int limit = n < 0 ? lib->count : n;
+    for (int k = 0; k < limit; k++) {
+        int i = n < 0 ? k : cand[k];
+        if ((lib->chars[i] & mask) != mask) continue;
+        bool ok = true;
+        for (int t = 0; t < term_count && ok; t++) {
+            if (lens[t] == 1 && isalnum((unsigned char)terms[t][0])) continue;
+            if (lens[t] == 2) continue;
+            ok = library_entry_has(lib, i, terms[t], lens[t]);
         }
+        if (ok) lib->matches[lib->match_count++] = i;
     }
-    
-    free(line);
-    pclose(fp);
-    
-    st->search_count = count;
-    st->search_selected = 0;
-    st->search_scroll = 0;
-    strncpy(st->query, query, sizeof(st->query) - 1);
-    st->query[sizeof(st->query) - 1] = '\0';
 
-    sb_log("[PLAYBACK] run_search: found %d results for query=\"%s\"", count, query);
+    if (lib->match_count == 0) {
+        lib->fuzzy = true;
+        for (int i = 0; i < lib->count; i++) {
+            if ((lib->chars[i] & mask) == mask && library_match_subsequence(lib, i, folded)) {
+                lib->matches[lib->match_count++] = i;
+            }
+        }
+    }
+}
+
+// Index every playlist song and every downloaded file
+static bool library_build(AppState *st) {
+    LibraryIndex *lib = &st->library;
+    char query[256];
+    snprintf(query, sizeof(query), "%s", lib->query);
+    library_free(lib);
+
+    for (int p = 0; p < st->playlist_count; p++) {
+        Playlist *pl = &st->playlists[p];
+        if (pl->count == 0) load_playlist_songs(st, p);
+        for (int s = 0; s < pl->count; s++) {
+            Song *song = playlist_song(st, pl, s);
+            if (!song->video_id[0]) continue;
+            bool known = strmap_get(&lib->ids, song->video_id) >= 0;
+            int i = library_add(lib, song->title ? song->title : song->video_id,
+                                song->video_id, song->duration);
+            if (i < 0 || known) continue;
+            lib->entries[i].playlist_idx = p;
+            lib->entries[i].song_idx = s;
+        }
+    }
+    library_scan_downloads(lib, st->config.download_path, NULL, true);
 
-    return count;
+    if (!library_finalize(lib)) {
+        library_free(lib);
+        return false;
+    }
+    snprintf(lib->query, sizeof(lib->query), "%s", query);
+    library_filter(lib);
+    sb_log("[LIBRARY] indexed %d songs, %d postings", lib->count,
+           lib->start[LIBRARY_TRIGRAM_BUCKETS]);
+    return true;
 }
 
 // ============================================================================
 // Playback Functions
 // ============================================================================
 
-static void play_search_result(AppState *st, int idx) {
-    if (idx < 0 || idx >= st->search_count) {
-        sb_log("[PLAYBACK] play_search_result: invalid index %d (count=%d)", idx, st->search_count);
-        return;
+// Load a track with the cache profile for its source, optionally starting at
+// an offset and/or paused (session resume)
+static void load_for_playback(AppState *st, const char *url, int start_pos, bool start_paused) {
+    char options[512];
+    stream_quality_choose(st);
+    int tier = stream_profile_options(st, url, options, sizeof(options));
+
+    if (start_pos > 0 || start_paused) {
+        size_t len = strlen(options);
+        snprintf(options + len, sizeof(options) - len, ",start=%d%s",
+                 start_pos > 0 ? start_pos : 0, start_paused ? ",pause=yes" : "");
+    }
+    mpv_start_if_needed(st);
+    mpv_load_url(url, options, "replace");
+    st->preloaded.valid = false;  // replace clears mpv's playlist
+    stream_track_started(st, tier);
+}
+
+// On a natural track end mpv has already moved on to the preloaded track;
+// adopt it instead of reloading. Returns false if video_id isn't the one
+// that was preloaded.
+static bool take_preloaded(AppState *st, const char *video_id) {
+    if (!st->advancing_on_eof || !st->preloaded.valid || !video_id ||
+        strcmp(st->preloaded.video_id, video_id) != 0) {
+        return false;
     }
-    if (!st->search_results[idx].url) {
-        sb_log("[PLAYBACK] play_search_result: no URL for result %d", idx);
+    sb_log("[PLAYBACK] gapless: continuing with preloaded track %s", video_id);
+    st->preloaded.valid = false;
+    stream_quality_choose(st);
+    stream_track_started(st, st->preloaded.tier);
+    return true;
+}
+
+static void update_download_priority(AppState *st);
+static void preload_next_track(AppState *st);
+
+// URL to play a song from: its downloaded file when there is one, else the stream
+static void song_playback_url(AppState *st, const Song *song, const char *playlist_name,
+                              bool stream_only, char *out, size_t out_size) {
+    if (!stream_only && get_local_file_path_for_song(st, playlist_name, song->video_id,
+                                                     out, out_size)) {
         return;
     }
+    youtube_watch_url(song->video_id, out, out_size);
+}
+
+// Leave queue playback when a song from a list starts
+static void end_queue_playback(AppState *st) {
+    if (!st->playing_from_queue) return;
+    queue_entry_free(&st->queue_current);
+    st->playing_from_queue = false;
+}
+
+static bool playback_active(AppState *st) {
+    return st->playing_index >= 0 || st->playing_from_queue;
+}
+
+// The song now playing, NULL if nothing is
+static const Song *current_song(AppState *st) {
+    if (st->playing_from_queue) return &st->queue_current.song;
+    if (st->playing_index < 0) return NULL;
+    if (st->playing_from_playlist) {
+        if (st->playing_playlist_idx < 0 || st->playing_playlist_idx >= st->playlist_count) return NULL;
+        Playlist *pl = &st->playlists[st->playing_playlist_idx];
+        return st->playing_index < pl->count ? playlist_song(st, pl, st->playing_index) : NULL;
+    }
+    int count = 0;
+    Song *songs = playing_search_songs(st, &count);
+    return st->playing_index < count ? &songs[st->playing_index] : NULL;
+}
 
+// Play a song of the search list playback runs on (see playing_search_songs)
+static void play_search_result_at(AppState *st, int idx, int start_pos, bool start_paused) {
+    int count = 0;
+    Song *songs = playing_search_songs(st, &count);
+    if (idx < 0 || idx >= count) {
+        sb_log("[PLAYBACK] play_search_result: invalid index %d (count=%d)", idx, count);
+        return;
+    }
+    char url[256];
+    youtube_watch_url(songs[idx].video_id, url, sizeof(url));
     sb_log("[PLAYBACK] play_search_result: playing result #%d: \"%s\" url=%s",
-           idx, st->search_results[idx].title ? st->search_results[idx].title : "(null)",
-           st->search_results[idx].url);
+           idx, songs[idx].title ? songs[idx].title : "(null)", url);
 
-    mpv_start_if_needed(st);
-    mpv_load_url(st->search_results[idx].url);
+    if (!take_preloaded(st, songs[idx].video_id)) {
+        load_for_playback(st, url, start_pos, start_paused);
+    }
 
+    end_queue_playback(st);
     st->playing_index = idx;
     st->playing_from_playlist = false;
     st->playing_playlist_idx = -1;
-    st->paused = false;
+    st->paused = start_paused;
     st->playback_started = time(NULL);
+    stats_track_loaded(st, songs[idx].video_id);
+    if (st->shuffle_mode && st->config.weighted_shuffle) {
+        weighted_after_play(st, idx);
+    } else if (st->shuffle_mode) {
+        shuffle_select(shuffle_for_list(st, false, -1, NULL), count, idx);
+    }
+    update_download_priority(st);
+    preload_next_track(st);
     sb_log("[PLAYBACK] play_search_result: playback started for result #%d", idx);
 }
 
-static void play_playlist_song(AppState *st, int playlist_idx, int song_idx) {
+// Play from the results on screen, leaving any earlier search list behind
+static void play_search_result(AppState *st, int idx) {
+    release_played_search(st);
+    play_search_result_at(st, idx, 0, false);
+}
+
+static void play_playlist_song_at(AppState *st, int playlist_idx, int song_idx,
+                                  int start_pos, bool start_paused) {
     if (playlist_idx < 0 || playlist_idx >= st->playlist_count) {
         sb_log("[PLAYBACK] play_playlist_song: invalid playlist_idx=%d (count=%d)", playlist_idx, st->playlist_count);
         return;
@@ -2133,127 +7128,280 @@ static void play_playlist_song(AppState *st, int playlist_idx, int song_idx) {
                song_idx, pl->count, pl->name ? pl->name : "(null)");
         return;
     }
-    if (!pl->items[song_idx].url) {
-        sb_log("[PLAYBACK] play_playlist_song: no URL for song %d in playlist \"%s\"",
-               song_idx, pl->name ? pl->name : "(null)");
-        return;
-    }
-
-    sb_log("[PLAYBACK] play_playlist_song: playlist=\"%s\" song=#%d \"%s\" video_id=%s url=%s is_youtube=%d",
+    Song *song = playlist_song(st, pl, song_idx);
+    sb_log("[PLAYBACK] play_playlist_song: playlist=\"%s\" song=#%d \"%s\" video_id=%s is_youtube=%d",
            pl->name ? pl->name : "(null)", song_idx,
-           pl->items[song_idx].title ? pl->items[song_idx].title : "(null)",
-           pl->items[song_idx].video_id ? pl->items[song_idx].video_id : "(null)",
-           pl->items[song_idx].url,
-           pl->is_youtube_playlist);
-
-    mpv_start_if_needed(st);
+           song->title ? song->title : "(null)",
+           song->video_id, pl->is_youtube_playlist);
 
-    // Check if YouTube playlist - always stream
-    if (pl->is_youtube_playlist) {
-        sb_log("[PLAYBACK] play_playlist_song: streaming YouTube playlist song: %s", pl->items[song_idx].url);
-        mpv_load_url(pl->items[song_idx].url);
-    } else {
-        // Check if local file exists for this song
-        char local_path[2048];
-        if (get_local_file_path_for_song(st, pl->name, pl->items[song_idx].video_id,
-                                          local_path, sizeof(local_path))) {
-            // Play from local file
-            sb_log("[PLAYBACK] play_playlist_song: playing LOCAL file: %s", local_path);
-            mpv_load_url(local_path);
-        } else {
-            // Stream from YouTube
-            sb_log("[PLAYBACK] play_playlist_song: no local file, STREAMING from: %s", pl->items[song_idx].url);
-            mpv_load_url(pl->items[song_idx].url);
-        }
+    if (!take_preloaded(st, song->video_id)) {
+        // YouTube playlists always stream; others play the local file if downloaded
+        char url[2048];
+        song_playback_url(st, song, pl->name, pl->is_youtube_playlist,
+                          url, sizeof(url));
+        sb_log("[PLAYBACK] play_playlist_song: playing %s", url);
+        load_for_playback(st, url, start_pos, start_paused);
     }
 
+    release_played_search(st);
+    end_queue_playback(st);
     st->playing_index = song_idx;
     st->playing_from_playlist = true;
     st->playing_playlist_idx = playlist_idx;
-    st->paused = false;
+    st->paused = start_paused;
     st->playback_started = time(NULL);
+    stats_track_loaded(st, song->video_id);
+    if (st->shuffle_mode && st->config.weighted_shuffle) {
+        weighted_after_play(st, song_idx);
+    } else if (st->shuffle_mode) {
+        shuffle_select(shuffle_for_list(st, true, playlist_idx, NULL), pl->count, song_idx);
+    }
+    update_download_priority(st);
+    preload_next_track(st);
     sb_log("[PLAYBACK] play_playlist_song: playback started");
 }
 
-static int get_random_index(int count, int current) {
-    if (count <= 1) return 0;
-    int next;
-    do {
-        next = rand() % count;
-    } while (next == current && count > 1);
-    return next;
+static void play_playlist_song(AppState *st, int playlist_idx, int song_idx) {
+    play_playlist_song_at(st, playlist_idx, song_idx, 0, false);
 }
 
-static void play_next(AppState *st) {
-    sb_log("[PLAYBACK] play_next: current index=%d, from_playlist=%d, playlist_idx=%d, shuffle=%d",
-           st->playing_index, st->playing_from_playlist, st->playing_playlist_idx, st->shuffle_mode);
-    if (st->playing_from_playlist && st->playing_playlist_idx >= 0) {
-        Playlist *pl = &st->playlists[st->playing_playlist_idx];
-        int next;
-        if (st->shuffle_mode) {
-            next = get_random_index(pl->count, st->playing_index);
-            sb_log("[PLAYBACK] play_next: shuffle mode, random index=%d/%d", next, pl->count);
-        } else {
-            next = st->playing_index + 1;
-        }
-        if (next < pl->count) {
-            sb_log("[PLAYBACK] play_next: advancing to playlist song #%d/%d", next, pl->count);
-            play_playlist_song(st, st->playing_playlist_idx, next);
-            st->playlist_song_selected = next;
-        } else if (st->shuffle_mode) {
-            // In shuffle mode, loop back
-            next = get_random_index(pl->count, st->playing_index);
-            sb_log("[PLAYBACK] play_next: shuffle loop, random index=%d/%d", next, pl->count);
-            play_playlist_song(st, st->playing_playlist_idx, next);
-            st->playlist_song_selected = next;
-        } else {
-            sb_log("[PLAYBACK] play_next: already at last song in playlist (%d/%d)", st->playing_index, pl->count);
+// Play a queue entry, taking ownership of it. The list position is kept so
+// playback returns to the list once the queue is empty.
+static void play_queue_entry(AppState *st, QueueEntry *e) {
+    sb_log("[PLAYBACK] play_queue_entry: \"%s\" video_id=%s",
+           e->song.title ? e->song.title : "(null)", e->song.video_id);
+
+    if (!take_preloaded(st, e->song.video_id)) {
+        char url[2048];
+        song_playback_url(st, &e->song, e->playlist, false, url, sizeof(url));
+        load_for_playback(st, url, 0, false);
+    }
+
+    queue_entry_free(&st->queue_current);
+    st->queue_current = *e;
+    memset(e, 0, sizeof(*e));
+    st->playing_from_queue = true;
+    st->paused = false;
+    st->playback_started = time(NULL);
+    stats_track_loaded(st, st->queue_current.song.video_id);
+    update_download_priority(st);
+    preload_next_track(st);
+}
+
+// Play a library entry: songs in a playlist play from that playlist, files
+// found only on disk play like a queue entry
+static void play_library_entry(AppState *st, int i) {
+    LibraryEntry *e = &st->library.entries[i];
+    if (e->playlist_idx >= 0 && e->playlist_idx < st->playlist_count) {
+        Playlist *pl = &st->playlists[e->playlist_idx];
+        if (e->song_idx < pl->count &&
+            strcmp(playlist_song(st, pl, e->song_idx)->video_id, e->video_id) == 0) {
+            play_playlist_song(st, e->playlist_idx, e->song_idx);
+            return;
         }
-    } else if (st->search_count > 0) {
-        int next;
-        if (st->shuffle_mode) {
-            next = get_random_index(st->search_count, st->playing_index);
-            sb_log("[PLAYBACK] play_next: shuffle mode, random search index=%d/%d", next, st->search_count);
-        } else {
-            next = st->playing_index + 1;
-        }
-        if (next < st->search_count) {
-            sb_log("[PLAYBACK] play_next: advancing to search result #%d/%d", next, st->search_count);
-            play_search_result(st, next);
-            st->search_selected = next;
-        } else if (st->shuffle_mode) {
-            // In shuffle mode, loop back
-            next = get_random_index(st->search_count, st->playing_index);
-            sb_log("[PLAYBACK] play_next: shuffle loop, random search index=%d/%d", next, st->search_count);
-            play_search_result(st, next);
-            st->search_selected = next;
-        } else {
-            sb_log("[PLAYBACK] play_next: already at last search result (%d/%d)", st->playing_index, st->search_count);
+    }
+
+    QueueEntry q = {0};
+    if (!song_set_video_id(&q.song, e->video_id)) return;
+    q.song.title = strdup(e->title);
+    q.song.duration = e->duration;
+    q.playlist = e->folder ? strdup(e->folder) : NULL;
+    if (!q.song.title) {
+        queue_entry_free(&q);
+        return;
+    }
+    play_queue_entry(st, &q);
+}
+
+// Index of the song k steps ahead in the playing list (k=0 is the current
+// song), following the shuffle order when shuffle is on. Returns -1 past the end.
+static int upcoming_index(AppState *st, int k) {
+    if (st->playing_index < 0) return -1;
+
+    int count = 0;
+    ShuffleOrder *so = playing_shuffle(st, &count);
+    if (st->shuffle_mode && st->config.weighted_shuffle) {
+        // Only the pre-sampled next song is known ahead of time
+        if (k == 0) return st->playing_index;
+        return (k == 1 && st->weighted.table.count == count) ? st->weighted.next_pick : -1;
+    }
+    if (st->shuffle_mode && so) {
+        int at = shuffle_peek(so, k);
+        if (at >= 0) return at;
+        if (so->count == count && so->cursor + k >= count) return -1;  // reshuffle pending
+    }
+
+    int idx = st->playing_index + k;
+    return idx < count ? idx : -1;
+}
+
+// The song k >= 1 tracks ahead: queued songs first, then the playing list.
+// Fills in where its local file would be. Returns NULL past the end.
+static const Song *upcoming_song(AppState *st, int k, const char **playlist_name,
+                                 bool *stream_only) {
+    *playlist_name = NULL;
+    *stream_only = false;
+    if (k <= st->queue.count) {
+        QueueEntry *e = queue_at(&st->queue, k - 1);
+        *playlist_name = e->playlist;
+        return &e->song;
+    }
+
+    int idx = upcoming_index(st, k - st->queue.count);
+    if (idx < 0) return NULL;
+    if (st->playing_from_playlist) {
+        if (st->playing_playlist_idx < 0 || st->playing_playlist_idx >= st->playlist_count) return NULL;
+        Playlist *pl = &st->playlists[st->playing_playlist_idx];
+        if (idx >= pl->count) return NULL;
+        *playlist_name = pl->name;
+        *stream_only = pl->is_youtube_playlist;
+        return playlist_song(st, pl, idx);
+    }
+    int count = 0;
+    Song *songs = playing_search_songs(st, &count);
+    *stream_only = true;
+    return idx < count ? &songs[idx] : NULL;
+}
+
+// Let the download thread fetch the next few tracks before the rest of the queue
+static void update_download_priority(AppState *st) {
+    char ids[DOWNLOAD_PRIORITY_COUNT][32] = {{0}};
+
+    for (int k = 1; k <= DOWNLOAD_PRIORITY_COUNT; k++) {
+        const char *playlist_name;
+        bool stream_only;
+        const Song *song = upcoming_song(st, k, &playlist_name, &stream_only);
+        if (!song) break;
+        snprintf(ids[k - 1], sizeof(ids[k - 1]), "%s", song->video_id);
+    }
+
+    pthread_mutex_lock(&st->download_queue.mutex);
+    memcpy(st->download_queue.priority_ids, ids, sizeof(ids));
+    pthread_mutex_unlock(&st->download_queue.mutex);
+}
+
+// Append the next track to mpv's playlist so mpv switches to it without a
+// gap when the current one ends. Call again whenever "next" may change.
+static void preload_next_track(AppState *st) {
+    if (mpv_ipc_fd < 0) return;
+    if (st->preloaded.valid) {
+        mpv_send_command("{\"command\":[\"playlist-clear\"]}");
+        st->preloaded.valid = false;
+    }
+    if (!playback_active(st)) return;
+
+    const char *playlist_name;
+    bool stream_only;
+    const Song *song = upcoming_song(st, 1, &playlist_name, &stream_only);
+    if (!song || !song->video_id[0]) return;
+
+    char url[2048];
+    char options[512];
+    song_playback_url(st, song, playlist_name, stream_only, url, sizeof(url));
+    st->preloaded.tier = stream_profile_options(st, url, options, sizeof(options));
+    mpv_load_url(url, options, "append");
+    snprintf(st->preloaded.video_id, sizeof(st->preloaded.video_id), "%s", song->video_id);
+    st->preloaded.valid = true;
+}
+
+// Persist the queue and refresh everything derived from "what plays next"
+static void queue_changed(AppState *st) {
+    save_play_queue(st);
+    update_download_priority(st);
+    preload_next_track(st);
+}
+
+static void stop_playback(AppState *st) {
+    mpv_stop_playback();  // also clears mpv's playlist
+    st->preloaded.valid = false;
+    end_queue_playback(st);
+    release_played_search(st);
+    st->playing_index = -1;
+    st->playing_from_playlist = false;
+    st->playing_playlist_idx = -1;
+    st->paused = false;
+}
+
+static void play_next(AppState *st) {
+    sb_log("[PLAYBACK] play_next: current index=%d, from_playlist=%d, playlist_idx=%d, shuffle=%d, queued=%d",
+           st->playing_index, st->playing_from_playlist, st->playing_playlist_idx,
+           st->shuffle_mode, st->queue.count);
+
+    QueueEntry e;
+    if (queue_pop_front(&st->queue, &e)) {
+        play_queue_entry(st, &e);
+        save_play_queue(st);
+        return;
+    }
+
+    int count = 0;
+    ShuffleOrder *so = playing_shuffle(st, &count);
+    if (st->playing_index < 0 || !so || count == 0) return;
+
+    int next;
+    if (st->shuffle_mode && st->config.weighted_shuffle) {
+        next = weighted_next(st);
+        sb_log("[PLAYBACK] play_next: weighted shuffle -> index %d", next);
+        if (next < 0) return;
+    } else if (st->shuffle_mode) {
+        // Align the order with the current song (shuffle may have just been enabled)
+        shuffle_select(so, count, st->playing_index);
+        next = shuffle_next(so);
+        sb_log("[PLAYBACK] play_next: shuffle order position %d/%d -> index %d",
+               so->cursor + 1, count, next);
+    } else {
+        next = st->playing_index + 1;
+        if (next >= count) {
+            sb_log("[PLAYBACK] play_next: already at last song (%d/%d)", st->playing_index, count);
+            return;
         }
     }
+
+    if (st->playing_from_playlist) {
+        sb_log("[PLAYBACK] play_next: advancing to playlist song #%d/%d", next, count);
+        play_playlist_song(st, st->playing_playlist_idx, next);
+        st->playlist_song_selected = next;
+    } else {
+        sb_log("[PLAYBACK] play_next: advancing to search result #%d/%d", next, count);
+        play_search_result_at(st, next, 0, false);
+        if (!st->search_detached) st->search_selected = next;
+    }
 }
 
 static void play_prev(AppState *st) {
     sb_log("[PLAYBACK] play_prev: current index=%d, from_playlist=%d, playlist_idx=%d",
            st->playing_index, st->playing_from_playlist, st->playing_playlist_idx);
-    if (st->playing_from_playlist && st->playing_playlist_idx >= 0) {
-        int prev = st->playing_index - 1;
-        if (prev >= 0) {
-            sb_log("[PLAYBACK] play_prev: going back to playlist song #%d", prev);
-            play_playlist_song(st, st->playing_playlist_idx, prev);
-            st->playlist_song_selected = prev;
-        } else {
-            sb_log("[PLAYBACK] play_prev: already at first song in playlist");
-        }
-    } else if (st->search_count > 0) {
-        int prev = st->playing_index - 1;
-        if (prev >= 0) {
-            sb_log("[PLAYBACK] play_prev: going back to search result #%d", prev);
-            play_search_result(st, prev);
-            st->search_selected = prev;
-        } else {
-            sb_log("[PLAYBACK] play_prev: already at first search result");
-        }
+
+    int count = 0;
+    ShuffleOrder *so = playing_shuffle(st, &count);
+    if (st->playing_index < 0 || !so || count == 0) return;
+
+    int prev;
+    if (st->playing_from_queue) {
+        // Back from a queued song to the list song it interrupted
+        prev = st->playing_index;
+    } else if (st->shuffle_mode && st->config.weighted_shuffle) {
+        prev = weighted_prev(st);
+    } else if (st->shuffle_mode) {
+        // Walk back through the shuffle history
+        shuffle_select(so, count, st->playing_index);
+        prev = shuffle_prev(so);
+    } else {
+        prev = st->playing_index - 1;
+    }
+    if (prev < 0) {
+        sb_log("[PLAYBACK] play_prev: already at first song");
+        return;
+    }
+
+    if (st->playing_from_playlist) {
+        sb_log("[PLAYBACK] play_prev: going back to playlist song #%d", prev);
+        play_playlist_song(st, st->playing_playlist_idx, prev);
+        st->playlist_song_selected = prev;
+    } else {
+        sb_log("[PLAYBACK] play_prev: going back to search result #%d", prev);
+        play_search_result_at(st, prev, 0, false);
+        if (!st->search_detached) st->search_selected = prev;
     }
 }
 
@@ -2286,16 +7434,16 @@ static void draw_header(int cols, ViewMode view) {
     // Line 2-3: Shortcuts (two lines)
     switch (view) {
         case VIEW_SEARCH:
-            mvprintw(1, 0, "  /,s: search | Enter: play | Space: pause | n/p: next/prev | R: shuffle | t: jump");
-            mvprintw(2, 0, "  Left/Right: seek | a: add | d: download | f: playlists | S: settings | q: quit");
+            mvprintw(1, 0, "  /,s: search | L: library | Enter: play | Space: pause | n/p: next/prev | R: shuffle | t: jump");
+            mvprintw(2, 0, "  Left/Right: seek | a: add | d: download | e/E: queue/next | Q: queue | f: playlists | S: settings | q: quit");
             break;
         case VIEW_PLAYLISTS:
-            mvprintw(1, 0, "  Enter: open | c: create | e: rename | p: add YouTube | x: delete | d: download all");
-            mvprintw(2, 0, "  Esc: back | i: about | q: quit");
+            mvprintw(1, 0, "  Enter: open | c: create | e: rename | p: add YouTube | I: import list | x: delete | d: download all");
+            mvprintw(2, 0, "  U: sync all YouTube | L: library | Esc: back | i: about | q: quit");
             break;
         case VIEW_PLAYLIST_SONGS:
             mvprintw(1, 0, "  Enter: play | Space: pause | n/p: next/prev | R: shuffle | t: jump | Left/Right: seek");
-            mvprintw(2, 0, "  a: add | d: download | r: remove | D: download all | u: sync YT | Esc: back | q: quit");
+            mvprintw(2, 0, "  a: add | d: download | r: remove | D: download all | u: sync YT | e/E: queue/next | Esc: back | q: quit");
             break;
         case VIEW_ADD_TO_PLAYLIST:
             mvprintw(1, 0, "  Enter: add to playlist | c: create new playlist");
@@ -2309,6 +7457,14 @@ static void draw_header(int cols, ViewMode view) {
             mvprintw(1, 0, "  Press any key to close");
             move(2, 0);
             break;
+        case VIEW_QUEUE:
+            mvprintw(1, 0, "  Enter: play now | r: remove | K/J: move up/down | C: clear | Space: pause | n/p: next/prev");
+            mvprintw(2, 0, "  Esc: back | q: quit");
+            break;
+        case VIEW_LIBRARY:
+            mvprintw(1, 0, "  Type to filter (words in any order) | Up/Down: select | Enter: play");
+            mvprintw(2, 0, "  Backspace: delete | Ctrl-U: clear | Esc: back");
+            break;
     }
 
     mvhline(3, 0, ACS_HLINE, cols);
@@ -2332,6 +7488,42 @@ static void draw_download_status(AppState *st, int rows, int cols) {
         status_parts++;
     }
 
+    // Tracklist import progress
+    if (st->tracklist) {
+        size_t cur_len = strlen(dl_status);
+        snprintf(dl_status + cur_len, sizeof(dl_status) - cur_len, "%s[%c Import %d/%d]",
+                 status_parts > 0 ? " " : "", spinner, st->tracklist->done, st->tracklist->count);
+        status_parts++;
+    }
+
+    // YouTube playlist imports (songs fetched across all of them) and syncs
+    int jobs = 0;
+    int fetched = 0;
+    for (PlaylistFetch *job = st->fetches; job; job = job->next) {
+        if (job->sync_file[0]) continue;
+        pthread_mutex_lock(&job->mutex);
+        fetched += job->fetched;
+        pthread_mutex_unlock(&job->mutex);
+        jobs++;
+    }
+    if (jobs > 0) {
+        size_t cur_len = strlen(dl_status);
+        if (jobs > 1) {
+            snprintf(dl_status + cur_len, sizeof(dl_status) - cur_len, "%s[%c %d YT imports: %d]",
+                     status_parts > 0 ? " " : "", spinner, jobs, fetched);
+        } else {
+            snprintf(dl_status + cur_len, sizeof(dl_status) - cur_len, "%s[%c YT import: %d]",
+                     status_parts > 0 ? " " : "", spinner, fetched);
+        }
+        status_parts++;
+    }
+    if (st->sync_total > 0) {
+        size_t cur_len = strlen(dl_status);
+        snprintf(dl_status + cur_len, sizeof(dl_status) - cur_len, "%s[%c Sync %d/%d]",
+                 status_parts > 0 ? " " : "", spinner, st->sync_done, st->sync_total);
+        status_parts++;
+    }
+
     // Download queue status
     pthread_mutex_lock(&st->download_queue.mutex);
 
@@ -2378,17 +7570,8 @@ static void draw_download_status(AppState *st, int rows, int cols) {
 static void draw_now_playing(AppState *st, int rows, int cols) {
     mvhline(rows - 2, 0, ACS_HLINE, cols);
     
-    const char *title = NULL;
-    
-    if (st->playing_from_playlist && st->playing_playlist_idx >= 0 &&
-        st->playing_playlist_idx < st->playlist_count) {
-        Playlist *pl = &st->playlists[st->playing_playlist_idx];
-        if (st->playing_index >= 0 && st->playing_index < pl->count) {
-            title = pl->items[st->playing_index].title;
-        }
-    } else if (st->playing_index >= 0 && st->playing_index < st->search_count) {
-        title = st->search_results[st->playing_index].title;
-    }
+    const Song *song = current_song(st);
+    const char *title = song ? song->title : NULL;
     
     if (title) {
         mvprintw(rows - 1, 0, " Now playing: ");
@@ -2410,8 +7593,15 @@ static void draw_now_playing(AppState *st, int rows, int cols) {
         if (st->paused) {
             printw(" [PAUSED]");
         }
+        if (st->playing_from_queue) {
+            printw(" [QUEUE]");
+        }
         if (st->shuffle_mode) {
-            printw(" [SHUFFLE]");
+            printw(st->config.weighted_shuffle ? " [SHUFFLE:W]" : " [SHUFFLE]");
+        }
+        if (st->stream.current_tier >= 0) {
+            printw(" [%s%s]", st->config.stream_quality == QUALITY_AUTO ? "AUTO " : "",
+                   stream_tiers[st->stream.current_tier].name);
         }
     }
     
@@ -2425,7 +7615,12 @@ static void draw_search_view(AppState *st, const char *status, int rows, int col
     printw("%s", st->query[0] ? st->query : "(none)");
     attroff(A_BOLD);
 
-    mvprintw(4, cols - 20, "Results: %d", st->search_count);
+    if (st->search_job) {
+        printw("   (searching \"%s\" %c)", st->search_job->query,
+               get_spinner_char(st->spinner_frame));
+    }
+
+    mvprintw(4, cols - 20, "Results: %d%s", st->search_count, st->search_more ? "+" : "");
 
     if (status && status[0]) {
         mvprintw(5, 0, ">>> %s", status);
@@ -2447,7 +7642,8 @@ static void draw_search_view(AppState *st, const char *status, int rows, int col
     for (int i = 0; i < list_height && (st->search_scroll + i) < st->search_count; i++) {
         int idx = st->search_scroll + i;
         bool is_selected = (idx == st->search_selected);
-        bool is_playing = (!st->playing_from_playlist && idx == st->playing_index);
+        bool is_playing = (!st->playing_from_playlist && !st->search_detached &&
+                           !st->playing_from_queue && idx == st->playing_index);
 
         int y = list_top + i;
         move(y, 0);
@@ -2472,7 +7668,12 @@ static void draw_search_view(AppState *st, const char *status, int rows, int col
                                                            local_path, sizeof(local_path));
         const char *dl_mark = is_downloaded ? "[D]" : "   ";
 
-        int max_title = cols - 20;
+        // P<n>: the song is in n playlists, once every playlist is loaded
+        char pl_mark[8] = "";
+        int lists = st->songs_complete ? song_playlist_count(st, st->search_results[idx].video_id) : 0;
+        if (lists > 0) snprintf(pl_mark, sizeof(pl_mark), "P%d", lists > 99 ? 99 : lists);
+
+        int max_title = cols - 24;
         if (max_title < 20) max_title = 20;
 
         char titlebuf[1024];
@@ -2487,7 +7688,7 @@ static void draw_search_view(AppState *st, const char *status, int rows, int col
             titlebuf[max_title] = '\0';
         }
 
-        mvprintw(y, 0, " %c %3d. %s [%s] %s", mark, idx + 1, dl_mark, dur, titlebuf);
+        mvprintw(y, 0, " %c %3d. %s %-3s [%s] %s", mark, idx + 1, dl_mark, pl_mark, dur, titlebuf);
         
         if (is_selected) {
             attroff(A_REVERSE);
@@ -2590,7 +7791,7 @@ static void draw_playlist_songs_view(AppState *st, const char *status, int rows,
     for (int i = 0; i < list_height && (st->playlist_song_scroll + i) < pl->count; i++) {
         int idx = st->playlist_song_scroll + i;
         bool is_selected = (idx == st->playlist_song_selected);
-        bool is_playing = (st->playing_from_playlist && 
+        bool is_playing = (st->playing_from_playlist && !st->playing_from_queue &&
                           st->playing_playlist_idx == st->current_playlist_idx &&
                           st->playing_index == idx);
         
@@ -2607,13 +7808,14 @@ static void draw_playlist_songs_view(AppState *st, const char *status, int rows,
             attron(A_REVERSE);
         }
         
+        Song *song = playlist_song(st, pl, idx);
         char dur[16];
-        format_duration(pl->items[idx].duration, dur);
+        format_duration(song->duration, dur);
 
         // Check if song is downloaded
         char local_path[2048];
         bool is_downloaded = get_local_file_path_for_song(st, pl->name,
-                                                           pl->items[idx].video_id,
+                                                           song->video_id,
                                                            local_path, sizeof(local_path));
         const char *dl_mark = is_downloaded ? "[D]" : "   ";
 
@@ -2621,7 +7823,7 @@ static void draw_playlist_songs_view(AppState *st, const char *status, int rows,
         if (max_title < 20) max_title = 20;
 
         char titlebuf[1024];
-        const char *title = pl->items[idx].title ? pl->items[idx].title : "(no title)";
+        const char *title = song->title ? song->title : "(no title)";
         strncpy(titlebuf, title, sizeof(titlebuf) - 1);
         titlebuf[sizeof(titlebuf) - 1] = '\0';
 
@@ -2645,11 +7847,11 @@ static void draw_playlist_songs_view(AppState *st, const char *status, int rows,
 
 static void draw_add_to_playlist_view(AppState *st, const char *status, int rows, int cols) {
     mvprintw(2, 0, "Add to playlist: ");
-    if (st->song_to_add && st->song_to_add->title) {
+    if (st->song_to_add.video_id[0]) {
         attron(A_BOLD);
         int max_title = cols - 20;
         char titlebuf[256];
-        strncpy(titlebuf, st->song_to_add->title, sizeof(titlebuf) - 1);
+        strncpy(titlebuf, st->song_to_add.title, sizeof(titlebuf) - 1);
         titlebuf[sizeof(titlebuf) - 1] = '\0';
         if ((int)strlen(titlebuf) > max_title && max_title > 3) {
             titlebuf[max_title - 3] = '.';
@@ -2694,10 +7896,149 @@ static void draw_add_to_playlist_view(AppState *st, const char *status, int rows
         if (is_selected) {
             attron(A_REVERSE);
         }
-        
-        Playlist *pl = &st->playlists[idx];
-        mvprintw(y, 0, "   %3d. %s (%d songs)", idx + 1, pl->name, pl->count);
-        
+        
+        Playlist *pl = &st->playlists[idx];
+        mvprintw(y, 0, "   %3d. %s (%d songs)", idx + 1, pl->name, pl->count);
+        
+        if (is_selected) {
+            attroff(A_REVERSE);
+        }
+    }
+}
+
+static void draw_queue_view(AppState *st, const char *status, int rows, int cols) {
+    mvprintw(4, 0, "Play queue");
+    mvprintw(4, cols - 20, "Queued: %d", st->queue.count);
+
+    if (status && status[0]) {
+        mvprintw(5, 0, ">>> %s", status);
+    }
+
+    mvhline(6, 0, ACS_HLINE, cols);
+
+    int list_top = 7;
+    int list_height = rows - list_top - 2;
+    if (list_height < 1) list_height = 1;
+
+    if (st->queue.count == 0) {
+        mvprintw(list_top + 1, 2, "Queue is empty. Press 'e' on a song to queue it, 'E' to play it next.");
+        return;
+    }
+
+    if (st->queue_selected >= st->queue.count) st->queue_selected = st->queue.count - 1;
+
+    // Adjust scroll
+    if (st->queue_selected < st->queue_scroll) {
+        st->queue_scroll = st->queue_selected;
+    } else if (st->queue_selected >= st->queue_scroll + list_height) {
+        st->queue_scroll = st->queue_selected - list_height + 1;
+    }
+
+    for (int i = 0; i < list_height && (st->queue_scroll + i) < st->queue.count; i++) {
+        int idx = st->queue_scroll + i;
+        QueueEntry *e = queue_at(&st->queue, idx);
+        bool is_selected = (idx == st->queue_selected);
+
+        int y = list_top + i;
+        move(y, 0);
+        clrtoeol();
+
+        if (is_selected) {
+            attron(A_REVERSE);
+        }
+
+        char dur[16];
+        format_duration(e->song.duration, dur);
+
+        int max_title = cols - 20;
+        if (max_title < 20) max_title = 20;
+
+        char titlebuf[1024];
+        strncpy(titlebuf, e->song.title ? e->song.title : "(no title)", sizeof(titlebuf) - 1);
+        titlebuf[sizeof(titlebuf) - 1] = '\0';
+        if ((int)strlen(titlebuf) > max_title && max_title > 3) {
+            titlebuf[max_title - 3] = '.';
+            titlebuf[max_title - 2] = '.';
+            titlebuf[max_title - 1] = '.';
+            titlebuf[max_title] = '\0';
+        }
+
+        mvprintw(y, 0, "   %3d. [%s] %s", idx + 1, dur, titlebuf);
+
+        if (is_selected) {
+            attroff(A_REVERSE);
+        }
+    }
+}
+
+static void draw_library_view(AppState *st, const char *status, int rows, int cols) {
+    LibraryIndex *lib = &st->library;
+    mvprintw(4, 0, "Library: ");
+    attron(A_BOLD);
+    printw("%s", lib->query);
+    attroff(A_BOLD);
+    printw("_");
+    mvprintw(4, cols - 24, "Matches: %d/%d", lib->match_count, lib->count);
+
+    if (status && status[0]) {
+        mvprintw(5, 0, ">>> %s", status);
+    }
+
+    mvhline(6, 0, ACS_HLINE, cols);
+
+    int list_top = 7;
+    int list_height = rows - list_top - 2;
+    if (list_height < 1) list_height = 1;
+
+    if (lib->match_count == 0) {
+        mvprintw(list_top + 1, 2, lib->count ? "No matching songs." :
+                 "Library is empty. Songs in playlists and downloaded files show up here.");
+        return;
+    }
+
+    if (lib->selected >= lib->match_count) lib->selected = lib->match_count - 1;
+    if (lib->selected < 0) lib->selected = 0;
+
+    if (lib->selected < lib->scroll) {
+        lib->scroll = lib->selected;
+    } else if (lib->selected >= lib->scroll + list_height) {
+        lib->scroll = lib->selected - list_height + 1;
+    }
+
+    for (int i = 0; i < list_height && (lib->scroll + i) < lib->match_count; i++) {
+        int idx = lib->scroll + i;
+        LibraryEntry *e = &lib->entries[lib->matches[idx]];
+        bool is_selected = (idx == lib->selected);
+
+        int y = list_top + i;
+        move(y, 0);
+        clrtoeol();
+
+        if (is_selected) {
+            attron(A_REVERSE);
+        }
+
+        char dur[16];
+        format_duration(e->duration, dur);
+
+        const char *where = e->playlist_idx >= 0 && e->playlist_idx < st->playlist_count ?
+                            st->playlists[e->playlist_idx].name : "downloads";
+        int max_title = cols - 32 - (int)strlen(where);
+        if (max_title < 20) max_title = 20;
+
+        char titlebuf[1024];
+        strncpy(titlebuf, e->title, sizeof(titlebuf) - 1);
+        titlebuf[sizeof(titlebuf) - 1] = '\0';
+        if ((int)strlen(titlebuf) > max_title && max_title > 3) {
+            titlebuf[max_title - 3] = '.';
+            titlebuf[max_title - 2] = '.';
+            titlebuf[max_title - 1] = '.';
+            titlebuf[max_title] = '\0';
+        }
+
+        mvprintw(y, 0, " %s %3d. [%s] %s  (%s)", e->downloaded ? "[D]" : "   ",
+                 idx + 1, dur, titlebuf, where);
+
         if (is_selected) {
             attroff(A_REVERSE);
         }
@@ -2781,6 +8122,63 @@ static void draw_settings_view(AppState *st, const char *status, int rows, int c
     if (is_selected) attroff(A_REVERSE);
     y += 2;
 
+    // Setting 4: Resume Playback (preload last track paused at startup)
+    is_selected = (st->settings_selected == 4);
+    if (is_selected) attron(A_REVERSE);
+    mvprintw(y, 2, "Resume Playback: %s%s", st->config.resume_playback ? "ON" : "OFF",
+             st->config.remember_session ? "" : " (needs Remember Session)");
+    if (is_selected) attroff(A_REVERSE);
+    y += 2;
+
+    // Setting 5: Stream Quality
+    is_selected = (st->settings_selected == 5);
+    if (is_selected) attron(A_REVERSE);
+    if (st->config.stream_quality == QUALITY_AUTO) {
+        mvprintw(y, 2, "Stream Quality: Auto (next: %s)", stream_tiers[st->stream.tier].name);
+    } else {
+        mvprintw(y, 2, "Stream Quality: %s", stream_tiers[st->config.stream_quality].name);
+    }
+    if (is_selected) attroff(A_REVERSE);
+    y += 2;
+
+    // Setting 6: Shuffle Weighting
+    is_selected = (st->settings_selected == 6);
+    if (is_selected) attron(A_REVERSE);
+    mvprintw(y, 2, "Shuffle Weighting: %s",
+             st->config.weighted_shuffle ? "By play stats (skip less, hear more)" : "Uniform");
+    if (is_selected) attroff(A_REVERSE);
+    y += 2;
+
+    // Setting 7: Search Cache
+    is_selected = (st->settings_selected == 7);
+    if (is_selected) attron(A_REVERSE);
+    if (st->config.search_cache_ttl > 0) {
+        mvprintw(y, 2, "Search Cache: refresh after %d hours (%d/%d queries cached)",
+                 st->config.search_cache_ttl, st->search_cache.count, st->config.search_cache_size);
+    } else {
+        mvprintw(y, 2, "Search Cache: OFF");
+    }
+    if (is_selected) attroff(A_REVERSE);
+    y += 2;
+
+    // Setting 8: YouTube playlist sync schedule
+    is_selected = (st->settings_selected == 8);
+    if (is_selected) attron(A_REVERSE);
+    if (st->config.youtube_sync_hours > 0) {
+        mvprintw(y, 2, "YouTube Playlist Sync: every %d hours", st->config.youtube_sync_hours);
+    } else {
+        mvprintw(y, 2, "YouTube Playlist Sync: manual (U in playlists)");
+    }
+    if (is_selected) attroff(A_REVERSE);
+    y += 2;
+
+    // Setting 9: Download songs added by a sync
+    is_selected = (st->settings_selected == 9);
+    if (is_selected) attron(A_REVERSE);
+    mvprintw(y, 2, "Download Synced Songs: %s", st->config.youtube_sync_download ? "ON" : "OFF");
+    if (is_selected) attroff(A_REVERSE);
+    y += 2;
+
     // Help text
     mvprintw(y, 2, "Up/Down: navigate | Enter: edit/toggle | Esc: back");
     y++;
@@ -2904,6 +8302,12 @@ static void draw_ui(AppState *st, const char *status) {
         case VIEW_ABOUT:
             draw_about_view(st, status, rows, cols);
             break;
+        case VIEW_QUEUE:
+            draw_queue_view(st, status, rows, cols);
+            break;
+        case VIEW_LIBRARY:
+            draw_library_view(st, status, rows, cols);
+            break;
     }
     
     draw_now_playing(st, rows, cols);
@@ -2911,25 +8315,6 @@ static void draw_ui(AppState *st, const char *status) {
     refresh();
 }
 
-// ============================================================================
-// YouTube Playlist Progress Callback
-// ============================================================================
-
-static void youtube_fetch_progress_callback(int count, const char *message, void *user_data) {
-    (void)count; // Suppress unused parameter warning
-    char *status_buf = (char *)user_data;
-    if (status_buf && message) {
-        strncpy(status_buf, message, 511);
-        status_buf[511] = '\0';
-        
-        // Redraw UI to show progress
-        if (g_app_state) {
-            draw_ui(g_app_state, status_buf);
-            refresh(); // Force screen update
-        }
-    }
-}
-
 // ============================================================================
 // Input Handling
 // ============================================================================
@@ -2998,6 +8383,11 @@ static void show_help(void) {
     mvprintw(y++, 6, "t           Jump to time (mm:ss)");
     y++;
 
+    mvprintw(y++, 4, "QUEUE:");
+    mvprintw(y++, 6, "e/E         Queue song / Play it next");
+    mvprintw(y++, 6, "Q           Show queue (Enter, r, K/J, C)");
+    y++;
+
     mvprintw(y++, 4, "NAVIGATION:");
     mvprintw(y++, 6, "Up/Down/j/k Navigate list");
     mvprintw(y++, 6, "PgUp/PgDn   Page up/down");
@@ -3011,9 +8401,12 @@ static void show_help(void) {
     mvprintw(y++, 6, "c           Create new playlist");
     mvprintw(y++, 6, "e           Rename playlist");
     mvprintw(y++, 6, "r           Remove song from playlist");
+    mvprintw(y++, 6, "K/J         Move song up/down in playlist");
     mvprintw(y++, 6, "d/D         Download song / Download all");
     mvprintw(y++, 6, "p           Import YouTube playlist");
+    mvprintw(y++, 6, "I           Import tracklist (text or CSV file)");
     mvprintw(y++, 6, "u           Sync YouTube playlist");
+    mvprintw(y++, 6, "U           Sync all YouTube playlists");
     mvprintw(y++, 6, "x           Delete playlist");
     y++;
 
@@ -3099,45 +8492,77 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    AppState st = {0};
-    st.playing_index = -1;
-    st.playing_playlist_idx = -1;
-    st.current_playlist_idx = -1;
-    st.view = VIEW_SEARCH;
+    // On the heap: the state grows with the library, not with fixed caps
+    AppState *st = calloc(1, sizeof(AppState));
+    if (!st) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    st->playing_index = -1;
+    st->playing_playlist_idx = -1;
+    st->current_playlist_idx = -1;
+    st->view = VIEW_SEARCH;
 
     // NEW: Initialize download queue mutex
-    pthread_mutex_init(&st.download_queue.mutex, NULL);
-    st.download_queue.current_idx = -1;
-    g_app_state = &st;
+    pthread_mutex_init(&st->download_queue.mutex, NULL);
+    st->download_queue.current_idx = -1;
+    g_app_state = st;
 
     // Initialize config directories
     sb_log("Initializing config directories...");
-    if (!init_config_dirs(&st)) {
+    if (!init_config_dirs(st)) {
         sb_log("FATAL: init_config_dirs failed");
         fprintf(stderr, "Failed to initialize config directory\n");
         return 1;
     }
-    sb_log("Config dir: %s", st.config_dir);
-    sb_log("yt-dlp bin dir: %s (exists=%s)", st.ytdlp_bin_dir, dir_exists(st.ytdlp_bin_dir) ? "yes" : "no");
-    sb_log("yt-dlp local path: %s", st.ytdlp_local_path);
+    sb_log("Config dir: %s", st->config_dir);
+    sb_log("yt-dlp bin dir: %s (exists=%s)", st->ytdlp_bin_dir, dir_exists(st->ytdlp_bin_dir) ? "yes" : "no");
+    sb_log("yt-dlp local path: %s", st->ytdlp_local_path);
+
+    // Config and playlist saves are written behind, on their own thread
+    if (!persist_start()) sb_log("Writer thread not started: saves are written in place");
     
     // NEW: Load configuration
-    load_config(&st);
+    load_config(st);
+
+    // Streams start at the middle tier unless quality is pinned
+    st->stream.tier = st->config.stream_quality == QUALITY_AUTO ?
+                     QUALITY_MEDIUM : st->config.stream_quality;
+    st->stream.current_tier = -1;
     
-    // Load playlists
-    load_playlists(&st);
+    // Load playlists: from the library snapshot if it's current, else from
+    // the JSON files while a new snapshot is built in the background
+    if (!library_snapshot_load(st)) {
+        load_playlists(st);
+        library_snapshot_rebuild(st);
+    }
+
+    // Shuffle orders from the previous run (attached to lists on first use)
+    load_shuffle_orders(st);
+
+    // Play/skip/completion counts for weighted shuffle
+    load_stats(st);
+
+    // Songs queued to play next
+    load_play_queue(st);
+
+    // Cached search results
+    load_search_cache_index(st);
     
     // NEW: Load pending downloads from previous session
-    load_download_queue(&st);
+    load_download_queue(st);
     
     // NEW: Start download thread if there are pending downloads
-    if (get_pending_download_count(&st) > 0) {
-        start_download_thread(&st);
+    if (get_pending_download_count(st) > 0) {
+        start_download_thread(st);
     }
 
     // Start yt-dlp auto-update in background
     sb_log("Starting yt-dlp auto-update thread...");
-    start_ytdlp_update(&st);
+    start_ytdlp_update(st);
+
+    bool helper_started = ytdlp_helper_start(get_ytdlp_cmd(st), st->ytdlp_bin_dir);
+    sb_log("yt-dlp helper: %s", helper_started ? "started" : "not started");
 
     initscr();
     cbreak();
@@ -3150,8 +8575,8 @@ int main(int argc, char *argv[]) {
     
     char status[512] = "";
     
-    if (!check_dependencies(&st, status, sizeof(status))) {
-        draw_ui(&st, status);
+    if (!check_dependencies(st, status, sizeof(status))) {
+        draw_ui(st, status);
         timeout(-1);
         getch();
         endwin();
@@ -3160,93 +8585,146 @@ int main(int argc, char *argv[]) {
     }
     
     // Restore session if remember_session is enabled
-    if (st.config.remember_session) {
-        if (st.was_playing_playlist && st.last_playlist_idx >= 0 &&
-            st.last_playlist_idx < st.playlist_count) {
+    if (st->config.remember_session) {
+        if (st->was_playing_playlist && st->last_playlist_idx >= 0 &&
+            st->last_playlist_idx < st->playlist_count) {
             // Restore playlist view
-            st.current_playlist_idx = st.last_playlist_idx;
-            load_playlist_songs(&st, st.current_playlist_idx);
-            if (st.last_song_idx >= 0 && st.last_song_idx < st.playlists[st.current_playlist_idx].count) {
-                st.playlist_song_selected = st.last_song_idx;
+            st->current_playlist_idx = st->last_playlist_idx;
+            load_playlist_songs(st, st->current_playlist_idx);
+            if (st->last_song_idx >= 0 && st->last_song_idx < st->playlists[st->current_playlist_idx].count) {
+                st->playlist_song_selected = st->last_song_idx;
             }
-            st.view = VIEW_PLAYLIST_SONGS;
+            st->view = VIEW_PLAYLIST_SONGS;
             snprintf(status, sizeof(status), "Resuming: %s, track %d",
-                     st.playlists[st.current_playlist_idx].name,
-                     st.last_song_idx + 1);
-        } else if (st.cached_search_count > 0 && st.last_query[0]) {
+                     st->playlists[st->current_playlist_idx].name,
+                     st->last_song_idx + 1);
+
+            // Preload the last track paused so Space resumes right away
+            if (st->config.resume_playback && st->last_position >= 0 &&
+                st->last_song_idx >= 0 &&
+                st->last_song_idx < st->playlists[st->current_playlist_idx].count) {
+                play_playlist_song_at(st, st->current_playlist_idx, st->last_song_idx,
+                                      st->last_position, true);
+                char pos[16];
+                format_duration(st->last_position, pos);
+                snprintf(status, sizeof(status), "Resuming: %s, track %d at %s (Space to play)",
+                         st->playlists[st->current_playlist_idx].name,
+                         st->last_song_idx + 1, pos);
+            }
+        } else if (st->cached_search_count > 0 && st->last_query[0]) {
             // Restore search results from cache
-            for (int i = 0; i < st.cached_search_count && i < MAX_RESULTS; i++) {
-                st.search_results[i] = st.cached_search[i];
-                // Clear cached pointers so they won't be double-freed
-                st.cached_search[i].title = NULL;
-                st.cached_search[i].video_id = NULL;
-                st.cached_search[i].url = NULL;
+            search_results_reserve(st, st->cached_search_count);
+            for (int i = 0; i < st->cached_search_count && i < st->search_cap; i++) {
+                st->search_results[i] = st->cached_search[i];
             }
-            st.search_count = st.cached_search_count;
-            strncpy(st.query, st.last_query, sizeof(st.query) - 1);
-            if (st.last_song_idx >= 0 && st.last_song_idx < st.search_count) {
-                st.search_selected = st.last_song_idx;
+            // The titles move along with their arena
+            arena_merge(&st->search_strings, &st->cached_search_strings);
+            st->search_count = st->search_cap < st->cached_search_count ?
+                              st->search_cap : st->cached_search_count;
+            st->cached_search_count = 0;
+            st->search_fetched = st->search_count;
+            st->search_more = st->search_count == MAX_RESULTS;
+            strncpy(st->query, st->last_query, sizeof(st->query) - 1);
+            if (st->last_song_idx >= 0 && st->last_song_idx < st->search_count) {
+                st->search_selected = st->last_song_idx;
             }
-            st.view = VIEW_SEARCH;
+            st->view = VIEW_SEARCH;
             snprintf(status, sizeof(status), "Resuming: search '%s', track %d",
-                     st.query, st.last_song_idx + 1);
+                     st->query, st->last_song_idx + 1);
+
+            if (st->config.resume_playback && st->last_position >= 0 &&
+                st->last_song_idx >= 0 && st->last_song_idx < st->search_count) {
+                play_search_result_at(st, st->last_song_idx, st->last_position, true);
+                char pos[16];
+                format_duration(st->last_position, pos);
+                snprintf(status, sizeof(status), "Resuming: search '%s', track %d at %s (Space to play)",
+                         st->query, st->last_song_idx + 1, pos);
+            }
         } else {
             snprintf(status, sizeof(status), "Press / to search, d to download, f for playlists, h for help.");
         }
     } else {
         snprintf(status, sizeof(status), "Press / to search, d to download, f for playlists, h for help.");
     }
-    draw_ui(&st, status);
+
+    // YouTube imports the last session didn't finish
+    int resumed_imports = import_resume_pending(st);
+    if (resumed_imports > 0) {
+        snprintf(status, sizeof(status), "Resuming %d interrupted playlist import%s",
+                 resumed_imports, resumed_imports == 1 ? "" : "s");
+    }
+    draw_ui(st, status);
 
     bool running = true;
     
     while (running) {
         // NEW: Update spinner for download animation
         time_t now = time(NULL);
-        if (now != st.last_spinner_update) {
-            st.spinner_frame++;
-            st.last_spinner_update = now;
+        if (now != st->last_spinner_update) {
+            st->spinner_frame++;
+            st->last_spinner_update = now;
         }
         
         // Check for track end via mpv IPC
-        // Only check if we've been playing for at least 3 seconds
-        if (st.playing_index >= 0 && mpv_ipc_fd >= 0) {
-            if (now - st.playback_started >= 3) {
-                if (mpv_check_track_end()) {
-                    // Auto-play next track
-                    play_next(&st);
-                    if (st.playing_index >= 0) {
-                        const char *title = NULL;
-                        if (st.playing_from_playlist && st.playing_playlist_idx >= 0) {
-                            Playlist *pl = &st.playlists[st.playing_playlist_idx];
-                            if (st.playing_index < pl->count) {
-                                title = pl->items[st.playing_index].title;
-                            }
-                        } else if (st.playing_index < st.search_count) {
-                            title = st.search_results[st.playing_index].title;
-                        }
-                        if (title) {
-                            snprintf(status, sizeof(status), "Auto-playing: %s", title);
-                        }
-                    } else {
-                        snprintf(status, sizeof(status), "Playback finished");
-                    }
-                    draw_ui(&st, status);
-                }
-            } else {
-                // During grace period, still drain the socket buffer
-                char drain_buf[4096];
-                while (read(mpv_ipc_fd, drain_buf, sizeof(drain_buf)) > 0) {
-                    // Discard data during grace period
+        // End events within the first 3 seconds come from replacing the
+        // previous track, so they are consumed but ignored
+        if (playback_active(st) && mpv_ipc_fd >= 0) {
+            TrackEnd track_ended = mpv_poll_events(st);
+            if (track_ended == TRACK_EOF && now - st->playback_started >= 3) {
+                // Auto-play next track (mpv may already be playing it gaplessly)
+                time_t started = st->playback_started;
+                st->advancing_on_eof = true;
+                play_next(st);
+                st->advancing_on_eof = false;
+                const Song *song = current_song(st);
+                if (st->playback_started != started && song) {
+                    snprintf(status, sizeof(status), "Auto-playing: %s",
+                             song->title ? song->title : "?");
+                } else {
+                    snprintf(status, sizeof(status), "Playback finished");
                 }
+                draw_ui(st, status);
+            } else if (track_ended != TRACK_PLAYING && st->preloaded.valid) {
+                // mpv went on to the preloaded track by itself, after an
+                // error or an end inside the grace period: it can't be
+                // adopted on the next end, so load the next track afresh
+                sb_log("[PLAYBACK] track ended early (%s): reloading the next track",
+                       track_ended == TRACK_EOF ? "eof" : "error");
+                st->preloaded.valid = false;
+                play_next(st);
+                const Song *song = current_song(st);
+                snprintf(status, sizeof(status), "Playing: %s", song && song->title ? song->title : "?");
+                draw_ui(st, status);
             }
         }
         
+        // Restart the helper once an update replaced yt-dlp
+        if (!st->ytdlp_updating) ytdlp_helper_refresh(get_ytdlp_cmd(st));
+
+        if (search_poll(st, status, sizeof(status))) {
+            draw_ui(st, status);
+        }
+        if (tracklist_poll(st, status, sizeof(status))) {
+            draw_ui(st, status);
+        }
+        // Scheduled sync of YouTube playlists
+        if (st->config.youtube_sync_hours > 0 && st->sync_total == 0 &&
+            now - st->config.youtube_sync_last >= (time_t)st->config.youtube_sync_hours * 3600) {
+            int no_url;
+            int queued = playlist_sync_all(st, &no_url);
+            sb_log("[PLAYBACK] scheduled sync: %d YouTube playlists queued", queued);
+        }
+        if (playlist_fetch_poll(st, status, sizeof(status))) {
+            draw_ui(st, status);
+        }
+        saves_poll(st);
+        library_snapshot_poll(st);
+
         int ch = getch();
 
         if (ch == ERR) {
             // Timeout - redraw UI to update spinner and download status
-            draw_ui(&st, status);
+            draw_ui(st, status);
             continue;
         }
         
@@ -3257,21 +8735,21 @@ int main(int argc, char *argv[]) {
         if (list_height < 1) list_height = 1;
         
         // NEW: Handle settings editing mode separately
-        if (st.view == VIEW_SETTINGS && st.settings_editing) {
+        if (st->view == VIEW_SETTINGS && st->settings_editing) {
             switch (ch) {
                 case 27: // Escape - cancel editing
-                    st.settings_editing = false;
+                    st->settings_editing = false;
                     curs_set(0);
                     snprintf(status, sizeof(status), "Edit cancelled");
                     break;
                 
                 case '\n':
                 case KEY_ENTER: // Save
-                    strncpy(st.config.download_path, st.settings_edit_buffer, 
-                            sizeof(st.config.download_path) - 1);
-                    st.config.download_path[sizeof(st.config.download_path) - 1] = '\0';
-                    save_config(&st);
-                    st.settings_editing = false;
+                    strncpy(st->config.download_path, st->settings_edit_buffer, 
+                            sizeof(st->config.download_path) - 1);
+                    st->config.download_path[sizeof(st->config.download_path) - 1] = '\0';
+                    save_config(st);
+                    st->settings_editing = false;
                     curs_set(0);
                     snprintf(status, sizeof(status), "Download path saved");
                     break;
@@ -3279,64 +8757,134 @@ int main(int argc, char *argv[]) {
                 case KEY_BACKSPACE:
                 case 127:
                 case 8: // Backspace
-                    if (st.settings_edit_pos > 0) {
-                        memmove(&st.settings_edit_buffer[st.settings_edit_pos - 1],
-                                &st.settings_edit_buffer[st.settings_edit_pos],
-                                strlen(&st.settings_edit_buffer[st.settings_edit_pos]) + 1);
-                        st.settings_edit_pos--;
+                    if (st->settings_edit_pos > 0) {
+                        memmove(&st->settings_edit_buffer[st->settings_edit_pos - 1],
+                                &st->settings_edit_buffer[st->settings_edit_pos],
+                                strlen(&st->settings_edit_buffer[st->settings_edit_pos]) + 1);
+                        st->settings_edit_pos--;
                     }
                     break;
                 
                 case KEY_DC: // Delete
-                    if (st.settings_edit_pos < (int)strlen(st.settings_edit_buffer)) {
-                        memmove(&st.settings_edit_buffer[st.settings_edit_pos],
-                                &st.settings_edit_buffer[st.settings_edit_pos + 1],
-                                strlen(&st.settings_edit_buffer[st.settings_edit_pos + 1]) + 1);
+                    if (st->settings_edit_pos < (int)strlen(st->settings_edit_buffer)) {
+                        memmove(&st->settings_edit_buffer[st->settings_edit_pos],
+                                &st->settings_edit_buffer[st->settings_edit_pos + 1],
+                                strlen(&st->settings_edit_buffer[st->settings_edit_pos + 1]) + 1);
                     }
                     break;
                 
                 case KEY_LEFT:
-                    if (st.settings_edit_pos > 0) st.settings_edit_pos--;
+                    if (st->settings_edit_pos > 0) st->settings_edit_pos--;
                     break;
                 
                 case KEY_RIGHT:
-                    if (st.settings_edit_pos < (int)strlen(st.settings_edit_buffer))
-                        st.settings_edit_pos++;
+                    if (st->settings_edit_pos < (int)strlen(st->settings_edit_buffer))
+                        st->settings_edit_pos++;
                     break;
                 
                 case KEY_HOME:
-                    st.settings_edit_pos = 0;
+                    st->settings_edit_pos = 0;
                     break;
                 
                 case KEY_END:
-                    st.settings_edit_pos = strlen(st.settings_edit_buffer);
+                    st->settings_edit_pos = strlen(st->settings_edit_buffer);
                     break;
                 
                 default:
                     // Insert printable character
                     if (ch >= 32 && ch < 127) {
-                        int len = strlen(st.settings_edit_buffer);
-                        if (len < (int)sizeof(st.settings_edit_buffer) - 1) {
-                            memmove(&st.settings_edit_buffer[st.settings_edit_pos + 1],
-                                    &st.settings_edit_buffer[st.settings_edit_pos],
-                                    len - st.settings_edit_pos + 1);
-                            st.settings_edit_buffer[st.settings_edit_pos] = ch;
-                            st.settings_edit_pos++;
+                        int len = strlen(st->settings_edit_buffer);
+                        if (len < (int)sizeof(st->settings_edit_buffer) - 1) {
+                            memmove(&st->settings_edit_buffer[st->settings_edit_pos + 1],
+                                    &st->settings_edit_buffer[st->settings_edit_pos],
+                                    len - st->settings_edit_pos + 1);
+                            st->settings_edit_buffer[st->settings_edit_pos] = ch;
+                            st->settings_edit_pos++;
                         }
                     }
                     break;
             }
-            draw_ui(&st, status);
+            draw_ui(st, status);
             continue;
         }
         
+        // Library filter takes typed characters, so it handles its own keys
+        if (st->view == VIEW_LIBRARY) {
+            LibraryIndex *lib = &st->library;
+            size_t len = strlen(lib->query);
+            switch (ch) {
+                case 27:
+                    st->view = st->library_return_view;
+                    status[0] = '\0';
+                    break;
+
+                case '\n':
+                case KEY_ENTER:
+                    if (lib->match_count > 0) {
+                        LibraryEntry *e = &lib->entries[lib->matches[lib->selected]];
+                        play_library_entry(st, lib->matches[lib->selected]);
+                        snprintf(status, sizeof(status), "Playing: %s", e->title);
+                    }
+                    break;
+
+                case KEY_UP:
+                    if (lib->selected > 0) lib->selected--;
+                    break;
+
+                case KEY_DOWN:
+                    if (lib->selected + 1 < lib->match_count) lib->selected++;
+                    break;
+
+                case KEY_PPAGE:
+                    lib->selected -= list_height;
+                    if (lib->selected < 0) lib->selected = 0;
+                    break;
+
+                case KEY_NPAGE:
+                    lib->selected += list_height;
+                    if (lib->selected >= lib->match_count) lib->selected = lib->match_count - 1;
+                    break;
+
+                case KEY_BACKSPACE:
+                case 127:
+                case 8:
+                    if (len > 0) {
+                        lib->query[len - 1] = '\0';
+                        library_filter(lib);
+                        lib->selected = 0;
+                    }
+                    break;
+
+                case 21: // Ctrl-U
+                    lib->query[0] = '\0';
+                    library_filter(lib);
+                    lib->selected = 0;
+                    break;
+
+                case KEY_RESIZE:
+                    clear();
+                    break;
+
+                default:
+                    if (ch >= 32 && ch < 256 && len + 1 < sizeof(lib->query)) {
+                        lib->query[len] = (char)ch;
+                        lib->query[len + 1] = '\0';
+                        library_filter(lib);
+                        lib->selected = 0;
+                    }
+                    break;
+            }
+            draw_ui(st, status);
+            continue;
+        }
+
         // Global keys
         switch (ch) {
             case 'q': {
                 // NEW: Check for pending downloads before exiting
-                int pending = get_pending_download_count(&st);
+                int pending = get_pending_download_count(st);
                 if (pending > 0) {
-                    draw_exit_dialog(&st, pending);
+                    draw_exit_dialog(st, pending);
                     timeout(-1);
                     int confirm = getch();
                     timeout(100);
@@ -3351,23 +8899,23 @@ int main(int argc, char *argv[]) {
             }
             
             case ' ':
-                if (st.playing_index >= 0 && file_exists(IPC_SOCKET)) {
+                if (playback_active(st) && file_exists(IPC_SOCKET)) {
                     mpv_toggle_pause();
-                    st.paused = !st.paused;
-                    snprintf(status, sizeof(status), st.paused ? "Paused" : "Playing");
+                    st->paused = !st->paused;
+                    snprintf(status, sizeof(status), st->paused ? "Paused" : "Playing");
                 }
                 break;
             
             case 'n':
-                if (st.playing_index >= 0) {
-                    play_next(&st);
+                if (playback_active(st) || st->queue.count > 0) {
+                    play_next(st);
                     snprintf(status, sizeof(status), "Next track");
                 }
                 break;
             
             case 'p':
-                if (st.playing_index >= 0) {
-                    play_prev(&st);
+                if (playback_active(st)) {
+                    play_prev(st);
                     snprintf(status, sizeof(status), "Previous track");
                 }
                 break;
@@ -3378,28 +8926,59 @@ int main(int argc, char *argv[]) {
                 break;
 
             case 'R': // Toggle shuffle mode
-                st.shuffle_mode = !st.shuffle_mode;
-                snprintf(status, sizeof(status), "Shuffle: %s", st.shuffle_mode ? "ON" : "OFF");
+                st->shuffle_mode = !st->shuffle_mode;
+                snprintf(status, sizeof(status), "Shuffle: %s", st->shuffle_mode ? "ON" : "OFF");
+                update_download_priority(st);
+                preload_next_track(st);
+                break;
+
+            case 'L': // Local library
+                if (st->view == VIEW_SEARCH || st->view == VIEW_PLAYLISTS ||
+                    st->view == VIEW_PLAYLIST_SONGS || st->view == VIEW_QUEUE) {
+                    struct timespec t0, t1;
+                    clock_gettime(CLOCK_MONOTONIC, &t0);
+                    if (library_build(st)) {
+                        clock_gettime(CLOCK_MONOTONIC, &t1);
+                        st->library_return_view = st->view;
+                        st->view = VIEW_LIBRARY;
+                        st->library.selected = 0;
+                        st->library.scroll = 0;
+                        snprintf(status, sizeof(status), "Indexed %d songs in %ld ms",
+                                 st->library.count,
+                                 (long)((t1.tv_sec - t0.tv_sec) * 1000 +
+                                        (t1.tv_nsec - t0.tv_nsec) / 1000000));
+                    } else {
+                        snprintf(status, sizeof(status), "Failed to index library");
+                    }
+                }
+                break;
+
+            case 'Q': // Play queue
+                if (st->view != VIEW_QUEUE) {
+                    st->queue_return_view = st->view;
+                    st->view = VIEW_QUEUE;
+                    status[0] = '\0';
+                }
                 break;
 
             case KEY_LEFT:
                 // Seek backward (only when not editing in settings)
-                if (st.view != VIEW_SETTINGS && st.playing_index >= 0 && file_exists(IPC_SOCKET)) {
-                    mpv_seek(-st.config.seek_step);
-                    snprintf(status, sizeof(status), "<< -%ds", st.config.seek_step);
+                if (st->view != VIEW_SETTINGS && playback_active(st) && file_exists(IPC_SOCKET)) {
+                    mpv_seek(-st->config.seek_step);
+                    snprintf(status, sizeof(status), "<< -%ds", st->config.seek_step);
                 }
                 break;
 
             case KEY_RIGHT:
                 // Seek forward (only when not editing in settings)
-                if (st.view != VIEW_SETTINGS && st.playing_index >= 0 && file_exists(IPC_SOCKET)) {
-                    mpv_seek(st.config.seek_step);
-                    snprintf(status, sizeof(status), ">> +%ds", st.config.seek_step);
+                if (st->view != VIEW_SETTINGS && playback_active(st) && file_exists(IPC_SOCKET)) {
+                    mpv_seek(st->config.seek_step);
+                    snprintf(status, sizeof(status), ">> +%ds", st->config.seek_step);
                 }
                 break;
 
             case 't': // Jump to time
-                if (st.playing_index >= 0 && file_exists(IPC_SOCKET)) {
+                if (playback_active(st) && file_exists(IPC_SOCKET)) {
                     char time_input[16] = {0};
                     int len = get_string_input(time_input, sizeof(time_input), "Jump to (mm:ss): ");
                     if (len > 0) {
@@ -3417,31 +8996,37 @@ int main(int argc, char *argv[]) {
                 break;
 
             case 'i': // About
-                st.view = VIEW_ABOUT;
-                draw_ui(&st, status);
+                st->view = VIEW_ABOUT;
+                draw_ui(st, status);
                 timeout(-1);
                 getch(); // Wait for any key
                 timeout(100);
-                st.view = VIEW_SEARCH;
+                st->view = VIEW_SEARCH;
                 break;
 
             case 27: // Escape
-                if (st.view == VIEW_PLAYLISTS) {
-                    st.view = VIEW_SEARCH;
+                if (st->view == VIEW_PLAYLISTS) {
+                    st->view = VIEW_SEARCH;
                     status[0] = '\0';
-                } else if (st.view == VIEW_PLAYLIST_SONGS) {
-                    st.view = VIEW_PLAYLISTS;
+                } else if (st->view == VIEW_PLAYLIST_SONGS) {
+                    st->view = VIEW_PLAYLISTS;
                     status[0] = '\0';
-                } else if (st.view == VIEW_ADD_TO_PLAYLIST) {
-                    st.view = VIEW_SEARCH;
-                    st.song_to_add = NULL;
+                } else if (st->view == VIEW_ADD_TO_PLAYLIST) {
+                    st->view = VIEW_SEARCH;
+                    song_to_add_clear(st);
                     snprintf(status, sizeof(status), "Cancelled");
-                } else if (st.view == VIEW_SETTINGS) {
-                    st.view = VIEW_SEARCH;
+                } else if (st->view == VIEW_SETTINGS) {
+                    st->view = VIEW_SEARCH;
                     status[0] = '\0';
-                } else if (st.view == VIEW_ABOUT) {
-                    st.view = VIEW_SEARCH;
+                } else if (st->view == VIEW_ABOUT) {
+                    st->view = VIEW_SEARCH;
                     status[0] = '\0';
+                } else if (st->view == VIEW_QUEUE) {
+                    st->view = st->queue_return_view;
+                    status[0] = '\0';
+                } else if (st->view == VIEW_SEARCH && st->search_job) {
+                    search_cancel(st);
+                    snprintf(status, sizeof(status), "Search cancelled");
                 }
                 break;
             
@@ -3454,50 +9039,50 @@ int main(int argc, char *argv[]) {
         }
         
         // View-specific keys
-        switch (st.view) {
+        switch (st->view) {
             case VIEW_SEARCH: {
                 switch (ch) {
                     case KEY_UP:
                     case 'k':
-                        if (st.search_selected > 0) st.search_selected--;
+                        if (st->search_selected > 0) st->search_selected--;
                         break;
                     
                     case KEY_DOWN:
                     case 'j':
-                        if (st.search_selected + 1 < st.search_count) st.search_selected++;
+                        if (st->search_selected + 1 < st->search_count) st->search_selected++;
                         break;
                     
                     case KEY_PPAGE:
-                        st.search_selected -= list_height;
-                        if (st.search_selected < 0) st.search_selected = 0;
+                        st->search_selected -= list_height;
+                        if (st->search_selected < 0) st->search_selected = 0;
                         break;
                     
                     case KEY_NPAGE:
-                        st.search_selected += list_height;
-                        if (st.search_selected >= st.search_count) 
-                            st.search_selected = st.search_count - 1;
-                        if (st.search_selected < 0) st.search_selected = 0;
+                        st->search_selected += list_height;
+                        if (st->search_selected >= st->search_count) 
+                            st->search_selected = st->search_count - 1;
+                        if (st->search_selected < 0) st->search_selected = 0;
                         break;
                     
                     case KEY_HOME:
                     case 'g':
-                        st.search_selected = 0;
-                        st.search_scroll = 0;
+                        st->search_selected = 0;
+                        st->search_scroll = 0;
                         break;
                     
                     case KEY_END:
-                        if (st.search_count > 0) {
-                            st.search_selected = st.search_count - 1;
+                        if (st->search_count > 0) {
+                            st->search_selected = st->search_count - 1;
                         }
                         break;
                     
                     case '\n':
                     case KEY_ENTER:
-                        if (st.search_count > 0) {
-                            play_search_result(&st, st.search_selected);
+                        if (st->search_count > 0) {
+                            play_search_result(st, st->search_selected);
                             snprintf(status, sizeof(status), "Playing: %s",
-                                     st.search_results[st.search_selected].title ?
-                                     st.search_results[st.search_selected].title : "?");
+                                     st->search_results[st->search_selected].title ?
+                                     st->search_results[st->search_selected].title : "?");
                         }
                         break;
                     
@@ -3506,16 +9091,15 @@ int main(int argc, char *argv[]) {
                         char q[256] = {0};
                         int len = get_string_input(q, sizeof(q), "Search: ");
                         if (len > 0) {
-                            snprintf(status, sizeof(status), "Searching: %s ...", q);
-                            draw_ui(&st, status);
-                            
-                            int r = run_search(&st, q);
+                            int r = search_start(st, q);
                             if (r < 0) {
                                 snprintf(status, sizeof(status), "Search error!");
-                            } else if (r == 0) {
-                                snprintf(status, sizeof(status), "No results for: %s", q);
-                            } else {
-                                snprintf(status, sizeof(status), "Found %d results for: %s", r, q);
+                            } else if (r == 2) {
+                                snprintf(status, sizeof(status), "Found %d results for: %s (cached%s)",
+                                         st->search_count, st->query,
+                                         st->search_job ? ", refreshing" : "");
+                            } else if (r > 0) {
+                                snprintf(status, sizeof(status), "Searching: %s ...", q);
                             }
                         } else {
                             snprintf(status, sizeof(status), "Search cancelled");
@@ -3524,30 +9108,37 @@ int main(int argc, char *argv[]) {
                     }
                     
                     case 'x':
-                        if (st.playing_index >= 0) {
-                            mpv_stop_playback();
-                            st.playing_index = -1;
-                            st.playing_from_playlist = false;
-                            st.playing_playlist_idx = -1;
-                            st.paused = false;
+                        if (playback_active(st)) {
+                            stop_playback(st);
                             snprintf(status, sizeof(status), "Playback stopped");
                         }
                         break;
                     
                     case 'f':
-                        st.view = VIEW_PLAYLISTS;
-                        st.playlist_selected = 0;
-                        st.playlist_scroll = 0;
-                        load_playlists(&st);
+                        st->view = VIEW_PLAYLISTS;
+                        st->playlist_selected = 0;
+                        st->playlist_scroll = 0;
                         snprintf(status, sizeof(status), "Playlists");
                         break;
                     
+                    case 'e': // Queue song
+                    case 'E': // Play song next
+                        if (st->search_count > 0) {
+                            Song *song = &st->search_results[st->search_selected];
+                            if (queue_push(&st->queue, song, NULL, ch == 'E')) {
+                                queue_changed(st);
+                                snprintf(status, sizeof(status), "%s: %s",
+                                         ch == 'E' ? "Playing next" : "Added to queue", song->title);
+                            }
+                        }
+                        break;
+
                     case 'a':
-                        if (st.search_count > 0) {
-                            st.song_to_add = &st.search_results[st.search_selected];
-                            st.add_to_playlist_selected = 0;
-                            st.add_to_playlist_scroll = 0;
-                            st.view = VIEW_ADD_TO_PLAYLIST;
+                        if (st->search_count > 0 &&
+                            song_to_add_set(st, &st->search_results[st->search_selected])) {
+                            st->add_to_playlist_selected = 0;
+                            st->add_to_playlist_scroll = 0;
+                            st->view = VIEW_ADD_TO_PLAYLIST;
                             snprintf(status, sizeof(status), "Select playlist");
                         } else {
                             snprintf(status, sizeof(status), "No song selected");
@@ -3558,7 +9149,7 @@ int main(int argc, char *argv[]) {
                         char name[128] = {0};
                         int len = get_string_input(name, sizeof(name), "New playlist name: ");
                         if (len > 0) {
-                            int idx = create_playlist(&st, name, false);
+                            int idx = create_playlist(st, name, false);
                             if (idx >= 0) {
                                 snprintf(status, sizeof(status), "Created playlist: %s", name);
                             } else if (idx == -2) {
@@ -3574,17 +9165,17 @@ int main(int argc, char *argv[]) {
                     
                     // NEW: Open settings with 'S'
                     case 'S':
-                        st.view = VIEW_SETTINGS;
-                        st.settings_selected = 0;
-                        st.settings_editing = false;
+                        st->view = VIEW_SETTINGS;
+                        st->settings_selected = 0;
+                        st->settings_editing = false;
                         snprintf(status, sizeof(status), "Settings");
                         break;
                     
                     // NEW: Download single song from search
                     case 'd':
-                        if (st.search_count > 0) {
-                            Song *song = &st.search_results[st.search_selected];
-                            int result = add_to_download_queue(&st, song->video_id, song->title, NULL);
+                        if (st->search_count > 0) {
+                            Song *song = &st->search_results[st->search_selected];
+                            int result = add_to_download_queue(st, song->video_id, song->title, NULL);
                             if (result > 0) {
                                 snprintf(status, sizeof(status), "Queued: %s", song->title);
                             } else if (result == 0) {
@@ -3597,6 +9188,9 @@ int main(int argc, char *argv[]) {
                         }
                         break;
                 }
+                if (st->view == VIEW_SEARCH && search_load_more(st)) {
+                    snprintf(status, sizeof(status), "Loading more results for: %s", st->query);
+                }
                 break;
             }
             
@@ -3604,36 +9198,36 @@ int main(int argc, char *argv[]) {
                 switch (ch) {
                     case KEY_UP:
                     case 'k':
-                        if (st.playlist_selected > 0) st.playlist_selected--;
+                        if (st->playlist_selected > 0) st->playlist_selected--;
                         break;
                     
                     case KEY_DOWN:
                     case 'j':
-                        if (st.playlist_selected + 1 < st.playlist_count) st.playlist_selected++;
+                        if (st->playlist_selected + 1 < st->playlist_count) st->playlist_selected++;
                         break;
                     
                     case KEY_PPAGE:
-                        st.playlist_selected -= list_height;
-                        if (st.playlist_selected < 0) st.playlist_selected = 0;
+                        st->playlist_selected -= list_height;
+                        if (st->playlist_selected < 0) st->playlist_selected = 0;
                         break;
                     
                     case KEY_NPAGE:
-                        st.playlist_selected += list_height;
-                        if (st.playlist_selected >= st.playlist_count)
-                            st.playlist_selected = st.playlist_count - 1;
-                        if (st.playlist_selected < 0) st.playlist_selected = 0;
+                        st->playlist_selected += list_height;
+                        if (st->playlist_selected >= st->playlist_count)
+                            st->playlist_selected = st->playlist_count - 1;
+                        if (st->playlist_selected < 0) st->playlist_selected = 0;
                         break;
                     
                     case '\n':
                     case KEY_ENTER:
-                        if (st.playlist_count > 0) {
-                            st.current_playlist_idx = st.playlist_selected;
-                            load_playlist_songs(&st, st.current_playlist_idx);
-                            st.playlist_song_selected = 0;
-                            st.playlist_song_scroll = 0;
-                            st.view = VIEW_PLAYLIST_SONGS;
+                        if (st->playlist_count > 0) {
+                            st->current_playlist_idx = st->playlist_selected;
+                            load_playlist_songs(st, st->current_playlist_idx);
+                            st->playlist_song_selected = 0;
+                            st->playlist_song_scroll = 0;
+                            st->view = VIEW_PLAYLIST_SONGS;
                             snprintf(status, sizeof(status), "Opened: %s",
-                                     st.playlists[st.current_playlist_idx].name);
+                                     st->playlists[st->current_playlist_idx].name);
                         }
                         break;
                     
@@ -3641,10 +9235,10 @@ int main(int argc, char *argv[]) {
                         char name[128] = {0};
                         int len = get_string_input(name, sizeof(name), "New playlist name: ");
                         if (len > 0) {
-                            int idx = create_playlist(&st, name, false);
+                            int idx = create_playlist(st, name, false);
                             if (idx >= 0) {
                                 snprintf(status, sizeof(status), "Created playlist: %s", name);
-                                st.playlist_selected = idx;
+                                st->playlist_selected = idx;
                             } else if (idx == -2) {
                                 snprintf(status, sizeof(status), "Playlist already exists: %s", name);
                             } else {
@@ -3657,17 +9251,17 @@ int main(int argc, char *argv[]) {
                     }
                     
                     case 'x':
-                        if (st.playlist_count > 0) {
+                        if (st->playlist_count > 0) {
                             char confirm[8] = {0};
                             char prompt[256];
                             snprintf(prompt, sizeof(prompt), "Delete '%s'? (y/n): ",
-                                     st.playlists[st.playlist_selected].name);
+                                     st->playlists[st->playlist_selected].name);
                             get_string_input(confirm, sizeof(confirm), prompt);
                             if (confirm[0] == 'y' || confirm[0] == 'Y') {
-                                if (delete_playlist(&st, st.playlist_selected)) {
+                                if (delete_playlist(st, st->playlist_selected)) {
                                     snprintf(status, sizeof(status), "Deleted playlist");
-                                    if (st.playlist_selected >= st.playlist_count && st.playlist_count > 0) {
-                                        st.playlist_selected = st.playlist_count - 1;
+                                    if (st->playlist_selected >= st->playlist_count && st->playlist_count > 0) {
+                                        st->playlist_selected = st->playlist_count - 1;
                                     }
                                 } else {
                                     snprintf(status, sizeof(status), "Failed to delete");
@@ -3679,23 +9273,16 @@ int main(int argc, char *argv[]) {
                         break;
 
                     case 'e': // Rename playlist
-                        if (st.playlist_count > 0) {
-                            Playlist *pl = &st.playlists[st.playlist_selected];
+                        if (st->playlist_count > 0) {
+                            Playlist *pl = &st->playlists[st->playlist_selected];
                             char new_name[256] = {0};
                             char prompt[384];
                             snprintf(prompt, sizeof(prompt), "Rename '%s' to: ", pl->name);
                             int len = get_string_input(new_name, sizeof(new_name), prompt);
                             if (len > 0) {
                                 // Check if name already exists
-                                bool exists = false;
-                                for (int i = 0; i < st.playlist_count; i++) {
-                                    if (i != st.playlist_selected &&
-                                        strcmp(st.playlists[i].name, new_name) == 0) {
-                                        exists = true;
-                                        break;
-                                    }
-                                }
-                                if (exists) {
+                                int owner = find_playlist(st, new_name);
+                                if (owner >= 0 && owner != st->playlist_selected) {
                                     snprintf(status, sizeof(status), "Playlist '%s' already exists", new_name);
                                 } else {
                                     // Rename the playlist
@@ -3703,63 +9290,58 @@ int main(int argc, char *argv[]) {
                                     char old_dl_path[4096], new_dl_path[4096];
 
                                     // Build old and new JSON file paths
-                                    char old_filename[512], new_filename[512];
+                                    char old_filename[512];
                                     snprintf(old_filename, sizeof(old_filename), "%s", pl->filename);
-                                    // Create new filename from new name
-                                    size_t fn_idx = 0;
-                                    for (size_t i = 0; new_name[i] && fn_idx < sizeof(new_filename) - 6; i++) {
-                                        char c = new_name[i];
-                                        if (isalnum((unsigned char)c) || c == '-' || c == '_') {
-                                            new_filename[fn_idx++] = c;
-                                        } else if (c == ' ') {
-                                            new_filename[fn_idx++] = '_';
-                                        }
-                                    }
-                                    new_filename[fn_idx] = '\0';
-                                    strcat(new_filename, ".json");
+                                    char *new_filename = unique_playlist_filename(st, new_name, st->playlist_selected);
 
                                     snprintf(old_json_path, sizeof(old_json_path), "%s/%s",
-                                             st.playlists_dir, old_filename);
+                                             st->playlists_dir, old_filename);
                                     snprintf(new_json_path, sizeof(new_json_path), "%s/%s",
-                                             st.playlists_dir, new_filename);
+                                             st->playlists_dir, new_filename ? new_filename : "");
 
                                     // Build old and new download folder paths
                                     snprintf(old_dl_path, sizeof(old_dl_path), "%s/%s",
-                                             st.config.download_path, pl->name);
+                                             st->config.download_path, pl->name);
                                     snprintf(new_dl_path, sizeof(new_dl_path), "%s/%s",
-                                             st.config.download_path, new_name);
+                                             st->config.download_path, new_name);
 
-                                    bool success = true;
+                                    bool success = new_filename != NULL;
 
-                                    // Rename JSON file
-                                    if (rename(old_json_path, new_json_path) != 0 && errno != ENOENT) {
-                                        success = false;
-                                    }
+                                    // The rename is journaled, against the loaded list
+                                    if (pl->count == 0) load_playlist_songs(st, st->playlist_selected);
 
-                                    // Rename download folder (if exists)
-                                    if (success && dir_exists(old_dl_path)) {
-                                        if (rename(old_dl_path, new_dl_path) != 0) {
-                                            // Try to revert JSON rename
-                                            rename(new_json_path, old_json_path);
-                                            success = false;
-                                        }
+                                    // Rename download folder (if exists) first: the
+                                    // playlist files are renamed behind, past undoing
+                                    if (success && dir_exists(old_dl_path) && rename(old_dl_path, new_dl_path) != 0) {
+                                        success = false;
                                     }
 
                                     if (success) {
+                                        // Rename JSON file, then its journal
+                                        persist_rename(old_json_path, new_json_path);
+                                        char old_journal[sizeof(old_json_path) + 8], new_journal[sizeof(new_json_path) + 8];
+                                        playlist_journal_path(st, old_filename, old_journal, sizeof(old_journal));
+                                        playlist_journal_path(st, new_filename, new_journal, sizeof(new_journal));
+                                        persist_rename(old_journal, new_journal);
+
                                         // Update in-memory data
+                                        playlist_index_remove(st, st->playlist_selected);
                                         free(pl->name);
                                         pl->name = strdup(new_name);
                                         free(pl->filename);
-                                        pl->filename = strdup(new_filename);
+                                        pl->filename = new_filename;
+                                        new_filename = NULL;
+                                        playlist_index_put(st, st->playlist_selected);
 
-                                        // Save updated index and playlist
-                                        save_playlists_index(&st);
-                                        save_playlist(&st, st.playlist_selected);
+                                        // Save updated index and journal the new name
+                                        save_playlists_index(st);
+                                        playlist_journal_rename(st, st->playlist_selected);
 
                                         snprintf(status, sizeof(status), "Renamed to '%s'", new_name);
                                     } else {
                                         snprintf(status, sizeof(status), "Failed to rename playlist");
                                     }
+                                    free(new_filename);
                                 }
                             } else {
                                 snprintf(status, sizeof(status), "Cancelled");
@@ -3777,83 +9359,149 @@ int main(int argc, char *argv[]) {
                                 break;
                             }
 
-                            snprintf(status, sizeof(status), "Validating URL...");
-                            draw_ui(&st, status);
-
-                            char fetched_title[256] = {0};
-                            Song temp_songs[MAX_PLAYLIST_ITEMS];
-                            int fetched = fetch_youtube_playlist(url, temp_songs, MAX_PLAYLIST_ITEMS,
-                                                                 fetched_title, sizeof(fetched_title),
-                                                                 youtube_fetch_progress_callback, status,
-                                                                 get_ytdlp_cmd(&st));
-                            if (fetched <= 0) {
-                                snprintf(status, sizeof(status), "Failed to fetch playlist");
+                            // The YouTube title isn't known yet; an empty
+                            // name picks it up when the import finishes
+                            char playlist_name[256] = {0};
+                            get_string_input(playlist_name, sizeof(playlist_name),
+                                             "Playlist name (Enter for YouTube title): ");
+                            if (find_playlist(st, playlist_name) >= 0) {
+                                snprintf(status, sizeof(status), "Playlist '%s' already exists", playlist_name);
                                 break;
                             }
 
-                            char playlist_name[256];
-                            int name_len = get_string_input(playlist_name, sizeof(playlist_name), "Playlist name: ");
-                            if (name_len == 0) {
-                                strncpy(playlist_name, fetched_title, sizeof(playlist_name) - 1);
-                                playlist_name[sizeof(playlist_name) - 1] = '\0';
-                            }
-
                             char mode[8] = {0};
                             while (1) {
                                 get_string_input(mode, sizeof(mode), "Mode (s)tream or (d)ownload: ");
                                 if (mode[0] == 's' || mode[0] == 'S' || mode[0] == 'd' || mode[0] == 'D') break;
                                 snprintf(status, sizeof(status), "Invalid mode. Choose 's' or 'd'");
-                                draw_ui(&st, status);
+                                draw_ui(st, status);
                             }
                             bool stream_only = (mode[0] == 's' || mode[0] == 'S');
 
-                            int idx = create_playlist(&st, playlist_name, true);
-                            if (idx < 0) {
-                                snprintf(status, sizeof(status), "Failed to create playlist");
-                                for (int i = 0; i < fetched; i++) {
-                                    free(temp_songs[i].title);
-                                    free(temp_songs[i].video_id);
-                                    free(temp_songs[i].url);
-                                }
-                                break;
+                            int started = playlist_import_start(st, url, playlist_name, stream_only);
+                            if (started > 0) {
+                                snprintf(status, sizeof(status), "Importing playlist in the background...");
+                            } else if (started == 0) {
+                                snprintf(status, sizeof(status), "That playlist is already being imported");
+                            } else {
+                                snprintf(status, sizeof(status), "Failed to start import");
                             }
+                        } else {
+                            snprintf(status, sizeof(status), "Cancelled");
+                        }
+                        break;
+                    }
+                    
+                    // Sync every YouTube playlist in the background
+                    case 'U': {
+                        int no_url;
+                        int queued = playlist_sync_all(st, &no_url);
+                        if (queued > 0 && no_url > 0) {
+                            snprintf(status, sizeof(status),
+                                     "Syncing %d YouTube playlists (%d without a stored URL: open and press u)",
+                                     queued, no_url);
+                        } else if (queued > 0) {
+                            snprintf(status, sizeof(status), "Syncing %d YouTube playlists...", queued);
+                        } else if (no_url > 0) {
+                            snprintf(status, sizeof(status),
+                                     "No stored URLs: open each YouTube playlist and press u once");
+                        } else if (st->sync_total > 0) {
+                            snprintf(status, sizeof(status), "Sync already running");
+                        } else {
+                            snprintf(status, sizeof(status), "No YouTube playlists to sync");
+                        }
+                        break;
+                    }
 
-                            Playlist *pl = &st.playlists[idx];
-                            for (int i = 0; i < fetched; i++) {
-                                pl->items[i] = temp_songs[i];
-                                pl->count++;
+                    // Build a playlist from a text or CSV tracklist
+                    case 'I': {
+                        if (st->tracklist) {
+                            char prompt[384];
+                            char answer[8] = {0};
+                            snprintf(prompt, sizeof(prompt), "Import into '%s' running (%d/%d). Cancel it? (y/n): ",
+                                     st->tracklist->name, st->tracklist->done, st->tracklist->count);
+                            get_string_input(answer, sizeof(answer), prompt);
+                            if (answer[0] == 'y' || answer[0] == 'Y') {
+                                tracklist_cancel(st);
+                                snprintf(status, sizeof(status), "Import cancelled");
+                            } else {
+                                status[0] = '\0';
                             }
-                            save_playlist(&st, idx);
+                            break;
+                        }
 
-                            if (!stream_only) {
-                                for (int i = 0; i < pl->count; i++) {
-                                    add_to_download_queue(&st, pl->items[i].video_id, pl->items[i].title, pl->name);
-                                }
-                            }
-                            status[0] = '\0';
-                        } else {
+                        char input[1024] = {0};
+                        if (get_string_input(input, sizeof(input), "Tracklist file (text or CSV): ") == 0) {
                             snprintf(status, sizeof(status), "Cancelled");
+                            break;
+                        }
+                        char path[2048];
+                        const char *home = getenv("HOME");
+                        if (input[0] == '~' && input[1] == '/' && home) {
+                            snprintf(path, sizeof(path), "%s%s", home, input + 1);
+                        } else {
+                            snprintf(path, sizeof(path), "%s", input);
+                        }
+                        if (!file_exists(path)) {
+                            snprintf(status, sizeof(status), "File not found: %s", path);
+                            break;
+                        }
+
+                        // Default name: the file name without its extension
+                        char default_name[256];
+                        const char *base = strrchr(path, '/');
+                        snprintf(default_name, sizeof(default_name), "%s", base ? base + 1 : path);
+                        char *dot = strrchr(default_name, '.');
+                        if (dot && dot != default_name) *dot = '\0';
+
+                        char prompt[384];
+                        char playlist_name[256] = {0};
+                        snprintf(prompt, sizeof(prompt), "Playlist name [%s]: ", default_name);
+                        if (get_string_input(playlist_name, sizeof(playlist_name), prompt) == 0) {
+                            snprintf(playlist_name, sizeof(playlist_name), "%s", default_name);
+                        }
+                        if (find_playlist(st, playlist_name) >= 0) {
+                            snprintf(status, sizeof(status), "Playlist '%s' already exists", playlist_name);
+                            break;
+                        }
+
+                        char mode[8] = {0};
+                        while (1) {
+                            get_string_input(mode, sizeof(mode), "Mode (s)tream or (d)ownload: ");
+                            if (mode[0] == 's' || mode[0] == 'S' || mode[0] == 'd' || mode[0] == 'D') break;
+                            snprintf(status, sizeof(status), "Invalid mode. Choose 's' or 'd'");
+                            draw_ui(st, status);
+                        }
+
+                        int lines = tracklist_start(st, path, playlist_name, mode[0] == 's' || mode[0] == 'S');
+                        if (lines < 0) {
+                            snprintf(status, sizeof(status), "Couldn't read %s", path);
+                        } else if (lines == 0) {
+                            snprintf(status, sizeof(status), "No tracks found in %s", path);
+                        } else {
+                            snprintf(status, sizeof(status), "Importing %d tracks into '%s'...", lines, playlist_name);
                         }
                         break;
                     }
-                    
+
                     // NEW: Download entire playlist
                     case 'd':
-                        if (st.playlist_count > 0) {
-                            Playlist *pl = &st.playlists[st.playlist_selected];
+                        if (st->playlist_count > 0) {
+                            Playlist *pl = &st->playlists[st->playlist_selected];
                             
                             // Make sure songs are loaded
                             if (pl->count == 0) {
-                                load_playlist_songs(&st, st.playlist_selected);
+                                load_playlist_songs(st, st->playlist_selected);
                             }
                             
                             int added = 0;
                             int skipped = 0;
                             
                             for (int i = 0; i < pl->count; i++) {
-                                int result = add_to_download_queue(&st, 
-                                    pl->items[i].video_id,
-                                    pl->items[i].title,
+                                Song *song = playlist_song(st, pl, i);
+                                int result = add_to_download_queue(st, 
+                                    song->video_id,
+                                    song->title,
                                     pl->name);
                                 
                                 if (result > 0) {
@@ -3879,51 +9527,62 @@ int main(int argc, char *argv[]) {
             
             case VIEW_PLAYLIST_SONGS: {
                 Playlist *pl = NULL;
-                if (st.current_playlist_idx >= 0 && st.current_playlist_idx < st.playlist_count) {
-                    pl = &st.playlists[st.current_playlist_idx];
+                if (st->current_playlist_idx >= 0 && st->current_playlist_idx < st->playlist_count) {
+                    pl = &st->playlists[st->current_playlist_idx];
                 }
                 
                 switch (ch) {
                     case KEY_UP:
                     case 'k':
-                        if (st.playlist_song_selected > 0) st.playlist_song_selected--;
+                        if (st->playlist_song_selected > 0) st->playlist_song_selected--;
                         break;
                     
                     case KEY_DOWN:
                     case 'j':
-                        if (pl && st.playlist_song_selected + 1 < pl->count) 
-                            st.playlist_song_selected++;
+                        if (pl && st->playlist_song_selected + 1 < pl->count) 
+                            st->playlist_song_selected++;
                         break;
                     
                     case KEY_PPAGE:
-                        st.playlist_song_selected -= list_height;
-                        if (st.playlist_song_selected < 0) st.playlist_song_selected = 0;
+                        st->playlist_song_selected -= list_height;
+                        if (st->playlist_song_selected < 0) st->playlist_song_selected = 0;
                         break;
                     
                     case KEY_NPAGE:
                         if (pl) {
-                            st.playlist_song_selected += list_height;
-                            if (st.playlist_song_selected >= pl->count)
-                                st.playlist_song_selected = pl->count - 1;
-                            if (st.playlist_song_selected < 0) st.playlist_song_selected = 0;
+                            st->playlist_song_selected += list_height;
+                            if (st->playlist_song_selected >= pl->count)
+                                st->playlist_song_selected = pl->count - 1;
+                            if (st->playlist_song_selected < 0) st->playlist_song_selected = 0;
                         }
                         break;
                     
                     case '\n':
                     case KEY_ENTER:
                         if (pl && pl->count > 0) {
-                            play_playlist_song(&st, st.current_playlist_idx, st.playlist_song_selected);
-                            snprintf(status, sizeof(status), "Playing: %s",
-                                     pl->items[st.playlist_song_selected].title ?
-                                     pl->items[st.playlist_song_selected].title : "?");
+                            play_playlist_song(st, st->current_playlist_idx, st->playlist_song_selected);
+                            const char *title = playlist_song(st, pl, st->playlist_song_selected)->title;
+                            snprintf(status, sizeof(status), "Playing: %s", title ? title : "?");
                         }
                         break;
                     
+                    case 'e': // Queue song
+                    case 'E': // Play song next
+                        if (pl && pl->count > 0) {
+                            Song *song = playlist_song(st, pl, st->playlist_song_selected);
+                            if (queue_push(&st->queue, song, pl->name, ch == 'E')) {
+                                queue_changed(st);
+                                snprintf(status, sizeof(status), "%s: %s",
+                                         ch == 'E' ? "Playing next" : "Added to queue", song->title);
+                            }
+                        }
+                        break;
+
                     // NEW: Download single song from playlist (saves to playlist folder)
                     case 'd':
                         if (pl && pl->count > 0) {
-                            Song *song = &pl->items[st.playlist_song_selected];
-                            int result = add_to_download_queue(&st, song->video_id, song->title, pl->name);
+                            Song *song = playlist_song(st, pl, st->playlist_song_selected);
+                            int result = add_to_download_queue(st, song->video_id, song->title, pl->name);
                             if (result > 0) {
                                 snprintf(status, sizeof(status), "Queued: %s", song->title);
                             } else if (result == 0) {
@@ -3936,15 +9595,26 @@ int main(int argc, char *argv[]) {
                         }
                         break;
                     
+                    case 'K': // Move song up
+                    case 'J': // Move song down
+                        if (pl && pl->count > 1) {
+                            int to = st->playlist_song_selected + (ch == 'K' ? -1 : 1);
+                            if (move_song_in_playlist(st, st->current_playlist_idx,
+                                                      st->playlist_song_selected, to)) {
+                                st->playlist_song_selected = to;
+                            }
+                        }
+                        break;
+                    
                     // Remove song with 'r' (was 'd')
                     case 'r':
                         if (pl && pl->count > 0) {
-                            const char *title = pl->items[st.playlist_song_selected].title;
-                            if (remove_song_from_playlist(&st, st.current_playlist_idx, 
-                                                         st.playlist_song_selected)) {
+                            const char *title = playlist_song(st, pl, st->playlist_song_selected)->title;
+                            if (remove_song_from_playlist(st, st->current_playlist_idx, 
+                                                         st->playlist_song_selected)) {
                                 snprintf(status, sizeof(status), "Removed: %s", title ? title : "?");
-                                if (st.playlist_song_selected >= pl->count && pl->count > 0) {
-                                    st.playlist_song_selected = pl->count - 1;
+                                if (st->playlist_song_selected >= pl->count && pl->count > 0) {
+                                    st->playlist_song_selected = pl->count - 1;
                                 }
                             } else {
                                 snprintf(status, sizeof(status), "Failed to remove");
@@ -3956,8 +9626,9 @@ int main(int argc, char *argv[]) {
                         if (pl && pl->is_youtube_playlist && pl->count > 0) {
                             int added = 0;
                             for (int i = 0; i < pl->count; i++) {
-                                int result = add_to_download_queue(&st, pl->items[i].video_id,
-                                                                   pl->items[i].title, pl->name);
+                                Song *song = playlist_song(st, pl, i);
+                                int result = add_to_download_queue(st, song->video_id,
+                                                                   song->title, pl->name);
                                 if (result > 0) added++;
                             }
                             if (added > 0) {
@@ -3970,73 +9641,31 @@ int main(int argc, char *argv[]) {
 
                     case 'u': // Sync YouTube playlist
                         if (pl && pl->is_youtube_playlist) {
-                            snprintf(status, sizeof(status), "Syncing playlist...");
-                            draw_ui(&st, status);
-
-                            char fetch_url[512] = {0};
-                            // For now, ask user to paste URL again
-                            int len = get_string_input(fetch_url, sizeof(fetch_url),
-                                "YouTube playlist URL to sync: ");
-
-                            if (len > 0 && validate_youtube_playlist_url(fetch_url)) {
-                                char fetched_title[256] = {0};
-                                Song temp_songs[MAX_PLAYLIST_ITEMS];
-                                int fetched = fetch_youtube_playlist(fetch_url, temp_songs, MAX_PLAYLIST_ITEMS,
-                                                                     fetched_title, sizeof(fetched_title),
-                                                                     youtube_fetch_progress_callback, status,
-                                                                     get_ytdlp_cmd(&st));
-
-                                if (fetched > 0) {
-                                    // Count new songs (not already in playlist)
-                                    int new_count = 0;
-                                    int old_count = pl->count;
-
-                                    for (int i = 0; i < fetched; i++) {
-                                        bool exists = false;
-                                        for (int j = 0; j < old_count; j++) {
-                                            if (pl->items[j].video_id && temp_songs[i].video_id &&
-                                                strcmp(pl->items[j].video_id, temp_songs[i].video_id) == 0) {
-                                                exists = true;
-                                                break;
-                                            }
-                                        }
-
-                                        if (!exists && pl->count < MAX_PLAYLIST_ITEMS) {
-                                            // Add new song
-                                            int idx = pl->count;
-                                            pl->items[idx].title = temp_songs[i].title;
-                                            pl->items[idx].video_id = temp_songs[i].video_id;
-                                            pl->items[idx].url = temp_songs[i].url;
-                                            pl->items[idx].duration = temp_songs[i].duration;
-                                            pl->count++;
-                                            new_count++;
-                                            // Clear pointers so they won't be freed below
-                                            temp_songs[i].title = NULL;
-                                            temp_songs[i].video_id = NULL;
-                                            temp_songs[i].url = NULL;
-                                        }
-                                    }
-
-                                    // Free remaining temp songs
-                                    for (int i = 0; i < fetched; i++) {
-                                        free(temp_songs[i].title);
-                                        free(temp_songs[i].video_id);
-                                        free(temp_songs[i].url);
-                                    }
-
-                                    if (new_count > 0) {
-                                        save_playlist(&st, st.current_playlist_idx);
-                                        snprintf(status, sizeof(status), "Added %d new songs", new_count);
-                                    } else {
-                                        snprintf(status, sizeof(status), "Playlist is up to date");
-                                    }
-                                } else {
-                                    snprintf(status, sizeof(status), "Failed to fetch playlist");
+                            if (!pl->source_url) {
+                                // Imported before source URLs were stored: ask once
+                                char fetch_url[512] = {0};
+                                int len = get_string_input(fetch_url, sizeof(fetch_url),
+                                    "YouTube playlist URL to sync: ");
+                                if (len == 0) {
+                                    snprintf(status, sizeof(status), "Sync cancelled");
+                                    break;
+                                }
+                                if (!validate_youtube_playlist_url(fetch_url)) {
+                                    snprintf(status, sizeof(status), "Invalid YouTube playlist URL");
+                                    break;
                                 }
-                            } else if (len > 0) {
-                                snprintf(status, sizeof(status), "Invalid YouTube playlist URL");
+                                pl->source_url = strdup(fetch_url);
+                                save_playlists_index(st);
+                                save_playlist(st, st->current_playlist_idx);
+                            }
+
+                            int result = playlist_sync_start(st, st->current_playlist_idx);
+                            if (result > 0) {
+                                snprintf(status, sizeof(status), "Syncing '%s' in the background...", pl->name);
+                            } else if (result == 0) {
+                                snprintf(status, sizeof(status), "'%s' is already syncing", pl->name);
                             } else {
-                                snprintf(status, sizeof(status), "Sync cancelled");
+                                snprintf(status, sizeof(status), "Failed to start sync");
                             }
                         } else {
                             snprintf(status, sizeof(status), "Not a YouTube playlist");
@@ -4044,12 +9673,8 @@ int main(int argc, char *argv[]) {
                         break;
 
                     case 'x':
-                        if (st.playing_index >= 0) {
-                            mpv_stop_playback();
-                            st.playing_index = -1;
-                            st.playing_from_playlist = false;
-                            st.playing_playlist_idx = -1;
-                            st.paused = false;
+                        if (playback_active(st)) {
+                            stop_playback(st);
                             snprintf(status, sizeof(status), "Playback stopped");
                         }
                         break;
@@ -4061,26 +9686,26 @@ int main(int argc, char *argv[]) {
                 switch (ch) {
                     case KEY_UP:
                     case 'k':
-                        if (st.add_to_playlist_selected > 0) st.add_to_playlist_selected--;
+                        if (st->add_to_playlist_selected > 0) st->add_to_playlist_selected--;
                         break;
                     
                     case KEY_DOWN:
                     case 'j':
-                        if (st.add_to_playlist_selected + 1 < st.playlist_count)
-                            st.add_to_playlist_selected++;
+                        if (st->add_to_playlist_selected + 1 < st->playlist_count)
+                            st->add_to_playlist_selected++;
                         break;
                     
                     case '\n':
                     case KEY_ENTER:
-                        if (st.playlist_count > 0 && st.song_to_add) {
-                            if (add_song_to_playlist(&st, st.add_to_playlist_selected, st.song_to_add)) {
+                        if (st->playlist_count > 0 && st->song_to_add.video_id[0]) {
+                            if (add_song_to_playlist(st, st->add_to_playlist_selected, &st->song_to_add)) {
                                 snprintf(status, sizeof(status), "Added to: %s",
-                                         st.playlists[st.add_to_playlist_selected].name);
+                                         st->playlists[st->add_to_playlist_selected].name);
                             } else {
                                 snprintf(status, sizeof(status), "Already in playlist or failed");
                             }
-                            st.song_to_add = NULL;
-                            st.view = VIEW_SEARCH;
+                            song_to_add_clear(st);
+                            st->view = VIEW_SEARCH;
                         }
                         break;
                     
@@ -4088,13 +9713,13 @@ int main(int argc, char *argv[]) {
                         char name[128] = {0};
                         int len = get_string_input(name, sizeof(name), "New playlist name: ");
                         if (len > 0) {
-                            int idx = create_playlist(&st, name, false);
+                            int idx = create_playlist(st, name, false);
                             if (idx >= 0) {
-                                if (st.song_to_add) {
-                                    add_song_to_playlist(&st, idx, st.song_to_add);
+                                if (st->song_to_add.video_id[0]) {
+                                    add_song_to_playlist(st, idx, &st->song_to_add);
                                     snprintf(status, sizeof(status), "Created '%s' and added song", name);
-                                    st.song_to_add = NULL;
-                                    st.view = VIEW_SEARCH;
+                                    song_to_add_clear(st);
+                                    st->view = VIEW_SEARCH;
                                 } else {
                                     snprintf(status, sizeof(status), "Created: %s", name);
                                 }
@@ -4117,49 +9742,119 @@ int main(int argc, char *argv[]) {
                 switch (ch) {
                     case KEY_UP:
                     case 'k':
-                        if (st.settings_selected > 0) st.settings_selected--;
+                        if (st->settings_selected > 0) st->settings_selected--;
                         break;
 
                     case KEY_DOWN:
                     case 'j':
-                        if (st.settings_selected < 3) st.settings_selected++;
+                        if (st->settings_selected < 9) st->settings_selected++;
                         break;
 
                     case '\n':
                     case KEY_ENTER:
-                        if (st.settings_selected == 0) {
+                        if (st->settings_selected == 0) {
                             // Download path - enter edit mode
-                            st.settings_editing = true;
-                            strncpy(st.settings_edit_buffer, st.config.download_path,
-                                    sizeof(st.settings_edit_buffer) - 1);
-                            st.settings_edit_buffer[sizeof(st.settings_edit_buffer) - 1] = '\0';
-                            st.settings_edit_pos = strlen(st.settings_edit_buffer);
+                            st->settings_editing = true;
+                            strncpy(st->settings_edit_buffer, st->config.download_path,
+                                    sizeof(st->settings_edit_buffer) - 1);
+                            st->settings_edit_buffer[sizeof(st->settings_edit_buffer) - 1] = '\0';
+                            st->settings_edit_pos = strlen(st->settings_edit_buffer);
                             snprintf(status, sizeof(status), "Editing download path...");
-                        } else if (st.settings_selected == 1) {
+                        } else if (st->settings_selected == 1) {
                             // Seek step - prompt for new value
                             char step_input[16] = {0};
                             int len = get_string_input(step_input, sizeof(step_input), "Seek step (1-300 seconds): ");
                             if (len > 0) {
                                 int new_step = atoi(step_input);
                                 if (new_step >= 1 && new_step <= 300) {
-                                    st.config.seek_step = new_step;
-                                    save_config(&st);
+                                    st->config.seek_step = new_step;
+                                    save_config(st);
                                     snprintf(status, sizeof(status), "Seek step set to %d seconds", new_step);
                                 } else {
                                     snprintf(status, sizeof(status), "Invalid value (must be 1-300)");
                                 }
                             }
-                        } else if (st.settings_selected == 2) {
+                        } else if (st->settings_selected == 2) {
                             // Remember session - toggle
-                            st.config.remember_session = !st.config.remember_session;
-                            save_config(&st);
+                            st->config.remember_session = !st->config.remember_session;
+                            save_config(st);
                             snprintf(status, sizeof(status), "Remember session: %s",
-                                     st.config.remember_session ? "ON" : "OFF");
-                        } else if (st.settings_selected == 3) {
+                                     st->config.remember_session ? "ON" : "OFF");
+                        } else if (st->settings_selected == 3) {
                             // Shuffle mode - toggle
-                            st.shuffle_mode = !st.shuffle_mode;
+                            st->shuffle_mode = !st->shuffle_mode;
                             snprintf(status, sizeof(status), "Shuffle: %s",
-                                     st.shuffle_mode ? "ON" : "OFF");
+                                     st->shuffle_mode ? "ON" : "OFF");
+                        } else if (st->settings_selected == 4) {
+                            // Resume playback - toggle
+                            st->config.resume_playback = !st->config.resume_playback;
+                            save_config(st);
+                            snprintf(status, sizeof(status), "Resume playback: %s",
+                                     st->config.resume_playback ? "ON" : "OFF");
+                        } else if (st->settings_selected == 5) {
+                            // Stream quality - cycle auto -> low -> medium -> high
+                            st->config.stream_quality++;
+                            if (st->config.stream_quality >= STREAM_TIER_COUNT) {
+                                st->config.stream_quality = QUALITY_AUTO;
+                            } else {
+                                st->stream.tier = st->config.stream_quality;
+                            }
+                            save_config(st);
+                            preload_next_track(st);
+                            snprintf(status, sizeof(status), "Stream quality: %s (applies to next track)",
+                                     stream_quality_name(st->config.stream_quality));
+                        } else if (st->settings_selected == 6) {
+                            // Shuffle weighting - toggle
+                            st->config.weighted_shuffle = !st->config.weighted_shuffle;
+                            save_config(st);
+                            update_download_priority(st);
+                            preload_next_track(st);
+                            snprintf(status, sizeof(status), "Shuffle weighting: %s",
+                                     st->config.weighted_shuffle ? "by play stats" : "uniform");
+                        } else if (st->settings_selected == 7) {
+                            // Search cache freshness - prompt for new value
+                            char ttl_input[16] = {0};
+                            int len = get_string_input(ttl_input, sizeof(ttl_input),
+                                                       "Search cache hours (0 = off, max 720): ");
+                            if (len > 0) {
+                                int ttl = atoi(ttl_input);
+                                if (ttl >= 0 && ttl <= 720) {
+                                    st->config.search_cache_ttl = ttl;
+                                    save_config(st);
+                                    if (ttl > 0) {
+                                        snprintf(status, sizeof(status), "Search cache: %d hours", ttl);
+                                    } else {
+                                        snprintf(status, sizeof(status), "Search cache: OFF");
+                                    }
+                                } else {
+                                    snprintf(status, sizeof(status), "Invalid value (must be 0-720)");
+                                }
+                            }
+                        } else if (st->settings_selected == 8) {
+                            // YouTube sync interval - prompt for new value
+                            char hours_input[16] = {0};
+                            int len = get_string_input(hours_input, sizeof(hours_input),
+                                                       "Sync YouTube playlists every N hours (0 = manual, max 720): ");
+                            if (len > 0) {
+                                int hours = atoi(hours_input);
+                                if (hours >= 0 && hours <= 720) {
+                                    st->config.youtube_sync_hours = hours;
+                                    save_config(st);
+                                    if (hours > 0) {
+                                        snprintf(status, sizeof(status), "YouTube playlists sync every %d hours", hours);
+                                    } else {
+                                        snprintf(status, sizeof(status), "YouTube playlist sync: manual");
+                                    }
+                                } else {
+                                    snprintf(status, sizeof(status), "Invalid value (must be 0-720)");
+                                }
+                            }
+                        } else if (st->settings_selected == 9) {
+                            // Download synced songs - toggle
+                            st->config.youtube_sync_download = !st->config.youtube_sync_download;
+                            save_config(st);
+                            snprintf(status, sizeof(status), "Download synced songs: %s",
+                                     st->config.youtube_sync_download ? "ON" : "OFF");
                         }
                         break;
                 }
@@ -4170,49 +9865,166 @@ int main(int argc, char *argv[]) {
                 // About view doesn't handle any keys (just closes on any key)
                 break;
             }
+
+            case VIEW_LIBRARY:
+                // Handled before the global keys
+                break;
+
+            case VIEW_QUEUE: {
+                switch (ch) {
+                    case KEY_UP:
+                    case 'k':
+                        if (st->queue_selected > 0) st->queue_selected--;
+                        break;
+
+                    case KEY_DOWN:
+                    case 'j':
+                        if (st->queue_selected + 1 < st->queue.count) st->queue_selected++;
+                        break;
+
+                    case '\n':
+                    case KEY_ENTER:
+                        if (st->queue.count > 0) {
+                            // Play now: move the entry to the front and start it
+                            for (int i = st->queue_selected; i > 0; i--) {
+                                queue_swap(&st->queue, i, i - 1);
+                            }
+                            QueueEntry e;
+                            queue_pop_front(&st->queue, &e);
+                            play_queue_entry(st, &e);
+                            save_play_queue(st);
+                            snprintf(status, sizeof(status), "Playing: %s",
+                                     st->queue_current.song.title);
+                        }
+                        break;
+
+                    case 'r':
+                        if (st->queue.count > 0) {
+                            queue_remove(&st->queue, st->queue_selected);
+                            if (st->queue_selected >= st->queue.count && st->queue_selected > 0) {
+                                st->queue_selected--;
+                            }
+                            queue_changed(st);
+                            snprintf(status, sizeof(status), "Removed from queue");
+                        }
+                        break;
+
+                    case 'K':
+                        if (st->queue_selected > 0) {
+                            queue_swap(&st->queue, st->queue_selected, st->queue_selected - 1);
+                            st->queue_selected--;
+                            queue_changed(st);
+                        }
+                        break;
+
+                    case 'J':
+                        if (st->queue_selected + 1 < st->queue.count) {
+                            queue_swap(&st->queue, st->queue_selected, st->queue_selected + 1);
+                            st->queue_selected++;
+                            queue_changed(st);
+                        }
+                        break;
+
+                    case 'C':
+                        if (st->queue.count > 0) {
+                            queue_clear(&st->queue);
+                            st->queue_selected = 0;
+                            st->queue_scroll = 0;
+                            queue_changed(st);
+                            snprintf(status, sizeof(status), "Queue cleared");
+                        }
+                        break;
+                }
+                break;
+            }
         }
 
-        draw_ui(&st, status);
+        draw_ui(st, status);
     }
 
     // Save session state before exit
-    if (st.config.remember_session) {
-        st.was_playing_playlist = st.playing_from_playlist;
-        if (st.playing_from_playlist) {
-            st.last_playlist_idx = st.playing_playlist_idx;
-            st.last_song_idx = st.playing_index;
+    if (st->config.remember_session) {
+        // Remember where the current track was so it can be resumed
+        // (queued songs and replaced search results aren't part of the session)
+        st->last_position = -1;
+        if (st->playing_index >= 0 && !st->playing_from_queue && !st->search_detached) {
+            double pos = 0;
+            if (mpv_get_property_double("time-pos", &pos) && pos >= 0) {
+                st->last_position = (int)pos;
+            } else {
+                st->last_position = 0;
+            }
+        }
+
+        st->was_playing_playlist = st->playing_from_playlist;
+        if (st->playing_from_playlist) {
+            st->last_playlist_idx = st->playing_playlist_idx;
+            st->last_song_idx = st->playing_index;
         } else {
-            st.last_playlist_idx = -1;
-            st.last_song_idx = st.search_selected;
+            st->last_playlist_idx = -1;
+            st->last_song_idx = (st->playing_index >= 0 && !st->search_detached) ?
+                               st->playing_index : st->search_selected;
             // Cache current search results
-            strncpy(st.last_query, st.query, sizeof(st.last_query) - 1);
-            st.cached_search_count = st.search_count;
-            for (int i = 0; i < st.search_count && i < MAX_RESULTS; i++) {
-                // Free any existing cached data
-                free(st.cached_search[i].title);
-                free(st.cached_search[i].video_id);
-                free(st.cached_search[i].url);
+            strncpy(st->last_query, st->query, sizeof(st->last_query) - 1);
+            st->cached_search_count = st->search_count < MAX_RESULTS ? st->search_count : MAX_RESULTS;
+            arena_free(&st->cached_search_strings);
+            for (int i = 0; i < st->cached_search_count; i++) {
                 // Copy current search results
-                st.cached_search[i].title = st.search_results[i].title ? strdup(st.search_results[i].title) : NULL;
-                st.cached_search[i].video_id = st.search_results[i].video_id ? strdup(st.search_results[i].video_id) : NULL;
-                st.cached_search[i].url = st.search_results[i].url ? strdup(st.search_results[i].url) : NULL;
-                st.cached_search[i].duration = st.search_results[i].duration;
+                st->cached_search[i] = st->search_results[i];
+                st->cached_search[i].title = arena_strdup(&st->cached_search_strings,
+                                                          st->search_results[i].title);
             }
         }
-        save_config(&st);
+        save_config(st);
     }
 
+    save_shuffle_orders(st);
+    save_stats(st);
+    save_play_queue(st);
+    if (st->search_cache.dirty) save_search_cache_index(st);
+
+    // Pending saves go out now, and the writer finishes them before exit
+    library_snapshot_cancel(st);
+    saves_commit(st);
+    persist_stop();
+
     // NEW: Stop download thread
-    stop_download_thread(&st);
-    stop_ytdlp_update(&st);
-    pthread_mutex_destroy(&st.download_queue.mutex);
+    stop_download_thread(st);
+    stop_ytdlp_update(st);
+    ytdlp_helper_stop();
+    pthread_mutex_destroy(&st->download_queue.mutex);
+
+    // The library as the files now have it, for the next start
+    library_snapshot_save(st);
 
     endwin();
     
     // Cleanup
-    free_search_results(&st);
-    free_all_playlists(&st);
+    search_cancel(st);
+    tracklist_cancel(st);
+    playlist_fetch_cancel_all(st);
+    free_search_results(st);
+    song_to_add_clear(st);
+    arena_free(&st->cached_search_strings);
+    search_cache_free(&st->search_cache);
+    release_played_search(st);
+    end_queue_playback(st);
+    queue_clear(&st->queue);
+    free(st->queue.items);
+    library_free(&st->library);
+    free_all_playlists(st);
+    song_table_free(&st->songs);
+    download_dirs_free(st);
+    library_snapshot_free(st);
+    free_saved_shuffles(st);
+    weighted_reset(&st->weighted);
+    strmap_free(&st->stats_index);
+    free(st->stats);
+    free(st->download_queue.tasks);
+    strmap_free(&st->download_queue.ids);
     mpv_quit();
+    g_app_state = NULL;
+    free(st);
 
     sb_log("ShellBeats exiting normally");
     if (g_log_file) {
@@ -1,118 +1,174 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "youtube_playlist.h"
+#include "ytdlp_helper.h"
+
+// Output of a yt-dlp listing, from the helper when it's up
+typedef struct {
+    FILE *fp;
+    pid_t pid;  // yt-dlp run directly, -1 for the helper
+} ListingStream;
+
+static bool listing_open(ListingStream *ls, int helper_fd, char *const argv[]) {
+    ls->pid = -1;
+    int fd = helper_fd >= 0 ? helper_fd : ytdlp_spawn(argv, &ls->pid);
+    if (fd < 0) return false;
+    ls->fp = fdopen(fd, "r");
+    if (ls->fp) return true;
+    close(fd);
+    if (ls->pid > 0) waitpid(ls->pid, NULL, 0);
+    return false;
+}
+
+// Returns false if yt-dlp exited with an error
+static bool listing_close(ListingStream *ls) {
+    fclose(ls->fp);
+    if (ls->pid < 0) return true;
+    int status;
+    if (waitpid(ls->pid, &status, 0) < 0) return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Last "|||" that starts in [start, end), or NULL
+static char *rfind_separator(char *start, char *end) {
+    for (char *p = end - 3; p >= start; p--) {
+        if (p[0] == '|' && p[1] == '|' && p[2] == '|') return p;
+    }
+    return NULL;
+}
 
-int fetch_youtube_playlist(const char *url, Song *songs, int max_songs,
+int fetch_youtube_playlist(const char *url, int start, Song **songs, int *count, int *cap, Arena *arena,
                            char *playlist_title, size_t title_size,
                            progress_callback_t progress_callback, void *callback_data,
                            const char *ytdlp_cmd) {
-    if (!url || !songs || max_songs <= 0 || !playlist_title || title_size == 0)
+    if (!url || !songs || !count || !cap || !arena || !playlist_title || title_size == 0)
         return -1;
 
     if (!ytdlp_cmd || !ytdlp_cmd[0]) ytdlp_cmd = "yt-dlp";
+    if (start < 1) start = 1;
 
-    // Report: Fetching playlist title
-    if (progress_callback) {
-        progress_callback(0, "Fetching playlist info...", callback_data);
-    }
-
-    char title_cmd[2048];
-    snprintf(title_cmd, sizeof(title_cmd),
-             "%s --flat-playlist --quiet --no-warnings "
-             "--print '%%(playlist_title)s' '%s' 2>/dev/null", ytdlp_cmd, url);
-
-    FILE *title_fp = popen(title_cmd, "r");
-    if (!title_fp) return -1;
-
-    char *title_line = NULL;
-    size_t title_cap = 0;
-    strcpy(playlist_title, "YouTube Playlist");
-
-    if (getline(&title_line, &title_cap, title_fp) != -1) {
-        size_t len = strlen(title_line);
-        while (len > 0 && (title_line[len-1] == '\n' || title_line[len-1] == '\r'))
-            title_line[--len] = '\0';
-        if (len > 0) {
-            strncpy(playlist_title, title_line, title_size - 1);
-            playlist_title[title_size - 1] = '\0';
-        }
-    }
-    free(title_line);
-    pclose(title_fp);
-
-    // Report: Fetching songs
-    if (progress_callback) {
-        progress_callback(0, "Fetching songs...", callback_data);
+    // Report: Fetching playlist
+    if (progress_callback && !progress_callback(*count, "Fetching playlist...", callback_data)) {
+        return -1;
     }
 
-    char cmd[2048];
-    snprintf(cmd, sizeof(cmd),
-             "%s --flat-playlist --quiet --no-warnings "
-             "--print '%%(title)s|||%%(id)s|||%%(duration)s' "
-             "'%s' 2>/dev/null", ytdlp_cmd, url);
+    // One pass: every entry carries the playlist title, so the first row
+    // gives it without a separate yt-dlp run. "--" keeps a URL starting with '-' from being read as an option
+    char range[32];
+    snprintf(range, sizeof(range), "%d:", start);
+    char *argv[] = {
+        (char *)ytdlp_cmd, "--flat-playlist", "--quiet", "--no-warnings",
+        "--print", "%(playlist_title)s|||%(title)s|||%(id)s|||%(duration)s",
+        "--playlist-items", range, "--", (char *)url, NULL
+    };
 
-    FILE *fp = popen(cmd, "r");
-    if (!fp) return -1;
+    ListingStream ls;
+    if (!listing_open(&ls, ytdlp_helper_playlist(url, start), argv)) return -1;
+    FILE *fp = ls.fp;
 
     char *line = NULL;
-    size_t cap = 0;
-    int count = 0;
+    size_t line_cap = 0;
+    int added = 0;
+    bool failed = false;
+    strcpy(playlist_title, "YouTube Playlist");
+    bool have_title = false;
 
-    while (count < max_songs && getline(&line, &cap, fp) != -1) {
+    while (getline(&line, &line_cap, fp) != -1) {
         size_t len = strlen(line);
         while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
             line[--len] = '\0';
 
-        if (!line[0] || strncmp(line, "ERROR", 5) == 0) continue;
+        if (!line[0]) continue;
+        if (strncmp(line, "ERROR", 5) == 0) {
+            failed = true;
+            break;
+        }
 
+        // playlist_title|||title|||id|||duration: id and duration are taken
+        // from the right so a "|||" inside the song title survives
         char *sep1 = strstr(line, "|||");
         if (!sep1) continue;
         *sep1 = '\0';
-        char *sep2 = strstr(sep1 + 3, "|||");
+        char *sep3 = rfind_separator(sep1 + 3, line + len);
+        if (!sep3) continue;
+        *sep3 = '\0';
+        char *sep2 = rfind_separator(sep1 + 3, sep3);
         if (!sep2) continue;
         *sep2 = '\0';
 
-        const char *title = line;
-        const char *video_id = sep1 + 3;
-        const char *duration_str = sep2 + 3;
+        const char *title = sep1 + 3;
+        const char *video_id = sep2 + 3;
+        const char *duration_str = sep3 + 3;
+
+        if (!have_title) {
+            have_title = true;
+            if (line[0] && strcmp(line, "NA") != 0) {
+                strncpy(playlist_title, line, title_size - 1);
+                playlist_title[title_size - 1] = '\0';
+            }
+        }
 
         if (!video_id[0]) continue;
 
-        songs[count].title = strdup(title);
-        songs[count].video_id = strdup(video_id);
-        songs[count].url = malloc(256);
-        if (songs[count].url) {
-            snprintf(songs[count].url, 256, "https://www.youtube.com/watch?v=%s", video_id);
+        if (*count == *cap) {
+            int new_cap = *cap ? *cap * 2 : 256;
+            Song *grown = realloc(*songs, sizeof(Song) * new_cap);
+            if (!grown) {
+                failed = true;
+                break;
+            }
+            *songs = grown;
+            *cap = new_cap;
         }
-        songs[count].duration = atoi(duration_str);
-
-        if (songs[count].title && songs[count].video_id && songs[count].url) {
-            count++;
-            // Report progress every 10 songs
-            if (progress_callback && (count % 10 == 0 || count == 1)) {
-                char msg[128];
-                snprintf(msg, sizeof(msg), "Fetched %d songs...", count);
-                progress_callback(count, msg, callback_data);
+
+        Song *song = &(*songs)[*count];
+        if (!song_set_video_id(song, video_id)) continue;
+        song->title = arena_strdup(arena, title);
+        if (!song->title) {
+            failed = true;
+            break;
+        }
+        song->duration = atoi(duration_str);
+        (*count)++;
+        added++;
+
+        // Report progress every 10 songs
+        if (progress_callback && (added % 10 == 0 || added == 1)) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "Fetched %d songs...", *count);
+            if (!progress_callback(*count, msg, callback_data)) {
+                failed = true;
+                break;
             }
-        } else {
-            free(songs[count].title);
-            free(songs[count].video_id);
-            free(songs[count].url);
         }
     }
 
     free(line);
-    pclose(fp);
-    
+    bool exited_ok = listing_close(&ls);
+    if (failed || !exited_ok) return -1;
+
     // Report: Complete
-    if (progress_callback && count > 0) {
+    if (progress_callback && added > 0) {
         char msg[128];
-        snprintf(msg, sizeof(msg), "Completed! Fetched %d songs", count);
-        progress_callback(count, msg, callback_data);
+        snprintf(msg, sizeof(msg), "Completed! Fetched %d songs", *count);
+        progress_callback(*count, msg, callback_data);
     }
-    
-    return count;
+
+    return added;
+}
+
+bool song_set_video_id(Song *song, const char *id) {
+    size_t len = strlen(id);
+    if (len == 0 || len >= sizeof(song->video_id)) return false;
+    memcpy(song->video_id, id, len + 1);
+    return true;
+}
+
+void youtube_watch_url(const char *video_id, char *out, size_t out_size) {
+    snprintf(out, out_size, "https://www.youtube.com/watch?v=%s", video_id);
 }
 
 bool validate_youtube_playlist_url(const char *url) {
@@ -3,19 +3,34 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include "arena.h"
 
+// YouTube video ids are 11 characters
+#define VIDEO_ID_SIZE 12
+
+// The title is owned by the list holding the song, usually in its arena.
+// The watch URL isn't stored: youtube_watch_url builds it from the id.
 typedef struct {
     char *title;
-    char *video_id;
-    char *url;
+    char video_id[VIDEO_ID_SIZE];
     int duration;
 } Song;
 
+// Copy id into song->video_id. Returns false if it is empty or too long.
+bool song_set_video_id(Song *song, const char *id);
+
+void youtube_watch_url(const char *video_id, char *out, size_t out_size);
+
 // Callback function type for progress updates
 // Parameters: current_count, message, user_data
-typedef void (*progress_callback_t)(int current_count, const char *message, void *user_data);
+// Return false to stop fetching; the songs fetched so far are kept.
+typedef bool (*progress_callback_t)(int current_count, const char *message, void *user_data);
 
-int fetch_youtube_playlist(const char *url, Song *songs, int max_songs,
+// Append the entries of a YouTube playlist, from the 1-based index start on,
+// to *songs (*count used, *cap allocated; grown as needed), with their titles
+// in arena. Returns the number appended, or -1 if the listing was cut short
+// by an error or by the callback; the songs read until then stay appended.
+int fetch_youtube_playlist(const char *url, int start, Song **songs, int *count, int *cap, Arena *arena,
                            char *playlist_title, size_t title_size,
                            progress_callback_t progress_callback, void *callback_data,
                            const char *ytdlp_cmd);
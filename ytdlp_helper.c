@@ -0,0 +1,498 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "ytdlp_helper.h"
+
+#define HELPER_SCRIPT "ytdlp_helper.py"
+
+// The helper runs in server mode under shellbeats and in client mode when
+// mpv's ytdl_hook calls it in place of yt-dlp. SOCKET and YTDLP are
+// prepended when the script is written.
+static const char helper_body[] =
+    "import json, os, socket, sys\n"
+    "\n"
+    "\n"
+    "# Called by mpv's ytdl_hook in place of yt-dlp: forward the command line to\n"
+    "# the helper, run the real yt-dlp if the helper is down or can't handle it\n"
+    "def client():\n"
+    "    argv = sys.argv[1:]\n"
+    "    data = b\"\"\n"
+    "    try:\n"
+    "        s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)\n"
+    "        s.connect(SOCKET)\n"
+    "        s.sendall((json.dumps({\"op\": \"cli\", \"argv\": argv}) + \"\\n\").encode())\n"
+    "        chunks = []\n"
+    "        while True:\n"
+    "            chunk = s.recv(65536)\n"
+    "            if not chunk:\n"
+    "                break\n"
+    "            chunks.append(chunk)\n"
+    "        data = b\"\".join(chunks)\n"
+    "    except OSError:\n"
+    "        pass\n"
+    "    if data[:1] == b\"0\":\n"
+    "        sys.stdout.buffer.write(data[1:])\n"
+    "        sys.exit(0)\n"
+    "    if data[:1] == b\"1\":\n"
+    "        sys.stderr.buffer.write(data[1:])\n"
+    "        sys.exit(1)\n"
+    "    os.execvp(YTDLP, [YTDLP] + argv)\n"
+    "\n"
+    "\n"
+    "def serve(sock_path, ytdlp):\n"
+    "    import itertools, socketserver, threading, zipfile\n"
+    "    # The release binary is a zip archive of the yt_dlp package\n"
+    "    if os.path.isfile(ytdlp) and zipfile.is_zipfile(ytdlp):\n"
+    "        sys.path.insert(0, ytdlp)\n"
+    "    import yt_dlp\n"
+    "\n"
+    "    class Quiet:\n"
+    "        def debug(self, msg):\n"
+    "            pass\n"
+    "\n"
+    "        def info(self, msg):\n"
+    "            pass\n"
+    "\n"
+    "        def warning(self, msg):\n"
+    "            pass\n"
+    "\n"
+    "        def error(self, msg):\n"
+    "            pass\n"
+    "\n"
+    "    def field(value):\n"
+    "        return \"NA\" if value is None else str(value).replace(\"\\n\", \" \")\n"
+    "\n"
+    "    # Same output as --flat-playlist --print '%(title)s|||%(id)s|||%(duration)s'\n"
+    "    # (prefixed with '%(playlist_title)s|||' for \"playlist\"), streamed as the\n"
+    "    # extractor yields entries\n"
+    "    def listing(req, write):\n"
+    "        opts = {\"quiet\": True, \"no_warnings\": True, \"extract_flat\": \"in_playlist\",\n"
+    "                \"lazy_playlist\": True, \"logger\": Quiet()}\n"
+    "        with yt_dlp.YoutubeDL(opts) as ydl:\n"
+    "            info = ydl.extract_info(req[\"target\"], download=False, process=False)\n"
+    "            while info and info.get(\"_type\") in (\"url\", \"url_transparent\"):\n"
+    "                info = ydl.extract_info(info[\"url\"], download=False, process=False,\n"
+    "                                        ie_key=info.get(\"ie_key\"))\n"
+    "            info = info or {}\n"
+    "            prefix = \"\"\n"
+    "            if req[\"op\"] == \"playlist\":\n"
+    "                prefix = field(info.get(\"title\")) + \"|||\"\n"
+    "            start = max(int(req.get(\"start\") or 1), 1)\n"
+    "            end = req.get(\"end\") or None\n"
+    "            for entry in itertools.islice(info.get(\"entries\") or [], start - 1, end):\n"
+    "                if entry:\n"
+    "                    write(\"%s%s|||%s|||%s\\n\" % (prefix, field(entry.get(\"title\")),\n"
+    "                                                field(entry.get(\"id\")),\n"
+    "                                                field(entry.get(\"duration\"))))\n"
+    "\n"
+    "    # A yt-dlp command line; replies \"0\" + stdout, \"1\" + error, or \"F\" when\n"
+    "    # the caller should run yt-dlp itself\n"
+    "    def cli(req, write):\n"
+    "        try:\n"
+    "            parsed = yt_dlp.parse_options(req[\"argv\"])\n"
+    "            opts = dict(parsed.ydl_opts)\n"
+    "        except BaseException:\n"
+    "            write(\"F\")\n"
+    "            return\n"
+    "        opts[\"logger\"] = Quiet()\n"
+    "        single_json = opts.pop(\"dump_single_json\", False)\n"
+    "        try:\n"
+    "            with yt_dlp.YoutubeDL(opts) as ydl:\n"
+    "                if single_json:\n"
+    "                    info = ydl.extract_info(parsed.urls[0], download=False)\n"
+    "                    write(\"0\" + json.dumps(ydl.sanitize_info(info)))\n"
+    "                else:\n"
+    "                    write(\"0\" if ydl.download(parsed.urls) == 0 else \"1\")\n"
+    "        except yt_dlp.utils.DownloadError as e:\n"
+    "            write(\"1\" + str(e))\n"
+    "        except (BrokenPipeError, ConnectionResetError):\n"
+    "            raise\n"
+    "        except Exception:\n"
+    "            write(\"F\")\n"
+    "\n"
+    "    class Handler(socketserver.StreamRequestHandler):\n"
+    "        def handle(self):\n"
+    "            def write(text):\n"
+    "                self.wfile.write(text.encode(\"utf-8\", \"replace\"))\n"
+    "                self.wfile.flush()\n"
+    "            try:\n"
+    "                req = json.loads(self.rfile.readline())\n"
+    "                if req.get(\"op\") == \"cli\":\n"
+    "                    cli(req, write)\n"
+    "                else:\n"
+    "                    listing(req, write)\n"
+    "            except (BrokenPipeError, ConnectionResetError):\n"
+    "                pass\n"
+    "            except Exception as e:\n"
+    "                try:\n"
+    "                    write(\"ERROR: %s\\n\" % e)\n"
+    "                except OSError:\n"
+    "                    pass\n"
+    "\n"
+    "    class Server(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):\n"
+    "        daemon_threads = True\n"
+    "\n"
+    "    try:\n"
+    "        os.unlink(sock_path)\n"
+    "    except OSError:\n"
+    "        pass\n"
+    "    # Only this user may connect: a \"cli\" request runs any yt-dlp options\n"
+    "    os.umask(0o077)\n"
+    "    server = Server(sock_path, Handler)\n"
+    "\n"
+    "    # shellbeats holds our stdin open; exit with it\n"
+    "    def watch_parent():\n"
+    "        sys.stdin.buffer.read()\n"
+    "        os._exit(0)\n"
+    "    threading.Thread(target=watch_parent, daemon=True).start()\n"
+    "    server.serve_forever()\n"
+    "\n"
+    "\n"
+    "if len(sys.argv) == 4 and sys.argv[1] == \"--serve\":\n"
+    "    serve(sys.argv[2], sys.argv[3])\n"
+    "else:\n"
+    "    client()\n";
+
+static pthread_mutex_t helper_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pid_t helper_pid = -1;
+static int helper_stdin = -1;         // the helper exits when this closes
+static char helper_dir[96];           // private to this user, holds the socket
+static char helper_sock[108];
+static char helper_script[1024];      // empty until ytdlp_helper_start finds python3
+static char helper_cmd[1024];         // yt-dlp command as configured
+static char helper_ytdlp[1024];       // resolved path the helper imports from
+static struct stat helper_ytdlp_stat;
+
+// Resolve a command name against PATH
+static bool find_executable(const char *cmd, char *out, size_t out_size) {
+    if (strchr(cmd, '/')) {
+        snprintf(out, out_size, "%s", cmd);
+        return access(out, X_OK) == 0;
+    }
+
+    const char *path = getenv("PATH");
+    if (!path) return false;
+
+    const char *p = path;
+    while (*p) {
+        const char *end = strchr(p, ':');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len > 0) {
+            snprintf(out, out_size, "%.*s/%s", (int)len, p, cmd);
+            if (access(out, X_OK) == 0) return true;
+        }
+        if (!end) break;
+        p = end + 1;
+    }
+    return false;
+}
+
+static bool same_file(const struct stat *a, const struct stat *b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+           a->st_size == b->st_size && a->st_mtime == b->st_mtime;
+}
+
+// Append s to buf as a JSON string literal. Returns false if it didn't fit.
+static bool json_append_string(char *buf, size_t size, const char *s) {
+    size_t len = strlen(buf);
+    if (len + 1 < size) buf[len++] = '"';
+    for (; *s && len + 7 < size; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            buf[len++] = '\\';
+            buf[len++] = c;
+        } else if (c < 0x20) {
+            len += snprintf(buf + len, size - len, "\\u%04x", c);
+        } else {
+            buf[len++] = c;
+        }
+    }
+    if (*s || len + 1 >= size) {
+        buf[len] = '\0';
+        return false;
+    }
+    buf[len++] = '"';
+    buf[len] = '\0';
+    return true;
+}
+
+// Write the script atomically so mpv never runs a half-written file
+static bool write_script(const char *path) {
+    char tmp[1100];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    char sock[256] = "";
+    char ytdlp[2200] = "";
+    if (!json_append_string(sock, sizeof(sock), helper_sock) ||
+        !json_append_string(ytdlp, sizeof(ytdlp), helper_cmd)) {
+        return false;
+    }
+
+    FILE *f = fopen(tmp, "w");
+    if (!f) return false;
+    fprintf(f, "#!/usr/bin/env python3\n");
+    fprintf(f, "SOCKET = %s\n", sock);
+    fprintf(f, "YTDLP = %s\n", ytdlp);
+    fputs(helper_body, f);
+
+    bool ok = fclose(f) == 0 && chmod(tmp, 0755) == 0 && rename(tmp, path) == 0;
+    if (!ok) unlink(tmp);
+    return ok;
+}
+
+static void helper_kill_locked(void) {
+    if (helper_stdin >= 0) {
+        close(helper_stdin);
+        helper_stdin = -1;
+    }
+    if (helper_pid > 0) {
+        kill(helper_pid, SIGTERM);
+        waitpid(helper_pid, NULL, 0);
+        helper_pid = -1;
+    }
+    if (helper_sock[0]) unlink(helper_sock);
+}
+
+// A directory only this user can enter, for the socket: a predictable path
+// in /tmp could be taken over or connected to by anyone
+static bool helper_make_dir(void) {
+    if (helper_dir[0]) return true;
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    const char *bases[] = { runtime && runtime[0] == '/' ? runtime : NULL, "/tmp" };
+    for (size_t i = 0; i < sizeof(bases) / sizeof(bases[0]); i++) {
+        if (!bases[i]) continue;
+        int n = snprintf(helper_dir, sizeof(helper_dir), "%s/shellbeats-XXXXXX", bases[i]);
+        if (n < 0 || (size_t)n >= sizeof(helper_dir)) continue;
+        if (mkdtemp(helper_dir)) {
+            snprintf(helper_sock, sizeof(helper_sock), "%s/ytdlp.sock", helper_dir);
+            return true;
+        }
+    }
+    helper_dir[0] = '\0';
+    return false;
+}
+
+static bool helper_spawn_locked(void) {
+    if (!find_executable(helper_cmd, helper_ytdlp, sizeof(helper_ytdlp)) ||
+        stat(helper_ytdlp, &helper_ytdlp_stat) != 0) {
+        return false;
+    }
+    if (!write_script(helper_script)) return false;
+
+    // Only the read end reaches the helper; no other child inherits the pipe
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) return false;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[0], STDIN_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+            close(devnull);
+        }
+        setpgid(0, 0);
+        execlp("python3", "python3", helper_script, "--serve", helper_sock, helper_ytdlp,
+               (char *)NULL);
+        _exit(127);
+    }
+
+    close(fds[0]);
+    if (pid < 0) {
+        close(fds[1]);
+        return false;
+    }
+    helper_pid = pid;
+    helper_stdin = fds[1];
+    return true;
+}
+
+bool ytdlp_helper_start(const char *ytdlp_cmd, const char *bin_dir) {
+    char python[1024];
+    if (!ytdlp_cmd || !bin_dir || !find_executable("python3", python, sizeof(python))) {
+        return false;
+    }
+
+    pthread_mutex_lock(&helper_mutex);
+    if (helper_pid > 0) {
+        pthread_mutex_unlock(&helper_mutex);
+        return true;
+    }
+    if (!helper_make_dir()) {
+        pthread_mutex_unlock(&helper_mutex);
+        return false;
+    }
+    snprintf(helper_script, sizeof(helper_script), "%s/%s", bin_dir, HELPER_SCRIPT);
+    snprintf(helper_cmd, sizeof(helper_cmd), "%s", ytdlp_cmd);
+    // On failure (e.g. yt-dlp not downloaded yet) ytdlp_helper_refresh retries
+    bool ok = helper_spawn_locked();
+    pthread_mutex_unlock(&helper_mutex);
+    return ok;
+}
+
+void ytdlp_helper_stop(void) {
+    pthread_mutex_lock(&helper_mutex);
+    helper_kill_locked();
+    if (helper_dir[0]) rmdir(helper_dir);
+    pthread_mutex_unlock(&helper_mutex);
+}
+
+// Restart when the yt-dlp the helper imported was replaced. Caller holds the lock.
+static void helper_check_locked(const char *ytdlp_cmd) {
+    if (!helper_script[0]) return;
+
+    char path[1024];
+    struct stat sb;
+    bool found = find_executable(ytdlp_cmd ? ytdlp_cmd : helper_cmd, path, sizeof(path)) &&
+                 stat(path, &sb) == 0;
+    if (!found) return;
+    if (helper_pid > 0 && strcmp(path, helper_ytdlp) == 0 && same_file(&sb, &helper_ytdlp_stat)) {
+        // Reap a helper that died (e.g. yt_dlp failed to import); it stays
+        // down until the binary changes
+        if (waitpid(helper_pid, NULL, WNOHANG) == helper_pid) {
+            helper_pid = -1;
+            close(helper_stdin);
+            helper_stdin = -1;
+        }
+        return;
+    }
+    if (helper_pid <= 0 && strcmp(path, helper_ytdlp) == 0 && same_file(&sb, &helper_ytdlp_stat)) {
+        return;
+    }
+
+    helper_kill_locked();
+    if (ytdlp_cmd) snprintf(helper_cmd, sizeof(helper_cmd), "%s", ytdlp_cmd);
+    helper_spawn_locked();
+}
+
+void ytdlp_helper_refresh(const char *ytdlp_cmd) {
+    pthread_mutex_lock(&helper_mutex);
+    helper_check_locked(ytdlp_cmd);
+    pthread_mutex_unlock(&helper_mutex);
+}
+
+const char *ytdlp_helper_client(void) {
+    return helper_script[0] && access(helper_script, X_OK) == 0 ? helper_script : NULL;
+}
+
+// Connect and send one request line. Returns the socket, -1 if the helper
+// isn't running or still starting up.
+static int helper_request(const char *request) {
+    pthread_mutex_lock(&helper_mutex);
+    helper_check_locked(NULL);
+    bool running = helper_pid > 0;
+    char sock_path[sizeof(helper_sock)];
+    snprintf(sock_path, sizeof(sock_path), "%s", helper_sock);
+    pthread_mutex_unlock(&helper_mutex);
+    if (!running) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sock_path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    size_t len = strlen(request);
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t n = send(fd, request + sent, len - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        sent += (size_t)n;
+    }
+    return fd;
+}
+
+int ytdlp_helper_list(const char *target, int start, int end) {
+    char request[4096] = "{\"op\": \"list\", \"target\": ";
+    if (!json_append_string(request, sizeof(request) - 64, target)) return -1;
+    size_t len = strlen(request);
+    snprintf(request + len, sizeof(request) - len, ", \"start\": %d, \"end\": %d}\n", start, end);
+    return helper_request(request);
+}
+
+int ytdlp_helper_playlist(const char *target, int start) {
+    char request[4096] = "{\"op\": \"playlist\", \"target\": ";
+    if (!json_append_string(request, sizeof(request) - 32, target)) return -1;
+    size_t len = strlen(request);
+    snprintf(request + len, sizeof(request) - len, ", \"start\": %d}\n", start);
+    return helper_request(request);
+}
+
+int ytdlp_helper_run(char *const argv[]) {
+    char request[8192] = "{\"op\": \"cli\", \"argv\": [";
+    // A command line that doesn't fit is run by the caller, never cut short
+    for (int i = 0; argv[i]; i++) {
+        if (i > 0) strcat(request, ", ");
+        if (!json_append_string(request, sizeof(request) - 8, argv[i])) return -1;
+    }
+    strcat(request, "]}\n");
+
+    int fd = helper_request(request);
+    if (fd < 0) return -1;
+
+    char status = 0;
+    ssize_t n;
+    do {
+        n = read(fd, &status, 1);
+    } while (n < 0 && errno == EINTR);
+    close(fd);
+
+    if (n == 1 && status == '0') return 0;
+    if (n == 1 && status == '1') return 1;
+    return -1;
+}
+
+// Run argv in its own process group with stdout on a pipe and stderr
+// discarded. Returns the read end of the pipe, -1 on error.
+int ytdlp_spawn(char *const argv[], pid_t *pid_out) {
+    int fds[2];
+    if (pipe(fds) < 0) return -1;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        setpgid(0, 0);  // own process group so a cancel can kill helpers too
+        setenv("PYTHONUNBUFFERED", "1", 1);  // yt-dlp: emit lines as they are produced
+        dup2(fds[1], STDOUT_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDERR_FILENO);
+            close(devnull);
+        }
+        close(fds[0]);
+        close(fds[1]);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    close(fds[1]);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);  // keep it out of mpv and other children
+    *pid_out = pid;
+    return fds[0];
+}
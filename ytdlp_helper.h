@@ -0,0 +1,39 @@
+#ifndef YTDLP_HELPER_H
+#define YTDLP_HELPER_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Long-lived Python process that imports yt_dlp once and serves requests on
+// a unix socket, one connection per request. Every call falls back cleanly:
+// when the helper is down or still starting, the request functions return -1
+// and the caller runs yt-dlp itself.
+
+bool ytdlp_helper_start(const char *ytdlp_cmd, const char *bin_dir);
+void ytdlp_helper_stop(void);
+
+// Restart the helper if ytdlp_cmd now points to a different or updated binary
+void ytdlp_helper_refresh(const char *ytdlp_cmd);
+
+// Script to use as mpv's ytdl_hook path, NULL if the helper isn't available
+const char *ytdlp_helper_client(void);
+
+// Flat listing of a search ("ytsearchN:query") or playlist URL, entries
+// start..end (1-based, end 0 = all). Returns a socket streaming
+// "title|||id|||duration" lines like yt-dlp's --print, or -1.
+int ytdlp_helper_list(const char *target, int start, int end);
+
+// Playlist entries from the 1-based index start on, in one pass: a socket
+// streaming "playlist_title|||title|||id|||duration" lines, or -1
+int ytdlp_helper_playlist(const char *target, int start);
+
+// Run a yt-dlp command line (without the program name) in the helper.
+// Returns 0 on success, 1 on failure, -1 if the helper can't run it.
+int ytdlp_helper_run(char *const argv[]);
+
+// Run argv in its own process group with stdout on a pipe and stderr
+// discarded. Returns the read end of the pipe, -1 on error; the caller
+// reaps *pid_out.
+int ytdlp_spawn(char *const argv[], pid_t *pid_out);
+
+#endif